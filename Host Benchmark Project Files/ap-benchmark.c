@@ -0,0 +1,824 @@
+/*
+IBEX UK LTD http://www.ibexuk.com
+Electronic Product Design Specialists
+RELEASED SOFTWARE
+
+The MIT License (MIT)
+
+Copyright (c) 2013, IBEX UK Ltd, http://ibexuk.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Project Name:		COMPACT FLASH MEMORY CARD FAT16 & FAT 32 DRIVER
+//HOST BENCHMARK PROJECT C CODE FILE
+//
+//Measures the driver on a Linux host using the CF card simulator (mem-cf-sim.c).  FAT16 and FAT32 disk images are created with several
+//cluster sizes and fragmentation levels and each test reports the host time taken, the CF bus strobes used per byte, the card sectors
+//read and written per operation and the sector cache hit rate.  'make run' runs it twice, the second time with the root directory index
+//(FFS_DIRECTORY_INDEX_ENTRIES) compiled in so the directory lookup cost can be compared.
+//
+//To build and run from this folder (no changes to the driver files are needed):
+//	make run
+//or build by hand with:
+//	gcc -O2 -DFFS_USING_GCC_HOST_COMPILER -I. -I.. -o ffs-benchmark ap-benchmark.c ../mem-ffs.c ../mem-cf.c ../mem-cf-sim.c
+//Run with no arguments.  The disk image is created in the current folder.
+
+
+
+
+
+
+//----- COMPILER LIBRARY FILES REQUIRED BY THIS SOURCE CODE FILE -----
+//(Included first as the header file for this source file uses them)
+#include "main.h"					//Global data type definitions (see https://github.com/ibexuk/C_Generic_Header_File )
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//----- OTHER PROJECT FILES REQUIRED BY THIS SOURCE CODE FILE -----
+#include "mem-ffs.h"
+#include "mem-cf-sim.h"
+
+//----- INCLUDE FILES FOR THIS SOURCE CODE FILE -----
+#define	BENCHMARK_C					//(Define used for following header file to flag that it is the header file for this source file)
+#include "ap-benchmark.h"			//(Include header file for this source file)
+
+
+
+
+
+
+
+//***********************************
+//***********************************
+//********** MAIN FUNCTION **********
+//***********************************
+//***********************************
+int main (void)
+{
+	BYTE level;
+	BYTE fragmentation_level;
+
+
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		printf("Root directory index: %u entries\n\n", FFS_DIRECTORY_INDEX_ENTRIES);
+	#else
+		printf("Root directory index: not used\n\n");
+	#endif
+
+	printf("%-14s %-18s %8s %10s %11s %10s %10s %10s %9s\n", "CONFIGURATION", "TEST", "OPS", "HOST mS", "KBYTES/S", "STROBES/B", "SEC RD/OP", "SEC WR/OP", "CACHE HIT");
+
+	for (level = 0; level < BENCHMARK_FRAGMENTATION_LEVELS; level++)
+	{
+		fragmentation_level = benchmark_fragmentation_levels[level];
+
+		//----- FAT16 -----
+		benchmark_run_configuration(0, 65536, 1, fragmentation_level);			//32MB, 512 byte clusters
+		benchmark_run_configuration(0, 262144, 4, fragmentation_level);			//128MB, 2K clusters
+		benchmark_run_configuration(0, 1048576, 16, fragmentation_level);		//512MB, 8K clusters
+
+		//----- FAT32 -----
+		benchmark_run_configuration(1, 131072, 1, fragmentation_level);			//64MB, 512 byte clusters
+		benchmark_run_configuration(1, 2097152, 8, fragmentation_level);		//1GB, 4K clusters
+	}
+
+	remove(BENCHMARK_IMAGE_FILENAME);
+
+	if (benchmark_errors)
+	{
+		printf("%lu ERRORS\n", (unsigned long)benchmark_errors);
+		return(1);
+	}
+	return(0);
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** RUN 1 CONFIGURATION **********
+//*****************************************
+//*****************************************
+void benchmark_run_configuration (BYTE fat_32, DWORD total_sectors, BYTE cluster_size, BYTE fragmentation_level)
+{
+	printf("\n");
+
+	if (benchmark_create_image(BENCHMARK_IMAGE_FILENAME, fat_32, total_sectors, cluster_size) == 0)
+	{
+		printf("FAT%s %u sectors per cluster - image could not be created\n", (fat_32 ? "32" : "16"), cluster_size);
+		benchmark_errors++;
+		return;
+	}
+
+	//----- INSERT THE CARD -----
+	if ((ffs_sim_open(BENCHMARK_IMAGE_FILENAME) == 0) || (ffs_sim_mount() == 0))
+	{
+		printf("FAT%s %u sectors per cluster - card could not be mounted\n", (fat_32 ? "32" : "16"), cluster_size);
+		benchmark_errors++;
+		ffs_sim_close();
+		ffs_process();
+		return;
+	}
+	printf("FAT%s %u byte clusters, fragmentation level %u:\n", (fat_32 ? "32" : "16"), ((WORD)cluster_size * 512), fragmentation_level);
+
+	benchmark_fragment(fragmentation_level);
+
+	//----- RUN THE TESTS -----
+	benchmark_sequential_write();
+	benchmark_sequential_read();
+	benchmark_random_read();
+	benchmark_file_churn();
+	benchmark_directory_lookup(fat_32);
+	benchmark_remove_large_file();
+
+	//----- REMOVE THE CARD -----
+	ffs_sim_close();
+	ffs_process();								//(Lets the driver see that the card has been removed)
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** FRAGMENT THE FAT **********
+//**************************************
+//**************************************
+//Creates one cluster files and then deletes every other one, so that the free clusters at the start of the card are in single cluster
+//holes that the following tests will have to use.  The files are kept in their own subdirectory so the root directory (which has a fixed
+//size on FAT16) is left for the other tests.
+void benchmark_fragment (BYTE fragmentation_level)
+{
+	FFS_FILE *file;
+	char filename[13];
+	WORD count;
+	WORD number_of_files;
+	DWORD cluster_bytes;
+
+
+	number_of_files = (WORD)fragmentation_level * BENCHMARK_FRAGMENT_FILES;
+	if (number_of_files == 0)
+		return;
+	cluster_bytes = (DWORD)sectors_per_cluster * 512;
+
+	memset(&benchmark_buffer[0], 0x55, sizeof(benchmark_buffer));
+
+	if ((ffs_mkdir("FRAG")) || (ffs_chdir("FRAG")))
+	{
+		benchmark_errors++;
+		return;
+	}
+
+	for (count = 0; count < number_of_files; count++)
+	{
+		sprintf(filename, "F%04u.FRG", count);
+		file = ffs_fopen(filename, "w");
+		if (file == 0)
+		{
+			benchmark_errors++;
+			ffs_chdir("\\");
+			return;
+		}
+		if (cluster_bytes <= sizeof(benchmark_buffer))
+			ffs_fwrite(&benchmark_buffer[0], 1, (int)cluster_bytes, file);
+		else
+			ffs_fwrite(&benchmark_buffer[0], 1, sizeof(benchmark_buffer), file);
+		ffs_fclose(file);
+	}
+
+	for (count = 0; count < number_of_files; count += 2)
+	{
+		sprintf(filename, "F%04u.FRG", count);
+		if (ffs_remove(filename))
+			benchmark_errors++;
+	}
+
+	if (ffs_chdir("\\"))
+		benchmark_errors++;
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** SEQUENTIAL WRITE **********
+//**************************************
+//**************************************
+void benchmark_sequential_write (void)
+{
+	FFS_FILE *file;
+	DWORD position;
+	WORD count;
+
+
+	benchmark_start();
+
+	file = ffs_fopen("SEQ.BIN", "w");
+	if (file == 0)
+	{
+		benchmark_errors++;
+		return;
+	}
+
+	for (position = 0; position < BENCHMARK_SEQUENTIAL_FILE_SIZE; position += BENCHMARK_TRANSFER_SIZE)
+	{
+		for (count = 0; count < BENCHMARK_TRANSFER_SIZE; count++)
+			benchmark_buffer[count] = benchmark_pattern(position + count);
+
+		if (ffs_fwrite(&benchmark_buffer[0], 1, BENCHMARK_TRANSFER_SIZE, file) != BENCHMARK_TRANSFER_SIZE)
+			benchmark_errors++;
+	}
+	if (ffs_fclose(file))
+		benchmark_errors++;
+
+	benchmark_report("sequential write", (BENCHMARK_SEQUENTIAL_FILE_SIZE / BENCHMARK_TRANSFER_SIZE), BENCHMARK_SEQUENTIAL_FILE_SIZE);
+}
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** SEQUENTIAL READ **********
+//*************************************
+//*************************************
+void benchmark_sequential_read (void)
+{
+	FFS_FILE *file;
+	DWORD position;
+	WORD count;
+
+
+	benchmark_start();
+
+	file = ffs_fopen("SEQ.BIN", "r");
+	if (file == 0)
+	{
+		benchmark_errors++;
+		return;
+	}
+
+	for (position = 0; position < BENCHMARK_SEQUENTIAL_FILE_SIZE; position += BENCHMARK_TRANSFER_SIZE)
+	{
+		if (ffs_fread(&benchmark_buffer[0], 1, BENCHMARK_TRANSFER_SIZE, file) != BENCHMARK_TRANSFER_SIZE)
+			benchmark_errors++;
+
+		for (count = 0; count < BENCHMARK_TRANSFER_SIZE; count++)
+		{
+			if (benchmark_buffer[count] != benchmark_pattern(position + count))
+			{
+				benchmark_errors++;
+				break;
+			}
+		}
+	}
+	ffs_fclose(file);
+
+	benchmark_report("sequential read", (BENCHMARK_SEQUENTIAL_FILE_SIZE / BENCHMARK_TRANSFER_SIZE), BENCHMARK_SEQUENTIAL_FILE_SIZE);
+}
+
+
+
+
+
+
+//*********************************
+//*********************************
+//********** RANDOM READ **********
+//*********************************
+//*********************************
+//ffs_fseek to a random position followed by ffs_fread
+void benchmark_random_read (void)
+{
+	FFS_FILE *file;
+	DWORD position;
+	WORD count;
+
+
+	benchmark_start();
+
+	file = ffs_fopen("SEQ.BIN", "r");
+	if (file == 0)
+	{
+		benchmark_errors++;
+		return;
+	}
+
+	for (count = 0; count < BENCHMARK_RANDOM_READS; count++)
+	{
+		position = benchmark_random() % (BENCHMARK_SEQUENTIAL_FILE_SIZE - BENCHMARK_RANDOM_READ_SIZE);
+
+		if (ffs_fseek(file, (long)position, FFS_SEEK_SET))
+			benchmark_errors++;
+		if (ffs_fread(&benchmark_buffer[0], 1, BENCHMARK_RANDOM_READ_SIZE, file) != BENCHMARK_RANDOM_READ_SIZE)
+			benchmark_errors++;
+		if (benchmark_buffer[0] != benchmark_pattern(position))
+			benchmark_errors++;
+	}
+	ffs_fclose(file);
+
+	benchmark_report("random fseek+fread", BENCHMARK_RANDOM_READS, ((DWORD)BENCHMARK_RANDOM_READS * BENCHMARK_RANDOM_READ_SIZE));
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** SMALL FILE CHURN **********
+//**************************************
+//**************************************
+//Create, write, close and delete small files
+void benchmark_file_churn (void)
+{
+	FFS_FILE *file;
+	WORD count;
+
+
+	memset(&benchmark_buffer[0], 0xaa, BENCHMARK_CHURN_FILE_SIZE);
+
+	benchmark_start();
+
+	for (count = 0; count < BENCHMARK_CHURN_FILES; count++)
+	{
+		file = ffs_fopen("CHURN.TXT", "w");
+		if (file == 0)
+		{
+			benchmark_errors++;
+			return;
+		}
+		if (ffs_fwrite(&benchmark_buffer[0], 1, BENCHMARK_CHURN_FILE_SIZE, file) != BENCHMARK_CHURN_FILE_SIZE)
+			benchmark_errors++;
+		if (ffs_fclose(file))
+			benchmark_errors++;
+		if (ffs_remove("CHURN.TXT"))
+			benchmark_errors++;
+	}
+
+	benchmark_report("small file churn", BENCHMARK_CHURN_FILES, ((DWORD)BENCHMARK_CHURN_FILES * BENCHMARK_CHURN_FILE_SIZE));
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** DIRECTORY LOOKUP **********
+//**************************************
+//**************************************
+//Opens files at random in a full directory (1 in 8 of the names looked up don't exist)
+void benchmark_directory_lookup (BYTE fat_32)
+{
+	FFS_FILE *file;
+	char filename[13];
+	WORD count;
+	WORD number_of_files;
+	WORD file_number;
+
+
+	if (fat_32)
+		number_of_files = BENCHMARK_FAT32_DIRECTORY_FILES;
+	else
+		number_of_files = BENCHMARK_FAT16_DIRECTORY_FILES;
+
+	//----- FILL THE DIRECTORY -----
+	for (count = 0; count < number_of_files; count++)
+	{
+		sprintf(filename, "D%04u.DAT", count);
+		file = ffs_fopen(filename, "w");
+		if (file == 0)
+		{
+			benchmark_errors++;
+			return;
+		}
+		ffs_fclose(file);
+	}
+
+	//----- LOOK UP FILES -----
+	benchmark_start();
+
+	for (count = 0; count < BENCHMARK_DIRECTORY_LOOKUPS; count++)
+	{
+		file_number = (WORD)(benchmark_random() % number_of_files);
+		if ((count & 0x07) == 0x07)
+		{
+			sprintf(filename, "X%04u.DAT", file_number);
+			if (ffs_fopen(filename, "r") != 0)
+				benchmark_errors++;
+		}
+		else
+		{
+			sprintf(filename, "D%04u.DAT", file_number);
+			file = ffs_fopen(filename, "r");
+			if (file == 0)
+				benchmark_errors++;
+			else
+				ffs_fclose(file);
+		}
+	}
+
+	benchmark_report("directory lookup", BENCHMARK_DIRECTORY_LOOKUPS, 0);
+}
+
+
+
+
+
+
+//***************************************
+//***************************************
+//********** REMOVE LARGE FILE **********
+//***************************************
+//***************************************
+void benchmark_remove_large_file (void)
+{
+	benchmark_start();
+
+	if (ffs_remove("SEQ.BIN"))
+		benchmark_errors++;
+
+	benchmark_report("remove large file", 1, 0);
+}
+
+
+
+
+
+
+
+
+
+//************************************************************************************************
+//************************************************************************************************
+//************************************************************************************************
+//************************************************************************************************
+//****************************** BENCHMARK SUB FUNCTIONS BELOW HERE ******************************
+//************************************************************************************************
+//************************************************************************************************
+//************************************************************************************************
+//************************************************************************************************
+
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** START MEASURING **********
+//*************************************
+//*************************************
+void benchmark_start (void)
+{
+	ffs_flush_sector_cache();				//(So data left over from a previous test isn't counted against this one)
+
+	benchmark_start_snapshot.clock = clock();
+	benchmark_start_snapshot.bus = ffs_sim_counters;
+	benchmark_start_snapshot.cache_hits = ffs_sector_cache_hits;
+	benchmark_start_snapshot.cache_misses = ffs_sector_cache_misses;
+}
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** REPORT A RESULT **********
+//*************************************
+//*************************************
+//bytes = the number of file bytes the test transfered (0 = none)
+void benchmark_report (const char *test_name, DWORD operations, DWORD bytes)
+{
+	double milliseconds;
+	DWORD strobes;
+	DWORD sectors_read;
+	DWORD sectors_written;
+	DWORD cache_hits;
+	DWORD cache_lookups;
+
+
+	ffs_flush_sector_cache();				//(Include the writes the test left in the cache)
+
+	milliseconds = ((double)(clock() - benchmark_start_snapshot.clock) * 1000.0) / CLOCKS_PER_SEC;
+	strobes = (ffs_sim_counters.oe_strobes - benchmark_start_snapshot.bus.oe_strobes) + (ffs_sim_counters.we_strobes - benchmark_start_snapshot.bus.we_strobes);
+	sectors_read = ffs_sim_counters.sectors_read - benchmark_start_snapshot.bus.sectors_read;
+	sectors_written = ffs_sim_counters.sectors_written - benchmark_start_snapshot.bus.sectors_written;
+	cache_hits = ffs_sector_cache_hits - benchmark_start_snapshot.cache_hits;
+	cache_lookups = cache_hits + (ffs_sector_cache_misses - benchmark_start_snapshot.cache_misses);
+
+	if ((ffs_sim_counters.bus_errors != benchmark_start_snapshot.bus.bus_errors) || (ffs_sim_counters.rejected_commands != benchmark_start_snapshot.bus.rejected_commands))
+		benchmark_errors++;
+
+	printf("%-14s %-18s %8lu %10.1f ", "", test_name, (unsigned long)operations, milliseconds);
+
+	if ((bytes) && (milliseconds > 0.0))
+		printf("%11.0f ", (((double)bytes / 1024.0) * 1000.0) / milliseconds);
+	else
+		printf("%11s ", "-");
+
+	if (bytes)
+		printf("%10.2f ", (double)strobes / (double)bytes);
+	else
+		printf("%10s ", "-");
+
+	printf("%10.2f %10.2f ", (double)sectors_read / (double)operations, (double)sectors_written / (double)operations);
+
+	if (cache_lookups)
+		printf("%8.1f%%\n", ((double)cache_hits * 100.0) / (double)cache_lookups);
+	else
+		printf("%9s\n", "-");
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** CREATE A DISK IMAGE **********
+//*****************************************
+//*****************************************
+//Creates a blank formatted card image with 1 partition.  cluster_size is in sectors.
+//Returns
+//	1 if created, 0 if not (e.g. the number of clusters is not valid for the FAT type)
+BYTE benchmark_create_image (const char *filename, BYTE fat_32, DWORD total_sectors, BYTE cluster_size)
+{
+	FILE *image_file;
+	BYTE sector[512];
+	DWORD partition_sectors;
+	DWORD reserved_sectors;
+	DWORD root_directory_sectors;
+	DWORD fat_sectors;
+	DWORD needed_fat_sectors;
+	DWORD clusters;
+	DWORD start_cylinder;
+	BYTE start_head;
+	BYTE start_sector;
+	BYTE count;
+
+
+	//----- CALCULATE THE LAYOUT -----
+	partition_sectors = total_sectors - BENCHMARK_PARTITION_START_SECTOR;
+	if (fat_32)
+	{
+		reserved_sectors = 32;
+		root_directory_sectors = 0;
+	}
+	else
+	{
+		reserved_sectors = 1;
+		root_directory_sectors = 32;					//512 entries
+	}
+
+	fat_sectors = 1;
+	while (1)
+	{
+		clusters = (partition_sectors - reserved_sectors - (fat_sectors << 1) - root_directory_sectors) / cluster_size;
+		if (fat_32)
+			needed_fat_sectors = (((clusters + 2) << 2) + 511) >> 9;
+		else
+			needed_fat_sectors = (((clusters + 2) << 1) + 511) >> 9;
+		if (needed_fat_sectors <= fat_sectors)
+			break;
+		fat_sectors = needed_fat_sectors;
+	}
+
+	if ((fat_32) && (clusters < 65525))
+		return(0);
+	if ((!fat_32) && ((clusters < 4085) || (clusters > 65524)))
+		return(0);
+
+	//----- CREATE THE BLANK IMAGE FILE -----
+	image_file = fopen(filename, "w+b");
+	if (image_file == 0)
+		return(0);
+
+	memset(&sector[0], 0x00, sizeof(sector));
+	benchmark_write_sector(image_file, (total_sectors - 1), &sector[0]);
+
+	//----- MASTER BOOT RECORD -----
+	start_cylinder = BENCHMARK_PARTITION_START_SECTOR / (BENCHMARK_HEADS * BENCHMARK_SECTORS_PER_TRACK);
+	start_head = (BYTE)((BENCHMARK_PARTITION_START_SECTOR / BENCHMARK_SECTORS_PER_TRACK) % BENCHMARK_HEADS);
+	start_sector = (BYTE)((BENCHMARK_PARTITION_START_SECTOR % BENCHMARK_SECTORS_PER_TRACK) + 1);
+
+	sector[0x1be] = 0x80;														//Bootable
+	sector[0x1bf] = start_head;
+	sector[0x1c0] = (BYTE)(start_sector | ((start_cylinder >> 2) & 0xc0));
+	sector[0x1c1] = (BYTE)(start_cylinder & 0xff);
+	if (fat_32)
+		sector[0x1c2] = 0x0c;
+	else if (partition_sectors < 65536)
+		sector[0x1c2] = 0x04;
+	else
+		sector[0x1c2] = 0x06;
+	sector[0x1c3] = 0xfe;														//(End CHS not used)
+	sector[0x1c4] = 0xff;
+	sector[0x1c5] = 0xff;
+	sector[0x1c6] = (BYTE)(BENCHMARK_PARTITION_START_SECTOR & 0xff);
+	sector[0x1c7] = (BYTE)((BENCHMARK_PARTITION_START_SECTOR >> 8) & 0xff);
+	sector[0x1c8] = (BYTE)((BENCHMARK_PARTITION_START_SECTOR >> 16) & 0xff);
+	sector[0x1c9] = (BYTE)((BENCHMARK_PARTITION_START_SECTOR >> 24) & 0xff);
+	sector[0x1ca] = (BYTE)(partition_sectors & 0xff);
+	sector[0x1cb] = (BYTE)((partition_sectors >> 8) & 0xff);
+	sector[0x1cc] = (BYTE)((partition_sectors >> 16) & 0xff);
+	sector[0x1cd] = (BYTE)((partition_sectors >> 24) & 0xff);
+	sector[510] = 0x55;
+	sector[511] = 0xaa;
+	benchmark_write_sector(image_file, 0, &sector[0]);
+
+	//----- BOOT RECORD -----
+	memset(&sector[0], 0x00, sizeof(sector));
+	sector[0] = 0xeb;
+	sector[1] = 0x3c;
+	sector[2] = 0x90;
+	memcpy(&sector[3], "MSWIN4.1", 8);
+	sector[11] = 0x00;															//Bytes per sector
+	sector[12] = 0x02;
+	sector[13] = cluster_size;
+	sector[14] = (BYTE)(reserved_sectors & 0xff);
+	sector[16] = 2;																//Number of FATs
+	if (!fat_32)
+	{
+		sector[17] = 0x00;														//Root directory entries
+		sector[18] = 0x02;
+	}
+	if ((!fat_32) && (partition_sectors < 65536))
+	{
+		sector[19] = (BYTE)(partition_sectors & 0xff);
+		sector[20] = (BYTE)(partition_sectors >> 8);
+	}
+	sector[21] = 0xf8;															//Media
+	if (!fat_32)
+	{
+		sector[22] = (BYTE)(fat_sectors & 0xff);
+		sector[23] = (BYTE)(fat_sectors >> 8);
+	}
+	sector[24] = BENCHMARK_SECTORS_PER_TRACK;
+	sector[26] = BENCHMARK_HEADS;
+	sector[28] = (BYTE)(BENCHMARK_PARTITION_START_SECTOR & 0xff);				//Hidden sectors
+	sector[32] = (BYTE)(partition_sectors & 0xff);
+	sector[33] = (BYTE)((partition_sectors >> 8) & 0xff);
+	sector[34] = (BYTE)((partition_sectors >> 16) & 0xff);
+	sector[35] = (BYTE)((partition_sectors >> 24) & 0xff);
+	if (fat_32)
+	{
+		sector[36] = (BYTE)(fat_sectors & 0xff);
+		sector[37] = (BYTE)((fat_sectors >> 8) & 0xff);
+		sector[38] = (BYTE)((fat_sectors >> 16) & 0xff);
+		sector[39] = (BYTE)((fat_sectors >> 24) & 0xff);
+		sector[44] = 2;															//Root directory cluster
+		sector[48] = 1;															//FSInfo sector
+		sector[50] = 6;															//Backup boot sector
+		sector[64] = 0x80;
+		sector[66] = 0x29;
+		memcpy(&sector[71], "NO NAME    FAT32   ", 19);
+	}
+	else
+	{
+		sector[36] = 0x80;
+		sector[38] = 0x29;
+		memcpy(&sector[43], "NO NAME    FAT16   ", 19);
+	}
+	sector[510] = 0x55;
+	sector[511] = 0xaa;
+	benchmark_write_sector(image_file, BENCHMARK_PARTITION_START_SECTOR, &sector[0]);
+	if (fat_32)
+		benchmark_write_sector(image_file, (BENCHMARK_PARTITION_START_SECTOR + 6), &sector[0]);
+
+	//----- FAT32 FILE SYSTEM INFORMATION SECTOR -----
+	if (fat_32)
+	{
+		memset(&sector[0], 0x00, sizeof(sector));
+		sector[0] = 0x52;
+		sector[1] = 0x52;
+		sector[2] = 0x61;
+		sector[3] = 0x41;
+		sector[484] = 0x72;
+		sector[485] = 0x72;
+		sector[486] = 0x41;
+		sector[487] = 0x61;
+		sector[488] = (BYTE)((clusters - 1) & 0xff);							//Free clusters (all but the root directory)
+		sector[489] = (BYTE)(((clusters - 1) >> 8) & 0xff);
+		sector[490] = (BYTE)(((clusters - 1) >> 16) & 0xff);
+		sector[491] = (BYTE)(((clusters - 1) >> 24) & 0xff);
+		sector[492] = 3;														//Next free cluster
+		sector[510] = 0x55;
+		sector[511] = 0xaa;
+		benchmark_write_sector(image_file, (BENCHMARK_PARTITION_START_SECTOR + 1), &sector[0]);
+	}
+
+	//----- FAT TABLES -----
+	memset(&sector[0], 0x00, sizeof(sector));
+	if (fat_32)
+	{
+		sector[0] = 0xf8;														//Cluster 0 = media, cluster 1 = end of chain, cluster 2 (root directory) = end of chain
+		sector[1] = 0xff;
+		sector[2] = 0xff;
+		sector[3] = 0x0f;
+		memset(&sector[4], 0xff, 8);
+		sector[7] = 0x0f;
+		sector[11] = 0x0f;
+	}
+	else
+	{
+		sector[0] = 0xf8;
+		memset(&sector[1], 0xff, 3);
+	}
+	for (count = 0; count < 2; count++)
+		benchmark_write_sector(image_file, (BENCHMARK_PARTITION_START_SECTOR + reserved_sectors + (count * fat_sectors)), &sector[0]);
+
+	//(The root directory is already blank)
+
+	fclose(image_file);
+	return(1);
+}
+
+
+
+
+
+
+//************************************
+//************************************
+//********** WRITE 1 SECTOR **********
+//************************************
+//************************************
+void benchmark_write_sector (FILE *image_file, DWORD sector_lba, BYTE *source)
+{
+	fseek(image_file, ((long)sector_lba * 512), SEEK_SET);
+	fwrite(source, 1, 512, image_file);
+}
+
+
+
+
+
+
+//***************************************
+//***************************************
+//********** TEST DATA PATTERN **********
+//***************************************
+//***************************************
+BYTE benchmark_pattern (DWORD position)
+{
+	return((BYTE)((position * 2654435761u) >> 13));
+}
+
+
+
+
+
+
+//***********************************
+//***********************************
+//********** RANDOM NUMBER **********
+//***********************************
+//***********************************
+//(Repeatable so that results can be compared between builds)
+DWORD benchmark_random (void)
+{
+	benchmark_random_seed = (benchmark_random_seed * 1103515245) + 12345;
+	return(benchmark_random_seed >> 8);
+}
+
+
+
+
+
+
+
+
@@ -0,0 +1,128 @@
+/*
+IBEX UK LTD http://www.ibexuk.com
+Electronic Product Design Specialists
+RELEASED SOFTWARE
+
+The MIT License (MIT)
+
+Copyright (c) 2013, IBEX UK Ltd, http://ibexuk.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Project Name:		COMPACT FLASH MEMORY CARD FAT16 & FAT 32 DRIVER
+//HOST BENCHMARK PROJECT C CODE HEADER FILE
+
+
+
+
+//*****************************
+//*****************************
+//********** DEFINES **********
+//*****************************
+//*****************************
+#ifndef BENCHMARK_C_INIT				//(Include this section only once for each source file that includes this header file)
+#define	BENCHMARK_C_INIT
+
+//------------------------
+//----- USER DEFINES -----
+//------------------------
+#define	BENCHMARK_IMAGE_FILENAME			"benchmark.img"
+#define	BENCHMARK_SEQUENTIAL_FILE_SIZE		1048576			//Bytes written and read by the sequential tests and deleted by the remove test
+#define	BENCHMARK_TRANSFER_SIZE				4096			//Bytes per ffs_fwrite / ffs_fread call in the sequential tests
+#define	BENCHMARK_RANDOM_READS				1000
+#define	BENCHMARK_RANDOM_READ_SIZE			64
+#define	BENCHMARK_CHURN_FILES				200
+#define	BENCHMARK_CHURN_FILE_SIZE			100
+#define	BENCHMARK_FAT16_DIRECTORY_FILES		300				//Files created for the directory lookup test (the FAT16 root directory has 512 entries)
+#define	BENCHMARK_FAT32_DIRECTORY_FILES		1000
+#define	BENCHMARK_DIRECTORY_LOOKUPS			500
+#define	BENCHMARK_FRAGMENT_FILES			200				//One cluster holes left per fragmentation level (the files are created in the FRAG subdirectory)
+#define	BENCHMARK_FRAGMENTATION_LEVELS		3				//Number of entries in benchmark_fragmentation_levels
+
+#define	BENCHMARK_PARTITION_START_SECTOR	63
+#define	BENCHMARK_HEADS						16				//(Matches the CF card simulator identify drive geometry)
+#define	BENCHMARK_SECTORS_PER_TRACK			63
+
+
+//----- MEASUREMENT -----
+typedef struct _BENCHMARK_SNAPSHOT
+{
+	clock_t clock;
+	FFS_SIM_COUNTERS bus;
+	DWORD cache_hits;
+	DWORD cache_misses;
+} BENCHMARK_SNAPSHOT;
+
+
+#endif
+
+
+
+
+
+
+//*******************************
+//*******************************
+//********** FUNCTIONS **********
+//*******************************
+//*******************************
+#ifdef BENCHMARK_C
+//-----------------------------------
+//----- INTERNAL ONLY FUNCTIONS -----
+//-----------------------------------
+BYTE benchmark_create_image (const char *filename, BYTE fat_32, DWORD total_sectors, BYTE cluster_size);
+void benchmark_write_sector (FILE *image_file, DWORD sector_lba, BYTE *source);
+void benchmark_run_configuration (BYTE fat_32, DWORD total_sectors, BYTE cluster_size, BYTE fragmentation_level);
+void benchmark_fragment (BYTE fragmentation_level);
+void benchmark_sequential_write (void);
+void benchmark_sequential_read (void);
+void benchmark_random_read (void);
+void benchmark_file_churn (void);
+void benchmark_directory_lookup (BYTE fat_32);
+void benchmark_remove_large_file (void);
+void benchmark_start (void);
+void benchmark_report (const char *test_name, DWORD operations, DWORD bytes);
+BYTE benchmark_pattern (DWORD position);
+DWORD benchmark_random (void);
+
+
+#endif
+
+
+
+
+//****************************
+//****************************
+//********** MEMORY **********
+//****************************
+//****************************
+#ifdef BENCHMARK_C
+//--------------------------------------------
+//----- INTERNAL ONLY MEMORY DEFINITIONS -----
+//--------------------------------------------
+BENCHMARK_SNAPSHOT benchmark_start_snapshot;
+BYTE benchmark_buffer[BENCHMARK_TRANSFER_SIZE];
+DWORD benchmark_random_seed = 1;
+DWORD benchmark_errors = 0;
+const BYTE benchmark_fragmentation_levels[BENCHMARK_FRAGMENTATION_LEVELS] = {0, 2, 8};		//(8 = 1600 one cluster files, 800 left as holes)
+
+
+#endif
+
+
+
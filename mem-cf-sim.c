@@ -0,0 +1,573 @@
+/*
+IBEX UK LTD http://www.ibexuk.com
+Electronic Product Design Specialists
+RELEASED SOFTWARE
+
+The MIT License (MIT)
+
+Copyright (c) 2013, IBEX UK Ltd, http://ibexuk.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Project Name:		COMPACT FLASH MEMORY CARD FAT16 & FAT 32 DRIVER
+//CF CARD BUS SIMULATOR C CODE FILE
+
+
+
+
+#include "main.h"					//Global data type definitions (see https://github.com/ibexuk/C_Generic_Header_File )
+#include <stdio.h>
+#include <string.h>
+#define CF_SIM_C
+#include "mem-ffs.h"
+#include "mem-cf.h"
+#include "mem-cf-sim.h"
+
+
+
+
+
+
+
+//***************************************
+//***************************************
+//********** INSERT CARD IMAGE **********
+//***************************************
+//***************************************
+//Opens a disk image file (a copy of a whole card including its master boot record) and presents it on the simulated card bus
+//as an inserted card.  The card is then initialised by ffs_process as normal (see ffs_sim_mount).
+//Returns
+//	1 if the image was opened, 0 if not
+BYTE ffs_sim_open (const char *filename)
+{
+	long file_size;
+
+
+	ffs_sim_close();
+
+	ffs_sim_image_file = fopen(filename, "r+b");
+	if (ffs_sim_image_file == 0)
+		return(0);
+
+	if (fseek(ffs_sim_image_file, 0, SEEK_END) != 0)
+	{
+		ffs_sim_close();
+		return(0);
+	}
+	file_size = ftell(ffs_sim_image_file);
+	if (file_size < FFS_SIM_BYTES_PER_SECTOR)
+	{
+		ffs_sim_close();
+		return(0);
+	}
+	ffs_sim_card_sectors = (DWORD)(file_size / FFS_SIM_BYTES_PER_SECTOR);
+
+	//----- POWER UP THE CARD -----
+	ffs_sim_bus.ce = 1;
+	ffs_sim_bus.ce2 = 1;
+	ffs_sim_bus.we = 1;
+	ffs_sim_bus.oe = 1;
+	ffs_sim_strobe_done = 0;
+	ffs_sim_reset_card();
+
+	ffs_sim_bus.card_detect = 0x00;				//Card present
+	return(1);
+}
+
+
+
+
+
+
+//***************************************
+//***************************************
+//********** REMOVE CARD IMAGE **********
+//***************************************
+//***************************************
+void ffs_sim_close (void)
+{
+	ffs_sim_bus.card_detect = 0x01;				//No card present
+
+	if (ffs_sim_image_file)
+	{
+		fclose(ffs_sim_image_file);
+		ffs_sim_image_file = 0;
+	}
+}
+
+
+
+
+
+
+//********************************
+//********************************
+//********** MOUNT CARD **********
+//********************************
+//********************************
+//Calls ffs_process, running the 10mS timer between each call in place of the applications timer interrupt, until the card has
+//been initialised.
+//Returns
+//	1 if the card is OK to use (ffs_card_ok is also set), 0 if not
+BYTE ffs_sim_mount (void)
+{
+	WORD count;
+
+
+	for (count = 0; count < 1000; count++)
+	{
+		ffs_process();
+		if (ffs_card_ok)
+			return(1);
+
+		if (ffs_10ms_timer)
+			ffs_10ms_timer--;
+	}
+	return(0);
+}
+
+
+
+
+
+
+//************************************
+//************************************
+//********** CLEAR COUNTERS **********
+//************************************
+//************************************
+void ffs_sim_clear_counters (void)
+{
+	memset(&ffs_sim_counters, 0x00, sizeof(ffs_sim_counters));
+}
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** READ RDY SIGNAL **********
+//*************************************
+//*************************************
+//Used by the FFS_RDY define.  Reading the card signals is when the simulated card actions the bus.
+BYTE ffs_sim_rdy (void)
+{
+	ffs_sim_counters.rdy_polls++;
+
+	if (ffs_sim_bus.reset & 0x01)
+	{
+		//CARD IS BEING RESET
+		ffs_sim_reset_card();
+		return(0);
+	}
+
+	ffs_sim_bus_cycle();
+
+	if (ffs_sim_busy_polls_remaining)
+	{
+		ffs_sim_busy_polls_remaining--;
+		return(0);
+	}
+	return(1);
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** READ WAIT SIGNAL **********
+//**************************************
+//**************************************
+//Used by the FFS_WAIT define.  Returns 0 while the card is inserting a wait state.
+BYTE ffs_sim_wait (void)
+{
+	ffs_sim_counters.wait_polls++;
+
+	ffs_sim_bus_cycle();
+
+	if (ffs_sim_wait_polls_remaining)
+	{
+		ffs_sim_wait_polls_remaining--;
+		return(0);
+	}
+	return(1);
+}
+
+
+
+
+
+
+
+
+
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+//****************************** DRIVER SUB FUNCTIONS BELOW HERE ******************************
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+
+
+
+
+
+
+
+//*******************************
+//*******************************
+//********** BUS CYCLE **********
+//*******************************
+//*******************************
+//Actions a -WE or -OE strobe the first time it is seen.  The driver always reads -WAIT after taking -WE or -OE low and before
+//releasing it, and reads RDY with both strobes high before the next bus cycle, so each strobe is seen exactly once.
+void ffs_sim_bus_cycle (void)
+{
+	BYTE address;
+	BYTE word_access;
+
+
+	if (ffs_sim_bus.we && ffs_sim_bus.oe)
+	{
+		ffs_sim_strobe_done = 0;
+		return;
+	}
+	if (ffs_sim_strobe_done)
+		return;
+	ffs_sim_strobe_done = 1;
+
+	if (ffs_sim_bus.we == 0)
+		ffs_sim_counters.we_strobes++;
+	else
+		ffs_sim_counters.oe_strobes++;
+
+	if ((ffs_sim_bus.ce) || (ffs_sim_bus.card_detect & 0x01) || (ffs_sim_image_file == 0) || (ffs_sim_bus.we == 0 && ffs_sim_bus.oe == 0))
+	{
+		ffs_sim_counters.bus_errors++;
+		return;
+	}
+
+	address = ffs_sim_bus.address & 0x07;
+	word_access = (ffs_sim_bus.ce2 == 0);
+	if ((word_access) && ((address != 0) || (ffs_sim_8_bit_mode)))
+	{
+		ffs_sim_counters.bus_errors++;
+		word_access = 0;
+	}
+
+	ffs_sim_wait_polls_remaining = ffs_sim_wait_state_polls;
+
+	if (address)
+	{
+		//----- TASK FILE REGISTER ACCESS -----
+		if (ffs_sim_bus.we == 0)
+			ffs_sim_write_register(address, ffs_sim_bus.data_op);
+		else
+			ffs_sim_bus.data_ip = ffs_sim_read_register(address);
+		return;
+	}
+
+	//----- DATA REGISTER ACCESS -----
+	if (ffs_sim_bus.we == 0)
+	{
+		//WRITE
+		ffs_sim_counters.data_writes++;
+		if ((ffs_sim_command_in_progress != 0x30) || (ffs_sim_sectors_remaining == 0))
+		{
+			ffs_sim_counters.bus_errors++;
+			return;
+		}
+
+		ffs_sim_buffer[ffs_sim_buffer_position++] = ffs_sim_bus.data_op;
+		if (word_access)
+			ffs_sim_buffer[ffs_sim_buffer_position++] = ffs_sim_bus.data_high_op;
+
+		if (ffs_sim_buffer_position >= FFS_SIM_BYTES_PER_SECTOR)
+		{
+			//SECTOR COMPLETE - STORE IT
+			fseek(ffs_sim_image_file, (long)ffs_sim_lba * FFS_SIM_BYTES_PER_SECTOR, SEEK_SET);
+			fwrite(&ffs_sim_buffer[0], 1, FFS_SIM_BYTES_PER_SECTOR, ffs_sim_image_file);
+			ffs_sim_counters.sectors_written++;
+
+			ffs_sim_lba++;
+			ffs_sim_buffer_position = 0;
+			if (--ffs_sim_sectors_remaining == 0)
+				ffs_sim_command_in_progress = 0;
+			ffs_sim_busy_polls_remaining = ffs_sim_command_busy_polls;
+		}
+	}
+	else
+	{
+		//READ
+		ffs_sim_counters.data_reads++;
+		if (ffs_sim_buffer_position >= ffs_sim_buffer_length)
+		{
+			ffs_sim_counters.bus_errors++;
+			ffs_sim_bus.data_ip = 0xff;
+			ffs_sim_bus.data_high_ip = 0xff;
+			return;
+		}
+
+		ffs_sim_bus.data_ip = ffs_sim_buffer[ffs_sim_buffer_position++];
+		if (word_access)
+			ffs_sim_bus.data_high_ip = ffs_sim_buffer[ffs_sim_buffer_position++];
+
+		if (ffs_sim_buffer_position >= ffs_sim_buffer_length)
+		{
+			//BUFFER EMPTIED - LOAD THE NEXT SECTOR FOR A MULTIPLE SECTOR READ
+			ffs_sim_buffer_length = 0;
+			if ((ffs_sim_command_in_progress == 0x20) && (--ffs_sim_sectors_remaining))
+			{
+				ffs_sim_lba++;
+				ffs_sim_load_sector();
+			}
+			else
+			{
+				ffs_sim_command_in_progress = 0;
+			}
+		}
+	}
+}
+
+
+
+
+
+
+//**********************************************
+//**********************************************
+//********** WRITE TASK FILE REGISTER **********
+//**********************************************
+//**********************************************
+void ffs_sim_write_register (BYTE address, BYTE data)
+{
+	ffs_sim_counters.register_writes++;
+
+	if (address == 0x07)
+	{
+		ffs_sim_command(data);
+		return;
+	}
+	ffs_sim_registers[address] = data;
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** READ TASK FILE REGISTER **********
+//*********************************************
+//*********************************************
+BYTE ffs_sim_read_register (BYTE address)
+{
+	ffs_sim_counters.register_reads++;
+
+	if (address == 0x07)
+	{
+		//STATUS REGISTER
+		if (ffs_sim_buffer_position < ffs_sim_buffer_length)
+			return(ffs_sim_status | FFS_SIM_STATUS_DRQ);
+		if ((ffs_sim_command_in_progress == 0x30) && (ffs_sim_sectors_remaining))
+			return(ffs_sim_status | FFS_SIM_STATUS_DRQ);
+		return(ffs_sim_status);
+	}
+	if (address == 0x01)
+	{
+		//ERROR REGISTER
+		if (ffs_sim_status & FFS_SIM_STATUS_ERR)
+			return(0x04);			//Aborted command
+		return(0x00);
+	}
+	return(ffs_sim_registers[address]);
+}
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** EXECUTE COMMAND **********
+//*************************************
+//*************************************
+void ffs_sim_command (BYTE command)
+{
+	WORD identify[256];
+	WORD count;
+	DWORD cylinders;
+
+
+	ffs_sim_counters.commands++;
+
+	ffs_sim_status = FFS_SIM_STATUS_RDY | FFS_SIM_STATUS_DSC;
+	ffs_sim_command_in_progress = 0;
+	ffs_sim_buffer_position = 0;
+	ffs_sim_buffer_length = 0;
+	ffs_sim_busy_polls_remaining = ffs_sim_command_busy_polls;
+
+	//Sector count register value of 0 = 256 sectors
+	ffs_sim_sectors_remaining = ffs_sim_registers[2];
+	if (ffs_sim_sectors_remaining == 0)
+		ffs_sim_sectors_remaining = 256;
+
+	//LBA from the task file registers (LBA27:24 in the low nibble of the card/head register)
+	ffs_sim_lba = ((DWORD)(ffs_sim_registers[6] & 0x0f) << 24) | ((DWORD)ffs_sim_registers[5] << 16) | ((DWORD)ffs_sim_registers[4] << 8) | (DWORD)ffs_sim_registers[3];
+
+	switch (command)
+	{
+	case 0xec:
+		//----- IDENTIFY DRIVE -----
+		ffs_sim_counters.identify_commands++;
+
+		cylinders = ffs_sim_card_sectors / (FFS_SIM_IDENTIFY_HEADS * FFS_SIM_IDENTIFY_SECTORS_PER_TRACK);
+		if (cylinders > 0xffff)
+			cylinders = 0xffff;
+
+		for (count = 0; count < 256; count++)
+			identify[count] = 0;
+		identify[0] = 0x848a;										//CF card
+		identify[1] = (WORD)cylinders;
+		identify[3] = FFS_SIM_IDENTIFY_HEADS;
+		identify[5] = FFS_SIM_BYTES_PER_SECTOR;
+		identify[6] = FFS_SIM_IDENTIFY_SECTORS_PER_TRACK;
+		identify[7] = (WORD)(ffs_sim_card_sectors >> 16);			//Number of sectors (MSW first)
+		identify[8] = (WORD)(ffs_sim_card_sectors & 0x0000ffff);
+		identify[21] = 1;											//Buffer size
+		identify[49] = 0x0200;										//LBA supported
+		identify[54] = (WORD)cylinders;
+		identify[55] = FFS_SIM_IDENTIFY_HEADS;
+		identify[56] = FFS_SIM_IDENTIFY_SECTORS_PER_TRACK;
+		identify[60] = (WORD)(ffs_sim_card_sectors & 0x0000ffff);	//Total LBA sectors (LSW first)
+		identify[61] = (WORD)(ffs_sim_card_sectors >> 16);
+
+		//Words are transfered low byte first
+		for (count = 0; count < 256; count++)
+		{
+			ffs_sim_buffer[(count << 1)] = (BYTE)(identify[count] & 0x00ff);
+			ffs_sim_buffer[(count << 1) + 1] = (BYTE)(identify[count] >> 8);
+		}
+		ffs_sim_buffer_length = FFS_SIM_BYTES_PER_SECTOR;
+		ffs_sim_command_in_progress = command;
+		return;
+
+	case 0x20:
+		//----- READ SECTORS -----
+		ffs_sim_counters.read_commands++;
+
+		if ((ffs_sim_lba + ffs_sim_sectors_remaining) > ffs_sim_card_sectors)
+			break;
+
+		ffs_sim_command_in_progress = command;
+		ffs_sim_load_sector();
+		return;
+
+	case 0x30:
+		//----- WRITE SECTORS -----
+		ffs_sim_counters.write_commands++;
+
+		if ((ffs_sim_lba + ffs_sim_sectors_remaining) > ffs_sim_card_sectors)
+			break;
+
+		ffs_sim_command_in_progress = command;
+		return;
+
+	case 0xef:
+		//----- SET FEATURES -----
+		ffs_sim_counters.set_features_commands++;
+
+		if (ffs_sim_registers[1] == 0x01)			//Enable 8 bit data transfers
+			ffs_sim_8_bit_mode = 1;
+		else if (ffs_sim_registers[1] == 0x81)		//Disable 8 bit data transfers
+			ffs_sim_8_bit_mode = 0;
+		else
+			break;
+		return;
+	}
+
+	//----- COMMAND REJECTED -----
+	ffs_sim_counters.rejected_commands++;
+	ffs_sim_status |= FFS_SIM_STATUS_ERR;
+	ffs_sim_sectors_remaining = 0;
+}
+
+
+
+
+
+
+//**************************************************
+//**************************************************
+//********** LOAD SECTOR INTO CARD BUFFER **********
+//**************************************************
+//**************************************************
+//Loads ffs_sim_lba ready to be read through the data register.  Sectors beyond the end of the image file are read as 0x00.
+void ffs_sim_load_sector (void)
+{
+	memset(&ffs_sim_buffer[0], 0x00, FFS_SIM_BYTES_PER_SECTOR);
+
+	fseek(ffs_sim_image_file, (long)ffs_sim_lba * FFS_SIM_BYTES_PER_SECTOR, SEEK_SET);
+	fread(&ffs_sim_buffer[0], 1, FFS_SIM_BYTES_PER_SECTOR, ffs_sim_image_file);
+	ffs_sim_counters.sectors_read++;
+
+	ffs_sim_buffer_position = 0;
+	ffs_sim_buffer_length = FFS_SIM_BYTES_PER_SECTOR;
+	ffs_sim_busy_polls_remaining = ffs_sim_command_busy_polls;
+}
+
+
+
+
+
+
+//********************************
+//********************************
+//********** RESET CARD **********
+//********************************
+//********************************
+void ffs_sim_reset_card (void)
+{
+	ffs_sim_8_bit_mode = 1;
+	ffs_sim_status = FFS_SIM_STATUS_RDY | FFS_SIM_STATUS_DSC;
+	ffs_sim_command_in_progress = 0;
+	ffs_sim_sectors_remaining = 0;
+	ffs_sim_buffer_position = 0;
+	ffs_sim_buffer_length = 0;
+	ffs_sim_busy_polls_remaining = 0;
+	ffs_sim_wait_polls_remaining = 0;
+	memset(&ffs_sim_registers[0], 0x00, sizeof(ffs_sim_registers));
+}
+
+
+
+
+
+
+
+
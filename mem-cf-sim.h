@@ -0,0 +1,235 @@
+/*
+IBEX UK LTD http://www.ibexuk.com
+Electronic Product Design Specialists
+RELEASED SOFTWARE
+
+The MIT License (MIT)
+
+Copyright (c) 2013, IBEX UK Ltd, http://ibexuk.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Project Name:		COMPACT FLASH MEMORY CARD FAT16 & FAT 32 DRIVER
+//CF CARD BUS SIMULATOR C CODE HEADER FILE
+//(For running mem-cf.c on a Linux host - the CF card task file registers are simulated over a disk image file.  Define
+//FFS_USING_GCC_HOST_COMPILER on the compiler command line (or select it in mem-cf.h and mem-ffs.h) to connect the FFS_ IO defines to the simulator)
+
+
+
+
+//##################################
+//##################################
+//########## USING DRIVER ##########
+//##################################
+//##################################
+/*
+	//----- INSERT A SIMULATED CARD -----
+	if (ffs_sim_open("card.img") == 0)
+		//Error
+
+	//----- MOUNT THE CARD -----
+	//(Calls ffs_process and runs the 10mS timer until the card is initialised)
+	if (ffs_sim_mount() == 0)
+		//Error
+
+	//----- MEASURE AN OPERATION -----
+	ffs_sim_clear_counters();
+	//... use the ffs_ file functions as normal ...
+	//ffs_sim_counters.oe_strobes + ffs_sim_counters.we_strobes = bus cycles used
+
+	//----- REMOVE THE CARD -----
+	ffs_sim_close();
+	//(ffs_process will then see the card as removed)
+*/
+
+
+
+
+
+//*****************************
+//*****************************
+//********** DEFINES **********
+//*****************************
+//*****************************
+#ifndef CF_SIM_C_INIT		//Do only once the first time this file is used
+#define	CF_SIM_C_INIT
+
+
+#define	FFS_SIM_BYTES_PER_SECTOR		512
+#define	FFS_SIM_IDENTIFY_HEADS			16			//CHS geometry reported by the identify drive command
+#define	FFS_SIM_IDENTIFY_SECTORS_PER_TRACK	63
+
+//STATUS REGISTER BITS:-
+#define	FFS_SIM_STATUS_ERR				0x01
+#define	FFS_SIM_STATUS_DRQ				0x08
+#define	FFS_SIM_STATUS_DSC				0x10
+#define	FFS_SIM_STATUS_RDY				0x40
+
+
+//----- CARD SIGNALS -----
+//(The FFS_ IO defines in mem-cf.h write and read these in place of processor port pins)
+typedef struct _FFS_SIM_BUS
+{
+	BYTE data_ip;						//D7:0 driven by the card
+	BYTE data_op;						//D7:0 driven by the processor
+	BYTE data_tris;
+	BYTE data_high_ip;					//D15:8 driven by the card
+	BYTE data_high_op;					//D15:8 driven by the processor
+	BYTE data_high_tris;
+	BYTE ce;							//-CE1
+	BYTE ce2;							//-CE2
+	BYTE we;							//-WE
+	BYTE oe;							//-OE
+	BYTE reg;							//-REG
+	BYTE address;						//A2:0 (bits 2:0)
+	BYTE reset;							//RESET (bit 0)
+	BYTE card_detect;					//-CD (bit 0, low = card present)
+} FFS_SIM_BUS;
+
+
+//----- BUS ACTIVITY COUNTERS -----
+typedef struct _FFS_SIM_COUNTERS
+{
+	DWORD oe_strobes;					//Every -OE strobe (read bus cycle)
+	DWORD we_strobes;					//Every -WE strobe (write bus cycle)
+	DWORD register_writes;				//-WE strobes to the task file registers 1 - 7
+	DWORD register_reads;				//-OE strobes to the task file registers 1 - 7
+	DWORD data_writes;					//-WE strobes to the data register (byte or word)
+	DWORD data_reads;					//-OE strobes to the data register (byte or word)
+	DWORD commands;						//Writes to the command register
+	DWORD identify_commands;			//0xec
+	DWORD read_commands;				//0x20
+	DWORD write_commands;				//0x30
+	DWORD set_features_commands;		//0xef
+	DWORD rejected_commands;			//Unknown commands and commands with an invalid LBA
+	DWORD sectors_read;
+	DWORD sectors_written;
+	DWORD rdy_polls;					//Reads of the RDY signal
+	DWORD wait_polls;					//Reads of the -WAIT signal
+	DWORD bus_errors;					//Strobes with the card deselected, data register accesses with no data to transfer and word accesses in 8 bit mode
+} FFS_SIM_COUNTERS;
+
+
+#endif
+
+
+
+
+//*******************************
+//*******************************
+//********** FUNCTIONS **********
+//*******************************
+//*******************************
+#ifdef CF_SIM_C
+//-----------------------------------
+//----- INTERNAL ONLY FUNCTIONS -----
+//-----------------------------------
+void ffs_sim_bus_cycle (void);
+void ffs_sim_write_register (BYTE address, BYTE data);
+BYTE ffs_sim_read_register (BYTE address);
+void ffs_sim_command (BYTE command);
+void ffs_sim_load_sector (void);
+void ffs_sim_reset_card (void);
+
+
+
+//-----------------------------------------
+//----- INTERNAL & EXTERNAL FUNCTIONS -----
+//-----------------------------------------
+//(Also defined below as extern)
+BYTE ffs_sim_open (const char *filename);
+void ffs_sim_close (void);
+BYTE ffs_sim_mount (void);
+void ffs_sim_clear_counters (void);
+BYTE ffs_sim_rdy (void);
+BYTE ffs_sim_wait (void);
+
+
+
+
+#else
+//------------------------------
+//----- EXTERNAL FUNCTIONS -----
+//------------------------------
+extern BYTE ffs_sim_open (const char *filename);
+extern void ffs_sim_close (void);
+extern BYTE ffs_sim_mount (void);
+extern void ffs_sim_clear_counters (void);
+extern BYTE ffs_sim_rdy (void);
+extern BYTE ffs_sim_wait (void);
+
+
+
+#endif
+
+
+
+
+//****************************
+//****************************
+//********** MEMORY **********
+//****************************
+//****************************
+#ifdef CF_SIM_C
+//--------------------------------------------
+//----- INTERNAL ONLY MEMORY DEFINITIONS -----
+//--------------------------------------------
+FILE *ffs_sim_image_file = 0;
+DWORD ffs_sim_card_sectors;
+BYTE ffs_sim_registers[8];					//Task file registers as last written (index = A2:0)
+BYTE ffs_sim_status;
+BYTE ffs_sim_command_in_progress;
+BYTE ffs_sim_8_bit_mode;					//1 = 8 bit data transfers (the power up default), 0 = 16 bit (set features 0x81)
+BYTE ffs_sim_strobe_done;					//1 once the current -OE / -WE strobe has been actioned
+DWORD ffs_sim_lba;							//The next sector to be transfered through the data register
+WORD ffs_sim_sectors_remaining;
+WORD ffs_sim_buffer_position;
+WORD ffs_sim_buffer_length;
+BYTE ffs_sim_buffer[FFS_SIM_BYTES_PER_SECTOR];
+WORD ffs_sim_busy_polls_remaining;
+WORD ffs_sim_wait_polls_remaining;
+
+
+
+//--------------------------------------------------
+//----- INTERNAL & EXTERNAL MEMORY DEFINITIONS -----
+//--------------------------------------------------
+//(Also defined below as extern)
+FFS_SIM_BUS ffs_sim_bus;
+FFS_SIM_COUNTERS ffs_sim_counters;
+WORD ffs_sim_command_busy_polls = 0;		//Number of RDY reads that return busy after each command (to simulate a slow card)
+WORD ffs_sim_wait_state_polls = 0;			//Number of -WAIT reads that return a wait state after each strobe (to simulate a slow card)
+
+
+
+
+#else
+//---------------------------------------
+//----- EXTERNAL MEMORY DEFINITIONS -----
+//---------------------------------------
+extern FFS_SIM_BUS ffs_sim_bus;
+extern FFS_SIM_COUNTERS ffs_sim_counters;
+extern WORD ffs_sim_command_busy_polls;
+extern WORD ffs_sim_wait_state_polls;
+
+
+
+#endif
+
+
+
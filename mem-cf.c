@@ -32,9 +32,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "main.h"					//Global data type definitions (see https://github.com/ibexuk/C_Generic_Header_File )
 #define CF_C
+#include "mem-ffs.h"					//(Included first as this file provides the FFS_BLOCK_DEVICE for the FAT driver)
 #include "mem-cf.h"
-
-#include "mem-ffs.h"
+#ifdef FFS_USING_GCC_HOST_COMPILER
+#include "mem-cf-sim.h"				//(The simulated card signals used by the IO defines)
+#endif
 
 
 
@@ -49,18 +51,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //This function needs to be called reguarly to detect a new card being inserted so that it can be initialised ready for access.
 void ffs_process (void)
 {
-	BYTE head;
-	WORD cylinder_no;
-	BYTE sector;
-
 	BYTE b_temp;
 	WORD w_temp;
-	DWORD dw_temp;
-	DWORD lba;
-	DWORD main_partition_start_sector;
-	WORD number_of_reserved_sectors;
-	BYTE number_of_copies_of_fat;
-	BYTE *buffer_pointer;
 
 
 
@@ -73,12 +65,19 @@ void ffs_process (void)
 		FFS_CE = 1;
 		FFS_WE = 1;
 		FFS_OE = 1;
+		#ifdef FFS_USE_16_BIT_DATA_BUS
+			FFS_CE2 = 1;
+		#endif
 		
 		ffs_card_ok = 0;					//Flag that card not OK
 
 		//Reset all file handlers
 		for (b_temp = 0; b_temp < FFS_FOPEN_MAX; b_temp++)
 			ffs_file[b_temp].flags.bits.file_is_open = 0;
+		for (b_temp = 0; b_temp < FFS_OPEN_FILES_MAX; b_temp++)
+			ffs_open_file[b_temp].handle_count = 0;
+		for (b_temp = 0; b_temp < FFS_OPENDIR_MAX; b_temp++)
+			ffs_dir[b_temp].dir_is_open = 0;
 
 		//Has a card has been inserted?
 		if (ffs_is_card_present() == 0)
@@ -190,6 +189,8 @@ void ffs_process (void)
 
 	ffs_card_ok = 0;					//Default to card not OK
 
+	ffs_initialise_sector_cache();		//Discard anything cached from a previous card
+
 
 	//---------------------------------------------------
 	//----- READ CARD SETUP (CF Identify Drive Cmd) -----
@@ -201,6 +202,17 @@ void ffs_process (void)
 	if (ffs_write_byte(0x00) == 0)
 		goto init_new_ffs_card_fail;
 
+	#ifdef FFS_USE_16_BIT_DATA_BUS
+		//----- ENABLE 16 BIT DATA TRANSFERS (CF Set Features Cmd) -----
+		ffs_set_address(0x01);					//Write the 'Features' register
+		if (ffs_write_byte(0x81) == 0)			//0x81 = Disable 8 bit data transfers
+			goto init_new_ffs_card_fail;
+
+		ffs_set_address(0x07);					//Write the 'Command' register
+		if (ffs_write_byte(0xef) == 0)			//Set features command
+			goto init_new_ffs_card_fail;
+	#endif
+
 	//Select the command register
 	ffs_set_address(0x07);
 	
@@ -230,325 +242,23 @@ void ffs_process (void)
 	//Dump the next word
 	ffs_read_word();
 
-	//Get number of sectors on the card (= the first invalid LBA address) (words 7&8) - not currently useful as we don't format a card
-	ffs_read_word();
-	ffs_read_word();
-
-	//Dump the next 12 words
-	for (b_temp = 0; b_temp < 12; b_temp++)
-		ffs_read_word();
-
-	//Get the buffer size (x512 bytes (NOT WORDS)) (word 21)
-	ffs_read_word();
-
-	//Dump the next 33 words
-	for (b_temp = 0; b_temp < 33; b_temp++)
-		ffs_read_word();
-
-	//Get the number of heads (word 55)
-	w_temp = ffs_read_word();
-	if (w_temp > 0xff)						//Can't be more than 255 heads
-		goto init_new_ffs_card_fail;
-	ffs_no_of_heads = (BYTE)w_temp;
-
-	//Get the number of sectors per track (word 56)
-	w_temp = ffs_read_word();
-	if (w_temp > 0xff)						//Can't be more than 64 sectors per track
-		goto init_new_ffs_card_fail;
-	ffs_no_of_sectors_per_track = (BYTE)w_temp;
-
-	//Set the number of bytes per sector before we move on to general access
-	ffs_bytes_per_sector = 512;
-
-	//---------------------------------------
-	//----- READ THE MASTER BOOT RECORD -----
-	//---------------------------------------
-	// read sector 1 (LBA 0x00)
-	ffs_set_address(0x06);					//Write the 'Select Card/Head' register [LBA27:24 - bits3:0]
-	ffs_write_byte(0xe0);					//(Use Logic Block Addressing - not Cylinder,Head,Sector)
-
-	ffs_set_address(0x05);					//Write the 'Cylinder High' register [LBA23:16]
-	ffs_write_byte(0x00);
-
-	ffs_set_address(0x04);					//Write the 'Cylinder Low' register [LBA15:8]
-	ffs_write_byte(0x00);
-
-	ffs_set_address(0x03);					//Write the 'Sector No' register [LBA7:0]
-	ffs_write_byte(0x00);
-
-	ffs_set_address(0x02);					//Write the 'Sector Count' register (no of sectors to be transfered to complete the operation)
-	ffs_write_byte(0x01);
-
-	ffs_set_address(0x07);					//Write the 'Command' register
-	ffs_write_byte(0x20);					//Read sector(s) command
-
-	ffs_set_address(0x00);					//Read the data register
-
-	//Read and dump the first 223 words (446 bytes of boot up executable code))
-	for (b_temp = 0; b_temp < 223; b_temp++)
-		ffs_read_word();
-
-	//Now at start of the partition table [0x000001be]
-
-	//Check for Partition 1 active (0x00 = inactive, 0x80 = active) [1]
-	//(We allow a value of 0x00 for partition 1 as this partition must be present and on some disks a value of 0x00 has been found)
-	b_temp = ffs_read_byte();
-	//if (b_temp != 0x80)
-	//	goto init_new_ffs_card_fail
-
-	//Get 'Beginning of Partition - Head' [0x000001bf]
-	head = ffs_read_byte();
-
-
-	//Get 'Beginning of Partition - Cylinder + Sector' [0x000001c0]
-	w_temp = ffs_read_word();
-
-	cylinder_no = (w_temp >> 8);				//Yes this is correct - strange bit layout in this register!
-	if (w_temp & 0x0040)
-		cylinder_no += 0x0100;
-	if (w_temp & 0x0080)
-		cylinder_no += 0x0200;
-
-	sector = (BYTE)(w_temp & 0x003f);
-
-	//----- GET START ADDRESS OF PARTITION 1 -----
-	//(Sectors per track x no of heads)
-	w_temp = ((WORD)ffs_no_of_sectors_per_track * (WORD)ffs_no_of_heads);
-
-	//Result x cylinder value just read
-	main_partition_start_sector = ((DWORD)w_temp * (DWORD)cylinder_no);
-
-	//Add (sectors per track x head value just read)
-	w_temp = ((WORD)ffs_no_of_sectors_per_track * (WORD)head);
-	main_partition_start_sector += (DWORD)w_temp;
-	
-	//Add sector value -1 (as sectors are numbered 1-#)
-	main_partition_start_sector += (DWORD)(sector - 1);
-
-	//WE NOW HAVE THE START ADDRESS OF THE FIRST PARTITION (THE ONLY PARTITION WE LOOK AT)
-
-
-	//Read the 'Type Of Partition' [0x000001c2]
-	//(We accept FAT16 or FAT32)
-	b_temp = ffs_read_byte();
-
-	if (b_temp == 0x04)						//FAT16 (smaller than 32MB)
-		disk_is_fat_32 = 0;
-	else if (b_temp == 0x06)				//FAT16 (larger than 32MB)
-		disk_is_fat_32 = 0;
-	else if (b_temp == 0x0b)				//FAT32 (Partition Up to 2048GB)
-		disk_is_fat_32 = 1;
-	else if (b_temp == 0x0c)				//FAT32 (Partition Up to 2048GB - uses 13h extensions)
-		disk_is_fat_32 = 1;
-	else if (b_temp == 0x0e)				//FAT16 (partition larger than 32MB, uses 13h extensions)
-		disk_is_fat_32 = 0;
-	else
-		goto init_new_ffs_card_fail;
-
-	//Get end of partition - head [0x000001c3]
-	ffs_read_byte();
-
-	//Get end of partition - Cylinder & Sector [0x000001c4]
-	ffs_read_word();
-
-	//Get no of sectors between MBR and the first sector in the partition [0x000001c6]
-	ffs_read_word();
-	ffs_read_word();
-
-	//Get no of sectors in the partition - could be useful when we do writing of files [0x000001ca]
-	ffs_no_of_partition_sectors = (DWORD)(ffs_read_word());
-	ffs_no_of_partition_sectors += (((DWORD)ffs_read_word() << 16));
-
-
-
-	//------------------------------------------
-	//---- READ THE PARTITION 1 BOOT RECORD ----
-	//------------------------------------------
-	//Setup for finding the FAT1 table start address root directory start address and data area start address
-	lba = main_partition_start_sector;
-
-	ffs_read_sector_to_buffer(lba);
-	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
-
-	//Dump jump code & OEM name (11 bytes)
-	buffer_pointer += 11;
-
-	//Get 'Bytes Per Sector' [# + 0x000b]
-	//Check value matches value read from 'Identify Drive' - Changed - use this value as ID value can be different (it = no of Unfotmatted bytes per sector)
-	//Value is usually 512, but can be 256 on some older CF cards.  Ensure <= 512 (this is the size of the sector read buffer we provide and it should not be bigger than this)
-	ffs_bytes_per_sector = (WORD)*buffer_pointer++;
-	ffs_bytes_per_sector |= (WORD)(*buffer_pointer++) << 8;
-	if (ffs_bytes_per_sector > 512)
-		goto init_new_ffs_card_fail;
-
-	//Get 'Sectors Per Cluster' [# + 0x000d]
-	//(Restricted to powers of 2 (1, 2, 4, 8, 16, 32))
-	sectors_per_cluster = *buffer_pointer++;
-	
-	b_temp = 0;											//Check its power of 2 (other functions rely on this check)
-	for (w_temp = 0x01; w_temp < 0x0100; w_temp <<= 1)
-	{
-		if (sectors_per_cluster & (BYTE)w_temp)
-			b_temp++;
-	}
-	if (b_temp != 1)
-		goto init_new_ffs_card_fail;
-
-
-	//Get '# of reserved sectors' [# + 0x000e]
-	//Adjust the start addresses acordingly
-	number_of_reserved_sectors = (WORD)*buffer_pointer++;
-	number_of_reserved_sectors |= (WORD)(*buffer_pointer++) << 8;
-
-	//Get 'no of copies of FAT' [# + 0x0010]
-	//(any number >= 1 is permitted, but no value other than 2 is recomended)
-	number_of_copies_of_fat = *buffer_pointer++;
-	if ((number_of_copies_of_fat > 4) || (number_of_copies_of_fat == 0))		//We set a limit on there being a maximum of 4 copies of fat
-		goto init_new_ffs_card_fail;
-
-	//Get 'max root directory entries' [# + 0x0011]
-	//(Used by FAT16, but not for FAT32)
-	dw_temp = (DWORD)*buffer_pointer++;
-	dw_temp |= (DWORD)(*buffer_pointer++) << 8;
-	number_of_root_directory_sectors = ((dw_temp * 32) + (DWORD)(ffs_bytes_per_sector - 1)) / ffs_bytes_per_sector;		//Multiply no of entries by 32 (no of bytes per entry)
-																														//This calculation rounds up
-	//Get 'number of sectors in partition < 32MB' [# + 0x0013]
-	//(Dump)
-	buffer_pointer++;
-	buffer_pointer++;
-
-	//Get 'media descriptor' [# + 0x0015]
-	//(Should be 0xF8 for hard disk)
-	if (*buffer_pointer++ != 0xf8)
-		goto init_new_ffs_card_fail;
-
-	//Get 'sectors per fat'  [# + 0x0016]
-	//(Used by FAT16, but not for FAT32 - for FAT32 the value is a double word and located later on in this table - variable will be overwritten)
-	sectors_per_fat = (DWORD)*buffer_pointer++;
-	sectors_per_fat |= (DWORD)(*buffer_pointer++) << 8;
-
-
-	if(disk_is_fat_32 == 0)
-	{
-		//---------------------------------------------------------------------------------------
-		//----- PARTITION IS FAT 16 - COMPLETE BOOT RECORD & INITAILISATION FOR THIS SYSTEM -----
-		//---------------------------------------------------------------------------------------
-
-		//CALCULATE THE PARTITION AREAS START ADDRESSES
-		fat1_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors;
-		root_directory_start_sector_cluster = main_partition_start_sector + (DWORD)number_of_reserved_sectors + (sectors_per_fat * number_of_copies_of_fat);
-		data_area_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors + (sectors_per_fat * number_of_copies_of_fat) + number_of_root_directory_sectors;
-
-		//SET THE ACTIVE FAT TABLE FLAGS
-		active_fat_table_flags = 0;						// #|#|#|#|USE_FAT_TABLE_3|USE_FAT_TABLE_2|USE_FAT_TABLE_1|USE_FAT_TABLE_0
-		for (b_temp = 0; b_temp < number_of_copies_of_fat; b_temp++)
-		{
-			active_fat_table_flags <<= 1;
-			active_fat_table_flags++;
-		}
-		
-		//SET UNUSED REGISTERS (used for FAT32)
-		file_system_information_sector = 0xffff;
-
-	}
-	else
-	{
-		//---------------------------------------------------------------------------------------
-		//----- PARTITION IS FAT 32 - COMPLETE BOOT RECORD & INITAILISATION FOR THIS SYSTEM -----
-		//---------------------------------------------------------------------------------------
-
-		//Dump sectors per track, # of heads, # of hidden sectors in partition (12 bytes)
-		buffer_pointer += 12;
-
-		//Get 'sectors per fat'  [# + 0x0024]
-		sectors_per_fat = (DWORD)*buffer_pointer++;
-		sectors_per_fat |= (DWORD)(*buffer_pointer++) << 8;
-		sectors_per_fat |= (DWORD)(*buffer_pointer++) << 16;
-		sectors_per_fat |= (DWORD)(*buffer_pointer++) << 24;
-
-		//Get 'Flags' [# + 0x0028]
-		//(Bits 0-4 Indicate Active FAT Copy)
-		//(Bit 7 Indicates whether FAT Mirroring is Enabled or Disabled <Clear is Enabled>) (If FAT Mirroringis Disabled, the FAT Information is
-		//only written to the copy indicated by bits 0-4)
-		w_temp = (DWORD)*buffer_pointer++;
-		w_temp |= (DWORD)(*buffer_pointer++) << 8;
-		if (w_temp & 0x0080)
-		{
-			//BIT7 = 1, FAT MIRRORING IS DISABLED
-			//Bits 3:0 set which FAT table is active
-			if ((w_temp & 0x000f) > number_of_copies_of_fat)
-				goto init_new_ffs_card_fail;
-			
-			switch (w_temp & 0x000f)
-			{
-			case 0:
-				active_fat_table_flags = 0x01;						// #|#|#|#|USE_FAT_TABLE_3|USE_FAT_TABLE_2|USE_FAT_TABLE_1|USE_FAT_TABLE_0
-				break;
-			case 1:
-				active_fat_table_flags = 0x02;
-				break;
-			case 2:
-				active_fat_table_flags = 0x04;
-				break;
-			case 3:
-				active_fat_table_flags = 0x08;
-				break;
-			}
-		}
-		else
-		{
-			//BIT7 = 0, FAT MIRRORING IS ENABLED INTO ALL FATS
-			active_fat_table_flags = 0;						// #|#|#|#|USE_FAT_TABLE_3|USE_FAT_TABLE_2|USE_FAT_TABLE_1|USE_FAT_TABLE_0
-			for (b_temp = 0; b_temp < number_of_copies_of_fat; b_temp++)
-			{
-				active_fat_table_flags <<= 1;
-				active_fat_table_flags++;
-			}
-		}
-
-		//Get 'Version of FAT32 Drive' [# + 0x002A]
-		//(High Byte = Major Version, Low Byte = Minor Version)
-		buffer_pointer++;
-		buffer_pointer++;
-
-		//Get 'Cluster Number of the Start of the Root Directory' [# + 0x2C]
-		//(Usually 2, but not requried to be 2)
-		root_directory_start_sector_cluster = (DWORD)*buffer_pointer++;
-		root_directory_start_sector_cluster |= (DWORD)(*buffer_pointer++) << 8;
-		root_directory_start_sector_cluster |= (DWORD)(*buffer_pointer++) << 16;
-		root_directory_start_sector_cluster |= (DWORD)(*buffer_pointer++) << 24;
-
-		//Get 'Sector Number of the File System Information Sector' [# + 0x0030]
-		//(Referenced from the Start of the Partition. Usually 1, but not requried to be 1)
-		file_system_information_sector = (DWORD)*buffer_pointer++;
-		file_system_information_sector |= (DWORD)(*buffer_pointer++) << 8;
-
-
-		//CALCULATE THE PARTITION AREAS START ADDRESSES
-		fat1_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors;			//THE FAT START ADDRESS IS NOW GOOD (has correct offset)
-		//root_directory_start_sector_cluster already done above
-		data_area_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors + (sectors_per_fat * number_of_copies_of_fat);
+	//Get number of sectors on the card (= the first invalid LBA address) (words 7&8)
+	ffs_cf_card_sectors = (DWORD)ffs_read_word() << 16;
+	ffs_cf_card_sectors |= (DWORD)ffs_read_word();
 
-		//SET UNUSED REGISTERS (used for FAT16)
-		number_of_root_directory_sectors = 0;
-	}
-
-	//------------------------------------------------------------------------
-	//----- BOOT RECORD IS DONE - ALL REQUIRED DISK PARAMETERS ARE KNOWN -----
-	//------------------------------------------------------------------------
+	//(The rest of the identify data isn't needed - the partition start is read from the LBA value in the master boot record so the
+	//card geometry (words 55 & 56) isn't used)
 
+	//-------------------------------------
+	//----- MOUNT THE FAT FILE SYSTEM -----
+	//-------------------------------------
+	FFS_CE = 1;								//Deselect the card
 
-	//-----------------------------
-	//----- CARD IS OK TO USE -----
-	//-----------------------------
-	FFS_CE = 1;						//Deselect the card
-	ffs_card_ok = 1;				//Flag that the card is OK
-
-	//Do CF Driver specific initialisations
-	last_found_free_cluster = 0;		//When we next look for a free cluster, start from the beginning
-
+	ffs_block_device = &ffs_cf_block_device;		//The FAT driver accesses the card through our block device functions
+	if (ffs_mount_volume())
+		return;
 
-	return;
+	//(Fall through to the card not compatible below)
 
 
 //----------------------------------
@@ -635,105 +345,165 @@ void ffs_card_reset_pin (BYTE pin_state)
 
 
 
-//*******************************************
-//*******************************************
-//********** READ SECTOR TO BUFFER **********
-//*******************************************
-//*******************************************
-//lba = start sector address
-//The card must be deselected after all of the data has been read using:
-//	FFS_CE = 1;					//Deselect the card
-void ffs_read_sector_to_buffer (DWORD sector_lba)
+//********************************************
+//********************************************
+//********** READ SECTORS FROM CARD **********
+//********************************************
+//********************************************
+//Block device function.  Reads a run of consecutive sectors from the card.  The task file registers are only setup once for each block of
+//up to 256 sectors, so this is much faster than reading the same sectors one at a time.
+//sector_lba = start sector address
+//sector_count = number of sectors to read
+//destination = buffer to read to (must be sector_count x ffs_bytes_per_sector bytes in size)
+void ffs_cf_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination)
 {
 	WORD count;
-	BYTE *buffer_pointer;
-
+	WORD sectors_this_command;
+	WORD data;
 
-	//----- IF LBA MATCHES THE LAST LBA DON'T BOTHER RE-READING AS THE DATA IS STILL IN THE BUFFER -----
-	if (ffs_buffer_contains_lba == sector_lba)
-	{
-		return;
-	}
 
 	FFS_CE = 0;										//Select the card
 
-
-	//----- IF THE BUFFER CONTAINS DATA THAT IS WAITING TO BE WRITTEN THEN WRITE IT FIRST -----
-	if (ffs_buffer_needs_writing_to_card)
+	while (sector_count)
 	{
-		if (ffs_buffer_contains_lba != 0xffffffff)			//This should not be possible but check is made just in case!
-			ffs_write_sector_from_buffer(ffs_buffer_contains_lba);
+		//----- SEND THE READ COMMAND FOR UP TO 256 SECTORS -----
+		if (sector_count > 256)
+			sectors_this_command = 256;
+		else
+			sectors_this_command = sector_count;
 
-		FFS_CE = 0;										//Select the card again
+		ffs_send_lba_command(sector_lba, sectors_this_command, 0x20);		//Read sector(s) command
 
-		ffs_buffer_needs_writing_to_card = 0;
+		sector_lba += sectors_this_command;
+		sector_count -= sectors_this_command;
+
+		//----- READ EACH SECTOR FROM THE DATA REGISTER -----
+		//(The card drops RDY between sectors while it fetches the next one - ffs_read_word waits for this)
+		while (sectors_this_command)
+		{
+			for (count = 0; count < ffs_bytes_per_sector; count += 2)
+			{
+				data = ffs_read_word();
+				*destination++ = (BYTE)(data & 0x00ff);
+				*destination++ = (BYTE)(data >> 8);
+			}
+			sectors_this_command--;
+		}
 	}
 
+	FFS_CE = 1;										//De-select the card
+}
 
 
-	//----- NEW LBA TO BE LOADED -----
-	ffs_set_address(0x06);							//0x06 - Write the 'Select Card/Head' register [LBA27:24 - bits3:0]
-	ffs_write_byte((BYTE)(0b11100000 | (sector_lba >> 24)));	//(Use Logic Block Addressing - not Cylinder,Head,Sector)
 
-	ffs_set_address(0x05);							//0x05 - Write the 'Cylinder High' register [LBA23:16]
-	ffs_write_byte((BYTE)((sector_lba & 0x00ff0000) >> 16));
 
-	ffs_set_address(0x04);							//0x04 - Write the 'Cylinder Low' register [LBA15:8]
-	ffs_write_byte((BYTE)((sector_lba & 0x0000ff00) >> 8));
 
-	ffs_set_address(0x03);							//0x03 - Write the 'Sector No' register [LBA7:0]
-	ffs_write_byte((BYTE)(sector_lba & 0x000000ff));
 
-	ffs_set_address(0x02);							//0x02 - Write the 'Sector Count' register (no of sectors to be transfered to complete the operation)
-	ffs_write_byte(1);
 
-	ffs_set_address(0x07);							//0x07 - Write the 'Command' register
-	ffs_write_byte(0x20);							//Read sector(s) command
+//*******************************************
+//*******************************************
+//********** WRITE SECTORS TO CARD **********
+//*******************************************
+//*******************************************
+//Block device function.  Writes a run of consecutive sectors to the card.  The task file registers are only setup once for each block of
+//up to 256 sectors, which cuts the command overhead and lets the card work on larger units with its internal write buffer.
+//sector_lba = start sector address
+//sector_count = number of sectors to write
+//source = buffer to write from (must be sector_count x ffs_bytes_per_sector bytes in size)
+void ffs_cf_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source)
+{
+	WORD count;
+	WORD sectors_this_command;
+	WORD data;
+
 
-	ffs_set_address(0x00);							//0x00 - Read from the data register
+	FFS_CE = 0;										//Select the card
 
-	ffs_buffer_contains_lba = 0xffffffff;			//Flag that buffer does not currently contain any lba
+	while (sector_count)
+	{
+		//----- SEND THE WRITE COMMAND FOR UP TO 256 SECTORS -----
+		if (sector_count > 256)
+			sectors_this_command = 256;
+		else
+			sectors_this_command = sector_count;
 
+		ffs_send_lba_command(sector_lba, sectors_this_command, 0x30);		//Write sector(s) command
 
-	//----- READ THE SECTOR INTO THE BUFFER -----
-	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
+		sector_lba += sectors_this_command;
+		sector_count -= sectors_this_command;
 
-	for (count = 0; count < ffs_bytes_per_sector; count++)
-	{
-		*buffer_pointer++ = ffs_read_byte();
+		//----- WRITE EACH SECTOR TO THE DATA REGISTER -----
+		while (sectors_this_command)
+		{
+			for (count = 0; count < ffs_bytes_per_sector; count += 2)
+			{
+				data = (WORD)*source++;
+				data |= (WORD)(*source++) << 8;
+				if (ffs_write_word(data) == 0)
+					goto ffs_cf_write_sectors_exit;		//The card isn't responding (it has probably been removed) - ffs_process will find it has gone
+			}
+			sectors_this_command--;
+		}
 	}
 
-	ffs_buffer_contains_lba = sector_lba;				//Flag that the data buffer currently contains data for this LBA (logged to avoid re-loading the buffer again if its not necessary)
+ffs_cf_write_sectors_exit:
+	FFS_CE = 1;										//Deselect the card
+}
+
+
+
+
 
-	FFS_CE = 1;											//De-select the card
 
-}
 
+//*******************************
+//*******************************
+//********** SYNC CARD **********
+//*******************************
+//*******************************
+//Block device function.  Waits for the card to complete any write it is still carrying out and leaves it deselected.
+void ffs_cf_sync (void)
+{
+	FFS_CE = 0;										//Select the card
 
+	while(FFS_RDY == 0)							//Wait for the card to be ready
+		FFS_IO_COUNT(rdy_wait_loops);
+
+	FFS_CE = 1;										//Deselect the card
+}
 
 
 
 
 
-//**********************************************
-//**********************************************
-//********** WRITE SECTOR FROM BUFFER **********
-//**********************************************
-//**********************************************
-void ffs_write_sector_from_buffer (DWORD sector_lba)
+
+//***********************************
+//***********************************
+//********** GET CARD SIZE **********
+//***********************************
+//***********************************
+//Block device function.
+//Returns the number of sectors on the card (read by the Identify Drive command when the card was initialised)
+DWORD ffs_cf_sector_count (void)
 {
-	WORD count;
-	BYTE *buffer_pointer;
-	
-	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
+	return(ffs_cf_card_sectors);
+}
+
 
-	ffs_buffer_needs_writing_to_card = 0;			//Flag that buffer is no longer waiting to write to card (must be at top as this function
-													//calls other functions that check this flag and would call the function back)
 
-	
-	//----- SETUP TO WRITE THE SECTOR -----
-	FFS_CE = 0;										//Select the card
 
+
+
+//**************************************
+//**************************************
+//********** SEND LBA COMMAND **********
+//**************************************
+//**************************************
+//Loads the task file registers with the start sector and sector count and then issues the command.  The data register is selected ready
+//for the sector data to be transfered.  The card must already be selected.
+//sector_count = 1 - 256 (256 is sent to the card as 0)
+void ffs_send_lba_command (DWORD sector_lba, WORD sector_count, BYTE command)
+{
 	ffs_set_address(0x06);							//0x06 - Write the 'Select Card/Head' register [LBA27:24 - bits3:0]
 	ffs_write_byte((BYTE)(0b11100000 | (sector_lba >> 24)));	//(Use Logic Block Addressing - not Cylinder,Head,Sector)
 
@@ -747,22 +517,12 @@ void ffs_write_sector_from_buffer (DWORD sector_lba)
 	ffs_write_byte((BYTE)(sector_lba & 0x000000ff));
 
 	ffs_set_address(0x02);							//0x02 - Write the 'Sector Count' register (no of sectors to be transfered to complete the operation)
-	ffs_write_byte(1);
+	ffs_write_byte((BYTE)(sector_count & 0x00ff));	//(0 = 256 sectors)
 
 	ffs_set_address(0x07);							//0x07 - Write the 'Command' register
-	ffs_write_byte(0x30);							//Write sector(s) command
+	ffs_write_byte(command);
 
-	ffs_set_address(0x00);							//0x00 - Write to the data register
-
-
-	//----- WRITE THE BUFFER TO THE CARD SECTOR -----
-	for (count = 0; count < ffs_bytes_per_sector; count++)
-	{
-		ffs_write_byte(*buffer_pointer++);
-	}
-	
-
-	FFS_CE = 1;						//Deselect the card
+	ffs_set_address(0x00);							//0x00 - Select the data register
 }
 
 
@@ -773,22 +533,10 @@ void ffs_write_sector_from_buffer (DWORD sector_lba)
 //********** SET ADDRESS **********
 //*********************************
 //*********************************
+//Selects a task file register.  This only drives the address lines - the sector cache is managed by the FAT driver, which writes back
+//modified sectors itself before they are re-used, so the sectors it holds stay valid across register accesses.
 void ffs_set_address (BYTE address)
 {
-	//----- IF THE BUFFER CONTAINS DATA THAT IS WAITING TO BE WRITTEN THEN WRITE IT FIRST -----
-	//(As we are now doing some other operation)
-	if (ffs_buffer_needs_writing_to_card)
-	{
-		if (ffs_buffer_contains_lba != 0xffffffff)			//This should not be possible but check is made just in case!
-			ffs_write_sector_from_buffer(ffs_buffer_contains_lba);
-
-		FFS_CE = 0;										//Select the card again
-
-		ffs_buffer_needs_writing_to_card = 0;
-	}
-
-	ffs_buffer_contains_lba = 0xffffffff;			//Flag that buffer does not currently contain any lba (done here as something new is happening with the card so don't rely on the data buffer having the same data in it after whatever is happening)
-
 	//----- SET THE ADDRESS -----
 	if (address & 0x01)
 		FFS_ADDRESS_REGISTER |= FFS_ADDRESS_BIT_0;
@@ -835,14 +583,17 @@ BYTE ffs_write_byte (BYTE data)
 	{
 		if(FFS_RDY)				//Ensure card is ready
 			goto ffs_write_byte_1;
+		FFS_IO_COUNT(rdy_wait_loops);
 	}
+	FFS_IO_COUNT(timeouts);
 	return (0);					//Error
 
 ffs_write_byte_1:
 	FFS_WE = 0;
 
 	FFS_DELAY_FOR_WAIT_SIGNAL();
-	while(FFS_WAIT == 0);		//Check to see if card is inserting a wait state
+	while(FFS_WAIT == 0)		//Check to see if card is inserting a wait state
+		FFS_IO_COUNT(wait_state_loops);
 
 	FFS_WE = 1;
 	
@@ -854,6 +605,66 @@ ffs_write_byte_1:
 
 
 
+//****************************************
+//****************************************
+//********** WRITE WORD TO CARD **********
+//****************************************
+//****************************************
+//Used for the data register.  The low byte is the first byte.
+//Returns 1 if the word was written, 0 if the card didn't become ready (e.g. it has been removed)
+BYTE ffs_write_word (WORD data)
+{
+#ifdef FFS_USE_16_BIT_DATA_BUS
+	//----- 16 BIT DATA BUS - WRITE THE WORD IN 1 ACCESS -----
+	//Bus to outputs
+	FFS_DATA_BUS_TO_OUTPUTS;
+	FFS_DATA_BUS_HIGH_TO_OUTPUTS;
+
+	//Load the data to latch
+	FFS_DATA_BUS_OP = (BYTE)(data & 0x00ff);
+	FFS_DATA_BUS_HIGH_OP = (BYTE)(data >> 8);
+
+	//Set timeout to 100mS (the same as ffs_write_byte)
+	ffs_10ms_timer = 10;
+
+	while (ffs_10ms_timer)
+	{
+		if(FFS_RDY)				//Ensure card is ready
+			goto ffs_write_word_1;
+		FFS_IO_COUNT(rdy_wait_loops);
+	}
+	FFS_IO_COUNT(timeouts);
+	FFS_DATA_BUS_HIGH_TO_INPUTS;
+	return (0);					//Error
+
+ffs_write_word_1:
+	FFS_CE2 = 0;						//-CE1 and -CE2 both low = word access
+	FFS_WE = 0;
+
+	FFS_DELAY_FOR_WAIT_SIGNAL();
+	while(FFS_WAIT == 0)		//Check to see if card is inserting a wait state
+		FFS_IO_COUNT(wait_state_loops);
+
+	FFS_WE = 1;
+	FFS_CE2 = 1;
+
+	FFS_DATA_BUS_HIGH_TO_INPUTS;		//(Not driven when accessing the 8 bit registers)
+
+	return (1);
+
+#else
+	//----- 8 BIT DATA BUS - WRITE THE LOW BYTE THEN THE HIGH BYTE -----
+	if (ffs_write_byte((BYTE)(data & 0x00ff)) == 0)
+		return (0);
+	return (ffs_write_byte((BYTE)(data >> 8)));
+#endif
+}
+
+
+
+
+
+
 //*****************************************
 //*****************************************
 //********** READ WORD FROM CARD **********
@@ -863,7 +674,35 @@ WORD ffs_read_word (void)
 {
 	WORD data;
 
-	while(FFS_RDY == 0);				//Ensure card is ready
+#ifdef FFS_USE_16_BIT_DATA_BUS
+	//----- 16 BIT DATA BUS - READ THE WORD IN 1 ACCESS -----
+	while(FFS_RDY == 0)				//Ensure card is ready
+		FFS_IO_COUNT(rdy_wait_loops);
+
+	//Bus to inputs
+	FFS_DATA_BUS_TO_INPUTS;
+	FFS_DATA_BUS_HIGH_TO_INPUTS;
+
+	FFS_CE2 = 0;						//-CE1 and -CE2 both low = word access
+	FFS_OE = 0;
+
+	FFS_DELAY_FOR_WAIT_SIGNAL();
+	while(FFS_WAIT == 0)		//Check to see if card is inserting a wait state
+		FFS_IO_COUNT(wait_state_loops);
+
+	data = (WORD)FFS_DATA_BUS_IP;
+	data |= ((WORD)FFS_DATA_BUS_HIGH_IP << 8);
+
+	FFS_OE = 1;
+	FFS_CE2 = 1;
+
+	//Bus to outputs
+	FFS_DATA_BUS_TO_OUTPUTS;
+
+#else
+	//----- 8 BIT DATA BUS - READ THE LOW BYTE THEN THE HIGH BYTE -----
+	while(FFS_RDY == 0)				//Ensure card is ready
+		FFS_IO_COUNT(rdy_wait_loops);
 
 	//Bus to inputs
 	FFS_DATA_BUS_TO_INPUTS;
@@ -871,19 +710,22 @@ WORD ffs_read_word (void)
 	FFS_OE = 0;
 
 	FFS_DELAY_FOR_WAIT_SIGNAL();
-	while(FFS_WAIT == 0);		//Check to see if card is inserting a wait state
+	while(FFS_WAIT == 0)		//Check to see if card is inserting a wait state
+		FFS_IO_COUNT(wait_state_loops);
 
 	data = (WORD)FFS_DATA_BUS_IP;
 
 	FFS_OE = 1;
 
 	FFS_DELAY_FOR_RDY_SIGNAL();
-	while(FFS_RDY == 0);				//Ensure card is ready
+	while(FFS_RDY == 0)				//Ensure card is ready
+		FFS_IO_COUNT(rdy_wait_loops);
 
 	FFS_OE = 0;
 
 	FFS_DELAY_FOR_WAIT_SIGNAL();
-	while(FFS_WAIT == 0);		//Check to see if card is inserting a wait state
+	while(FFS_WAIT == 0)		//Check to see if card is inserting a wait state
+		FFS_IO_COUNT(wait_state_loops);
 
 	data += ((WORD)FFS_DATA_BUS_IP << 8);
 
@@ -891,6 +733,7 @@ WORD ffs_read_word (void)
 
 	//Bus to outputs
 	FFS_DATA_BUS_TO_OUTPUTS;
+#endif
 
 	return (data);
 }
@@ -909,7 +752,8 @@ BYTE ffs_read_byte (void)
 {
 	BYTE data;
 
-	while(FFS_RDY == 0);				//Ensure card is ready
+	while(FFS_RDY == 0)				//Ensure card is ready
+		FFS_IO_COUNT(rdy_wait_loops);
 
 	//Bus to inputs
 	FFS_DATA_BUS_TO_INPUTS;
@@ -917,7 +761,8 @@ BYTE ffs_read_byte (void)
 	FFS_OE = 0;
 
 	FFS_DELAY_FOR_WAIT_SIGNAL();
-	while(FFS_WAIT == 0);		//Check to see if card is inserting a wait state
+	while(FFS_WAIT == 0)		//Check to see if card is inserting a wait state
+		FFS_IO_COUNT(wait_state_loops);
 
 	data = FFS_DATA_BUS_IP;
 
@@ -46,8 +46,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //----- DEFINE TARGET COMPILER & PROCESSOR -----
 //----------------------------------------------
 //(ONLY 1 SHOULD BE INCLUDED, COMMENT OUT OTHERS - ALSO SET IN THE OTHER DRIVER .h FILE)
-#define	FFS_USING_MICROCHIP_C18_COMPILER
+//#define	FFS_USING_GCC_HOST_COMPILER				//Linux host build - the card is simulated by mem-cf-sim.c over a disk image file (or use -DFFS_USING_GCC_HOST_COMPILER)
 //<< add other compiler types here
+#if !defined(FFS_USING_GCC_HOST_COMPILER)
+#define	FFS_USING_MICROCHIP_C18_COMPILER			//(Used when no other compiler is selected)
+#endif
 
 
 
@@ -63,6 +66,16 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define	FFS_DATA_BUS_TO_INPUTS		TRISD = 0xff	//CF D7:0 data bus input / output register (bit state 0 = output, 1 = input)
 #define	FFS_DATA_BUS_TO_OUTPUTS		TRISD = 0x00
 
+//16 BIT DATA BUS:-
+//#define	FFS_USE_16_BIT_DATA_BUS						//Optional - define if CF D15:8 and -CE2 are connected so the data register is accessed a word at a time.  Comment out for an 8 bit data bus
+#ifdef FFS_USE_16_BIT_DATA_BUS
+#define FFS_DATA_BUS_HIGH_IP		PORTJ			//CF D15:8 data bus read register
+#define FFS_DATA_BUS_HIGH_OP		LATJ			//CF D15:8 data bus write register
+#define	FFS_DATA_BUS_HIGH_TO_INPUTS		TRISJ = 0xff	//CF D15:8 data bus input / output register (bit state 0 = output, 1 = input)
+#define	FFS_DATA_BUS_HIGH_TO_OUTPUTS	TRISJ = 0x00
+#define	FFS_CE2						LATCbits.LATC3		//CF -CE2 (only taken low for data register word accesses)
+#endif
+
 //CONTROL PINS:-
 #define	FFS_CE						LATCbits.LATC2
 #define	FFS_WE						LATCbits.LATC0
@@ -88,11 +101,51 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define	FFS_CD_PIN_BIT				0x20				//(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02 or 0x01)
 //#define	FFS_CD_PIN_FUNCTION							//Optional function to call to get the FFS_RESET_PIN_REGISTER.  Comment out if not requried
 
+#endif		//#ifdef FFS_USING_MICROCHIP_C18_COMPILER
+
 
+#ifdef FFS_USING_GCC_HOST_COMPILER
+//(Signals of the simulated card in mem-cf-sim.c)
 
-#define	FFS_DRIVER_GEN_512_BYTE_BUFFER	ffs_general_buffer		//This general buffer is used by routines and may be the same as the buffer that
-																//the application uses to read and write data from and to the card if ram is limited
-#endif		//#ifdef FFS_USING_MICROCHIP_C18_COMPILER
+//PORTS:-
+#define FFS_DATA_BUS_IP				ffs_sim_bus.data_ip
+#define FFS_DATA_BUS_OP				ffs_sim_bus.data_op
+#define	FFS_DATA_BUS_TO_INPUTS		ffs_sim_bus.data_tris = 0xff
+#define	FFS_DATA_BUS_TO_OUTPUTS		ffs_sim_bus.data_tris = 0x00
+
+//16 BIT DATA BUS:-
+//#define	FFS_USE_16_BIT_DATA_BUS
+#ifdef FFS_USE_16_BIT_DATA_BUS
+#define FFS_DATA_BUS_HIGH_IP		ffs_sim_bus.data_high_ip
+#define FFS_DATA_BUS_HIGH_OP		ffs_sim_bus.data_high_op
+#define	FFS_DATA_BUS_HIGH_TO_INPUTS		ffs_sim_bus.data_high_tris = 0xff
+#define	FFS_DATA_BUS_HIGH_TO_OUTPUTS	ffs_sim_bus.data_high_tris = 0x00
+#define	FFS_CE2						ffs_sim_bus.ce2
+#endif
+
+//CONTROL PINS:-
+#define	FFS_CE						ffs_sim_bus.ce
+#define	FFS_WE						ffs_sim_bus.we
+#define	FFS_OE						ffs_sim_bus.oe
+#define	FFS_REG						ffs_sim_bus.reg
+#define	FFS_RDY						ffs_sim_rdy()
+#define	FFS_WAIT					ffs_sim_wait()
+
+//ADDRESS PINS:-
+#define	FFS_ADDRESS_REGISTER		ffs_sim_bus.address
+#define	FFS_ADDRESS_BIT_0			0x01
+#define	FFS_ADDRESS_BIT_1			0x02
+#define	FFS_ADDRESS_BIT_2			0x04
+
+//RESET PIN:-
+#define	FFS_RESET_PIN_REGISTER		ffs_sim_bus.reset
+#define	FFS_RESET_PIN_BIT			0x01
+
+//CARD DETECT PIN:-
+#define	FFS_CD_PIN_REGISTER			ffs_sim_bus.card_detect
+#define	FFS_CD_PIN_BIT				0x01
+
+#endif		//#ifdef FFS_USING_GCC_HOST_COMPILER
 
 
 
@@ -113,6 +166,13 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #endif		//#ifdef FFS_USING_MICROCHIP_C18_COMPILER
 
+#ifdef FFS_USING_GCC_HOST_COMPILER
+
+#define FFS_DELAY_FOR_WAIT_SIGNAL()									//(The simulated card signals don't need time to settle)
+#define FFS_DELAY_FOR_RDY_SIGNAL()
+
+#endif		//#ifdef FFS_USING_GCC_HOST_COMPILER
+
 
 
 //PROCESS CF CARD STATE MACHINE STATES
@@ -140,6 +200,11 @@ typedef enum _FFS_PROCESS_STATE
 //-----------------------------------
 //----- INTERNAL ONLY FUNCTIONS -----
 //-----------------------------------
+void ffs_send_lba_command (DWORD sector_lba, WORD sector_count, BYTE command);
+void ffs_cf_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination);
+void ffs_cf_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source);
+void ffs_cf_sync (void);
+DWORD ffs_cf_sector_count (void);
 
 
 
@@ -150,10 +215,9 @@ typedef enum _FFS_PROCESS_STATE
 void ffs_process (void);
 BYTE ffs_is_card_present (void);
 void ffs_card_reset_pin (BYTE pin_state);
-void ffs_read_sector_to_buffer (DWORD sector_lba);
-void ffs_write_sector_from_buffer (DWORD sector_lba);
 void ffs_set_address (BYTE address);
 BYTE ffs_write_byte (BYTE data);
+BYTE ffs_write_word (WORD data);
 WORD ffs_read_word (void);
 BYTE ffs_read_byte (void);
 
@@ -167,10 +231,9 @@ BYTE ffs_read_byte (void);
 extern void ffs_process (void);
 extern BYTE ffs_is_card_present (void);
 extern void ffs_card_reset_pin (BYTE pin_state);
-extern void ffs_read_sector_to_buffer (DWORD sector_lba);
-extern void ffs_write_sector_from_buffer (DWORD sector_lba);
 extern void ffs_set_address (BYTE address);
 extern BYTE ffs_write_byte (BYTE data);
+extern BYTE ffs_write_word (WORD data);
 extern WORD ffs_read_word (void);
 extern BYTE ffs_read_byte (void);
 
@@ -191,54 +254,10 @@ extern BYTE ffs_read_byte (void);
 //----- INTERNAL ONLY MEMORY DEFINITIONS -----
 //--------------------------------------------
 BYTE sm_ffs_process = FFS_PROCESS_NO_CARD;
-WORD file_system_information_sector;
-BYTE ffs_no_of_heads;
-BYTE ffs_no_of_sectors_per_track;
-DWORD ffs_no_of_partition_sectors;
-
-
-
-
-
-
-//--------------------------------------------------
-//----- INTERNAL & EXTERNAL MEMORY DEFINITIONS -----
-//--------------------------------------------------
-//(Also defined below as extern)
-WORD number_of_root_directory_sectors;				//Only used by FAT16, 0 for FAT32
-BYTE ffs_buffer_needs_writing_to_card;
-DWORD ffs_buffer_contains_lba = 0xffffffff;
-DWORD fat1_start_sector;
-DWORD root_directory_start_sector_cluster;			//Start sector for FAT16, start clustor for FAT32
-DWORD data_area_start_sector;
-BYTE disk_is_fat_32;
-BYTE sectors_per_cluster;
-DWORD last_found_free_cluster;
-DWORD sectors_per_fat;
-BYTE active_fat_table_flags;
-DWORD read_write_directory_last_lba;
-WORD read_write_directory_last_entry;
-
-
-#else
-//---------------------------------------
-//----- EXTERNAL MEMORY DEFINITIONS -----
-//---------------------------------------
-extern WORD number_of_root_directory_sectors;				//Only used by FAT16, 0 for FAT32
-extern BYTE ffs_buffer_needs_writing_to_card;
-extern DWORD ffs_buffer_contains_lba;
-extern DWORD fat1_start_sector;
-extern DWORD root_directory_start_sector_cluster;
-extern DWORD data_area_start_sector;
-extern BYTE disk_is_fat_32;
-extern BYTE sectors_per_cluster;
-extern DWORD last_found_free_cluster;
-extern DWORD sectors_per_fat;
-extern BYTE active_fat_table_flags;
-extern DWORD read_write_directory_last_lba;
-extern WORD read_write_directory_last_entry;
-
+DWORD ffs_cf_card_sectors;
 
+//The block device functions the FAT driver uses to access the card
+FFS_BLOCK_DEVICE ffs_cf_block_device = {ffs_cf_read_sectors, ffs_cf_write_sectors, ffs_cf_sync, ffs_cf_sector_count, 0};		//(Trim not supported)
 
 #endif
 
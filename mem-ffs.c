@@ -31,9 +31,9 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 
 #include "main.h"					//Global data type definitions (see https://github.com/ibexuk/C_Generic_Header_File )
+#include <string.h>					//memcpy
 #define FFS_C
 #include "mem-ffs.h"
-#include "mem-cf.h"
 
 
 
@@ -53,8 +53,10 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //difference is in how the operating system chooses to handle text files)
 //
 //filename
-//	Only 8 character DOS compatible root directory filenames are allowed.  Format is F.E where F may be between 1 and 8 characters
-//	and E may be between 1 and 3 characters, null terminated, non-case sensitive.  The '*' and '?' wildcard characters may be used.
+//	DOS compatible 8.3 filename.  Format is F.E where F may be between 1 and 8 characters and E may be between 0 and 3 characters,
+//	null terminated, non-case sensitive.  The '*' and '?' wildcard characters may be used.  If FFS_LONG_FILENAME_MAX is defined a
+//	long filename may be used instead (up to 255 characters, non-case sensitive).  The filename may follow a path of existing
+//	directories, e.g. "LOG\\2026\\10\\DAY17.CSV" (see ffs_find_file).
 //
 //access_mode
 //	"r"		Open a file for reading. The file must exist.
@@ -65,6 +67,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //	"a+"	Open a file for reading and appending. All writing operations are done at the end of the file protecting the previous
 //			content from being overwritten.  You can reposition (fseek) the pointer to anywhere in the file for reading, but
 //			writing operations will move back to the end of file.  The file is created if it doesn't exist.
+//	A file may be open with several handles at the same time (e.g. one appending with "a" while others read with "r").  Only one of
+//	them may write to the file and a file that is open can't be opened with "w".
 //
 //Return value.
 //	If the file has been successfully opened the function will return a pointer to the file. Otherwise a null pointer is returned (0x00).
@@ -72,10 +76,20 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 FFS_FILE* ffs_fopen (const char *filename, const char *access_mode)
 {
 	BYTE file_number;
+	BYTE open_file_number;
 	BYTE attribute_byte;
-	BYTE count;
 	BYTE read_file_name[8];
 	BYTE read_file_extension[3];
+	BYTE write_access;
+	DWORD start_cluster;
+	DWORD file_size;
+	DWORD directory_entry_sector;
+	BYTE directory_entry_within_sector;
+	FFS_OPEN_FILE *open_file;
+
+	//----- SELECT THE CURRENT VOLUME -----
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(0);
 
 	//----------------------------------------------
 	//----- LOOK FOR AN AVAILABLE FILE HANDLER -----
@@ -97,38 +111,63 @@ FFS_FILE* ffs_fopen (const char *filename, const char *access_mode)
 	//----- AVAILABLE FILE HANDLER FOUND BUT NOT YET ASSIGNED -----
 	//(file_number = the available handler)
 
+	//Every mode other than "r" may write to the file
+	if (
+		(*access_mode != 'r') ||
+		(*(access_mode + 1) == '+') ||
+		((*(access_mode + 1) != 0x00) && (*(access_mode + 2) == '+'))
+		)
+	{
+		write_access = 1;
+	}
+	else
+	{
+		write_access = 0;
+	}
+
 
 	//----------------------------------------------
 	//----- LOOK TO SEE IF FILE ALREADY EXISTS -----
 	//----------------------------------------------
-	ffs_file[file_number].current_cluster = ffs_find_file (filename, &ffs_file[file_number].file_size, &attribute_byte, &ffs_file[file_number].directory_entry_sector, &ffs_file[file_number].directory_entry_within_sector, read_file_name, read_file_extension);
+	start_cluster = ffs_find_file (filename, &file_size, &attribute_byte, &directory_entry_sector, &directory_entry_within_sector, read_file_name, read_file_extension);
 
 
-	//--------------------------------------------------------
-	//----- IF FILE EXISTS ENSURE IT IS NOT ALREADY OPEN -----
-	//--------------------------------------------------------
-	if (ffs_file[file_number].current_cluster != 0xffffffff)		//0xffffffff = file not found
+	//------------------------------------------------------
+	//----- IF FILE EXISTS CHECK IF IT IS ALREADY OPEN -----
+	//------------------------------------------------------
+	//A file may be open with several handlers at the same time.  They share the files size, start cluster and extent cache, so a handler
+	//reading the file sees the data added by a handler appending to it without reading the directory entry again.  Only one of the
+	//handlers may write to the file, and a file that is open can't be erased by opening it with "w".
+	open_file = 0;
+	if (start_cluster != 0xffffffff)		//0xffffffff = file not found
 	{
-		for (count = 0; count < FFS_FOPEN_MAX; count++)
+		open_file = ffs_find_open_file(directory_entry_sector, directory_entry_within_sector);
+		if (open_file)
 		{
-			if (ffs_file[count].flags.bits.file_is_open)
-			{
-				if (
-					(count != file_number) &&
-					(ffs_file[count].directory_entry_sector == ffs_file[file_number].directory_entry_sector) &&
-					(ffs_file[count].directory_entry_within_sector == ffs_file[file_number].directory_entry_within_sector)
-					)
-				{
-					return(0);
-				}
-			}
+			if ((*access_mode == 'w') || ((write_access) && (open_file->flags.bits.open_for_writing)))
+				return(0);
+		}
+	}
+
+	//----- IF IT ISN'T OPEN LOOK FOR AN AVAILABLE OPEN FILE ENTRY -----
+	if (open_file == 0)
+	{
+		for (open_file_number = 0; open_file_number < FFS_OPEN_FILES_MAX; open_file_number++)
+		{
+			if (ffs_open_file[open_file_number].handle_count == 0)
+				break;
+		}
+		if (open_file_number == FFS_OPEN_FILES_MAX)
+		{
+			//THE MAXIMUM NUMBER OF DIFFERENT FILES ARE ALREADY OPEN
+			return(0);
 		}
 	}
 
 	//-------------------------------------------------------------
 	//----- IF OPENING A FILE FOR READ THEN CHECK FILE EXISTS -----
 	//-------------------------------------------------------------
-	if (ffs_file[file_number].current_cluster == 0xffffffff)		//0xffffffff = file not found
+	if (start_cluster == 0xffffffff)		//0xffffffff = file not found
 	{
 		if (*access_mode == 'r')
 		{
@@ -140,38 +179,57 @@ FFS_FILE* ffs_fopen (const char *filename, const char *access_mode)
 	//-----------------------------------------------------------------
 	//----- IF WRITING A FILE AND IT ALREADY EXISTS THEN ERASE IT -----
 	//-----------------------------------------------------------------
-	if (ffs_file[file_number].current_cluster != 0xffffffff)		//0xffffffff = file not found
+	if (start_cluster != 0xffffffff)		//0xffffffff = file not found
 	{
 		if (*access_mode == 'w')
 		{
 			//ERASE FILE
 			ffs_remove(filename);
-			ffs_file[file_number].current_cluster = 0xffffffff;
+			start_cluster = 0xffffffff;
 		}
 	}
 
 	//----------------------------------------------------------------------
 	//----- IF WRITING OR APPENDING A FILE THEN CREATE IT IF NECESSARY -----
 	//----------------------------------------------------------------------
-	if (ffs_file[file_number].current_cluster == 0xffffffff)
+	if (start_cluster == 0xffffffff)
 	{
-		if (ffs_create_new_file(filename, &ffs_file[file_number].current_cluster, &ffs_file[file_number].directory_entry_sector,
-								&ffs_file[file_number].directory_entry_within_sector) == 0)		//This function checks for any wildcard characters in the filename and aborts if there are any
+		if (ffs_create_new_file(filename, 0x00, &start_cluster, &directory_entry_sector, &directory_entry_within_sector) == 0)		//This function checks for any wildcard characters in the filename and aborts if there are any
 		{
 			//ERROR - CAN'T CREATE A NEW FILE
 			return(0);
 		}
-		ffs_file[file_number].file_size = 0;
+		file_size = 0;
+	}
+
+	//----- SET UP THE OPEN FILE ENTRY IF THE FILE WASN'T ALREADY OPEN -----
+	if (open_file == 0)
+	{
+		open_file = &ffs_open_file[open_file_number];
+		open_file->directory_entry_sector = directory_entry_sector;
+		open_file->directory_entry_within_sector = directory_entry_within_sector;
+		open_file->start_cluster = start_cluster;
+		open_file->file_size = file_size;
+		open_file->handle_count = 0;
+		open_file->volume = ffs_active_volume;
+		open_file->flags.byte = 0;
+		#ifdef FFS_EXTENT_CACHE_ENTRIES
+			open_file->extent_count = 0;
+		#endif
 	}
+	open_file->handle_count++;
 
 
 	//------------------------------------------------------------
 	//----- FLAG THAT FILE IS OPEN AND SETUP FOR FILE ACCESS -----
 	//------------------------------------------------------------
+	ffs_file[file_number].open_file = open_file;
+	ffs_file[file_number].current_cluster = open_file->start_cluster;
 	ffs_file[file_number].flags.bits.file_is_open = 1;
 	ffs_file[file_number].flags.bits.access_error = 0;
 	ffs_file[file_number].flags.bits.end_of_file = 0;
-	ffs_file[file_number].flags.bits.file_size_has_changed = 0;
+	ffs_file[file_number].flags.bits.read_permitted = 0;
+	ffs_file[file_number].flags.bits.write_permitted = 0;
 
 
 	//--------------------------------------------------
@@ -255,13 +313,16 @@ FFS_FILE* ffs_fopen (const char *filename, const char *access_mode)
 
 		ffs_fseek(&ffs_file[file_number], 0, FFS_SEEK_END);					//Use the fseek function to do this
 
-		if (ffs_file[file_number].file_size)
+		if (open_file->file_size)
 		{
 			ffs_file[file_number].flags.bits.inc_posn_before_next_rw = 1;		//Increment before doing the next read or write as we're pointing to the last byte of the file and the next byte will be a new byte
 		}
 
 	}
 
+	if (ffs_file[file_number].flags.bits.write_permitted)
+		open_file->flags.bits.open_for_writing = 1;
+
 	return(&ffs_file[file_number]);
 }
 
@@ -293,15 +354,18 @@ int ffs_fseek (FFS_FILE *file_pointer, long offset, int origin)
 	BYTE calculate_new_posn;
 
 
-	bytes_per_cluster = sectors_per_cluster * ffs_bytes_per_sector;
-
-
 	//-----------------------------------
 	//----- ENSURE THE FILE IS OPEN -----
 	//-----------------------------------
 	if (file_pointer->flags.bits.file_is_open == 0)
 		return(1);
 
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(1);
+
+	bytes_per_cluster = sectors_per_cluster * ffs_bytes_per_sector;
+
 
 	if (origin == FFS_SEEK_SET)
 	{
@@ -358,11 +422,11 @@ int ffs_fseek (FFS_FILE *file_pointer, long offset, int origin)
 		}
 		else if (offset == 1)
 		{
-			bytes_to_new_posn = file_pointer->file_size;
+			bytes_to_new_posn = file_pointer->open_file->file_size;
 		}
 		else
 		{
-			bytes_to_new_posn = (file_pointer->file_size) - (DWORD)(0 - offset) - 1;			//Set bytes from start value ready to move to requried location
+			bytes_to_new_posn = (file_pointer->open_file->file_size) - (DWORD)(0 - offset) - 1;			//Set bytes from start value ready to move to requried location
 		}
 	}
 	else
@@ -379,12 +443,12 @@ int ffs_fseek (FFS_FILE *file_pointer, long offset, int origin)
 	//------------------------------------------------
 
 	//----- CHECK OFFSET IS VALID -----
-	if (bytes_to_new_posn > (file_pointer->file_size))
+	if (bytes_to_new_posn > (file_pointer->open_file->file_size))
 	{
 		//NEW POSITION IS > FILE SIZE + 1 = ERROR
 		return(1);
 	}
-	else if (bytes_to_new_posn == (file_pointer->file_size))
+	else if (bytes_to_new_posn == (file_pointer->open_file->file_size))
 	{
 		//NEW POSITION = FILE SIZE SO IS THE POSITION READY FOR WRITING A NEW BYTE (DOESN'T ACTUALLY EXIST IN FILE YET)
 		if (bytes_to_new_posn)
@@ -409,7 +473,7 @@ int ffs_fseek (FFS_FILE *file_pointer, long offset, int origin)
 		//-------------------------------------------------
 		//----- OFFSET IS ZERO - SET TO START OF FILE -----
 		//-------------------------------------------------
-		file_pointer->current_cluster = get_file_start_cluster(file_pointer);
+		file_pointer->current_cluster = ffs_get_file_cluster(file_pointer, 0);
 		file_pointer->current_sector = 0;
 		file_pointer->current_byte = 0;
 		file_pointer->current_byte_within_file = 0;
@@ -521,16 +585,13 @@ int ffs_fseek (FFS_FILE *file_pointer, long offset, int origin)
 			//-------------------------------------------------------------------------------------------
 			//----- NEW LOCATION IS NOT IN THE CURRENT CLUSTER - FIND IT FROM THE START OF THE FILE -----
 			//-------------------------------------------------------------------------------------------
-			file_pointer->current_cluster = get_file_start_cluster(file_pointer);
 			file_pointer->current_sector = 0;
 			file_pointer->current_byte_within_file = bytes_to_new_posn;
 	
-			//KEEP MOVING TO NEXT CLUSTER UNTIL WE'RE IN THE REQURIED CLUSTER
-			while (bytes_to_new_posn >= bytes_per_cluster)
-			{
-				bytes_to_new_posn -= bytes_per_cluster;
-				file_pointer->current_cluster = ffs_get_next_cluster_no(file_pointer->current_cluster);
-			}
+			//GET THE CLUSTER
+			dw_temp = (bytes_to_new_posn / bytes_per_cluster);
+			bytes_to_new_posn -= (dw_temp * bytes_per_cluster);
+			file_pointer->current_cluster = ffs_get_file_cluster(file_pointer, dw_temp);
 			//KEEP MOVING TO NEXT SECTOR UNTIL WE'RE IN THE REQURIED SECTOR (OF THE ALREADY FOUND CLUSTER)
 	
 			while (bytes_to_new_posn >= ffs_bytes_per_sector)
@@ -659,6 +720,10 @@ int ffs_fputc (int data, FFS_FILE *file_pointer)
 	if (file_pointer->flags.bits.file_is_open == 0)
 		return(FFS_EOF);
 
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(FFS_EOF);
+
 
 	//---------------------------------------------------------------------------------------------------------------------------
 	//----- CHECK THAT WRITING IN THIS POSITION IS PERMITTED FOR THE FOPEN MODE THAT WAS SPECIFIED WHEN THE FILE WAS OPENED -----
@@ -678,7 +743,7 @@ int ffs_fputc (int data, FFS_FILE *file_pointer)
 			dw_temp++;
 		}
 
-		if (dw_temp < file_pointer->file_size)
+		if (dw_temp < file_pointer->open_file->file_size)
 		{
 			//CURRENTLY POINTING TO WITHIN FILE - SET TO END OF FILE
 			ffs_fseek(file_pointer, 1, FFS_SEEK_END);
@@ -708,21 +773,15 @@ int ffs_fputc (int data, FFS_FILE *file_pointer)
 				//----- MOVE TO NEXT CLUSTER -----
 				file_pointer->current_sector = 0;
 
-				dw_temp = ffs_get_next_free_cluster();
+				//(If we are overwriting existing data the next cluster is already in the chain, otherwise a new cluster is added)
+				dw_temp = ffs_get_or_add_next_cluster(file_pointer->current_cluster);
 				if (dw_temp == 0xffffffff)			//0xffffffff = no empty cluster found
 				{
 					//NOT ENOUGH SPACE FOR ANY MORE OF FILE
-					FFS_CE = 1;
 					file_pointer->flags.bits.end_of_file = 1;
 					return(FFS_EOF);
 				}
 
-				//UPDATE THE CURRENT CLUSTER TO LINK TO THE NEXT CLUSTER
-				ffs_modify_cluster_entry_in_fat (file_pointer->current_cluster, dw_temp);
-
-				//UPDATE THE NEXT CLUSTER WITH THE END OF FILE MARKER
-				ffs_modify_cluster_entry_in_fat (dw_temp, 0x0fffffff);
-
 				file_pointer->current_cluster = dw_temp;
 			}
 		}
@@ -739,7 +798,7 @@ int ffs_fputc (int data, FFS_FILE *file_pointer)
 				(DWORD)file_pointer->current_sector +
 				data_area_start_sector
 				);
-	if (ffs_buffer_contains_lba != dw_temp)
+	if (ffs_sector_buffer->lba != dw_temp)
 	{
 		ffs_read_sector_to_buffer(dw_temp);
 	}
@@ -755,10 +814,10 @@ int ffs_fputc (int data, FFS_FILE *file_pointer)
 	//---------------------------------------------------------------------------
 	//----- ADJUST FILE SIZE IF WE HAVE JUST WRITTEN TO THE END OF THE FILE -----
 	//---------------------------------------------------------------------------
-	if (file_pointer->current_byte_within_file >= file_pointer->file_size)
+	if (file_pointer->current_byte_within_file >= file_pointer->open_file->file_size)
 	{
-		file_pointer->file_size++;
-		file_pointer->flags.bits.file_size_has_changed = 1;
+		file_pointer->open_file->file_size++;
+		file_pointer->open_file->flags.bits.file_size_has_changed = 1;
 	}
 
 
@@ -771,7 +830,7 @@ int ffs_fputc (int data, FFS_FILE *file_pointer)
 	//----------------------------------------------------------
 	//----- FLAG THAT THE BUFFER NEEDS WRITING TO THE CARD -----
 	//----------------------------------------------------------
-	ffs_buffer_needs_writing_to_card = 1;
+	ffs_sector_buffer->needs_writing_to_card = 1;
 
 	//-----------------------------------------------
 	//----- EXIT WITH THE BYTE THAT WAS WRITTEN -----
@@ -804,6 +863,10 @@ int ffs_fgetc (FFS_FILE *file_pointer)
 	if (file_pointer->flags.bits.file_is_open == 0)
 		return(FFS_EOF);
 
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(FFS_EOF);
+
 	//---------------------------------------------------------------------------------------------------------------------------
 	//----- CHECK THAT READING IN THIS POSITION IS PERMITTED FOR THE FOPEN MODE THAT WAS SPECIFIED WHEN THE FILE WAS OPENED -----
 	//---------------------------------------------------------------------------------------------------------------------------
@@ -822,7 +885,7 @@ int ffs_fgetc (FFS_FILE *file_pointer)
 	if (file_pointer->flags.bits.inc_posn_before_next_rw)
 		dw_temp++;
 
-	if (dw_temp >= file_pointer->file_size)
+	if (dw_temp >= file_pointer->open_file->file_size)
 	{
 		//TRYING TO READ PAST END OF FILE
 		file_pointer->flags.bits.end_of_file = 1;
@@ -861,7 +924,6 @@ int ffs_fgetc (FFS_FILE *file_pointer)
 					if (dw_temp >= 0x0ffffff8)
 					{
 						//There is no next cluster - all of file has been read
-						FFS_CE = 1;
 						file_pointer->flags.bits.end_of_file = 1;
 						return(FFS_EOF);
 					}
@@ -872,7 +934,6 @@ int ffs_fgetc (FFS_FILE *file_pointer)
 					if (dw_temp >= 0xfff8)
 					{
 						//There is no next cluster - all of file has been read
-						FFS_CE = 1;
 						file_pointer->flags.bits.end_of_file = 1;
 						return(FFS_EOF);
 					}
@@ -895,7 +956,7 @@ int ffs_fgetc (FFS_FILE *file_pointer)
 				(DWORD)file_pointer->current_sector +
 				data_area_start_sector
 				);
-	if (ffs_buffer_contains_lba != dw_temp)
+	if (ffs_sector_buffer->lba != dw_temp)
 	{
 		ffs_read_sector_to_buffer(dw_temp);
 	}
@@ -1044,30 +1105,75 @@ char* ffs_fgets (char *string, int length, FFS_FILE *file_pointer)
  
 int ffs_fwrite (const void *buffer, int size, int count, FFS_FILE *file_pointer)
 {
-	int size_count;
-	BYTE *string_Pointer;
-	int number_of_items_written = 0;
+	BYTE *source_pointer;
+	DWORD bytes_remaining;
+	DWORD bytes_written = 0;
+	DWORD dw_temp;
+
+
+	if ((size <= 0) || (count <= 0))
+		return(0);
+
+	if (file_pointer->flags.bits.file_is_open == 0)
+		return(0);
 
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(0);
 
-	string_Pointer = (BYTE*)buffer;
+	source_pointer = (BYTE*)buffer;
+	bytes_remaining = (DWORD)size * (DWORD)count;
 
-	//STORE ALL OF THE ITEMS
-	while (count)
+	while (bytes_remaining)
 	{
-		//STORE EACH ITEM
-		for (size_count = 0; size_count < size; size_count++)
+		//----- IF WE'RE AT THE START OF A SECTOR WRITE ANY WHOLE SECTORS DIRECTLY FROM THE CALLERS BUFFER -----
+		if (bytes_remaining >= ffs_bytes_per_sector)
 		{
-
-			if (ffs_fputc((int)*string_Pointer++, file_pointer) == FFS_EOF)
+			dw_temp = ffs_write_file_sectors(file_pointer, source_pointer, (bytes_remaining / ffs_bytes_per_sector));
+			if (dw_temp)
 			{
-				return(number_of_items_written);
+				dw_temp *= ffs_bytes_per_sector;
+				source_pointer += dw_temp;
+				bytes_remaining -= dw_temp;
+				bytes_written += dw_temp;
+				continue;
 			}
 		}
-		number_of_items_written++;
-		count--;
+
+		//----- WRITE THE FIRST BYTE OF THE SPAN -----
+		//(ffs_fputc checks the access mode, moves to the next sector or cluster if necessary and loads the sector into the buffer)
+		if (ffs_fputc((int)*source_pointer++, file_pointer) == FFS_EOF)
+			break;
+
+		bytes_remaining--;
+		bytes_written++;
+
+		//----- COPY AS MUCH OF THE REST OF THE SPAN AS FITS IN THIS SECTOR STRAIGHT INTO THE BUFFER -----
+		dw_temp = (DWORD)(ffs_bytes_per_sector - 1 - file_pointer->current_byte);
+		if (dw_temp > bytes_remaining)
+			dw_temp = bytes_remaining;
+		if (dw_temp == 0)
+			continue;
+
+		memcpy(&FFS_DRIVER_GEN_512_BYTE_BUFFER[file_pointer->current_byte + 1], source_pointer, (WORD)dw_temp);
+		ffs_sector_buffer->needs_writing_to_card = 1;
+
+		//Leave the file pointing to the last byte written
+		file_pointer->current_byte += (WORD)dw_temp;
+		file_pointer->current_byte_within_file += dw_temp;
+		if (file_pointer->current_byte_within_file >= file_pointer->open_file->file_size)
+		{
+			file_pointer->open_file->file_size = file_pointer->current_byte_within_file + 1;
+			file_pointer->open_file->flags.bits.file_size_has_changed = 1;
+		}
+
+		source_pointer += dw_temp;
+		bytes_remaining -= dw_temp;
+		bytes_written += dw_temp;
 	}
 
-	return(number_of_items_written);
+	//Return the number of full items written
+	return((int)(bytes_written / (DWORD)size));
 }
 
 
@@ -1086,36 +1192,75 @@ int ffs_fwrite (const void *buffer, int size, int count, FFS_FILE *file_pointer)
 //	occurred or End Of File has been reached (use ffs_ferror or ffs_feof to check what happened)
 int ffs_fread (void *buffer, int size, int count, FFS_FILE *file_pointer)
 {
-	int size_count;
+	BYTE *destination_pointer;
+	DWORD bytes_remaining;
+	DWORD bytes_read = 0;
+	DWORD dw_temp;
 	int return_value;
-	BYTE *string_Pointer;
-	int number_of_items_written = 0;
 
 
-	string_Pointer = (BYTE*)buffer;
+	if ((size <= 0) || (count <= 0))
+		return(0);
+
+	if (file_pointer->flags.bits.file_is_open == 0)
+		return(0);
+
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(0);
+
+	destination_pointer = (BYTE*)buffer;
+	bytes_remaining = (DWORD)size * (DWORD)count;
 
-	//READ ALL OF THE ITEMS
-	while (count)
+	while (bytes_remaining)
 	{
-		//STORE EACH ITEM
-		for (size_count = 0; size_count < size; size_count++)
+		//----- IF WE'RE AT THE START OF A SECTOR READ ANY WHOLE SECTORS DIRECTLY TO THE CALLERS BUFFER -----
+		if (bytes_remaining >= ffs_bytes_per_sector)
 		{
+			dw_temp = ffs_read_file_sectors(file_pointer, destination_pointer, (bytes_remaining / ffs_bytes_per_sector));
+			if (dw_temp)
+			{
+				dw_temp *= ffs_bytes_per_sector;
+				destination_pointer += dw_temp;
+				bytes_remaining -= dw_temp;
+				bytes_read += dw_temp;
+				continue;
+			}
+		}
+
+		//----- READ THE FIRST BYTE OF THE SPAN -----
+		//(ffs_fgetc checks the access mode and for end of file, moves to the next sector or cluster if necessary and loads the sector into the buffer)
+		return_value = ffs_fgetc(file_pointer);
+		if (return_value == FFS_EOF)
+			break;
 
-			return_value = ffs_fgetc(file_pointer);
+		*destination_pointer++ = (BYTE)return_value;
+		bytes_remaining--;
+		bytes_read++;
 
-			if (return_value == FFS_EOF)
-				return(number_of_items_written);
-			
-			*string_Pointer++ = (BYTE)return_value;
-		}
-		number_of_items_written++;
-		count--;
-	}
+		//----- COPY AS MUCH OF THE REST OF THE SPAN AS IS IN THIS SECTOR STRAIGHT FROM THE BUFFER -----
+		dw_temp = (DWORD)(ffs_bytes_per_sector - 1 - file_pointer->current_byte);
+		if (dw_temp > (file_pointer->open_file->file_size - 1 - file_pointer->current_byte_within_file))
+			dw_temp = file_pointer->open_file->file_size - 1 - file_pointer->current_byte_within_file;			//Don't read past the end of the file
+		if (dw_temp > bytes_remaining)
+			dw_temp = bytes_remaining;
+		if (dw_temp == 0)
+			continue;
 
-	return(number_of_items_written);
-}
+		memcpy(destination_pointer, &FFS_DRIVER_GEN_512_BYTE_BUFFER[file_pointer->current_byte + 1], (WORD)dw_temp);
+
+		//Leave the file pointing to the last byte read
+		file_pointer->current_byte += (WORD)dw_temp;
+		file_pointer->current_byte_within_file += dw_temp;
 
+		destination_pointer += dw_temp;
+		bytes_remaining -= dw_temp;
+		bytes_read += dw_temp;
+	}
 
+	//Return the number of full items read
+	return((int)(bytes_read / (DWORD)size));
+}
 
 
 
@@ -1132,43 +1277,276 @@ int ffs_fread (void *buffer, int size, int count, FFS_FILE *file_pointer)
 int ffs_fflush (FFS_FILE *file_pointer)
 {
 	BYTE *buffer_pointer;
+#ifdef FFS_IO_TRACE_FUNCTION
+	FFS_IO_TRACE_TIMER_TYPE trace_start_time;
+#endif
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+#endif
 
 
 	//----- EXIT IF THIS FILE ISN'T ACTUALLY OPEN -----
 	if (file_pointer->flags.bits.file_is_open == 0)
 		return(1);
 
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(1);
 
-	//If the data buffer contains data that is waiting to be written then write it
-	//(We just store any unwritten data regardless of what file this funciton is called with as there is only 1 buffer)
-	if (ffs_buffer_needs_writing_to_card)
-	{
-		if (ffs_buffer_contains_lba != 0xffffffff)			//This should not be possible but check is made just in case!
-			ffs_write_sector_from_buffer(ffs_buffer_contains_lba);
 
-		ffs_buffer_needs_writing_to_card = 0;
-	}
+	//If the sector cache contains data that is waiting to be written then write it
+	//(We just store any unwritten data regardless of what file this funciton is called with as the cache is shared by all files)
+	ffs_flush_sector_cache();
+
+	//If the FAT window contains changes that are waiting to be written then write them
+	ffs_flush_fat_window();
 
-	if (file_pointer->flags.bits.file_size_has_changed)
+	//If the free cluster count has changed update the FAT32 FSInfo sector
+	ffs_flush_file_system_information();
+
+	if (file_pointer->open_file->flags.bits.file_size_has_changed)
 	{
 		//----- STORE THE NEW FILE SIZE IN THE FILES DIRECTORY ENTRY -----
-		ffs_read_sector_to_buffer (file_pointer->directory_entry_sector);
+		FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+		ffs_read_sector_to_buffer (file_pointer->open_file->directory_entry_sector);
+		FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
 
 		//Offset to the start of the entry
-		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + ((WORD)file_pointer->directory_entry_within_sector << 5) + 28;			//Start of the file size is 28 bytes into the entry
+		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + ((WORD)file_pointer->open_file->directory_entry_within_sector << 5) + 28;			//Start of the file size is 28 bytes into the entry
+
+		*buffer_pointer++ = (BYTE)(file_pointer->open_file->file_size & 0x000000ff);
+		*buffer_pointer++ = (BYTE)((file_pointer->open_file->file_size & 0x0000ff00) >> 8);
+		*buffer_pointer++ = (BYTE)((file_pointer->open_file->file_size & 0x00ff0000) >> 16);
+		*buffer_pointer++ = (BYTE)((file_pointer->open_file->file_size & 0xff000000) >> 24);
+
+		ffs_write_sector_from_buffer(file_pointer->open_file->directory_entry_sector);
+
+		#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+			index_entry = ffs_get_directory_index_entry(file_pointer->open_file->directory_entry_sector, file_pointer->open_file->directory_entry_within_sector);
+			if (index_entry)
+				index_entry->file_size = file_pointer->open_file->file_size;
+		#endif
+
+		file_pointer->open_file->flags.bits.file_size_has_changed = 0;
+	}
+
+
+	//Let the block device complete any writes it is still carrying out
+	#ifdef FFS_IO_TRACE_FUNCTION
+		trace_start_time = FFS_IO_TRACE_TIME;
+	#endif
+
+	ffs_block_device->sync();
+
+	#ifdef FFS_IO_TRACE_FUNCTION
+		FFS_IO_TRACE_FUNCTION(FFS_IO_SYNC, 0, 0, FFS_IO_TRACE_DURATION(trace_start_time));
+	#endif
+
+	return(0);
+}
+
+
+
+
+//********************************************
+//********************************************
+//********** PREALLOCATE FILE SPACE **********
+//********************************************
+//********************************************
+//Adds clusters to the end of the file so that it can grow to length bytes without any further clusters needing to be allocated.  The
+//clusters added are a single run of consecutive clusters found in one pass of the FAT table (following on from the files last cluster
+//if possible), so each FAT sector is only written once and later writes to the file don't need to search the FAT table.  If the file is
+//empty its start cluster is moved to the start of the run so the whole file is contiguous.  The file size is not changed - any clusters
+//that haven't been used are released again when the file is closed.
+//Return value
+//	0 = successful (or the file already has enough clusters)
+//	1 = error (file not open for writing or there isn't a run of free clusters big enough)
+int ffs_fallocate (FFS_FILE *file_pointer, DWORD length)
+{
+	DWORD bytes_per_cluster;
+	DWORD clusters_needed;
+	DWORD start_cluster;
+	DWORD last_cluster;
+	DWORD next_cluster;
+	DWORD cluster;
+	DWORD run_start_cluster;
+	DWORD run_length;
+	BYTE searched_from_start;
+	BYTE move_start_cluster;
+	BYTE *buffer_pointer;
+	BYTE count;
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+#endif
+
+
+	//----- CHECK THE FILE IS OPEN FOR WRITING -----
+	if (ffs_card_ok == 0)
+		return(1);
+	if ((file_pointer->flags.bits.file_is_open == 0) || (file_pointer->flags.bits.write_permitted == 0))
+		return(1);
 
-		*buffer_pointer++ = (BYTE)(file_pointer->file_size & 0x000000ff);
-		*buffer_pointer++ = (BYTE)((file_pointer->file_size & 0x0000ff00) >> 8);
-		*buffer_pointer++ = (BYTE)((file_pointer->file_size & 0x00ff0000) >> 16);
-		*buffer_pointer++ = (BYTE)((file_pointer->file_size & 0xff000000) >> 24);
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(1);
+
+	bytes_per_cluster = (DWORD)sectors_per_cluster * (DWORD)ffs_bytes_per_sector;
+	clusters_needed = (length / bytes_per_cluster);
+	if (length % bytes_per_cluster)
+		clusters_needed++;
+
+
+	//----- FIND THE FILES LAST CLUSTER AND HOW MANY MORE CLUSTERS ARE NEEDED -----
+	start_cluster = file_pointer->open_file->start_cluster;
+	last_cluster = start_cluster;
+	if (clusters_needed)
+		clusters_needed--;
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		next_cluster = ffs_get_next_cluster_no(last_cluster);
+		if (next_cluster < 2)
+			break;
+		if (disk_is_fat_32)
+		{
+			if (next_cluster >= 0x0ffffff8)
+				break;
+		}
+		else
+		{
+			if (next_cluster >= 0xfff8)
+				break;
+		}
+
+		last_cluster = next_cluster;
+		if (clusters_needed)
+			clusters_needed--;
+	}
+
+	if (clusters_needed == 0)
+	{
+		//THE FILE ALREADY HAS ENOUGH CLUSTERS
+		return(0);
+	}
+
+	//If the file is empty its start cluster is treated as free in the search (the run will then start with it if the following clusters
+	//are free).  Its FAT entry isn't changed until the run has been chosen so the directory entry never points to a free cluster.
+	move_start_cluster = 0;
+	if ((file_pointer->open_file->file_size == 0) && (last_cluster == start_cluster))
+	{
+		clusters_needed++;
+		move_start_cluster = 1;
+	}
+
+
+	//----- FIND A RUN OF FREE CLUSTERS -----
+	//Start from the files last cluster so the file stays contiguous if possible, then if necessary search again from the start
+	cluster = last_cluster;
+	if (move_start_cluster == 0)
+		cluster++;
+	run_start_cluster = cluster;
+	run_length = 0;
+	searched_from_start = 0;
+	while (run_length < clusters_needed)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		if (cluster > max_cluster_number)
+		{
+			if (searched_from_start)
+			{
+				//THERE ISN'T A RUN OF FREE CLUSTERS BIG ENOUGH
+				return(1);
+			}
+			searched_from_start = 1;
+			cluster = 2;
+			run_length = 0;
+		}
+
+		if ((ffs_get_next_cluster_no(cluster) == 0) || ((move_start_cluster) && (cluster == start_cluster)))
+		{
+			if (run_length == 0)
+				run_start_cluster = cluster;
+			run_length++;
+		}
+		else
+		{
+			run_length = 0;
+		}
+		cluster++;
+	}
 
-		ffs_write_sector_from_buffer(file_pointer->directory_entry_sector);
 
-		file_pointer->flags.bits.file_size_has_changed = 0;
+	//----- LINK THE RUN OF CLUSTERS ON TO THE END OF THE FILE -----
+	if (move_start_cluster == 0)
+		ffs_modify_cluster_entry_in_fat(last_cluster, run_start_cluster);
+
+	for (cluster = run_start_cluster; cluster < (run_start_cluster + clusters_needed - 1); cluster++)
+		ffs_modify_cluster_entry_in_fat(cluster, (cluster + 1));
+
+	ffs_modify_cluster_entry_in_fat(cluster, 0x0fffffff);			//(FAT16 will just use the low 16 bits)
+
+	if (move_start_cluster)
+	{
+		if (run_start_cluster != start_cluster)
+		{
+			//The run is written to the FAT tables before the directory entry points to it
+			ffs_flush_fat_window();
+
+			//STORE THE NEW START CLUSTER IN THE FILES DIRECTORY ENTRY
+			FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+			ffs_read_sector_to_buffer (file_pointer->open_file->directory_entry_sector);
+			FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+			buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + ((WORD)file_pointer->open_file->directory_entry_within_sector << 5) + 20;
+			*buffer_pointer++ = (BYTE)(run_start_cluster >> 16);		//0x0000 for FAT16, high word of cluster number for FAT32
+			*buffer_pointer++ = (BYTE)(run_start_cluster >> 24);
+			buffer_pointer += 4;
+			*buffer_pointer++ = (BYTE)run_start_cluster;
+			*buffer_pointer++ = (BYTE)(run_start_cluster >> 8);
+
+			ffs_write_sector_from_buffer(file_pointer->open_file->directory_entry_sector);
+
+			#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+				index_entry = ffs_get_directory_index_entry(file_pointer->open_file->directory_entry_sector, file_pointer->open_file->directory_entry_within_sector);
+				if (index_entry)
+					index_entry->start_cluster = run_start_cluster;
+			#endif
+
+			//Move each handler the file is open with to the new start cluster (an empty file is always at position 0)
+			file_pointer->open_file->start_cluster = run_start_cluster;
+			for (count = 0; count < FFS_FOPEN_MAX; count++)
+			{
+				if ((ffs_file[count].flags.bits.file_is_open) && (ffs_file[count].open_file == file_pointer->open_file))
+					ffs_file[count].current_cluster = run_start_cluster;
+			}
+			#ifdef FFS_EXTENT_CACHE_ENTRIES
+				file_pointer->open_file->extent_count = 0;
+			#endif
+
+			//Free the old start cluster now nothing points to it (unless the run found when searching from the start includes it)
+			if ((start_cluster < run_start_cluster) || (start_cluster > cluster))
+			{
+				ffs_modify_cluster_entry_in_fat(start_cluster, 0x00000000);
+				if (last_found_free_cluster > start_cluster)
+					last_found_free_cluster = start_cluster;
+			}
+		}
 	}
 
+	ffs_flush_fat_window();
+
+	if ((last_found_free_cluster >= run_start_cluster) && (last_found_free_cluster <= cluster))
+		last_found_free_cluster = cluster + 1;
 
-	FFS_CE = 1;										//De-select the card
+	ffs_flush_file_system_information();
+
+	file_pointer->open_file->flags.bits.clusters_preallocated = 1;
 
 	return(0);
 }
@@ -1190,10 +1568,28 @@ int ffs_fclose (FFS_FILE *file_pointer)
 	if (file_pointer->flags.bits.file_is_open == 0)
 		return(1);
 
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(1);
+
+	if (file_pointer->flags.bits.write_permitted)
+	{
+		//----- RELEASE ANY PREALLOCATED CLUSTERS THAT HAVEN'T BEEN USED -----
+		//(Only the handler that may write to the file can have preallocated them)
+		if (file_pointer->open_file->flags.bits.clusters_preallocated)
+		{
+			ffs_release_unused_clusters(file_pointer);
+			file_pointer->open_file->flags.bits.clusters_preallocated = 0;
+		}
+		file_pointer->open_file->flags.bits.open_for_writing = 0;
+	}
+
 	//----- ENSURE ANY UNWRITTEN DATA AND ANY CHANGE IN FILE SIZE IS STORED -----
 	ffs_fflush(file_pointer);
 
 	//----- FLAG THAT THE FILE IS NO LOGER OPEN AND THIS FILE HANDLER IS AVAILABLE AGAIN -----
+	//(The open file entry is available again once all of the handlers the file is open with are closed)
+	file_pointer->open_file->handle_count--;
 	file_pointer->flags.bits.file_is_open = 0;
 
 	return(0);
@@ -1212,7 +1608,6 @@ int ffs_fclose (FFS_FILE *file_pointer)
 // 1 = error (file doesn't exist or can't be deleted as its currently open)
 int ffs_remove (const char *filename)
 {
-	BYTE temp;
 	BYTE temp1;
 	DWORD next_cluster;
 	BYTE converted_file_name[8];
@@ -1223,21 +1618,20 @@ int ffs_remove (const char *filename)
 	DWORD lowest_cluster_number_released = 0xffffffff;
 	DWORD directory_entry_sector;
 	BYTE directory_entry_within_sector;
-	DWORD fat_entries_per_sector;
-	DWORD dw_temp;
-	BYTE *buffer_pointer;
-	DWORD lba;
 
 	//Check card is inserted and has been initialised
 	if (ffs_card_ok == 0)
 		return(1);
 
+	//Select the current volume
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(1);
+
 	//----- FIND THE FILE -----
 	read_cluster_number = ffs_find_file(filename, &read_file_size, &attribute_byte, &directory_entry_sector, &directory_entry_within_sector, converted_file_name, converted_file_extension);
 	if (read_cluster_number == 0xffffffff)		//0xffffffff = file not found
 	{
 		//FILE DOES NOT EXIST
-		FFS_CE = 1;
 		return(1);
 	}
 
@@ -1247,29 +1641,12 @@ int ffs_remove (const char *filename)
 	//------------------------------------
 
 	//----- CHECK FILE IS NOT BEING ACCESSED BY ANY CURRENT FILE HANDLER -----
-	//if (read_cluster_number != 0xffffffff)		//0xffffffff = file not found
-	//{
-		for (temp = 0; temp < FFS_FOPEN_MAX; temp++)
-		{
-			if (ffs_file[temp].flags.bits.file_is_open)
-			{
-				if (
-					(ffs_file[temp].directory_entry_sector == directory_entry_sector) &&
-					(ffs_file[temp].directory_entry_within_sector == directory_entry_within_sector)
-					)
-				{
-					return(1);
-				}
-			}
-		}
-	//}
+	if (ffs_find_open_file(directory_entry_sector, directory_entry_within_sector))
+		return(1);
 
 
-	//----- SET THE 1ST CHARACTER OF THE FILE NAME TO 0xE5 TO INDICATE ITS A DELETED ENTRY IN THE DIRECTORY -----
-	converted_file_name[0] = 0xe5;
-	
-	//----- STORE THE MODIFIED DIRECTORY ENTRY BACK TO THE DISK -----
-	ffs_overwrite_last_directory_entry(converted_file_name, converted_file_extension, &attribute_byte, &read_file_size, &read_cluster_number);
+	//----- MARK THE FILES DIRECTORY ENTRY (AND ANY LONG FILENAME ENTRIES) AS DELETED -----
+	ffs_delete_directory_entry(directory_entry_sector, directory_entry_within_sector);
 
 	//----- CHANGE ALL ENTRIES IN THE FAT TABLE FOR THIS FILE BACK TO 0 TO INDICATE THE CLUSTERS ARE NOW FREE -----
 	while(1)
@@ -1281,54 +1658,10 @@ int ffs_remove (const char *filename)
 		//Get next cluster number
 		next_cluster = ffs_get_next_cluster_no(read_cluster_number);
 
-		//IF THE NEXT CLUSTER IS IN THE SAME AS THIS CLUSTER THEN JUST UPDATE THE SECTOR BUFFER
-		//(If we don't do this then for each change to the FAT table we have to do a sector read followed by 2 sector writes
-		//as there are 2 FAT tables to update.  This makes deleting increadibly slow as the efficiency of working on a single
-		//sector as much as possible before writing it and reading the next is lost.  This solution solves the problem based
-		//on the assumption that most files will largely use concurrent clusters and therefore concurrent entries in the FAT table).
-
-		lba = fat1_start_sector;
-
-		if (disk_is_fat_32)
-			fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
-		else
-			fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
-
-		dw_temp = (next_cluster / fat_entries_per_sector);						//dw_temp now has the sector address that will need to be modifed for the next cluster entry
-		lba += dw_temp;
-
-		if (lba == ffs_buffer_contains_lba)
-		{
-			//----- NEXT CLUSTER ENTRY IS IN SAME FAT TABLE SECTOR AS THE CURRENT CLUSTER ENTRY -----
-			read_cluster_number -= (dw_temp * fat_entries_per_sector);
-
-			//Point to this entry in the FAT table
-			if (disk_is_fat_32)
-			{
-				buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_cluster_number << 2);
-
-				*buffer_pointer++ = 0x00;										//FAT32 - 1 double word per entry
-				*buffer_pointer++ = 0x00;
-				*buffer_pointer++ = 0x00;
-				*buffer_pointer++ &= 0xf0;										//(The top 4 bits are reserved and should not be modified)
-			}
-			else
-			{
-				buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_cluster_number << 1);
-
-				*buffer_pointer++ = 0x00;										//FAT16 - 1 word per entry
-				*buffer_pointer++ = 0x00;
-			}
-		}
-		else
-		{
-			//----- NEXT CLUSTER ENTRY IS NOT IN THE SAME FAT TABLE SECTOR - DO UPDATE AS NOMAL -----
-			//(This also stores all of the previous updates to the FAT table)
-			//Clear the current cluster entry
-			ffs_modify_cluster_entry_in_fat(read_cluster_number, (DWORD) 0x00000000);
-		}
-
-
+		//Clear the current cluster entry
+		//(The FAT window is only written to the card when we move on to another FAT sector, so files that largely use concurrent clusters
+		//and therefore concurrent entries in the FAT table only cost 1 write per FAT sector)
+		ffs_modify_cluster_entry_in_fat(read_cluster_number, (DWORD) 0x00000000);
 
 
 		//CHECK FOR THAT WAS THE LAST CLUSTER
@@ -1361,12 +1694,17 @@ int ffs_remove (const char *filename)
 			lowest_cluster_number_released = read_cluster_number;
 	}
 
-	FFS_CE = 1;
+	//Write the last of the FAT table changes
+	ffs_flush_fat_window();
+
 
 	//If we have free'd up some lower clusters than the current cluster to start looking in when writing new clusters then change the value
 	if (last_found_free_cluster > lowest_cluster_number_released)
 		last_found_free_cluster = lowest_cluster_number_released;
 
+	//Update the FAT32 FSInfo sector with the clusters that have been released
+	ffs_flush_file_system_information();
+
 	return(0);	
 
 
@@ -1381,6 +1719,7 @@ int ffs_remove (const char *filename)
 //********** RENAME FILE **********
 //*********************************
 //*********************************
+//The new filename may include a path but it must be to the directory the file is already in (files can't be moved to another directory).
 //Return value
 // 0 = file is succesfully renamed
 // 1 = error (file doesn't exist or can't be renamed as its currently open)
@@ -1388,24 +1727,51 @@ int ffs_rename (const char *old_filename, const char *new_filename)
 {
 	BYTE converted_file_name[8];
 	BYTE converted_file_extension[3];
+	BYTE new_file_name[8];
+	BYTE new_file_extension[3];
+	BYTE name_type;
 	DWORD read_cluster_number = 0;
 	DWORD read_file_size;
 	BYTE attribute_byte;
 	DWORD directory_entry_sector;
 	BYTE directory_entry_within_sector;
-	BYTE temp;
+	DWORD new_directory_cluster;
+	const char *new_name;
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+#endif
+#ifdef FFS_LONG_FILENAME_MAX
+	DWORD new_directory_entry_sector;
+	BYTE new_directory_entry_within_sector;
+	DWORD directory_cluster;
+#endif
 
 
 	//CHECK CARD IS INSERTED AND HAS BEEN INITIALISED
 	if (ffs_card_ok == 0)
 		return(1);
 
+	//SELECT THE CURRENT VOLUME
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(1);
+
+	//----- FIND THE DIRECTORY OF THE NEW FILENAME -----
+	//(Done first as it may search directories, which would lose the position of the files directory entry)
+	new_directory_cluster = ffs_find_path_directory(new_filename, &new_name);
+	if (new_directory_cluster == 0xffffffff)
+		return(1);
+
 	//----- FIND THE FILE -----
 	read_cluster_number = ffs_find_file(old_filename, &read_file_size, &attribute_byte, &directory_entry_sector, &directory_entry_within_sector, converted_file_name, converted_file_extension);
 	if (read_cluster_number == 0xffffffff)		//0xffffffff = file not found
 	{
 		//FILE DOES NOT EXIST
-		FFS_CE = 1;
+		return(1);
+	}
+
+	if (read_write_directory_start_cluster != new_directory_cluster)
+	{
+		//THE NEW FILENAME IS IN A DIFFERENT DIRECTORY
 		return(1);
 	}
 
@@ -1414,30 +1780,480 @@ int ffs_rename (const char *old_filename, const char *new_filename)
 	//------------------------------------
 
 	//----- CHECK FILE IS NOT BEING ACCESSED BY ANY CURRENT FILE HANDLER -----
-	if (read_cluster_number != 0xffffffff)		//0xffffffff = file not found
+	if (ffs_find_open_file(directory_entry_sector, directory_entry_within_sector))
+		return(1);
+
+	//CONVERT THE NEW FILENAME TO DOS FILENAME
+	name_type = ffs_convert_filename_to_dos (new_name, new_file_name, new_file_extension);
+	if (name_type == 1)
+		return(1);								//Wildcard characters
+
+	if (name_type == 2)
 	{
-		for (temp = 0; temp < FFS_FOPEN_MAX; temp++)
-		{
-			if (ffs_file[temp].flags.bits.file_is_open)
-			{
-				if (
-					(ffs_file[temp].directory_entry_sector == directory_entry_sector) &&
-					(ffs_file[temp].directory_entry_within_sector == directory_entry_within_sector)
-					)
-				{
-					return(1);
+	#ifdef FFS_LONG_FILENAME_MAX
+		//----- THE NEW NAME IS A LONG FILENAME -----
+		//Add new entries for the file with the long filename and its alias, then delete the old entries
+		if (ffs_add_directory_entry(new_name, attribute_byte, read_file_size, &read_cluster_number, &new_directory_entry_sector, &new_directory_entry_within_sector) == 0)
+			return(1);
+		ffs_delete_directory_entry(directory_entry_sector, directory_entry_within_sector);
+
+		//Write the FAT table changes if the directory had to be extended
+		ffs_flush_fat_window();
+		ffs_flush_file_system_information();
+		return(0);
+	#else
+		return(1);								//Not a valid 8.3 name
+	#endif
+	}
+
+	#ifdef FFS_LONG_FILENAME_MAX
+		//DELETE ANY LONG FILENAME THE FILE HAD
+		ffs_delete_long_filename(ffs_get_directory_entry_number(directory_entry_sector, directory_entry_within_sector, &directory_cluster));
+		read_write_directory_last_lba = directory_entry_sector;
+		read_write_directory_last_entry = directory_entry_within_sector;
+	#endif
+
+	//STORE THE MODIFIED DIRECTORY ENTRY BACK TO THE DISK
+	ffs_overwrite_last_directory_entry(new_file_name, new_file_extension, &attribute_byte, &read_file_size, &read_cluster_number);
+
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		//MOVE THE FILE TO ITS NEW NAME IN THE DIRECTORY INDEX
+		index_entry = ffs_get_directory_index_entry(directory_entry_sector, directory_entry_within_sector);
+		if (index_entry)
+			index_entry->directory_entry_sector = 0;			//0 = entry has been removed
+		ffs_add_file_to_directory_index(new_file_name, new_file_extension, attribute_byte, read_cluster_number, read_file_size, directory_entry_sector, directory_entry_within_sector, 0);
+	#endif
+
+	return(0);
+}
+
+
+
+
+
+//**************************************
+//**************************************
+//********** CREATE DIRECTORY **********
+//**************************************
+//**************************************
+//dirname
+//	The directory to create.  It may follow a path of existing directories (see ffs_find_file), e.g. "LOG\\2026".
+//
+//Return value
+// 0 = directory successfully created
+// 1 = error (a file or directory with this name already exists, a directory in the path doesn't exist, the name isn't valid or there is
+//	   no space on the card)
+int ffs_mkdir (const char *dirname)
+{
+	const char *name;
+	DWORD directory_cluster;
+	DWORD start_cluster;
+	DWORD file_size;
+	BYTE attribute_byte;
+	DWORD directory_entry_sector;
+	BYTE directory_entry_within_sector;
+	BYTE converted_file_name[8];
+	BYTE converted_file_extension[3];
+	BYTE count;
+
+
+	//CHECK CARD IS INSERTED AND HAS BEEN INITIALISED
+	if (ffs_card_ok == 0)
+		return(1);
+
+	//SELECT THE CURRENT VOLUME
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(1);
+
+	//----- FIND THE DIRECTORY TO CREATE THE DIRECTORY IN -----
+	directory_cluster = ffs_find_path_directory(dirname, &name);
+	if (directory_cluster == 0xffffffff)
+		return(1);
+
+	//----- CREATE THE DIRECTORY ENTRY -----
+	//(This also checks there isn't already a file or directory with this name and allocates the first cluster of the new directory)
+	if (ffs_create_new_file(dirname, 0x10, &start_cluster, &directory_entry_sector, &directory_entry_within_sector) == 0)
+		return(1);
+
+	//----- SET ALL THE ENTRIES OF THE NEW DIRECTORY TO UNUSED -----
+	ffs_clear_directory_cluster(start_cluster);
+
+	//----- ADD THE "." AND ".." ENTRIES -----
+	//(ffs_overwrite_last_directory_entry writes to the entry at read_write_directory_last_lba and read_write_directory_last_entry)
+	for (count = 0; count < 8; count++)
+		converted_file_name[count] = ' ';
+	for (count = 0; count < 3; count++)
+		converted_file_extension[count] = ' ';
+	attribute_byte = 0x10;
+	file_size = 0;
+
+	read_write_directory_last_lba = data_area_start_sector + ((start_cluster - 2) * sectors_per_cluster);
+
+	converted_file_name[0] = '.';									//"." = this directory
+	read_write_directory_last_entry = 0;
+	ffs_overwrite_last_directory_entry(converted_file_name, converted_file_extension, &attribute_byte, &file_size, &start_cluster);
+
+	converted_file_name[1] = '.';									//".." = the parent directory (0 = root directory)
+	read_write_directory_last_entry = 1;
+	ffs_overwrite_last_directory_entry(converted_file_name, converted_file_extension, &attribute_byte, &file_size, &directory_cluster);
+
+	return(0);
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** CHANGE DIRECTORY **********
+//**************************************
+//**************************************
+//Sets the current directory that paths which don't start with '\\' or '/' start from.
+//dirname
+//	The new current directory, e.g. "\\LOG\\2026", "10" or ".." ("\\" = the root directory)
+//
+//Return value
+// 0 = current directory changed
+// 1 = error (the directory doesn't exist)
+int ffs_chdir (const char *dirname)
+{
+	const char *name;
+	DWORD directory_cluster;
+
+
+	//CHECK CARD IS INSERTED AND HAS BEEN INITIALISED
+	if (ffs_card_ok == 0)
+		return(1);
+
+	//SELECT THE CURRENT VOLUME
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(1);
+
+	directory_cluster = ffs_find_path_directory(dirname, &name);
+	if (directory_cluster != 0xffffffff)
+		directory_cluster = ffs_find_subdirectory(directory_cluster, name, (WORD)strlen(name));
+	if (directory_cluster == 0xffffffff)
+		return(1);
+
+	ffs_current_directory_cluster = directory_cluster;
+	return(0);
+}
+
+
+
+
+
+
+//***********************************
+//***********************************
+//********** CHANGE VOLUME **********
+//***********************************
+//***********************************
+//Sets the volume that filenames passed to ffs_fopen, ffs_remove, ffs_rename, ffs_mkdir, ffs_chdir and ffs_opendir refer to, and that
+//ffs_get_free_space returns the free space of.  Each volume has its own current directory.  Volume 0 is selected when a card is inserted.
+//volume
+//	0 = partition 1, or a volume mounted with ffs_mount_partition
+//Return value
+// 0 = current volume changed
+// 1 = error (the volume isn't mounted)
+int ffs_chvol (BYTE volume)
+{
+
+	if (ffs_select_volume(volume) == 0)
+		return(1);
+
+	ffs_current_volume = volume;
+	return(0);
+}
+
+
+
+
+
+
+//************************************
+//************************************
+//********** OPEN DIRECTORY **********
+//************************************
+//************************************
+//dirname
+//	The directory to list, e.g. "\\" for the root directory, "" for the current directory or "LOG\\2026" (see ffs_find_file).
+//
+//Return value.
+//	A pointer to the directory handler to pass to ffs_readdir and ffs_closedir, or a null pointer (0x00) if the directory can't be opened
+//	(the card isn't available, the directory doesn't exist or FFS_OPENDIR_MAX directories are already open).
+//
+//Each directory handler has its own position in the directory, so directories may be listed while files are being accessed and while
+//other directories are being listed.
+FFS_DIR* ffs_opendir (const char *dirname)
+{
+	BYTE dir_number;
+	const char *name;
+	DWORD directory_cluster;
+
+
+	//----- CHECK CARD IS INSERTED AND HAS BEEN INITIALISED -----
+	if (ffs_card_ok == 0)
+		return(0);
+
+	//----- SELECT THE CURRENT VOLUME -----
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(0);
+
+	//----- FIND THE DIRECTORY -----
+	directory_cluster = ffs_find_path_directory(dirname, &name);
+	if (directory_cluster != 0xffffffff)
+		directory_cluster = ffs_find_subdirectory(directory_cluster, name, (WORD)strlen(name));
+	if (directory_cluster == 0xffffffff)
+		return(0);
+
+	//----- LOOK FOR AN AVAILABLE DIRECTORY HANDLER -----
+	for (dir_number = 0; dir_number < FFS_OPENDIR_MAX; dir_number++)
+	{
+		if (ffs_dir[dir_number].dir_is_open == 0)
+			break;
+	}
+	if (dir_number == FFS_OPENDIR_MAX)
+		return(0);								//The maximum number of directories are already open
+
+	//----- SET THE POSITION TO THE FIRST ENTRY OF THE DIRECTORY -----
+	if ((directory_cluster) || (disk_is_fat_32))
+	{
+		//----- SUBDIRECTORY OR FAT32 ROOT DIRECTORY -----
+		if (directory_cluster == 0)
+			directory_cluster = root_directory_start_sector_cluster;
+		ffs_dir[dir_number].current_cluster = directory_cluster;
+		ffs_dir[dir_number].current_lba = data_area_start_sector + ((directory_cluster - 2) * sectors_per_cluster);
+		ffs_dir[dir_number].sectors_left = sectors_per_cluster - 1;
+	}
+	else
+	{
+		//----- FAT16 ROOT DIRECTORY -----
+		ffs_dir[dir_number].current_cluster = 0;
+		ffs_dir[dir_number].current_lba = root_directory_start_sector_cluster;
+		ffs_dir[dir_number].sectors_left = (BYTE)(number_of_root_directory_sectors - 1);
+	}
+	ffs_dir[dir_number].current_entry = 0;
+	ffs_dir[dir_number].dir_is_open = 1;
+	ffs_dir[dir_number].volume = ffs_active_volume;
+	#ifdef FFS_LONG_FILENAME_MAX
+		ffs_dir[dir_number].long_name_sequence = 0;
+	#endif
+
+	return(&ffs_dir[dir_number]);
+}
+
+
+
+
+
+
+//************************************
+//************************************
+//********** READ DIRECTORY **********
+//************************************
+//************************************
+//Returns a pointer to the next file or subdirectory entry in the directory, or a null pointer (0x00) when there are no more entries.
+//Deleted entries and volume label entries are skipped.  With FFS_LONG_FILENAME_MAX the name is the entry's long filename if it has one
+//(assembled from the long filename entries before it).  The returned entry is held in the directory handler and is overwritten by the
+//next call for the same handler.
+FFS_DIRENT* ffs_readdir (FFS_DIR *dir_pointer)
+{
+	BYTE count;
+	BYTE *buffer_pointer;
+	BYTE *name_pointer;
+	BYTE file_name[8];
+	BYTE file_extension[3];
+	DWORD next_cluster;
+#ifdef FFS_LONG_FILENAME_MAX
+	BYTE *character_pointer;
+	WORD position;
+#endif
+
+
+	if ((ffs_card_ok == 0) || (dir_pointer->dir_is_open == 0))
+		return(0);
+
+	//----- SELECT THE VOLUME THE DIRECTORY IS ON -----
+	if (ffs_select_volume(dir_pointer->volume) == 0)
+		return(0);
+
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//----- HAS THE END OF THE DIRECTORY BEEN REACHED? -----
+		if (dir_pointer->current_lba == 0xffffffff)
+			return(0);
+
+		//----- MOVE TO THE NEXT SECTOR? -----
+		if (dir_pointer->current_entry >= (BYTE)(ffs_bytes_per_sector >> 5))		// /32 as each directory entry is 32 bytes
+		{
+			dir_pointer->current_entry = 0;
+
+			if (dir_pointer->sectors_left)
+			{
+				//Next sector of this cluster (or of the FAT16 root directory)
+				dir_pointer->current_lba++;
+				dir_pointer->sectors_left--;
+			}
+			else if (dir_pointer->current_cluster)
+			{
+				//Next cluster of the directory
+				next_cluster = ffs_get_next_cluster_no(dir_pointer->current_cluster);
+				if (
+					(next_cluster < 2) ||
+					((disk_is_fat_32) && ((next_cluster & 0x0fffffff) >= 0x0ffffff8)) ||
+					((disk_is_fat_32 == 0) && (next_cluster >= 0xfff8))
+					)
+				{
+					dir_pointer->current_lba = 0xffffffff;
+					return(0);
+				}
+				dir_pointer->current_cluster = next_cluster;
+				dir_pointer->current_lba = data_area_start_sector + ((next_cluster - 2) * sectors_per_cluster);
+				dir_pointer->sectors_left = sectors_per_cluster - 1;
+			}
+			else
+			{
+				//End of the FAT16 root directory
+				dir_pointer->current_lba = 0xffffffff;
+				return(0);
+			}
+		}
+
+		//----- GET THE ENTRY -----
+		//(The sector is read each time as other sectors may have been accessed since the last call - it will normally still be in the sector cache)
+		FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+		ffs_read_sector_to_buffer(dir_pointer->current_lba);
+		FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + ((WORD)dir_pointer->current_entry << 5);
+		dir_pointer->current_entry++;
+
+		//0x00 = entry has never been used = end of used directory marker
+		if (buffer_pointer[0] == 0x00)
+		{
+			dir_pointer->current_lba = 0xffffffff;
+			return(0);
+		}
+
+		#ifdef FFS_LONG_FILENAME_MAX
+			//----- LONG FILENAME ENTRY -----
+			//The characters are copied to the name as each entry is read (see ffs_follow_long_filename_entry)
+			if ((buffer_pointer[0] != 0xe5) && (buffer_pointer[11] == 0x0f))
+			{
+				if (ffs_follow_long_filename_entry(buffer_pointer, &dir_pointer->long_name_sequence, &dir_pointer->long_name_checksum) == 2)
+				{
+					//The entry with the end of the name - get the length of the name
+					position = (WORD)(dir_pointer->long_name_sequence - 1) * 13;
+					for (count = 0; count < 13; count++)
+					{
+						character_pointer = buffer_pointer + ffs_long_filename_character_offsets[count];
+						if ((character_pointer[0] == 0x00) && (character_pointer[1] == 0x00))
+							break;
+						position++;
+					}
+					if (position > FFS_LONG_FILENAME_MAX)
+						dir_pointer->long_name_sequence = 0;			//Too long - the 8.3 name is returned
+					else
+						dir_pointer->entry.name[position] = 0x00;
+				}
+
+				if (dir_pointer->long_name_sequence)
+				{
+					//Copy the characters (characters that aren't in the 8 bit character set are returned as '_')
+					position = (WORD)(dir_pointer->long_name_sequence - 1) * 13;
+					for (count = 0; count < 13; count++)
+					{
+						character_pointer = buffer_pointer + ffs_long_filename_character_offsets[count];
+						if ((position >= FFS_LONG_FILENAME_MAX) || ((character_pointer[0] == 0x00) && (character_pointer[1] == 0x00)))
+							break;
+						if (character_pointer[1])
+							dir_pointer->entry.name[position] = '_';
+						else
+							dir_pointer->entry.name[position] = (char)character_pointer[0];
+						position++;
+					}
 				}
+				continue;
+			}
+		#endif
+
+		//Skip deleted entries (0xe5) and volume label entries
+		if ((buffer_pointer[0] == 0xe5) || (buffer_pointer[11] & 0x08))
+		{
+			#ifdef FFS_LONG_FILENAME_MAX
+				dir_pointer->long_name_sequence = 0;
+			#endif
+			continue;
+		}
+
+		ffs_get_directory_entry(buffer_pointer, file_name, file_extension, &dir_pointer->entry.attribute_byte,
+								&dir_pointer->entry.file_size, &dir_pointer->entry.start_cluster);
+
+		//A first character of 0x05 is stored for names that start with 0xe5
+		if (file_name[0] == 0x05)
+			file_name[0] = 0xe5;
+
+		//----- CONVERT THE NAME TO A NULL TERMINATED "NAME.EXT" STRING -----
+		#ifdef FFS_LONG_FILENAME_MAX
+			name_pointer = (BYTE*)&dir_pointer->entry.short_name[0];
+		#else
+			name_pointer = (BYTE*)&dir_pointer->entry.name[0];
+		#endif
+		for (count = 0; count < 8; count++)
+		{
+			if (file_name[count] != ' ')
+				*name_pointer++ = file_name[count];
+		}
+		if (file_extension[0] != ' ')
+		{
+			*name_pointer++ = '.';
+			for (count = 0; count < 3; count++)
+			{
+				if (file_extension[count] != ' ')
+					*name_pointer++ = file_extension[count];
 			}
 		}
+		*name_pointer = 0x00;
+
+		#ifdef FFS_LONG_FILENAME_MAX
+			//----- USE THE LONG FILENAME IF IT HAS ONE -----
+			//(Its entries must have ended with sequence number 1 and have the checksum of this 8.3 name)
+			if ((dir_pointer->long_name_sequence != 1) || (ffs_short_name_checksum(buffer_pointer, buffer_pointer + 8) != dir_pointer->long_name_checksum))
+				strcpy(dir_pointer->entry.name, dir_pointer->entry.short_name);
+			dir_pointer->long_name_sequence = 0;
+		#endif
+
+		return(&dir_pointer->entry);
 	}
+}
 
-	//CONVERT THE NEW FILENAME TO DOS FILENAME
-	if (ffs_convert_filename_to_dos (new_filename, converted_file_name, converted_file_extension))		//Returns 1 if filename had wildcard characters
-		return(1);
 
-	//STORE THE MODIFIED DIRECTORY ENTRY BACK TO THE DISK
-	ffs_overwrite_last_directory_entry(converted_file_name, converted_file_extension, &attribute_byte, &read_file_size, &read_cluster_number);
 
+
+
+
+//*************************************
+//*************************************
+//********** CLOSE DIRECTORY **********
+//*************************************
+//*************************************
+//Return value
+// 0 = directory handler closed
+// 1 = error (the handler isn't open)
+int ffs_closedir (FFS_DIR *dir_pointer)
+{
+
+	if (dir_pointer->dir_is_open == 0)
+		return(1);
+
+	dir_pointer->dir_is_open = 0;
 	return(0);
 }
 
@@ -1518,6 +2334,50 @@ BYTE ffs_is_card_available (void)
 
 
 
+//************************************
+//************************************
+//********** GET FREE SPACE **********
+//************************************
+//************************************
+//Returns:
+//	Free space on the current volume (see ffs_chvol) in K bytes (0 if the card isn't available)
+//The free cluster count is read from the FAT32 FSInfo sector when the card is inserted and then kept up to date as clusters are used
+//and released, so this normally returns instantly.  For FAT16, or if the FSInfo count wasn't valid or was 0, the FAT table is searched
+//the first time this is called.
+DWORD ffs_get_free_space (void)
+{
+	DWORD bytes_per_cluster;
+
+
+	if (ffs_card_ok == 0)
+		return(0);
+
+	//----- SELECT THE CURRENT VOLUME -----
+	if (ffs_select_volume(ffs_current_volume) == 0)
+		return(0);
+
+	//----- IF THE NUMBER OF FREE CLUSTERS ISN'T KNOWN THEN COUNT THEM -----
+	if (free_cluster_count == 0xffffffff)
+	{
+		free_cluster_count = ffs_count_free_clusters();
+		file_system_information_needs_writing = 1;
+
+	}
+
+	//----- CONVERT TO K BYTES -----
+	bytes_per_cluster = ((DWORD)sectors_per_cluster * (DWORD)ffs_bytes_per_sector);
+	if (bytes_per_cluster >= 1024)
+		return(free_cluster_count * (bytes_per_cluster >> 10));
+	else
+		return(free_cluster_count / (1024 / bytes_per_cluster));
+}
+
+
+
+
+
+
+
 
 
 
@@ -1544,8 +2404,11 @@ BYTE ffs_is_card_available (void)
 //*******************************
 //*******************************
 //filename
-//	Only 8 character DOS compatible root directory filenames are allowed.  Format is F.E where F may be between 1 and 8 characters
-//	and E may be between 1 and 3 characters, null terminated.  The '*' and '?' wildcard characters are allowed.
+//	8 character DOS compatible filename.  Format is F.E where F may be between 1 and 8 characters and E may be between 0 and 3
+//	characters, null terminated.  The '*' and '?' wildcard characters are allowed.  With FFS_LONG_FILENAME_MAX the name may also be a
+//	long filename (up to 255 characters, no wildcard characters, compared without case).  The filename may follow a path of
+//	directory names each ending with '\\' or '/' (e.g. "LOG\\2026\\DAY17.CSV").  A path that starts with '\\' or '/' starts from the
+//	root directory, otherwise it starts from the current directory (see ffs_chdir).
 //file_size
 //	File size (bytes) will be written to here
 //attribute_byte
@@ -1568,203 +2431,4319 @@ BYTE ffs_is_card_available (void)
 DWORD ffs_find_file (const char *filename, DWORD *file_size, BYTE *attribute_byte, DWORD *directory_entry_sector,
 					 BYTE *directory_entry_within_sector, BYTE *read_file_name, BYTE *read_file_extension)
 {
-	BYTE temp;
-	BYTE this_is_the_file;
-	BYTE this_is_first_read;
-	BYTE converted_file_name[8];
-	BYTE converted_file_extension[3];
-	DWORD read_cluster_number;
-	
+	DWORD directory_cluster;
+
 
 	//----- CHECK CARD IS INSERTED AND HAS BEEN INITIALISED -----
 	if(ffs_card_ok == 0)
 		return((DWORD)0xffffffff);
 
-	//----- CONVERT NULL TERMINATED FILE NAME TO 8 CHARACTER DOS FILENAME -----
-	ffs_convert_filename_to_dos (filename, converted_file_name, converted_file_extension);
-
-	this_is_first_read = 1;
-	//----- GET EACH DIRECTORY ENTRY UNTIL WE FIND THE MATCHING FILE -----
-	while (1)
-	{
-		#ifdef CLEAR_WATCHDOG_TIMER
-			CLEAR_WATCHDOG_TIMER();
-		#endif
-
-		//GET NEXT ENTRY
-		if (ffs_read_next_directory_entry (read_file_name, read_file_extension, attribute_byte, file_size,
-											&read_cluster_number, this_is_first_read, directory_entry_sector,
-											directory_entry_within_sector) == 0)
-		{
-			FFS_CE = 1;								//Deselect the card
-			return((DWORD)0xffffffff);				//Reached end of directory
-		}
-		this_is_first_read = 0;
-
-		this_is_the_file = 1;								//Default to this is the file
+	//----- FIND THE DIRECTORY THE FILE IS IN -----
+	directory_cluster = ffs_find_path_directory(filename, &filename);
+	if (directory_cluster == 0xffffffff)
+		return((DWORD)0xffffffff);				//A directory in the path doesn't exist
 
-		//If 1st value is 0x00 then entry has never been used (erased entries are 0xe5) so 0x00 is the end of used directory marker)
-		if (*(read_file_name + 0) == 0x00)
-		{
-			FFS_CE = 1;						//Deselect the card
-			return((DWORD)0xffffffff);
-		}
-
-		//If 1st value is 0xe5 then entry has been deleted
-		if (*(read_file_name + 0) == 0xe5)
-		{
-				this_is_the_file = 0;
-		}
-		
-		//Does the file name match?
-		for (temp = 0; temp < 8; temp++)
-		{
-			if ((converted_file_name[temp] != '?') && (*(read_file_name + temp) != converted_file_name[temp]))
-				this_is_the_file = 0;
-		}
+	//----- LOOK FOR THE FILE IN THE DIRECTORY -----
+	ffs_select_directory(directory_cluster);
+	return(ffs_find_directory_entry(filename, FFS_FIND_FILE, file_size, attribute_byte, directory_entry_sector, directory_entry_within_sector,
+									read_file_name, read_file_extension));
+}
 
 
-		//Does file extension match?
-		for (temp = 0; temp < 3; temp++)
-		{
-			if ((converted_file_extension[temp] != '?') && (*(read_file_extension + temp) != converted_file_extension[temp]))
-				this_is_the_file = 0;
-		}
 
-		//Is attribute byte for a file?
-		if (*attribute_byte & 0x08)						//Not valid if the 'volume' bit is set
-			this_is_the_file = 0;
 
-		if (*attribute_byte & 0x10)						//Not valid if the 'directory' bit is set
-			this_is_the_file = 0;
 
-		if (*attribute_byte & 0x02)						//Not valid if the 'hidden' bit is set
-			this_is_the_file = 0;
 
-		//----- IS THIS THE FILE? -----
-		if (this_is_the_file)
-		{
-			//THIS IS THE FILE
-			FFS_CE = 1;						//Deselect the card
-			return(read_cluster_number);
+//******************************************
+//******************************************
+//********** FIND DIRECTORY ENTRY **********
+//******************************************
+//******************************************
+//Looks for a file or subdirectory in the directory selected by ffs_select_directory.
+//filename
+//	The name to look for (no path).  The '*' and '?' wildcard characters are allowed.
+//find_type
+//	FFS_FIND_FILE, FFS_FIND_DIRECTORY or FFS_FIND_ANY
+//The other parameters and the return value are as ffs_find_file.
+DWORD ffs_find_directory_entry (const char *filename, BYTE find_type, DWORD *file_size, BYTE *attribute_byte, DWORD *directory_entry_sector,
+								BYTE *directory_entry_within_sector, BYTE *read_file_name, BYTE *read_file_extension)
+{
+	BYTE temp;
+	BYTE entry;
+	BYTE entries_per_sector;
+	BYTE converted_file_name[8];
+	BYTE converted_file_extension[3];
+	BYTE match_name[12];
+	BYTE match_mask[12];
+	BYTE *buffer_pointer;
+	DWORD read_cluster_number;
+	BYTE name_type;
+	BYTE this_is_the_file;
+	DWORD entry_number;
+	BYTE attribute_mask;
+	BYTE attribute_value;
+#ifdef FFS_DIRECTORY_WIDE_COMPARE
+	DWORD match_name_words[3];
+	DWORD match_mask_words[3];
+	DWORD entry_words[3];
+#endif
+#ifdef FFS_LONG_FILENAME_MAX
+	WORD long_name_length;
+	BYTE long_name_entries;
+	BYTE long_name_sequence;
+	BYTE long_name_checksum;
+	BYTE long_name_matches;
+#endif
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+	WORD long_name_hash = 0;
+#endif
+	
+
+	//----- CONVERT NULL TERMINATED FILE NAME TO 8 CHARACTER DOS FILENAME -----
+	//(0 = valid 8.3 name, 1 = wildcard characters, 2 = not a valid 8.3 name)
+	name_type = ffs_convert_filename_to_dos (filename, converted_file_name, converted_file_extension);
+
+	#ifdef FFS_LONG_FILENAME_MAX
+		//----- GET THE LENGTH OF THE NAME TO COMPARE WITH LONG FILENAMES -----
+		//(The name may be part of a path so it ends at a '\\' or '/' as well as a null.  Names with wildcard characters are only compared
+		//with 8.3 names.  Each long filename entry holds 13 characters.)
+		long_name_length = 0;
+		while ((filename[long_name_length] != 0x00) && (filename[long_name_length] != '\\') && (filename[long_name_length] != '/'))
+			long_name_length++;
+
+		if ((name_type == 1) || (long_name_length > 255))
+			long_name_entries = 0;
+		else
+			long_name_entries = (BYTE)((long_name_length + 12) / 13);
+		long_name_sequence = 0;
+		long_name_checksum = 0;
+		long_name_matches = 0;
+	#else
+		if (name_type == 2)
+			return((DWORD)0xffffffff);				//Not a valid 8.3 name
+	#endif
+
+	//----- THE TYPE OF ENTRY TO LOOK FOR -----
+	//An entry is compared if its attribute byte ANDed with the mask is the value.  Volume label entries (which long filename entries
+	//also look like) are never compared.
+	if (find_type == FFS_FIND_DIRECTORY)
+	{
+		attribute_mask = 0x18;
+		attribute_value = 0x10;
+	}
+	else if (find_type == FFS_FIND_ANY)
+	{
+		attribute_mask = 0x08;
+		attribute_value = 0x00;
+	}
+	else
+	{
+		attribute_mask = 0x1a;				//Not a directory, volume or hidden entry
+		attribute_value = 0x00;
+	}
+
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		//----- LOOK FOR THE FILE IN THE DIRECTORY INDEX -----
+		//(Filenames with wildcard characters have to be compared with each directory entry.  Only the root directory files are indexed)
+		if ((name_type != 1) && (find_type == FFS_FIND_FILE) && (read_write_directory_start_cluster == 0))
+		{
+			if (ffs_directory_index_state == FFS_DIRECTORY_INDEX_NOT_BUILT)
+				ffs_build_directory_index();
+
+			if (name_type == 0)
+			{
+				read_cluster_number = ffs_find_file_in_directory_index(converted_file_name, converted_file_extension, file_size, attribute_byte,
+																		directory_entry_sector, directory_entry_within_sector);
+				if (read_cluster_number != 0xffffffff)
+				{
+					for (temp = 0; temp < 8; temp++)
+						*(read_file_name + temp) = converted_file_name[temp];
+					for (temp = 0; temp < 3; temp++)
+						*(read_file_extension + temp) = converted_file_extension[temp];
+					return(read_cluster_number);
+				}
+			}
+
+			#ifdef FFS_LONG_FILENAME_MAX
+				if (long_name_entries)
+				{
+					read_cluster_number = ffs_find_long_filename_in_directory_index(filename, long_name_length, file_size, attribute_byte, directory_entry_sector,
+																					directory_entry_within_sector, read_file_name, read_file_extension);
+					if (read_cluster_number != 0xffffffff)
+						return(read_cluster_number);
+				}
+			#endif
+
+			if (ffs_directory_index_state == FFS_DIRECTORY_INDEX_COMPLETE)
+				return((DWORD)0xffffffff);				//Every file is in the index so the file doesn't exist
+		}
+	#endif
+
+	//----- SET UP THE NAME TO COMPARE EACH DIRECTORY ENTRY WITH -----
+	//Each directory entry byte is ANDed with the mask before comparing so that '?' wildcard characters match anything (mask 0x00) and
+	//letters match lower case entries (mask 0xdf).  Byte 11 is the attribute byte which isn't compared.
+	for (temp = 0; temp < 11; temp++)
+	{
+		if (temp < 8)
+			match_name[temp] = converted_file_name[temp];
+		else
+			match_name[temp] = converted_file_extension[temp - 8];
+
+		if (match_name[temp] == '?')
+			match_mask[temp] = 0x00;
+		else if ((match_name[temp] >= 'A') && (match_name[temp] <= 'Z'))
+			match_mask[temp] = 0xdf;
+		else
+			match_mask[temp] = 0xff;
+
+		match_name[temp] &= match_mask[temp];
+	}
+	match_name[11] = 0x00;
+	match_mask[11] = 0x00;
+
+	#ifdef FFS_DIRECTORY_WIDE_COMPARE
+		memcpy(&match_name_words[0], &match_name[0], 12);
+		memcpy(&match_mask_words[0], &match_mask[0], 12);
+	#endif
+
+	//----- SEARCH THE DIRECTORY A SECTOR AT A TIME -----
+	//(The entries are compared where they are in the sector buffer - only the matching entry is copied out)
+	entries_per_sector = (BYTE)(ffs_bytes_per_sector >> 5);			// /32 as each directory entry is 32 bytes
+	entry_number = 0;
+	ffs_move_to_directory_start();
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//No entries from the end of directory marker on are used
+		if (entry_number == ffs_directory_end_entry_number)
+			return((DWORD)0xffffffff);
+
+		//GET THE NEXT SECTOR
+		if (ffs_move_to_next_directory_sector() == 0)
+			return((DWORD)0xffffffff);				//Reached end of directory
+
+		FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+		ffs_read_sector_to_buffer (read_write_directory_last_lba);
+		FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
+
+		//CHECK EACH ENTRY IN THE SECTOR
+		for (entry = 0; entry < entries_per_sector; entry++)
+		{
+			//If 1st value is 0x00 then entry has never been used (erased entries are 0xe5) so 0x00 is the end of used directory marker)
+			if (buffer_pointer[0] == 0x00)
+			{
+				ffs_directory_end_entry_number = entry_number;
+				return((DWORD)0xffffffff);
+			}
+			entry_number++;
+
+			#ifdef FFS_LONG_FILENAME_MAX
+				//----- LONG FILENAME ENTRY -----
+				//Its characters are compared where they are in the sector buffer, so the long filename is never assembled
+				if ((buffer_pointer[0] != 0xe5) && (buffer_pointer[11] == 0x0f))
+				{
+					temp = ffs_follow_long_filename_entry(buffer_pointer, &long_name_sequence, &long_name_checksum);
+					if (temp == 2)
+					{
+						//The first entry of a long filename.  Its sequence number is the number of entries, so names of a different length
+						//are rejected without comparing any characters.
+						long_name_matches = (long_name_sequence == long_name_entries);
+						#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+							long_name_hash = 0;
+						#endif
+					}
+					if (temp)
+					{
+						if (long_name_matches)
+							long_name_matches = ffs_compare_long_filename_entry(buffer_pointer, filename, long_name_length);
+						#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+							long_name_hash += ffs_long_filename_entry_hash(buffer_pointer);
+						#endif
+					}
+					buffer_pointer += 32;
+					continue;
+				}
+
+				//The long filename entries before an 8.3 entry belong to it if they ended with sequence number 1 and have its checksum
+				if ((long_name_sequence != 1) || (ffs_short_name_checksum(buffer_pointer, buffer_pointer + 8) != long_name_checksum))
+					long_name_sequence = 0;
+			#endif
+
+			//Skip deleted entries (0xe5) and entries of other types without comparing the name
+			if ((buffer_pointer[0] != 0xe5) && ((buffer_pointer[11] & attribute_mask) == attribute_value))
+			{
+				//Does the name match?
+				this_is_the_file = 0;
+				if (name_type != 2)
+				{
+				#ifdef FFS_DIRECTORY_WIDE_COMPARE
+					memcpy(&entry_words[0], buffer_pointer, 12);
+					if (
+						((entry_words[0] & match_mask_words[0]) == match_name_words[0]) &&
+						((entry_words[1] & match_mask_words[1]) == match_name_words[1]) &&
+						((entry_words[2] & match_mask_words[2]) == match_name_words[2])
+						)
+					{
+						this_is_the_file = 1;
+					}
+				#else
+					for (temp = 0; temp < 11; temp++)
+					{
+						if ((buffer_pointer[temp] & match_mask[temp]) != match_name[temp])
+							break;
+					}
+					if (temp == 11)
+						this_is_the_file = 1;
+				#endif
+				}
+
+				#ifdef FFS_LONG_FILENAME_MAX
+					//Does its long filename match?
+					if ((long_name_sequence) && (long_name_matches))
+						this_is_the_file = 1;
+				#endif
+
+				if (this_is_the_file)
+				{
+					//----- THIS IS THE FILE -----
+					read_write_directory_last_entry = entry;
+					ffs_get_directory_entry(buffer_pointer, read_file_name, read_file_extension, attribute_byte, file_size, &read_cluster_number);
+					*directory_entry_sector = read_write_directory_last_lba;
+					*directory_entry_within_sector = entry;
+
+					#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+						#ifdef FFS_LONG_FILENAME_MAX
+							if (long_name_sequence == 0)
+								long_name_hash = 0;
+							else if (long_name_hash == 0)
+								long_name_hash = 1;				//(0 = no long filename)
+						#endif
+						if (name_type != 1)
+							ffs_add_file_to_directory_index(read_file_name, read_file_extension, *attribute_byte, read_cluster_number, *file_size, *directory_entry_sector, *directory_entry_within_sector, long_name_hash);
+					#endif
+					return(read_cluster_number);
+				}
+			}
+			#ifdef FFS_LONG_FILENAME_MAX
+				long_name_sequence = 0;
+			#endif
+
+			buffer_pointer += 32;
+		}
+	}
+}
+
+
+
+
+
+
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+//*******************************************
+//*******************************************
+//********** BUILD DIRECTORY INDEX **********
+//*******************************************
+//*******************************************
+//Reads every entry in the root directory and adds each file that ffs_find_file can match to the directory index.  The root directory must
+//be the selected directory.
+void ffs_build_directory_index (void)
+{
+	WORD count;
+	BYTE start_from_beginning;
+	BYTE file_name[8];
+	BYTE file_extension[3];
+	BYTE attribute_byte;
+	DWORD file_size;
+	DWORD cluster_number;
+	DWORD directory_entry_sector;
+	BYTE directory_entry_within_sector;
+	DWORD entry_number;
+	WORD long_name_hash = 0;
+#ifdef FFS_LONG_FILENAME_MAX
+	BYTE *entry_pointer;
+	BYTE long_name_sequence = 0;
+	BYTE long_name_checksum = 0;
+#endif
+
+
+	for (count = 0; count < FFS_DIRECTORY_INDEX_ENTRIES; count++)
+		ffs_directory_index[count].directory_entry_sector = 0xffffffff;
+
+	ffs_directory_index_state = FFS_DIRECTORY_INDEX_COMPLETE;			//(Changed to partial if a file doesn't fit in the index)
+	ffs_directory_index_volume = ffs_active_volume;
+
+	start_from_beginning = 1;
+	entry_number = 0;
+	while (entry_number != ffs_directory_end_entry_number)			//(No entries from the end of directory marker on are used)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		if (ffs_read_next_directory_entry (file_name, file_extension, &attribute_byte, &file_size, &cluster_number, start_from_beginning,
+											&directory_entry_sector, &directory_entry_within_sector) == 0)
+			break;
+
+		start_from_beginning = 0;
+
+		//0x00 = entry has never been used = end of used directory marker
+		if (file_name[0] == 0x00)
+		{
+			ffs_directory_end_entry_number = entry_number;
+			break;
+		}
+		entry_number++;
+
+		#ifdef FFS_LONG_FILENAME_MAX
+			//----- LONG FILENAME ENTRIES -----
+			//Make the hash of the long filename from its entries (see ffs_find_directory_entry)
+			entry_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5);
+			if ((file_name[0] != 0xe5) && (attribute_byte == 0x0f))
+			{
+				if (ffs_follow_long_filename_entry(entry_pointer, &long_name_sequence, &long_name_checksum) == 2)
+					long_name_hash = 0;
+				if (long_name_sequence)
+					long_name_hash += ffs_long_filename_entry_hash(entry_pointer);
+				continue;
+			}
+
+			if ((long_name_sequence != 1) || (ffs_short_name_checksum(entry_pointer, entry_pointer + 8) != long_name_checksum))
+				long_name_hash = 0;
+			else if (long_name_hash == 0)
+				long_name_hash = 1;					//(0 = no long filename)
+			long_name_sequence = 0;
+		#endif
+
+		//Don't add deleted entries (0xe5) or volume, directory or hidden entries
+		if ((file_name[0] != 0xe5) && ((attribute_byte & 0x1a) == 0))
+			ffs_add_file_to_directory_index(file_name, file_extension, attribute_byte, cluster_number, file_size, directory_entry_sector, directory_entry_within_sector, long_name_hash);
+	}
+}
+
+
+
+
+
+
+//**************************************************
+//**************************************************
+//********** FIND FILE IN DIRECTORY INDEX **********
+//**************************************************
+//**************************************************
+//file_name, file_extension
+//	DOS filename to look for (no wildcard characters)
+//The other parameters are as ffs_find_file.  read_write_directory_last_lba and read_write_directory_last_entry are set to the files
+//directory entry so that ffs_overwrite_last_directory_entry may be used after this function, as with ffs_find_file.
+//
+//Returns
+//	file start cluster number (0xffffffff = file not in the index)
+DWORD ffs_find_file_in_directory_index (BYTE *file_name, BYTE *file_extension, DWORD *file_size, BYTE *attribute_byte,
+										DWORD *directory_entry_sector, BYTE *directory_entry_within_sector)
+{
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+	WORD entry;
+	WORD count;
+	BYTE temp;
+	BYTE this_is_the_file;
+
+
+	entry = ffs_directory_index_hash(file_name, file_extension);
+
+	for (count = 0; count < FFS_DIRECTORY_INDEX_ENTRIES; count++)
+	{
+		index_entry = &ffs_directory_index[entry];
+
+		//An entry that has never been used ends the search
+		if (index_entry->directory_entry_sector == 0xffffffff)
+			break;
+
+		//(Removed entries are skipped as files added after them may follow them)
+		if (index_entry->directory_entry_sector != 0)
+		{
+			this_is_the_file = 1;
+			for (temp = 0; temp < 8; temp++)
+			{
+				if (index_entry->file_name[temp] != file_name[temp])
+					this_is_the_file = 0;
+			}
+			for (temp = 0; temp < 3; temp++)
+			{
+				if (index_entry->file_extension[temp] != file_extension[temp])
+					this_is_the_file = 0;
+			}
+
+			if (this_is_the_file)
+			{
+				*file_size = index_entry->file_size;
+				*attribute_byte = index_entry->attribute_byte;
+				*directory_entry_sector = index_entry->directory_entry_sector;
+				*directory_entry_within_sector = index_entry->directory_entry_within_sector;
+
+				read_write_directory_last_lba = index_entry->directory_entry_sector;
+				read_write_directory_last_entry = index_entry->directory_entry_within_sector;
+
+				return(index_entry->start_cluster);
+			}
+		}
+
+		entry = ((entry + 1) & (FFS_DIRECTORY_INDEX_ENTRIES - 1));
+	}
+	return((DWORD)0xffffffff);
+}
+
+
+
+
+
+
+#ifdef FFS_LONG_FILENAME_MAX
+//***********************************************************
+//***********************************************************
+//********** FIND LONG FILENAME IN DIRECTORY INDEX **********
+//***********************************************************
+//***********************************************************
+//long_name, long_name_length
+//	The long filename to look for (not null terminated, no wildcard characters)
+//The other parameters are as ffs_find_file.  Only the index entries with the same long filename hash are checked, by reading the long
+//filename entries before their 8.3 entry.  read_write_directory_last_lba and read_write_directory_last_entry are set to the files 8.3
+//directory entry, as with ffs_find_file.
+//
+//Returns
+//	file start cluster number (0xffffffff = file not in the index)
+DWORD ffs_find_long_filename_in_directory_index (const char *long_name, WORD long_name_length, DWORD *file_size, BYTE *attribute_byte,
+												DWORD *directory_entry_sector, BYTE *directory_entry_within_sector, BYTE *read_file_name,
+												BYTE *read_file_extension)
+{
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+	WORD long_name_hash;
+	WORD count;
+	BYTE temp;
+	DWORD entry_number;
+	DWORD directory_cluster;
+
+
+	long_name_hash = ffs_long_filename_hash(long_name, long_name_length);
+
+	for (count = 0; count < FFS_DIRECTORY_INDEX_ENTRIES; count++)
+	{
+		index_entry = &ffs_directory_index[count];
+
+		if (
+			(index_entry->long_name_hash == long_name_hash) &&
+			(index_entry->directory_entry_sector != 0xffffffff) &&
+			(index_entry->directory_entry_sector != 0)
+			)
+		{
+			entry_number = ffs_get_directory_entry_number(index_entry->directory_entry_sector, index_entry->directory_entry_within_sector, &directory_cluster);
+			if ((entry_number != 0xffffffff) && (ffs_check_long_filename(long_name, long_name_length, entry_number)))
+			{
+				for (temp = 0; temp < 8; temp++)
+					read_file_name[temp] = index_entry->file_name[temp];
+				for (temp = 0; temp < 3; temp++)
+					read_file_extension[temp] = index_entry->file_extension[temp];
+				*file_size = index_entry->file_size;
+				*attribute_byte = index_entry->attribute_byte;
+				*directory_entry_sector = index_entry->directory_entry_sector;
+				*directory_entry_within_sector = index_entry->directory_entry_within_sector;
+
+				read_write_directory_last_lba = index_entry->directory_entry_sector;
+				read_write_directory_last_entry = index_entry->directory_entry_within_sector;
+
+				return(index_entry->start_cluster);
+			}
+		}
+	}
+	return((DWORD)0xffffffff);
+}
+#endif
+
+
+
+
+
+//*************************************************
+//*************************************************
+//********** ADD FILE TO DIRECTORY INDEX **********
+//*************************************************
+//*************************************************
+//If the index is full the index is flagged as partial so that files that aren't found in it are looked for in the directory
+//long_name_hash
+//	ffs_long_filename_hash of the files long filename (0 = the file doesn't have a long filename)
+void ffs_add_file_to_directory_index (BYTE *file_name, BYTE *file_extension, BYTE attribute_byte, DWORD start_cluster, DWORD file_size,
+										DWORD directory_entry_sector, BYTE directory_entry_within_sector, WORD long_name_hash)
+{
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+	WORD entry;
+	WORD count;
+	BYTE temp;
+
+
+	//If the index hasn't been built yet the file will be added when it is
+	if (ffs_directory_index_state == FFS_DIRECTORY_INDEX_NOT_BUILT)
+		return;
+
+	//Only root directory files are indexed (not subdirectories or hidden files)
+	if ((read_write_directory_start_cluster != 0) || (attribute_byte & 0x1a))
+		return;
+
+	entry = ffs_directory_index_hash(file_name, file_extension);
+
+	for (count = 0; count < FFS_DIRECTORY_INDEX_ENTRIES; count++)
+	{
+		index_entry = &ffs_directory_index[entry];
+
+		//Use the first entry that has never been used or has been removed
+		if ((index_entry->directory_entry_sector == 0xffffffff) || (index_entry->directory_entry_sector == 0))
+		{
+			index_entry->directory_entry_sector = directory_entry_sector;
+			index_entry->directory_entry_within_sector = directory_entry_within_sector;
+			for (temp = 0; temp < 8; temp++)
+				index_entry->file_name[temp] = file_name[temp];
+			for (temp = 0; temp < 3; temp++)
+				index_entry->file_extension[temp] = file_extension[temp];
+			index_entry->attribute_byte = attribute_byte;
+			index_entry->start_cluster = start_cluster;
+			index_entry->file_size = file_size;
+			#ifdef FFS_LONG_FILENAME_MAX
+				index_entry->long_name_hash = long_name_hash;
+			#endif
+			return;
+		}
+
+		entry = ((entry + 1) & (FFS_DIRECTORY_INDEX_ENTRIES - 1));
+	}
+
+	//----- THE INDEX IS FULL -----
+	ffs_directory_index_state = FFS_DIRECTORY_INDEX_PARTIAL;
+}
+
+
+
+
+
+
+//***********************************************
+//***********************************************
+//********** GET DIRECTORY INDEX ENTRY **********
+//***********************************************
+//***********************************************
+//Returns a pointer to the index entry for the file with this directory entry, or 0 if the file isn't in the index
+FFS_DIRECTORY_INDEX_ENTRY* ffs_get_directory_index_entry (DWORD directory_entry_sector, BYTE directory_entry_within_sector)
+{
+	WORD count;
+
+
+	if (ffs_directory_index_state == FFS_DIRECTORY_INDEX_NOT_BUILT)
+		return(0);
+
+	for (count = 0; count < FFS_DIRECTORY_INDEX_ENTRIES; count++)
+	{
+		if (
+			(ffs_directory_index[count].directory_entry_sector == directory_entry_sector) &&
+			(ffs_directory_index[count].directory_entry_within_sector == directory_entry_within_sector)
+			)
+		{
+			return(&ffs_directory_index[count]);
+		}
+	}
+	return(0);
+}
+
+
+
+
+
+
+//******************************************
+//******************************************
+//********** DIRECTORY INDEX HASH **********
+//******************************************
+//******************************************
+//Returns the index entry to start looking for a DOS filename from
+WORD ffs_directory_index_hash (BYTE *file_name, BYTE *file_extension)
+{
+	WORD hash = 0;
+	WORD count;
+
+
+	for (count = 0; count < 8; count++)
+		hash = (hash << 3) + hash + (WORD)file_name[count];				//(x 9 + character)
+
+	for (count = 0; count < 3; count++)
+		hash = (hash << 3) + hash + (WORD)file_extension[count];
+
+	return((hash ^ (hash >> 8)) & (FFS_DIRECTORY_INDEX_ENTRIES - 1));
+}
+#endif		//#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** FIND PATH DIRECTORY **********
+//*****************************************
+//*****************************************
+//Follows the directories in a path.
+//path
+//	The path and name, e.g. "LOG\\2026\\DAY17.CSV" (see ffs_find_file)
+//file_name
+//	A pointer to the name at the end of the path will be written to here ("DAY17.CSV" - this is an empty string if the path ends with a '\\' or '/')
+//
+//Returns
+//	The start cluster of the directory that contains the name (0 = root directory, 0xffffffff = a directory in the path doesn't exist)
+DWORD ffs_find_path_directory (const char *path, const char **file_name)
+{
+	DWORD directory_cluster;
+	const char *name_end;
+
+
+	//----- START FROM THE ROOT DIRECTORY OR THE CURRENT DIRECTORY -----
+	if ((*path == '\\') || (*path == '/'))
+	{
+		directory_cluster = 0;
+		path++;
+	}
+	else
+	{
+		directory_cluster = ffs_current_directory_cluster;
+	}
+
+	//----- FOLLOW EACH DIRECTORY IN THE PATH -----
+	while (1)
+	{
+		//Find the end of this part of the path
+		name_end = path;
+		while ((*name_end != 0x00) && (*name_end != '\\') && (*name_end != '/'))
+			name_end++;
+
+		//The last part is the name
+		if (*name_end == 0x00)
+			break;
+
+		directory_cluster = ffs_find_subdirectory(directory_cluster, path, (WORD)(name_end - path));
+		if (directory_cluster == 0xffffffff)
+			return(0xffffffff);
+
+		path = name_end + 1;
+	}
+
+	*file_name = path;
+	return(directory_cluster);
+}
+
+
+
+
+
+
+//***************************************
+//***************************************
+//********** FIND SUBDIRECTORY **********
+//***************************************
+//***************************************
+//directory_cluster
+//	The start cluster of the directory to look in (0 = root directory)
+//name, name_length
+//	The subdirectory name (it ends with a '\\', '/' or null, which name_length is the position of).  "." and an empty name are the
+//	directory itself and ".." is its parent directory.
+//
+//Returns
+//	The start cluster of the subdirectory (0 = root directory, 0xffffffff = the subdirectory doesn't exist)
+DWORD ffs_find_subdirectory (DWORD directory_cluster, const char *name, WORD name_length)
+{
+	BYTE read_file_name[8];
+	BYTE read_file_extension[3];
+	BYTE converted_file_name[8];
+	BYTE converted_file_extension[3];
+	BYTE attribute_byte;
+	DWORD file_size;
+	DWORD directory_entry_sector;
+	BYTE directory_entry_within_sector;
+	DWORD start_cluster;
+	BYTE name_type;
+#ifdef FFS_PATH_CACHE_ENTRIES
+	FFS_PATH_CACHE_ENTRY *cache_entry;
+	BYTE this_is_the_directory;
+	BYTE count;
+	BYTE temp;
+#endif
+
+
+	//----- THIS DIRECTORY -----
+	if (
+		(name_length == 0) ||
+		((name_length == 1) && (name[0] == '.'))
+		)
+	{
+		return(directory_cluster);
+	}
+
+	//----- PARENT DIRECTORY -----
+	if ((name_length == 2) && (name[0] == '.') && (name[1] == '.'))
+	{
+		if (directory_cluster == 0)
+			return(0);							//(The root directory is its own parent)
+
+		//The second entry of a subdirectory is its ".." entry, which holds the parent directory start cluster (0 = root directory)
+		FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+		ffs_read_sector_to_buffer(data_area_start_sector + ((directory_cluster - 2) * sectors_per_cluster));
+		FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+		ffs_get_directory_entry(&FFS_DRIVER_GEN_512_BYTE_BUFFER[32], read_file_name, read_file_extension, &attribute_byte, &file_size, &start_cluster);
+		if ((read_file_name[0] != '.') || (read_file_name[1] != '.') || ((attribute_byte & 0x10) == 0))
+			return(0xffffffff);
+
+		if ((disk_is_fat_32) && (start_cluster == root_directory_start_sector_cluster))
+			start_cluster = 0;
+		return(start_cluster);
+	}
+
+	//(0 = valid 8.3 name, 1 = wildcard characters, 2 = not a valid 8.3 name)
+	name_type = ffs_convert_filename_to_dos(name, converted_file_name, converted_file_extension);
+	if (name_type == 1)
+		return(0xffffffff);
+
+	#ifdef FFS_PATH_CACHE_ENTRIES
+		//----- LOOK FOR THE SUBDIRECTORY IN THE PATH CACHE -----
+		//(Only subdirectories looked for by their 8.3 name are cached)
+		for (count = 0; (count < FFS_PATH_CACHE_ENTRIES) && (name_type == 0); count++)
+		{
+			cache_entry = &ffs_path_cache[count];
+			if ((cache_entry->volume == ffs_active_volume) && (cache_entry->parent_cluster == directory_cluster))
+			{
+				this_is_the_directory = 1;
+				for (temp = 0; temp < 8; temp++)
+				{
+					if (cache_entry->file_name[temp] != converted_file_name[temp])
+						this_is_the_directory = 0;
+				}
+				for (temp = 0; temp < 3; temp++)
+				{
+					if (cache_entry->file_extension[temp] != converted_file_extension[temp])
+						this_is_the_directory = 0;
+				}
+				if (this_is_the_directory)
+					return(cache_entry->start_cluster);
+			}
+		}
+	#endif
+
+	//----- LOOK FOR THE SUBDIRECTORY IN THE DIRECTORY -----
+	ffs_select_directory(directory_cluster);
+	start_cluster = ffs_find_directory_entry(name, FFS_FIND_DIRECTORY, &file_size, &attribute_byte, &directory_entry_sector,
+											&directory_entry_within_sector, read_file_name, read_file_extension);
+	if ((start_cluster == 0xffffffff) || (start_cluster < 2))
+		return(0xffffffff);
+
+	#ifdef FFS_PATH_CACHE_ENTRIES
+		//----- ADD IT TO THE PATH CACHE -----
+		//(Wildcard names have been rejected above so this is the name that was looked for)
+		if (name_type == 0)
+		{
+			cache_entry = &ffs_path_cache[ffs_path_cache_next_entry];
+			cache_entry->volume = ffs_active_volume;
+			cache_entry->parent_cluster = directory_cluster;
+			for (count = 0; count < 8; count++)
+				cache_entry->file_name[count] = read_file_name[count];
+			for (count = 0; count < 3; count++)
+				cache_entry->file_extension[count] = read_file_extension[count];
+			cache_entry->start_cluster = start_cluster;
+
+			ffs_path_cache_next_entry++;
+			if (ffs_path_cache_next_entry >= FFS_PATH_CACHE_ENTRIES)
+				ffs_path_cache_next_entry = 0;
+		}
+	#endif
+
+	return(start_cluster);
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** SELECT DIRECTORY **********
+//**************************************
+//**************************************
+//Sets the directory that ffs_find_directory_entry, ffs_read_next_directory_entry and the other directory functions work on.
+//start_cluster
+//	The start cluster of the directory (0 = root directory)
+//The first free entry hint and the end of directory marker of the directory that was selected are stored in the directory hint table
+//and those of the new directory are restored from it (if FFS_DIRECTORY_HINT_ENTRIES isn't defined they are just reset).
+void ffs_select_directory (DWORD start_cluster)
+{
+#ifdef FFS_DIRECTORY_HINT_ENTRIES
+	BYTE count;
+	FFS_DIRECTORY_HINT *hint;
+#endif
+
+
+	read_write_directory_start_cluster = start_cluster;
+
+	if (start_cluster == ffs_directory_hint_start_cluster)
+		return;
+
+	#ifdef FFS_DIRECTORY_HINT_ENTRIES
+		//----- STORE THE HINTS OF THE DIRECTORY THAT WAS SELECTED -----
+		ffs_store_directory_hints();
+	#endif
+
+	ffs_directory_hint_start_cluster = start_cluster;
+	ffs_directory_free_entry.entry_number = 0xffffffff;			//Not known
+	ffs_directory_end_entry_number = 0xffffffff;
+
+	#ifdef FFS_DIRECTORY_HINT_ENTRIES
+		//----- RESTORE THE HINTS OF THE NEW DIRECTORY -----
+		//(The table entry is freed as the hints are now held for the selected directory)
+		for (count = 0; count < FFS_DIRECTORY_HINT_ENTRIES; count++)
+		{
+			hint = &ffs_directory_hint[count];
+			if ((hint->volume == ffs_active_volume) && (hint->start_cluster == start_cluster))
+			{
+				ffs_directory_free_entry = hint->free_entry;
+				ffs_directory_end_entry_number = hint->end_entry_number;
+				hint->start_cluster = 0xffffffff;						//Entry not used
+				break;
+			}
+		}
+	#endif
+}
+
+
+
+
+
+
+#ifdef FFS_DIRECTORY_HINT_ENTRIES
+//*******************************************
+//*******************************************
+//********** STORE DIRECTORY HINTS **********
+//*******************************************
+//*******************************************
+//Stores the first free entry hint and the end of directory marker of the selected directory in the directory hint table, if anything is
+//known about it.  An unused entry is used if there is one, otherwise the oldest is replaced.
+void ffs_store_directory_hints (void)
+{
+	BYTE count;
+	FFS_DIRECTORY_HINT *hint;
+
+
+	if ((ffs_directory_free_entry.entry_number == 0xffffffff) && (ffs_directory_end_entry_number == 0xffffffff))
+		return;
+
+	hint = 0;
+	for (count = 0; count < FFS_DIRECTORY_HINT_ENTRIES; count++)
+	{
+		if (ffs_directory_hint[count].start_cluster == 0xffffffff)
+		{
+			hint = &ffs_directory_hint[count];
+			break;
+		}
+	}
+	if (hint == 0)
+	{
+		hint = &ffs_directory_hint[ffs_directory_hint_next_entry];
+		ffs_directory_hint_next_entry++;
+		if (ffs_directory_hint_next_entry >= FFS_DIRECTORY_HINT_ENTRIES)
+			ffs_directory_hint_next_entry = 0;
+	}
+
+	hint->volume = ffs_active_volume;
+	hint->start_cluster = ffs_directory_hint_start_cluster;
+	hint->free_entry = ffs_directory_free_entry;
+	hint->end_entry_number = ffs_directory_end_entry_number;
+}
+#endif
+
+
+
+
+
+
+//*******************************************************************
+//*******************************************************************
+//********** CONVERT FILE NAME TO 8 CHARACTER DOS FILENAME **********
+//*******************************************************************
+//*******************************************************************
+//Source filename is a case insensitive string with between 1 and 8 filename characters, a period (full stop) character, between 1 and 3 extension characters and a terminating null.
+//The period and extension may be left out (as is usual for directory names).  The name may also end with a '\\' or '/' (when it is part of a path).
+//Returns:
+//	1 if the filename contained any wildcard characters
+//	2 if it isn't a valid 8.3 name (too long, or it has characters that are only allowed in long filenames) - the converted name is not usable
+//	0 if it is a valid 8.3 name
+//(This allows calling functions to detect invalid names if they are creating a new file)
+BYTE ffs_convert_filename_to_dos (const char *source_filename, BYTE *dos_filename, BYTE *dos_extension)
+{
+	BYTE temp;
+	BYTE no_null_found_yet;
+	BYTE wildcard_character_found = 0;
+	BYTE asterix_wildcard_used;
+	const char *name_pointer;
+	BYTE name_length;
+	BYTE extension_length;
+	BYTE valid_name;
+
+	//----- CHECK IT IS A VALID 8.3 NAME -----
+	//(1 - 8 name characters, an optional '.' and 0 - 3 extension characters)
+	name_length = 0;
+	extension_length = 0;
+	valid_name = 1;
+	for (name_pointer = source_filename; ((*name_pointer != 0x00) && (*name_pointer != '\\') && (*name_pointer != '/')); name_pointer++)
+	{
+		temp = (BYTE)*name_pointer;
+
+		if ((temp == '?') || (temp == '*'))
+			wildcard_character_found = 1;
+
+		if (temp == '.')
+		{
+			if (extension_length)
+				valid_name = 0;					//More than 1 '.'
+			extension_length = 1;				//(The '.' is counted as part of the extension)
+		}
+		else if (
+			(temp < 0x20) || (temp == ' ') || (temp == '"') || (temp == '+') || (temp == ',') || (temp == ':') || (temp == ';') ||
+			(temp == '<') || (temp == '=') || (temp == '>') || (temp == '[') || (temp == ']') || (temp == '|')
+			)
+		{
+			valid_name = 0;						//Characters that are only allowed in long filenames (or not at all)
+		}
+		else if (extension_length)
+		{
+			extension_length++;
+		}
+		else
+		{
+			name_length++;
+		}
+	}
+	if ((name_length == 0) || (name_length > 8) || (extension_length > 4))
+		valid_name = 0;
+
+	//----- DO THE FILENAME -----
+	no_null_found_yet = 1;
+	asterix_wildcard_used = 0;
+	for (temp = 0; temp < 8; temp++)
+	{
+		//Flag if filename contains a wildcard character (for return)
+		if ((*source_filename == '?') || (*source_filename == '*'))
+			wildcard_character_found = 1;
+
+		//Check for asterix wildcard character
+		if (*source_filename == '*')
+			asterix_wildcard_used = 1;
+
+		//Check for terminating '.' (or null, '\\' or '/' if there is no extension)
+		if ((*source_filename == '.') || (*source_filename == 0x00) || (*source_filename == '\\') || (*source_filename == '/'))
+			no_null_found_yet = 0;
+
+		//COPY THE CHARACTER
+		if (asterix_wildcard_used)
+		{
+			//Doing asterix wildcard replace
+			*dos_filename++ = '?';
+			if (no_null_found_yet)
+				*source_filename++;
+		}
+		else if (no_null_found_yet)
+		{
+			//Copy the character
+			*dos_filename++ = *source_filename++;
+		}
+		else
+		{
+			//Pad rest of name with spaces as characters are unused
+			*dos_filename++ = 0x20;				//0x20 is used for unused trailing characters
+		}
+	}
+
+	//DUMP THE '.'
+	if (*source_filename == '.')
+		source_filename++;
+
+	//----- DO THE EXTENSION -----
+	no_null_found_yet = 1;
+	asterix_wildcard_used = 0;
+	for (temp = 0; temp < 3; temp++)
+	{
+		//Flag if filename contains a wildcard character (for return)
+		if ((*source_filename == '?') || (*source_filename == '*'))
+			wildcard_character_found = 1;
+
+		//Check for asterix wildcard character
+		if (*source_filename == '*')
+			asterix_wildcard_used = 1;
+
+		//Check for terminating null ('\\' or '/')
+		if ((*source_filename == 0x00) || (*source_filename == '\\') || (*source_filename == '/'))
+			no_null_found_yet = 0;
+
+		//COPY THE CHARACTER
+		if (asterix_wildcard_used)
+		{
+			//Doing asterix wildcard replace
+			*dos_extension++ = '?';
+			if (no_null_found_yet)
+				*source_filename++;
+		}
+		else if (no_null_found_yet)
+		{
+			//Copy the character
+			*dos_extension++ = *source_filename++;
+		}
+		else
+		{
+			//Pad rest of name with spaces as characters are unused
+			*dos_extension++ = 0x20;				//0x20 is used for unused trailing characters
+		}
+	}
+
+
+	//----- CONVERT TO UPPERCASE -----
+	dos_filename -= 8;
+	dos_extension -= 3;
+
+	for (temp = 0; temp < 8; temp++)
+	{
+		if ((dos_filename[temp] >= 0x61) && (dos_filename[temp] <= 0x7a))
+			dos_filename[temp] -= 0x20;
+	}
+	for (temp = 0; temp < 3; temp++)
+	{
+		if ((dos_extension[temp] >= 0x61) && (dos_extension[temp] <= 0x7a))
+			dos_extension[temp] -= 0x20;
+	}
+
+	if (wildcard_character_found)
+		return(1);
+	if (valid_name == 0)
+		return(2);
+	return(0);
+}
+
+
+
+
+
+
+#ifdef FFS_LONG_FILENAME_MAX
+//************************************************
+//************************************************
+//********** FOLLOW LONG FILENAME ENTRY **********
+//************************************************
+//************************************************
+//Called for each long filename entry as a directory is read in order.  The entries of a long filename are stored before its 8.3 entry,
+//last part of the name first.  Each entry holds 13 characters of the name, its sequence number (1 = the first 13 characters, with 0x40
+//added for the entry with the end of the name) and the checksum of the 8.3 name.  The long filename belongs to the 8.3 entry after it if
+//the sequence number has reached 1 and the checksum is the checksum of the 8.3 name (see ffs_short_name_checksum).
+//long_name_sequence, long_name_checksum
+//	The sequence number and checksum of the previous long filename entry (sequence 0 = not reading a long filename).  Updated for this entry.
+//
+//Returns
+//	2 = the first entry of a long filename (the entry with the end of the name)
+//	1 = the next entry of the long filename
+//	0 = not part of a valid long filename (long_name_sequence is set to 0)
+BYTE ffs_follow_long_filename_entry (BYTE *entry_pointer, BYTE *long_name_sequence, BYTE *long_name_checksum)
+{
+	BYTE sequence;
+
+
+	sequence = entry_pointer[0] & 0x1f;
+
+	if (entry_pointer[0] & 0x40)
+	{
+		*long_name_sequence = sequence;
+		*long_name_checksum = entry_pointer[13];
+		if (sequence == 0)
+			return(0);
+		return(2);
+	}
+
+	if ((*long_name_sequence) && (sequence == (*long_name_sequence - 1)) && (entry_pointer[13] == *long_name_checksum))
+	{
+		*long_name_sequence = sequence;
+		return(1);
+	}
+
+	*long_name_sequence = 0;
+	return(0);
+}
+
+
+
+
+
+
+//*************************************************
+//*************************************************
+//********** COMPARE LONG FILENAME ENTRY **********
+//*************************************************
+//*************************************************
+//Compares the 13 characters of a long filename entry with the part of a long filename that it holds (without case).
+//long_name, long_name_length
+//	The long filename (not null terminated)
+//
+//Returns
+//	1 if the characters match, 0 if not
+BYTE ffs_compare_long_filename_entry (BYTE *entry_pointer, const char *long_name, WORD long_name_length)
+{
+	BYTE count;
+	WORD position;
+	WORD character;
+	WORD name_character;
+	BYTE *character_pointer;
+
+
+	position = (WORD)((entry_pointer[0] & 0x1f) - 1) * 13;
+	for (count = 0; count < 13; count++)
+	{
+		character_pointer = entry_pointer + ffs_long_filename_character_offsets[count];
+		character = (WORD)character_pointer[0] + ((WORD)character_pointer[1] << 8);
+
+		//The end of the name is followed by a 0x0000 (if there is space for it in the entry) then 0xffff padding
+		if (position == long_name_length)
+			return(character == 0x0000);
+
+		name_character = (WORD)(BYTE)long_name[position];
+		if ((name_character >= 'a') && (name_character <= 'z'))
+			name_character -= 0x20;
+		if ((character >= 'a') && (character <= 'z'))
+			character -= 0x20;
+		if (character != name_character)
+			return(0);
+
+		position++;
+	}
+	return(1);
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** CHECK LONG FILENAME **********
+//*****************************************
+//*****************************************
+//Reads the long filename entries before an 8.3 entry of the selected directory and compares them with a long filename.
+//long_name, long_name_length
+//	The long filename (not null terminated)
+//entry_number
+//	The number of the 8.3 entry in the directory
+//
+//Returns
+//	1 if the entry has this long filename, 0 if not
+BYTE ffs_check_long_filename (const char *long_name, WORD long_name_length, DWORD entry_number)
+{
+	BYTE *entry_pointer;
+	BYTE checksum;
+	BYTE sequence;
+	BYTE entries;
+
+
+	entries = (BYTE)((long_name_length + 12) / 13);
+	if ((entries == 0) || (entry_number < entries))
+		return(0);
+
+	entry_pointer = ffs_read_directory_entry_number(entry_number);
+	if (entry_pointer == 0)
+		return(0);
+	checksum = ffs_short_name_checksum(entry_pointer, entry_pointer + 8);
+
+	//The entry before the 8.3 entry has sequence number 1, the entry before that 2 etc
+	//(It is normally in the same sector, otherwise its sector is found from the directory cluster chain)
+	for (sequence = 1; sequence <= entries; sequence++)
+	{
+		if (read_write_directory_last_entry)
+		{
+			read_write_directory_last_entry--;
+			entry_pointer -= 32;
+		}
+		else
+		{
+			entry_pointer = ffs_read_directory_entry_number(entry_number - sequence);
+		}
+		if (
+			(entry_pointer == 0) ||
+			(entry_pointer[0] == 0xe5) ||
+			(entry_pointer[11] != 0x0f) ||
+			((entry_pointer[0] & 0x1f) != sequence) ||
+			(entry_pointer[13] != checksum)
+			)
+		{
+			return(0);
+		}
+
+		//Only the last entry has the end of the name flag
+		if (((entry_pointer[0] & 0x40) != 0) != (sequence == entries))
+			return(0);
+
+		if (ffs_compare_long_filename_entry(entry_pointer, long_name, long_name_length) == 0)
+			return(0);
+	}
+	return(1);
+}
+
+
+
+
+
+
+//******************************************
+//******************************************
+//********** DELETE LONG FILENAME **********
+//******************************************
+//******************************************
+//Marks the long filename entries before an 8.3 entry of the selected directory as deleted (if it has a long filename).  The first free
+//directory entry hint is moved back to them if they are before it.
+//entry_number
+//	The number of the 8.3 entry in the directory (0xffffffff = not known, nothing is done)
+void ffs_delete_long_filename (DWORD entry_number)
+{
+	BYTE *entry_pointer;
+	BYTE checksum;
+	BYTE sequence;
+	BYTE last_entry;
+
+
+	if (entry_number == 0xffffffff)
+		return;
+
+	entry_pointer = ffs_read_directory_entry_number(entry_number);
+	if (entry_pointer == 0)
+		return;
+	checksum = ffs_short_name_checksum(entry_pointer, entry_pointer + 8);
+
+	sequence = 1;
+	while (entry_number)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//The entry before is normally in the same sector, otherwise its sector is found from the directory cluster chain
+		entry_number--;
+		if (read_write_directory_last_entry)
+		{
+			read_write_directory_last_entry--;
+			entry_pointer -= 32;
+		}
+		else
+		{
+			entry_pointer = ffs_read_directory_entry_number(entry_number);
+		}
+		if (
+			(entry_pointer == 0) ||
+			(entry_pointer[0] == 0xe5) ||
+			(entry_pointer[11] != 0x0f) ||
+			((entry_pointer[0] & 0x1f) != sequence) ||
+			(entry_pointer[13] != checksum)
+			)
+		{
+			break;
+		}
+
+		//Mark the entry as deleted (the sector is written when the sector cache is flushed below)
+		last_entry = entry_pointer[0] & 0x40;
+		entry_pointer[0] = 0xe5;
+		ffs_sector_buffer->needs_writing_to_card = 1;
+
+		//If this entry is before the first free directory entry hint it becomes the hint
+		if ((ffs_directory_free_entry.entry_number != 0xffffffff) && (entry_number < ffs_directory_free_entry.entry_number))
+		{
+			ffs_directory_free_entry.entry_number = entry_number;
+			ffs_directory_free_entry.lba = read_write_directory_last_lba;
+			ffs_directory_free_entry.entry_within_sector = (BYTE)read_write_directory_last_entry;
+			ffs_directory_free_entry.cluster = read_write_directory_current_cluster;
+		}
+
+		if (last_entry)
+			break;
+		sequence++;
+	}
+
+	ffs_flush_sector_cache();
+}
+
+
+
+
+
+
+//***********************************************
+//***********************************************
+//********** WRITE LONG FILENAME ENTRY **********
+//***********************************************
+//***********************************************
+//Writes a long filename entry to the entry at read_write_directory_last_lba and read_write_directory_last_entry.  The sector buffer is
+//marked as modified but is not written to the card.
+//long_name, long_name_length
+//	The long filename (not null terminated)
+//sequence
+//	1 for the entry with the first 13 characters of the name, 2 for the next 13 characters etc
+//checksum
+//	The checksum of the 8.3 alias (see ffs_short_name_checksum)
+void ffs_write_long_filename_entry (const char *long_name, WORD long_name_length, BYTE sequence, BYTE checksum)
+{
+	BYTE *entry_pointer;
+	BYTE *character_pointer;
+	BYTE count;
+	WORD position;
+
+
+	//Ensure the sector containing the entry is the current buffer (it will normally still be in the sector cache)
+	FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+	ffs_read_sector_to_buffer (read_write_directory_last_lba);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	entry_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5);
+
+	//SEQUENCE NUMBER [1]
+	entry_pointer[0] = sequence;
+	if (sequence == (BYTE)((long_name_length + 12) / 13))
+		entry_pointer[0] |= 0x40;						//The entry with the end of the name
+
+	//ATTRIBUTE BYTE [1], TYPE [1], CHECKSUM [1]
+	entry_pointer[11] = 0x0f;							//(Read only, hidden, system and volume label)
+	entry_pointer[12] = 0x00;
+	entry_pointer[13] = checksum;
+
+	//CLUSTER [2]
+	entry_pointer[26] = 0x00;
+	entry_pointer[27] = 0x00;
+
+	//CHARACTERS [13 x 2]
+	//16 bit unicode.  The end of the name is followed by 0x0000 (if there is space for it in the entry) then 0xffff padding.
+	position = (WORD)(sequence - 1) * 13;
+	for (count = 0; count < 13; count++)
+	{
+		character_pointer = entry_pointer + ffs_long_filename_character_offsets[count];
+		if (position < long_name_length)
+		{
+			character_pointer[0] = (BYTE)long_name[position];
+			character_pointer[1] = 0x00;
+		}
+		else if (position == long_name_length)
+		{
+			character_pointer[0] = 0x00;
+			character_pointer[1] = 0x00;
+		}
+		else
+		{
+			character_pointer[0] = 0xff;
+			character_pointer[1] = 0xff;
+		}
+		position++;
+	}
+
+	ffs_sector_buffer->needs_writing_to_card = 1;
+}
+
+
+
+
+
+
+//****************************************************
+//****************************************************
+//********** CHECK LONG FILENAME CHARACTERS **********
+//****************************************************
+//****************************************************
+//Returns
+//	The length of the long filename, or 0 if it isn't a valid long filename (empty, longer than 255 characters, has characters that
+//	aren't allowed or ends with a '.' or space)
+WORD ffs_check_long_filename_characters (const char *long_name)
+{
+	WORD length;
+	BYTE character;
+
+
+	for (length = 0; long_name[length] != 0x00; length++)
+	{
+		character = (BYTE)long_name[length];
+		if (
+			(character < 0x20) || (character == '"') || (character == '*') || (character == '/') || (character == ':') || (character == '<') ||
+			(character == '>') || (character == '?') || (character == '\\') || (character == '|')
+			)
+		{
+			return(0);
+		}
+
+		if (length >= 255)
+			return(0);
+	}
+
+	if (length == 0)
+		return(0);
+	if ((long_name[length - 1] == '.') || (long_name[length - 1] == ' '))
+		return(0);
+
+	return(length);
+}
+
+
+
+
+
+
+//***************************************
+//***************************************
+//********** START SHORT ALIAS **********
+//***************************************
+//***************************************
+//Starts making the 8.3 alias for a new long filename.  The alias is the first 6 characters of the name, a '~' and the lowest number 1 - 4
+//that isn't already used by an alias with the same start and extension, and the first 3 characters after the last '.' as the extension
+//(e.g. "Log file 2026.data" = "LOGFIL~1.DAT").  If numbers 1 - 4 are all used the first 2 characters of the name, 4 hex digits of the
+//long filename hash, '~' and the lowest unused number 1 - 9 are used instead (e.g. "LO3F2A~1.DAT").  Each entry in the directory is then
+//passed to ffs_check_short_alias_entry and ffs_finish_short_alias makes the alias.
+//long_name, long_name_length
+//	The long filename (not null terminated)
+void ffs_start_short_alias (const char *long_name, WORD long_name_length, FFS_SHORT_ALIAS *alias)
+{
+	BYTE count;
+	BYTE character;
+	WORD position;
+	WORD last_dot;
+	WORD w_temp;
+
+
+	//----- MAKE THE NAME AND EXTENSION FROM THE LONG FILENAME -----
+	//(Leading '.'s and spaces are left out and characters that aren't allowed in 8.3 names become '_')
+	for (count = 0; count < 3; count++)
+		alias->extension[count] = ' ';
+
+	position = 0;
+	while ((position < long_name_length) && (long_name[position] == '.'))
+		position++;
+
+	last_dot = 0xffff;
+	for (w_temp = position; w_temp < long_name_length; w_temp++)
+	{
+		if (long_name[w_temp] == '.')
+			last_dot = w_temp;
+	}
+
+	alias->name_length = 0;
+	for ( ; (position < long_name_length) && (position != last_dot); position++)
+	{
+		character = ffs_short_alias_character((BYTE)long_name[position]);
+		if ((character) && (alias->name_length < 6))
+			alias->name[alias->name_length++] = character;
+	}
+	if (alias->name_length == 0)
+		alias->name[alias->name_length++] = '_';
+
+	if (last_dot != 0xffff)
+	{
+		count = 0;
+		for (position = last_dot + 1; (position < long_name_length) && (count < 3); position++)
+		{
+			character = ffs_short_alias_character((BYTE)long_name[position]);
+			if (character)
+				alias->extension[count++] = character;
+		}
+	}
+
+	//----- MAKE THE START OF THE HASHED FORM -----
+	alias->hash_name_length = (alias->name_length < 2) ? alias->name_length : 2;
+	for (count = 0; count < alias->hash_name_length; count++)
+		alias->hash_name[count] = alias->name[count];
+
+	w_temp = ffs_long_filename_hash(long_name, long_name_length);
+	for (count = 0; count < 4; count++)
+	{
+		character = (BYTE)(w_temp >> 12);
+		alias->hash_name[alias->hash_name_length++] = (character < 10) ? ('0' + character) : ('A' - 10 + character);
+		w_temp <<= 4;
+	}
+
+	alias->used_numbers = 0;
+	alias->used_hash_numbers = 0;
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** CHECK SHORT ALIAS ENTRY **********
+//*********************************************
+//*********************************************
+//Notes the number used by an existing 8.3 directory entry if it has the same start and extension as the alias being made.
+//file_name, file_extension
+//	The entry's name as stored in the directory (the entry must be used and not a long filename or volume label entry)
+void ffs_check_short_alias_entry (FFS_SHORT_ALIAS *alias, BYTE *file_name, BYTE *file_extension)
+{
+	BYTE count;
+	BYTE character;
+	BYTE number;
+	BYTE tail_position;
+
+
+	//----- SAME EXTENSION? -----
+	for (count = 0; count < 3; count++)
+	{
+		character = file_extension[count];
+		if ((character >= 'a') && (character <= 'z'))
+			character -= 0x20;
+		if (character != alias->extension[count])
+			return;
+	}
+
+	//----- GET THE NUMBER AFTER THE '~' -----
+	//(1 digit, the rest of the name must be spaces)
+	for (tail_position = 1; tail_position < 7; tail_position++)
+	{
+		if (file_name[tail_position] == '~')
+			break;
+	}
+	if (tail_position == 7)
+		return;
+
+	number = file_name[tail_position + 1];
+	if ((number < '1') || (number > '9'))
+		return;
+	number -= '0';
+	for (count = tail_position + 2; count < 8; count++)
+	{
+		if (file_name[count] != ' ')
+			return;
+	}
+
+	//----- SAME START? -----
+	if ((number <= 4) && (tail_position == alias->name_length))
+	{
+		for (count = 0; count < tail_position; count++)
+		{
+			character = file_name[count];
+			if ((character >= 'a') && (character <= 'z'))
+				character -= 0x20;
+			if (character != alias->name[count])
+				break;
+		}
+		if (count == tail_position)
+			alias->used_numbers |= (BYTE)(0x01 << number);
+	}
+
+	if (tail_position == alias->hash_name_length)
+	{
+		for (count = 0; count < tail_position; count++)
+		{
+			character = file_name[count];
+			if ((character >= 'a') && (character <= 'z'))
+				character -= 0x20;
+			if (character != alias->hash_name[count])
+				break;
+		}
+		if (count == tail_position)
+			alias->used_hash_numbers |= (WORD)(0x0001 << number);
+	}
+}
+
+
+
+
+
+
+//****************************************
+//****************************************
+//********** FINISH SHORT ALIAS **********
+//****************************************
+//****************************************
+//Makes the alias once every entry in the directory has been checked with ffs_check_short_alias_entry.
+//alias_name, alias_extension
+//	8 and 3 character arrays the alias is written to
+//
+//Returns
+//	1 = alias created, 0 = failed (the numbers of both forms are all used)
+BYTE ffs_finish_short_alias (FFS_SHORT_ALIAS *alias, BYTE *alias_name, BYTE *alias_extension)
+{
+	BYTE count;
+	BYTE number;
+	BYTE tail_position;
+
+
+	for (count = 0; count < 8; count++)
+		alias_name[count] = ' ';
+	for (count = 0; count < 3; count++)
+		alias_extension[count] = alias->extension[count];
+
+	//----- USE THE LOWEST NUMBER OF THE SHORT FORM THAT ISN'T USED -----
+	for (number = 1; number <= 4; number++)
+	{
+		if ((alias->used_numbers & (BYTE)(0x01 << number)) == 0)
+		{
+			for (tail_position = 0; tail_position < alias->name_length; tail_position++)
+				alias_name[tail_position] = alias->name[tail_position];
+			alias_name[tail_position++] = '~';
+			alias_name[tail_position] = '0' + number;
+			return(1);
+		}
+	}
+
+	//----- OTHERWISE USE THE LOWEST NUMBER OF THE HASHED FORM THAT ISN'T USED -----
+	for (number = 1; number <= 9; number++)
+	{
+		if ((alias->used_hash_numbers & (WORD)(0x0001 << number)) == 0)
+		{
+			for (tail_position = 0; tail_position < alias->hash_name_length; tail_position++)
+				alias_name[tail_position] = alias->hash_name[tail_position];
+			alias_name[tail_position++] = '~';
+			alias_name[tail_position] = '0' + number;
+			return(1);
+		}
+	}
+	return(0);
+}
+
+
+
+
+
+
+//*******************************************
+//*******************************************
+//********** SHORT ALIAS CHARACTER **********
+//*******************************************
+//*******************************************
+//Returns the character to use in an 8.3 alias for a long filename character (0 = leave the character out)
+BYTE ffs_short_alias_character (BYTE character)
+{
+
+	if ((character == ' ') || (character == '.'))
+		return(0);
+
+	if ((character >= 'a') && (character <= 'z'))
+		return(character - 0x20);
+
+	if (
+		(character >= 0x80) || (character == '+') || (character == ',') || (character == ';') || (character == '=') ||
+		(character == '[') || (character == ']')
+		)
+	{
+		return('_');
+	}
+
+	return(character);
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** SHORT NAME CHECKSUM **********
+//*****************************************
+//*****************************************
+//Returns the checksum of an 8.3 name that is stored in its long filename entries
+BYTE ffs_short_name_checksum (BYTE *file_name, BYTE *file_extension)
+{
+	BYTE checksum = 0;
+	BYTE count;
+
+
+	for (count = 0; count < 11; count++)
+	{
+		//Rotate right then add the character
+		checksum = ((checksum & 0x01) ? 0x80 : 0x00) + (checksum >> 1);
+		if (count < 8)
+			checksum += file_name[count];
+		else
+			checksum += file_extension[count - 8];
+	}
+	return(checksum);
+}
+
+
+
+
+
+
+//*************************************************
+//*************************************************
+//********** READ DIRECTORY ENTRY NUMBER **********
+//*************************************************
+//*************************************************
+//Reads the sector that holds an entry of the selected directory.  read_write_directory_last_lba, read_write_directory_last_entry,
+//read_write_directory_current_cluster and read_write_directory_sectors_left are set to the entry (as if ffs_read_next_directory_entry had
+//just returned it).
+//entry_number
+//	The entry number counting from the start of the directory
+//
+//Returns
+//	A pointer to the entry in the sector buffer, or 0 if the directory doesn't have this entry
+BYTE* ffs_read_directory_entry_number (DWORD entry_number)
+{
+	DWORD entries_per_cluster;
+	DWORD cluster;
+	BYTE entries_per_sector;
+
+
+	entries_per_sector = (BYTE)(ffs_bytes_per_sector >> 5);			// /32 as each directory entry is 32 bytes
+
+	if ((read_write_directory_start_cluster == 0) && (disk_is_fat_32 == 0))
+	{
+		//----- FAT16 ROOT DIRECTORY -----
+		//(The root directory is one run of sectors)
+		if (entry_number >= ((DWORD)number_of_root_directory_sectors * (DWORD)entries_per_sector))
+			return(0);
+
+		read_write_directory_current_cluster = 0;
+		read_write_directory_last_lba = root_directory_start_sector_cluster + (entry_number / entries_per_sector);
+		read_write_directory_sectors_left = (BYTE)(number_of_root_directory_sectors - 1 - (WORD)(entry_number / entries_per_sector));
+	}
+	else
+	{
+		//----- SUBDIRECTORY OR FAT32 ROOT DIRECTORY -----
+		//Follow the directory cluster chain to the cluster that contains the entry
+		entries_per_cluster = (DWORD)sectors_per_cluster * (DWORD)entries_per_sector;
+		if (read_write_directory_start_cluster)
+			cluster = read_write_directory_start_cluster;
+		else
+			cluster = root_directory_start_sector_cluster;
+
+		while (entry_number >= entries_per_cluster)
+		{
+			#ifdef CLEAR_WATCHDOG_TIMER
+				CLEAR_WATCHDOG_TIMER();
+			#endif
+
+			cluster = ffs_get_next_cluster_no(cluster);
+			if (
+				(cluster < 2) ||
+				((disk_is_fat_32) && ((cluster & 0x0fffffff) >= 0x0ffffff8)) ||
+				((disk_is_fat_32 == 0) && (cluster >= 0xfff8))
+				)
+			{
+				return(0);
+			}
+			entry_number -= entries_per_cluster;
+		}
+
+		read_write_directory_current_cluster = cluster;
+		read_write_directory_last_lba = data_area_start_sector + ((cluster - 2) * sectors_per_cluster) + (entry_number / entries_per_sector);
+		read_write_directory_sectors_left = sectors_per_cluster - 1 - (BYTE)(entry_number / entries_per_sector);
+	}
+	read_write_directory_last_entry = (WORD)(entry_number % entries_per_sector);
+
+	FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+	ffs_read_sector_to_buffer (read_write_directory_last_lba);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	return(&FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5));
+}
+
+
+
+
+
+
+//****************************************
+//****************************************
+//********** LONG FILENAME HASH **********
+//****************************************
+//****************************************
+//Returns the hash of a long filename that is stored in the directory index (never 0).  Each character is added with a multiplier for its
+//position, so the same hash can be made from the long filename entries in the order they are stored (see ffs_long_filename_entry_hash).
+//long_name, long_name_length
+//	The long filename (not null terminated)
+WORD ffs_long_filename_hash (const char *long_name, WORD long_name_length)
+{
+	WORD hash = 0;
+	WORD position;
+
+
+	for (position = 0; position < long_name_length; position++)
+		hash += ffs_long_filename_character_hash((WORD)(BYTE)long_name[position], position);
+
+	if (hash == 0)
+		hash = 1;							//(0 = no long filename)
+	return(hash);
+}
+
+
+
+
+
+
+//**********************************************
+//**********************************************
+//********** LONG FILENAME ENTRY HASH **********
+//**********************************************
+//**********************************************
+//Returns the part of ffs_long_filename_hash for the characters a long filename entry holds (the entry hashes of a long filename are added
+//together, then 0 is changed to 1)
+WORD ffs_long_filename_entry_hash (BYTE *entry_pointer)
+{
+	WORD hash = 0;
+	WORD position;
+	WORD character;
+	BYTE count;
+	BYTE *character_pointer;
+
+
+	position = (WORD)((entry_pointer[0] & 0x1f) - 1) * 13;
+	for (count = 0; count < 13; count++)
+	{
+		character_pointer = entry_pointer + ffs_long_filename_character_offsets[count];
+		character = (WORD)character_pointer[0] + ((WORD)character_pointer[1] << 8);
+		if (character == 0x0000)
+			break;							//The end of the name
+
+		hash += ffs_long_filename_character_hash(character, position);
+		position++;
+	}
+	return(hash);
+}
+
+
+
+
+
+
+//**************************************************
+//**************************************************
+//********** LONG FILENAME CHARACTER HASH **********
+//**************************************************
+//**************************************************
+//(Long filenames are compared without case)
+WORD ffs_long_filename_character_hash (WORD character, WORD position)
+{
+
+	if ((character >= 'a') && (character <= 'z'))
+		character -= 0x20;
+
+	return((character + 1) * ((position << 1) + 1));
+}
+#endif		//#ifdef FFS_LONG_FILENAME_MAX
+
+
+
+
+
+//***********************************************
+//***********************************************
+//********** READ NEXT DIRECTORY ENTRY **********
+//***********************************************
+//***********************************************
+//file_name
+//	8 character array filename will be written to here
+//file_extension
+//	3 character array filename extension will be written to here
+//attribute_byte
+//	file attribute byte will be written to here
+//file_size
+//	file size will be written to here
+//cluster_number
+//	start cluster for the file will be written to here
+//start_from_beginning
+//	set to cause routine to start from 1st directory entry (must be set if the drivers data buffer has been modified since the last call)
+//directory_entry_sector
+//	Sector that contains the files directory entry will be written to here
+//directory_entry_within_sector
+//	The file directory entry number within the sector that contains the file will be written to here
+//Returns
+//	1 = file entry found
+//	0 = not found = end of directory
+BYTE ffs_read_next_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte,
+									DWORD *file_size, DWORD *cluster_number, BYTE start_from_beginning,
+									DWORD *directory_entry_sector, BYTE *directory_entry_within_sector)
+{
+
+	//----- START FROM BEGINNING OF DIRECTORY? -----
+	if (start_from_beginning)
+		ffs_move_to_directory_start();
+
+	//----- LOAD A NEW SECTOR OF THE DIRECTORY? -----
+	if (read_write_directory_last_entry >= ((ffs_bytes_per_sector - 32) >> 5))			// /32 as each directory entry is 32 bytes
+	{
+		if (ffs_move_to_next_directory_sector() == 0)
+			return(0);
+	}
+
+
+	//----- GET THE NEXT DIRECTORY ENTRY FROM THE BUFFER -----
+	//Read the sector to our buffer (the sector cache will normally still hold it from the last call, but other sectors may have been accessed since)
+	FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+	ffs_read_sector_to_buffer (read_write_directory_last_lba);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	read_write_directory_last_entry++;
+
+	ffs_get_directory_entry((&FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5)), file_name, file_extension, attribute_byte, file_size, cluster_number);
+
+	//Return the location of this directory entry
+	*directory_entry_sector = read_write_directory_last_lba;
+	*directory_entry_within_sector = read_write_directory_last_entry;
+
+	return(1);
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** MOVE TO DIRECTORY START **********
+//*********************************************
+//*********************************************
+//Sets up ffs_move_to_next_directory_sector (and ffs_read_next_directory_entry) to move to the first sector of the selected directory
+void ffs_move_to_directory_start (void)
+{
+	if ((read_write_directory_start_cluster) || (disk_is_fat_32))
+	{
+		//----- SUBDIRECTORY OR FAT32 ROOT DIRECTORY -----
+		//(Stored in a chain of clusters like a file)
+		if (read_write_directory_start_cluster)
+			read_write_directory_current_cluster = read_write_directory_start_cluster;
+		else
+			read_write_directory_current_cluster = root_directory_start_sector_cluster;		//(For FAT32 it contains the start cluster)
+
+		read_write_directory_last_lba = (data_area_start_sector + ((read_write_directory_current_cluster - 2) * sectors_per_cluster) - 1);
+		read_write_directory_sectors_left = sectors_per_cluster;
+	}
+	else
+	{
+		//----- FAT16 ROOT DIRECTORY -----
+		read_write_directory_last_lba = (root_directory_start_sector_cluster - 1);		//(For FAT16 it contains the start sector)
+		read_write_directory_current_cluster = 0;										//(A fixed run of sectors)
+		read_write_directory_sectors_left = number_of_root_directory_sectors;
+	}
+	read_write_directory_last_entry = 0xffff;							//Cause the next cluster to be read
+}
+
+
+
+
+
+
+//***************************************************
+//***************************************************
+//********** MOVE TO NEXT DIRECTORY SECTOR **********
+//***************************************************
+//***************************************************
+//Moves read_write_directory_last_lba on to the next sector of the directory.  A subdirectory or FAT32 root directory has a new cluster
+//added to it if it has no more clusters.  The sector is not read (ffs_read_sector_to_buffer must be called for it).
+//Returns
+//	1 = moved to next sector
+//	0 = end of directory (FAT16 root directory), or no space to extend the directory
+BYTE ffs_move_to_next_directory_sector (void)
+{
+	DWORD dw_temp;
+
+
+	read_write_directory_last_lba++;										//Move to next sector
+
+	//----- CHECK FOR MOVE TO NEXT CLUSTER -----
+	if (read_write_directory_sectors_left == 0)
+	{
+		//----- NEED TO MOVE TO NEXT CLUSTER -----
+		if (read_write_directory_current_cluster)
+		{
+			//----- SUBDIRECTORY OR FAT32 ROOT DIRECTORY -----
+			//Move to next cluster that contains the next part of the directory
+			read_write_directory_sectors_left = sectors_per_cluster - 1;
+
+			dw_temp = ffs_get_next_cluster_no(read_write_directory_current_cluster);
+			
+			if (
+				((disk_is_fat_32) && ((dw_temp & 0x0fffffff) >= 0x0ffffff8)) ||
+				((disk_is_fat_32 == 0) && (dw_temp >= 0xfff8))
+				)
+			{
+				//DIRECTORY HAS NO MORE CLUSTERS - ADD A NEW CLUSTER
+				dw_temp = ffs_get_next_free_cluster();
+				if (dw_temp == 0xffffffff)			//0xffffffff = no empty cluster found
+				{
+					//No more space to extend the directory
+					return (0);
+				}
+				ffs_modify_cluster_entry_in_fat(read_write_directory_current_cluster, dw_temp);
+				ffs_modify_cluster_entry_in_fat(dw_temp, 0x0fffffff);
+				read_write_directory_current_cluster = dw_temp;
+				
+				//SET THE CONTENTS OF THE NEW CLUSTER TO 0x00 = all entries unused
+				ffs_clear_directory_cluster(read_write_directory_current_cluster);
+			}
+			else
+			{
+				read_write_directory_current_cluster = dw_temp;
+			}
+
+			//Set the address of the next sector we're going to read
+			read_write_directory_last_lba = data_area_start_sector + ((read_write_directory_current_cluster - 2) * sectors_per_cluster);
+		}
+		else
+		{
+			//----- FAT16 ROOT DIRECTORY -----
+			//We've reached the end of the root directory
+			return (0);
+		}
+	}
+	else
+	{
+		//----- GET NEXT SECTOR OF THIS CLUSTER -----
+		read_write_directory_sectors_left--;
+	}
+
+	read_write_directory_last_entry = 0xffff;
+	return(1);
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** CLEAR DIRECTORY CLUSTER **********
+//*********************************************
+//*********************************************
+//Sets every sector of a cluster that is being added to a directory to 0x00 (all entries unused).  The current sector cache entry is used
+//as the blank sector and is left holding the first sector of the cluster.
+void ffs_clear_directory_cluster (DWORD cluster)
+{
+	BYTE b_temp;
+	WORD w_temp;
+	BYTE *buffer_pointer;
+
+
+	//(Write the current sector cache entry back first if it has been modified)
+	if (ffs_sector_buffer->needs_writing_to_card)
+		ffs_write_sector_from_buffer(ffs_sector_buffer->lba);
+	ffs_sector_buffer->lba = 0xffffffff;
+
+	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
+	for (w_temp = 0; w_temp < 512; w_temp++)
+		*buffer_pointer++ = 0x00;
+
+	for (b_temp = 0; b_temp < sectors_per_cluster; b_temp++)
+	{
+		ffs_write_sector_from_buffer(
+									data_area_start_sector + ((cluster - 2) * sectors_per_cluster) + b_temp		//(Data on a Partition starts with cluster number 2)
+									);			
+	}
+	ffs_sector_buffer->lba = data_area_start_sector + ((cluster - 2) * sectors_per_cluster);		//The buffer now matches the first sector of the cluster
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** GET DIRECTORY ENTRY **********
+//*****************************************
+//*****************************************
+//entry_pointer
+//	The directory entry in the sector buffer
+//The other parameters are as ffs_read_next_directory_entry (the filename is converted to uppercase)
+void ffs_get_directory_entry (BYTE *entry_pointer, BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte, DWORD *file_size, DWORD *cluster_number)
+{
+	BYTE b_temp;
+	BYTE *buffer_pointer;
+
+
+	buffer_pointer = entry_pointer;
+
+	//GET FILE NAME [8]
+	file_name[0] = *buffer_pointer++;
+	file_name[1] = *buffer_pointer++;
+	file_name[2] = *buffer_pointer++;
+	file_name[3] = *buffer_pointer++;
+	file_name[4] = *buffer_pointer++;
+	file_name[5] = *buffer_pointer++;
+	file_name[6] = *buffer_pointer++;
+	file_name[7] = *buffer_pointer++;
+
+	//Convert to uppercase
+	for (b_temp = 0; b_temp < 8; b_temp++)
+	{
+		if ((file_name[b_temp] >= 0x61) && (file_name[b_temp] <= 0x7a))
+			file_name[b_temp] -= 0x20;
+	}
+
+	//GET FILENAME EXTENSION [3]
+	file_extension[0] = *buffer_pointer++;
+	file_extension[1] = *buffer_pointer++;
+	file_extension[2] = *buffer_pointer++;
+
+	//Convert to uppercase
+	for (b_temp = 0; b_temp < 3; b_temp++)
+	{
+		if ((file_extension[b_temp] >= 0x61) && (file_extension[b_temp] <= 0x7a))
+			file_extension[b_temp] -= 0x20;
+	}
+
+	//GET ATTRIBUTE BYTE [1]
+	//Bit	7-6					 5		   4		   3			  2		   1		0 
+	//		Reserved, set to 0 | Archive | Directory | Volume Label | System | Hidden | Read Only 
+	*attribute_byte = *buffer_pointer++;
+
+	//GET NT [1]
+	//(Dump)
+	buffer_pointer++;
+
+	//GET CREATED TIME (mS portion) [1]
+	//(Dump)
+	buffer_pointer++;
+
+	//GET CREATED TIME (h + m) [2]
+	//(Dump)
+	buffer_pointer++;
+	buffer_pointer++;
+
+	//GET CREATED DATE [2]
+	//(Dump)
+	buffer_pointer++;
+	buffer_pointer++;
+
+	//GET LAST ACESSED DATE [2]
+	//(Dump)
+	buffer_pointer++;
+	buffer_pointer++;
+
+	//GET EXTENDED ATTRIBUTE [2]
+	//0x0000 for FAT16, high word of cluster number for FAT32
+	if (disk_is_fat_32)
+	{
+		*cluster_number = ((DWORD)*buffer_pointer++ << 16);
+		*cluster_number += ((DWORD)*buffer_pointer++ << 24);
+	}
+	else
+	{
+		buffer_pointer++;
+		buffer_pointer++;
+		*cluster_number = 0;
+	}
+
+	//GET TIME [2]
+	//(Dump)
+	buffer_pointer++;
+	buffer_pointer++;
+
+	//GET DATE [2]
+	//(Dump)
+	buffer_pointer++;
+	buffer_pointer++;
+
+	//GET CLUSTER [2]
+	*cluster_number += (DWORD)*buffer_pointer++;
+	*cluster_number += ((DWORD)*buffer_pointer++ << 8);
+			
+	//GET FILE SIZE [4]
+	*file_size = (DWORD)*buffer_pointer++;
+	*file_size += ((DWORD)*buffer_pointer++ << 8);
+	*file_size += ((DWORD)*buffer_pointer++ << 16);
+	*file_size += ((DWORD)*buffer_pointer++ << 24);
+}
+
+
+
+
+
+
+//********************************************************
+//********************************************************
+//********** OVERWRITE LAST DIRECTORY FILE NAME **********
+//********************************************************
+//********************************************************
+//file_name = 8 character array filename (must be DOS compatible - uppercase and any trailing unused characters set to 0x20)
+//file_extension = 3 character array filename extension (must be DOS compatible - uppercase and any trailing unused characters set to 0x20)
+//attribute_byte = file attribute byte
+//file_size = file size
+//cluster_number = start cluster for the file
+void ffs_overwrite_last_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte,
+												DWORD *file_size, DWORD *cluster_number)
+{
+	BYTE *buffer_pointer;
+
+	//----- WRITE THE NEW ENTRY TO THE BUFFER -----
+	//Ensure the sector containing the entry is the current buffer (it will normally still be in the sector cache)
+	FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+	ffs_read_sector_to_buffer (read_write_directory_last_lba);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	//Offset to the start of the entry
+	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5);
+
+	//WRITE FILE NAME [8]
+	*buffer_pointer++ = file_name[0];
+	*buffer_pointer++ = file_name[1];
+	*buffer_pointer++ = file_name[2];
+	*buffer_pointer++ = file_name[3];
+	*buffer_pointer++ = file_name[4];
+	*buffer_pointer++ = file_name[5];
+	*buffer_pointer++ = file_name[6];
+	*buffer_pointer++ = file_name[7];
+
+	//WRITE FILENAME EXTENSION [3]
+	*buffer_pointer++ = file_extension[0];
+	*buffer_pointer++ = file_extension[1];
+	*buffer_pointer++ = file_extension[2];
+
+	//WRITE ATTRIBUTE BYTE [1]
+	//Bit	7-6					 5		   4		   3			  2		   1		0 
+	//		Reserved, set to 0 | Archive | Directory | Volume Label | System | Hidden | Read Only 
+	*buffer_pointer++ = *attribute_byte;
+
+	//WRITE NT [1]
+	*buffer_pointer++ = 0x00;
+
+	//WRITE CREATED TIME (mS portion) [1]
+	*buffer_pointer++ = 0x00;
+
+	//WRITE CREATED TIME (h + m) [2]
+	//Bits	15-11								10-5								  4-0 
+	//		Hours - valid from 0-23 inclusive | Minutes - valid from 0-59 inclusive | Seconds / 2 - valid from 0-29 inclusive (0-58 seconds). 
+	*buffer_pointer++ = 0x00;
+	*buffer_pointer++ = 0x00;
+
+	//WRITE CREATED DATE [2]
+	//Bits	15-9													    8-5													 4-0 
+	//		Years since 1980 - valid from 0-127 inclusive (1980-2107) | Month of year - valid from 1-12 inclusive(1 = Jan) | Day of the month - valid from 1-31 inclusive. 
+	*buffer_pointer++ = 0x21;			//Hard coded to 1st Jan 2000
+	*buffer_pointer++ = 0x28;
+
+	//WRITE LAST ACESSED DATE [2]
+	*buffer_pointer++ = 0x21;			//Hard coded to 1st Jan 2000
+	*buffer_pointer++ = 0x28;
+
+	//WRITE EXTENDED ATTRIBUTE [2]
+	*buffer_pointer++ = (BYTE)(*cluster_number >> 16);		//0x0000 for FAT16, high word of cluster number for FAT32
+	*buffer_pointer++ = (BYTE)(*cluster_number >> 24);
+
+	//WRITE TIME [2]
+	*buffer_pointer++ = 0x00;
+	*buffer_pointer++ = 0x00;
+
+	//WRITE DATE [2]
+	*buffer_pointer++ = 0x21;			//Hard coded to 1st Jan 2000
+	*buffer_pointer++ = 0x28;
+
+	//WRITE CLUSTER [2]
+	*buffer_pointer++ = (BYTE)*cluster_number;
+	*buffer_pointer++ = (BYTE)(*cluster_number >> 8);
+			
+	//WRITE FILE SIZE [4]
+	*buffer_pointer++ = (BYTE)*file_size;
+	*buffer_pointer++ = (BYTE)(*file_size >> 8);
+	*buffer_pointer++ = (BYTE)(*file_size >> 16);
+	*buffer_pointer++ = (BYTE)(*file_size >> 24);
+
+	//WRITE THE BUFFER BACK TO THE DISK SECTOR
+	ffs_write_sector_from_buffer(read_write_directory_last_lba);
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** MOVE TO DIRECTORY ENTRY **********
+//*********************************************
+//*********************************************
+//Sets up ffs_read_next_directory_entry so that the next entry it returns (called with start_from_beginning = 0) is the entry at this position
+void ffs_move_to_directory_entry (FFS_DIRECTORY_POSITION *position)
+{
+
+	if (position->cluster)
+	{
+		//----- SUBDIRECTORY OR FAT32 ROOT DIRECTORY -----
+		read_write_directory_current_cluster = position->cluster;
+		read_write_directory_sectors_left = sectors_per_cluster - 1 - (BYTE)(position->lba - (data_area_start_sector + ((position->cluster - 2) * sectors_per_cluster)));
+	}
+	else
+	{
+		//----- FAT16 ROOT DIRECTORY -----
+		read_write_directory_current_cluster = 0;
+		read_write_directory_sectors_left = (BYTE)(number_of_root_directory_sectors - 1 - (position->lba - root_directory_start_sector_cluster));
+	}
+
+	if (position->entry_within_sector == 0)
+	{
+		//Set to the end of the previous sector, as when starting from the beginning of the directory, so the entry's sector is loaded
+		read_write_directory_last_lba = position->lba - 1;
+		read_write_directory_sectors_left++;
+		read_write_directory_last_entry = 0xffff;
+	}
+	else
+	{
+		read_write_directory_last_lba = position->lba;
+		read_write_directory_last_entry = position->entry_within_sector - 1;
+	}
+}
+
+
+
+
+
+
+//************************************************
+//************************************************
+//********** GET DIRECTORY ENTRY NUMBER **********
+//************************************************
+//************************************************
+//directory_entry_sector, directory_entry_within_sector
+//	The directory entry (in the selected directory)
+//cluster
+//	The directory cluster that contains the entry will be written to here (0 for the FAT16 root directory)
+//
+//Returns
+//	The entry number counting from the start of the directory (0xffffffff = the sector isn't part of the directory)
+DWORD ffs_get_directory_entry_number (DWORD directory_entry_sector, BYTE directory_entry_within_sector, DWORD *cluster)
+{
+	DWORD entries_per_cluster;
+	DWORD cluster_start_lba;
+	DWORD entry_number;
+
+
+	if ((read_write_directory_start_cluster == 0) && (disk_is_fat_32 == 0))
+	{
+		//----- FAT16 ROOT DIRECTORY -----
+		//(The root directory is one run of sectors)
+		*cluster = 0;
+		return(((directory_entry_sector - root_directory_start_sector_cluster) * (DWORD)(ffs_bytes_per_sector >> 5)) + (DWORD)directory_entry_within_sector);
+	}
+
+	//----- SUBDIRECTORY OR FAT32 ROOT DIRECTORY -----
+	//Follow the directory cluster chain to the cluster that contains the sector
+	entries_per_cluster = (DWORD)sectors_per_cluster * (DWORD)(ffs_bytes_per_sector >> 5);
+	entry_number = 0;
+	if (read_write_directory_start_cluster)
+		*cluster = read_write_directory_start_cluster;
+	else
+		*cluster = root_directory_start_sector_cluster;
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		cluster_start_lba = data_area_start_sector + ((*cluster - 2) * sectors_per_cluster);
+		if ((directory_entry_sector >= cluster_start_lba) && (directory_entry_sector < (cluster_start_lba + sectors_per_cluster)))
+		{
+			return(entry_number + ((directory_entry_sector - cluster_start_lba) * (DWORD)(ffs_bytes_per_sector >> 5)) + (DWORD)directory_entry_within_sector);
+		}
+
+		*cluster = ffs_get_next_cluster_no(*cluster);
+		if (
+			(*cluster < 2) ||
+			((disk_is_fat_32) && ((*cluster & 0x0fffffff) >= 0x0ffffff8)) ||
+			((disk_is_fat_32 == 0) && (*cluster >= 0xfff8))
+			)
+		{
+			return(0xffffffff);
+		}
+
+		entry_number += entries_per_cluster;
+	}
+}
+
+
+
+
+
+
+//********************************************
+//********************************************
+//********** DELETE DIRECTORY ENTRY **********
+//********************************************
+//********************************************
+//Marks a directory entry of the selected directory (and any long filename entries before it) as deleted and removes it from the directory
+//index.  The first free directory entry hint is moved back to it if it is before the hint.
+void ffs_delete_directory_entry (DWORD directory_entry_sector, BYTE directory_entry_within_sector)
+{
+	DWORD entry_number;
+	DWORD directory_cluster;
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+	FFS_DIRECTORY_INDEX_ENTRY *index_entry;
+#endif
+
+
+	entry_number = ffs_get_directory_entry_number(directory_entry_sector, directory_entry_within_sector, &directory_cluster);
+
+	#ifdef FFS_LONG_FILENAME_MAX
+		//----- DELETE ITS LONG FILENAME ENTRIES -----
+		//(Done first as they are found from the checksum of the 8.3 name)
+		ffs_delete_long_filename(entry_number);
+	#endif
+
+	//----- SET THE 1ST CHARACTER OF THE FILE NAME TO 0xE5 TO INDICATE ITS A DELETED ENTRY IN THE DIRECTORY -----
+	FFS_IO_READ_TYPE(FFS_IO_READ_DIRECTORY);
+	ffs_read_sector_to_buffer (directory_entry_sector);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	FFS_DRIVER_GEN_512_BYTE_BUFFER[(WORD)directory_entry_within_sector << 5] = 0xe5;
+
+	ffs_write_sector_from_buffer(directory_entry_sector);
+
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		//----- REMOVE THE FILE FROM THE DIRECTORY INDEX -----
+		index_entry = ffs_get_directory_index_entry(directory_entry_sector, directory_entry_within_sector);
+		if (index_entry)
+			index_entry->directory_entry_sector = 0;			//0 = entry has been removed
+	#endif
+
+	//----- IF THIS ENTRY IS BEFORE THE FIRST FREE DIRECTORY ENTRY HINT IT BECOMES THE HINT -----
+	if (ffs_directory_free_entry.entry_number != 0xffffffff)
+	{
+		if (entry_number < ffs_directory_free_entry.entry_number)
+		{
+			ffs_directory_free_entry.entry_number = entry_number;
+			ffs_directory_free_entry.lba = directory_entry_sector;
+			ffs_directory_free_entry.entry_within_sector = directory_entry_within_sector;
+			ffs_directory_free_entry.cluster = directory_cluster;
+		}
+		else if (entry_number == 0xffffffff)
+		{
+			ffs_directory_free_entry.entry_number = 0xffffffff;		//Not found in the directory (shouldn't happen) - the next search starts from the beginning
+		}
+	}
+}
+
+
+
+
+
+//************************************
+//************************************
+//********** FIND OPEN FILE **********
+//************************************
+//************************************
+//Returns the open file entry of the file with this directory entry, or 0 if the file isn't open
+FFS_OPEN_FILE* ffs_find_open_file (DWORD directory_entry_sector, BYTE directory_entry_within_sector)
+{
+	BYTE count;
+
+
+	for (count = 0; count < FFS_OPEN_FILES_MAX; count++)
+	{
+		if (
+			(ffs_open_file[count].handle_count) &&
+			(ffs_open_file[count].directory_entry_sector == directory_entry_sector) &&
+			(ffs_open_file[count].directory_entry_within_sector == directory_entry_within_sector)
+			)
+		{
+			return(&ffs_open_file[count]);
+		}
+	}
+	return(0);
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** GET FILE CLUSTER **********
+//**************************************
+//**************************************
+//Get the card cluster number of a cluster of a file
+//file_cluster = the cluster number within the file (0 = the files start cluster)
+//If the file has an extent cache the cluster is found with a binary search of the runs of clusters already known, and only the part of
+//the cluster chain after the nearest run before it is followed through the FAT table (adding the clusters found to the cache).
+DWORD ffs_get_file_cluster (FFS_FILE *file_pointer, DWORD file_cluster)
+{
+	DWORD cluster;
+	DWORD cluster_count;
+#ifdef FFS_EXTENT_CACHE_ENTRIES
+	BYTE low;
+	BYTE high;
+	BYTE middle;
+	FFS_EXTENT *extent;
+
+
+	//----- LOOK FOR THE CLUSTER IN THE EXTENT CACHE -----
+	if (file_pointer->open_file->extent_count)
+	{
+		//Binary search for the last extent that starts at or before the cluster
+		low = 0;
+		high = file_pointer->open_file->extent_count - 1;
+		while (low < high)
+		{
+			middle = (BYTE)(((WORD)low + (WORD)high + 1) >> 1);
+			if (file_pointer->open_file->extent[middle].file_cluster <= file_cluster)
+				low = middle;
+			else
+				high = middle - 1;
+		}
+		extent = &file_pointer->open_file->extent[low];
+
+		if (file_cluster < (extent->file_cluster + extent->length))
+			return(extent->disk_cluster + (file_cluster - extent->file_cluster));
+
+		//Not in the cache - start following the chain from the last cluster we know before it
+		//(The first extent is always the files start cluster so the extent found never starts after the cluster)
+		cluster_count = extent->file_cluster + extent->length - 1;
+		cluster = extent->disk_cluster + extent->length - 1;
+	}
+	else
+	{
+		cluster_count = 0;
+		cluster = file_pointer->open_file->start_cluster;
+		ffs_add_file_cluster_to_extent_cache(file_pointer, 0, cluster);
+	}
+#else
+
+	cluster_count = 0;
+	cluster = file_pointer->open_file->start_cluster;
+#endif
+
+	//----- KEEP MOVING TO NEXT CLUSTER UNTIL WE'RE IN THE REQURIED CLUSTER -----
+	while (cluster_count < file_cluster)
+	{
+		cluster = ffs_get_next_cluster_no(cluster);
+		cluster_count++;
+
+		#ifdef FFS_EXTENT_CACHE_ENTRIES
+			ffs_add_file_cluster_to_extent_cache(file_pointer, cluster_count, cluster);
+		#endif
+	}
+	return(cluster);
+}
+
+
+
+
+
+
+#ifdef FFS_EXTENT_CACHE_ENTRIES
+//*************************************************
+//*************************************************
+//********** ADD CLUSTER TO EXTENT CACHE **********
+//*************************************************
+//*************************************************
+//The cluster is added to the run it follows on from, or starts a new run.  When the cache is full the run whose removal leaves the smallest
+//part of the file not covered is removed (this may be the new run), so the runs kept stay spread across the whole file and a seek never
+//has to follow a long part of the cluster chain.  The first run (the files start cluster) is never removed.
+void ffs_add_file_cluster_to_extent_cache (FFS_FILE *file_pointer, DWORD file_cluster, DWORD disk_cluster)
+{
+	FFS_OPEN_FILE *open_file;
+	FFS_EXTENT *extent;
+	FFS_EXTENT new_extent;
+	BYTE position;
+	WORD entry;
+	WORD remove_entry;
+	DWORD gap;
+	DWORD smallest_gap;
+	DWORD previous_end;
+
+
+	//----- CHECK ITS A VALID CLUSTER (NOT THE END OF CHAIN MARKER) -----
+	if (disk_cluster < 2)
+		return;
+	if (disk_is_fat_32)
+	{
+		if (disk_cluster >= 0x0ffffff8)
+			return;
+	}
+	else
+	{
+		if (disk_cluster >= 0xfff8)
+			return;
+	}
+
+	open_file = file_pointer->open_file;
+
+	new_extent.file_cluster = file_cluster;
+	new_extent.disk_cluster = disk_cluster;
+	new_extent.length = 1;
+
+	if (open_file->extent_count == 0)
+	{
+		//----- THE FIRST EXTENT MUST BE THE FILES START CLUSTER -----
+		if (file_cluster != 0)
+			return;
+		position = 0;
+	}
+	else
+	{
+		//----- FIND THE LAST EXTENT THAT STARTS AT OR BEFORE THE CLUSTER -----
+		position = open_file->extent_count;
+		while ((position > 1) && (open_file->extent[position - 1].file_cluster > file_cluster))
+			position--;
+		extent = &open_file->extent[position - 1];
+
+		if (file_cluster < (extent->file_cluster + extent->length))
+			return;											//Already known
+
+		//----- ADD TO THE EXTENT IF IT FOLLOWS ON FROM IT -----
+		if ((file_cluster == (extent->file_cluster + extent->length)) && (disk_cluster == (extent->disk_cluster + extent->length)))
+		{
+			extent->length++;
+			return;
+		}
+
+		//----- IF THE CACHE IS FULL REMOVE THE EXTENT THAT LEAVES THE SMALLEST GAP -----
+		//(Looking at the extents as they would be with the new extent inserted at position)
+		if (open_file->extent_count >= FFS_EXTENT_CACHE_ENTRIES)
+		{
+			smallest_gap = 0xffffffff;
+			remove_entry = position;
+			for (entry = 1; entry <= open_file->extent_count; entry++)
+			{
+				extent = ffs_extent_cache_entry(open_file, &new_extent, position, (entry - 1));
+				previous_end = extent->file_cluster + extent->length;
+
+				if (entry < open_file->extent_count)
+				{
+					//The gap is up to the start of the next extent
+					extent = ffs_extent_cache_entry(open_file, &new_extent, position, (entry + 1));
+					gap = extent->file_cluster - previous_end;
+				}
+				else
+				{
+					//The last extent - the gap is up to its end
+					extent = ffs_extent_cache_entry(open_file, &new_extent, position, entry);
+					gap = (extent->file_cluster + extent->length) - previous_end;
+				}
+
+				if (gap < smallest_gap)
+				{
+					smallest_gap = gap;
+					remove_entry = entry;
+				}
+			}
+
+			if (remove_entry == position)
+				return;											//The new extent is the one to drop
+
+			if (remove_entry > position)
+				remove_entry--;									//(Its index in the cache without the new extent)
+			else
+				position--;										//(The new extent's position moves down when an extent before it is removed)
+
+			for (entry = remove_entry; entry < (WORD)(open_file->extent_count - 1); entry++)
+				open_file->extent[entry] = open_file->extent[entry + 1];
+			open_file->extent_count--;
+		}
+	}
+
+	//----- INSERT THE NEW EXTENT -----
+	for (entry = open_file->extent_count; entry > position; entry--)
+		open_file->extent[entry] = open_file->extent[entry - 1];
+	open_file->extent[position] = new_extent;
+	open_file->extent_count++;
+}
+
+
+
+
+
+
+//********************************************************
+//********************************************************
+//********** EXTENT CACHE ENTRY WITH NEW EXTENT **********
+//********************************************************
+//********************************************************
+//Returns an extent of a files extent cache as it would be with new_extent inserted at new_position (entry 0 - extent_count)
+FFS_EXTENT* ffs_extent_cache_entry (FFS_OPEN_FILE *open_file, FFS_EXTENT *new_extent, BYTE new_position, WORD entry)
+{
+	if (entry < new_position)
+		return(&open_file->extent[entry]);
+	if (entry == new_position)
+		return(new_extent);
+	return(&open_file->extent[entry - 1]);
+}
+#endif		//#ifdef FFS_EXTENT_CACHE_ENTRIES
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** CREATE NEW FILE **********
+//*************************************
+//*************************************
+//
+//file_name
+//	The filename, which may follow a path of existing directories (see ffs_find_file)
+//attribute_byte
+//	0x00 for a file, 0x10 for a directory
+//write_file_start_cluster
+//	start cluster for the file will be read from here
+//directory_entry_sector
+//	Sector that contains the files directory entry will be written to here
+//directory_entry_within_sector
+//	The file directory entry number within the sector that contains the file will be written to here
+//
+//Return value
+//	1 = successful
+//	0 = failed (including if a file or directory with this name already exists)
+BYTE ffs_create_new_file (const char *file_name, BYTE attribute_byte, DWORD *write_file_start_cluster, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector)
+{
+	DWORD directory_cluster;
+	DWORD file_size;
+	BYTE read_attribute_byte;
+	BYTE read_file_name[8];
+	BYTE read_file_extension[3];
+
+	//CHECK CARD IS INSERTED AND HAS BEEN INITIALISED
+	if(ffs_card_ok == 0)
+		return(0);
+
+	//----- FIND THE DIRECTORY TO CREATE THE FILE IN -----
+	directory_cluster = ffs_find_path_directory(file_name, &file_name);
+	if (directory_cluster == 0xffffffff)
+		return(0);								//A directory in the path doesn't exist
+	ffs_select_directory(directory_cluster);
+
+	//----- CHECK THE NAME DOES NOT ALREADY EXIST -----
+	//(ffs_fopen deletes a file that exists before creating it, but ffs_find_file doesn't find directories or hidden files so the name may
+	//still be used by one of them)
+	if (ffs_find_directory_entry(file_name, FFS_FIND_ANY, &file_size, &read_attribute_byte, directory_entry_sector, directory_entry_within_sector,
+									read_file_name, read_file_extension) != 0xffffffff)
+	{
+		return(0);
+	}
+
+	//----- STORE FILE ENTRY IN DIRECTORY -----
+	//(This also finds the next empty cluster to use for the file)
+	*write_file_start_cluster = 0xffffffff;
+	if (ffs_add_directory_entry(file_name, attribute_byte, 0, write_file_start_cluster, directory_entry_sector, directory_entry_within_sector) == 0)
+		return(0);
+
+	//----- STORE END OF FILE MARKER FOR THE CLUSTER ENTRY IN THE FAT TABLE -----
+	ffs_modify_cluster_entry_in_fat(*write_file_start_cluster, 0x0fffffff);
+	ffs_flush_fat_window();
+	ffs_flush_file_system_information();
+
+
+
+	return(1);
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** ADD DIRECTORY ENTRY **********
+//*****************************************
+//*****************************************
+//Adds an entry to the selected directory.  With FFS_LONG_FILENAME_MAX a name that isn't a valid 8.3 name is stored as long filename
+//entries followed by an 8.3 entry with an alias of the name.
+//file_name
+//	The name (without a path)
+//attribute_byte, file_size
+//	For the new entry
+//start_cluster
+//	The start cluster for the entry.  If 0xffffffff the next empty cluster is found and written to here (it is not marked as used in
+//	the FAT table).
+//directory_entry_sector
+//	Sector that contains the 8.3 directory entry will be written to here
+//directory_entry_within_sector
+//	The 8.3 directory entry number within the sector will be written to here
+//
+//Return value
+//	1 = successful
+//	0 = failed (the name isn't valid, the directory is full or the card is full)
+BYTE ffs_add_directory_entry (const char *file_name, BYTE attribute_byte, DWORD file_size, DWORD *start_cluster, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector)
+{
+	BYTE converted_file_name[8];
+	BYTE converted_file_extension[3];
+	BYTE read_file_name[8];
+	BYTE read_file_extension[3];
+	BYTE read_attribute_byte;
+	DWORD read_file_size;
+	DWORD read_cluster_number;
+	BYTE start_from_beginning;
+	DWORD entry_number;
+	BYTE name_type;
+	BYTE entries_needed;
+	BYTE free_entries_found;
+	BYTE free_entry_hint_set;
+#ifdef FFS_LONG_FILENAME_MAX
+	FFS_DIRECTORY_POSITION first_entry;
+	FFS_SHORT_ALIAS alias;
+	WORD long_name_length = 0;
+	BYTE sequence;
+	BYTE checksum;
+#endif
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+	WORD long_name_hash = 0;
+#endif
+
+
+	//----- CONVERT FILE NAME TO 8 CHARACTER DOS FILENAME -----
+	//(0 = valid 8.3 name, 1 = wildcard characters, 2 = not a valid 8.3 name)
+	name_type = ffs_convert_filename_to_dos (file_name, converted_file_name, converted_file_extension);
+	if (name_type == 1)
+		return(0);
+
+	entries_needed = 1;
+	if (name_type == 2)
+	{
+	#ifdef FFS_LONG_FILENAME_MAX
+		//----- STORE THE NAME AS A LONG FILENAME WITH AN 8.3 ALIAS -----
+		long_name_length = ffs_check_long_filename_characters(file_name);
+		if (long_name_length == 0)
+			return(0);							//Not a valid long filename either ("", "." or "..", or characters that aren't allowed)
+
+		ffs_start_short_alias(file_name, long_name_length, &alias);			//(The alias is made once the directory has been searched)
+
+		entries_needed = (BYTE)((long_name_length + 12) / 13) + 1;		//(13 characters per long filename entry)
+	#else
+		return(0);								//Not a valid 8.3 name ("", "." or "..", too long or characters that aren't allowed)
+	#endif
+	}
+
+	//----- FIND EMPTY DIRECTORY ENTRIES TO USE FOR THE FILE -----
+	//Start from the first free entry hint if we have one (no entry before it is free), otherwise from the beginning of the directory.
+	//A long filename always starts from the beginning as every entry is checked for aliases already used by the same search.
+	if ((ffs_directory_free_entry.entry_number == 0xffffffff) || (entries_needed > 1))
+	{
+		start_from_beginning = 1;
+		entry_number = 0;
+	}
+	else
+	{
+		ffs_move_to_directory_entry(&ffs_directory_free_entry);
+		start_from_beginning = 0;
+		entry_number = ffs_directory_free_entry.entry_number;
+	}
+
+	//Get each entry until we find enough empty entries in a row
+	//(If 1st value is 0xe5 or 0x00 then entry is available - 0xe5 = deleted file, 0 = unused entry)
+	free_entries_found = 0;
+	free_entry_hint_set = 0;
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//GET NEXT ENTRY
+		if (ffs_read_next_directory_entry (&read_file_name[0], &read_file_extension[0], &read_attribute_byte, &read_file_size,
+											&read_cluster_number, start_from_beginning, directory_entry_sector, directory_entry_within_sector) == 0)
+		{
+			//Directory is full - no space for another entry
+			return(0);						//Reached end of directory
+		}
+		start_from_beginning = 0;
+
+		if ((read_file_name[0] == 0xe5) || (read_file_name[0] == 0x00))
+		{
+			//The first empty entry becomes the first free entry hint (as no entry before it is free the next search can start from it)
+			if (free_entry_hint_set == 0)
+			{
+				free_entry_hint_set = 1;
+				ffs_directory_free_entry.entry_number = entry_number;
+				ffs_directory_free_entry.lba = read_write_directory_last_lba;
+				ffs_directory_free_entry.entry_within_sector = (BYTE)read_write_directory_last_entry;
+				ffs_directory_free_entry.cluster = read_write_directory_current_cluster;
+			}
+
+			if (free_entries_found < entries_needed)
+			{
+				#ifdef FFS_LONG_FILENAME_MAX
+					if (free_entries_found == 0)
+					{
+						first_entry.entry_number = entry_number;
+						first_entry.lba = read_write_directory_last_lba;
+						first_entry.entry_within_sector = (BYTE)read_write_directory_last_entry;
+						first_entry.cluster = read_write_directory_current_cluster;
+					}
+				#endif
+
+				free_entries_found++;
+			}
+
+			//Done once enough entries have been found (a long filename carries on to the end of directory marker to check every alias)
+			if ((free_entries_found == entries_needed) && ((entries_needed == 1) || (read_file_name[0] == 0x00)))
+				break;
+		}
+		else
+		{
+			if (free_entries_found < entries_needed)
+				free_entries_found = 0;
+
+			#ifdef FFS_LONG_FILENAME_MAX
+				if ((entries_needed > 1) && ((read_attribute_byte & 0x08) == 0))		//(Not a long filename or volume label entry)
+					ffs_check_short_alias_entry(&alias, read_file_name, read_file_extension);
+			#endif
+		}
+
+		entry_number++;
+	}
+
+	//All entries after an entry that has never been used have never been used either
+	if (read_file_name[0] == 0x00)
+		ffs_directory_end_entry_number = entry_number + 1;
+
+	#ifdef FFS_LONG_FILENAME_MAX
+		//----- MAKE THE 8.3 ALIAS -----
+		if (entries_needed > 1)
+		{
+			if (ffs_finish_short_alias(&alias, converted_file_name, converted_file_extension) == 0)
+				return(0);
+		}
+	#endif
+
+	//----- FIND THE NEXT EMPTY CLUSTER TO USE FOR THE FILE
+	//(Done after finding the directory entries as a FAT32 directory may have had a new cluster added to it)
+	if (*start_cluster == 0xffffffff)
+	{
+		*start_cluster = ffs_get_next_free_cluster();
+		if (*start_cluster == 0xffffffff)			//0xffffffff = no empty cluster found
+		{
+			//No cluster available - disk is full
+			return(0);
+		}
+	}
+
+	#ifdef FFS_LONG_FILENAME_MAX
+		if (entries_needed > 1)
+		{
+			//----- STORE THE LONG FILENAME ENTRIES -----
+			//(In the entries before the 8.3 entry, the entry with the end of the name first)
+			checksum = ffs_short_name_checksum(converted_file_name, converted_file_extension);
+			ffs_move_to_directory_entry(&first_entry);
+			for (sequence = entries_needed - 1; sequence > 0; sequence--)
+			{
+				ffs_read_next_directory_entry (&read_file_name[0], &read_file_extension[0], &read_attribute_byte, &read_file_size,
+												&read_cluster_number, 0, directory_entry_sector, directory_entry_within_sector);
+				ffs_write_long_filename_entry(file_name, long_name_length, sequence, checksum);
+			}
+
+			//Move on to the 8.3 entry
+			ffs_read_next_directory_entry (&read_file_name[0], &read_file_extension[0], &read_attribute_byte, &read_file_size,
+											&read_cluster_number, 0, directory_entry_sector, directory_entry_within_sector);
+
+			#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+				long_name_hash = ffs_long_filename_hash(file_name, long_name_length);
+			#endif
+		}
+	#endif
+
+	//----- STORE FILE ENTRY IN DIRECTORY -----
+	ffs_overwrite_last_directory_entry (converted_file_name, converted_file_extension, &attribute_byte, &file_size, start_cluster);
+
+	#ifdef FFS_LONG_FILENAME_MAX
+		//Write the long filename entries that are in other sectors
+		if (entries_needed > 1)
+			ffs_flush_sector_cache();
+	#endif
+
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		ffs_add_file_to_directory_index(converted_file_name, converted_file_extension, attribute_byte, *start_cluster, file_size, *directory_entry_sector, *directory_entry_within_sector, long_name_hash);
+	#endif
+
+	return(1);
+}
+
+
+
+
+
+
+//*******************************************
+//*******************************************
+//********** FIND NEXT FREE CLUSTER *********
+//*******************************************
+//*******************************************
+//Find the next free cluster in the FAT table
+//Returns the cluster number, or 0xffffffff if no free cluster found (card full)
+DWORD ffs_get_next_free_cluster (void)
+{
+	WORD w_data;
+	DWORD dw_data;
+	DWORD lba;
+	DWORD dw_count;
+	DWORD dw_count1;
+	DWORD fat_entries_per_sector;
+	DWORD next_free_cluster;
+	BYTE *buffer_pointer;
+	DWORD start_cluster;
+
+
+	//----- IF THE NUMBER OF FREE CLUSTERS IS 0 THEN CHECK THE FAT TABLE BEFORE DECIDING THE DISK IS FULL -----
+	//(The count may have started from a FAT32 FSInfo sector that wasn't kept up to date, so it is only used as a guide)
+	if (free_cluster_count == 0)
+	{
+		free_cluster_count = ffs_count_free_clusters();
+		file_system_information_needs_writing = 1;
+		if (free_cluster_count == 0)
+			return(0xffffffff);
+	}
+
+	start_cluster = last_found_free_cluster;
+
+ffs_get_next_free_cluster_search:
+	#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+		//----- SEARCH THE FREE CLUSTER BITMAP FIRST -----
+		//(The bitmap is only kept for volume 0)
+		if (ffs_active_volume == 0)
+		{
+			next_free_cluster = ffs_find_free_cluster_in_bitmap(start_cluster);
+			if (next_free_cluster != 0xffffffff)
+				goto ffs_get_next_free_cluster_found;
+
+			//No free cluster in the part of the card the bitmap covers - search the FAT table above it
+			if (start_cluster < FFS_FREE_CLUSTER_BITMAP_CLUSTERS)
+				start_cluster = FFS_FREE_CLUSTER_BITMAP_CLUSTERS;
+			if (start_cluster > max_cluster_number)
+				goto ffs_get_next_free_cluster_none_found;
+		}
+	#endif
+
+
+	//----- START READING THE FAT TABLE FROM THE LAST ENTRY WHERE WE FOUND A FREE CLUSTER -----
+	lba = fat1_start_sector;
+
+	if (disk_is_fat_32)
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);	//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
+	else
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);	//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
+
+	//Move to the sector the last free cluster was found in
+	//(To avoid having to search from the start each time which could waste a lot of time)
+	dw_count = (start_cluster / fat_entries_per_sector);
+	lba += dw_count;
+	next_free_cluster = (dw_count * fat_entries_per_sector);
+	
+
+	//----- SEARCH FOR THE NEXT FREE CLUSTER -----
+	//Incrementally read each sector of the FAT table
+	for (dw_count = (lba - fat1_start_sector); dw_count < (sectors_per_fat - 1); dw_count++)	//We use (sectors_per_fat - 1) to avoid the need to calculate the total number of sectors per fat
+	{																							//(this saves code space and should only result in a relatively small amount of wasted clusters)
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//Read the next sector
+		ffs_read_fat_sector_to_window(lba);
+		buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0];
+
+		//Check each entry in the sector
+		for (dw_count1 = 0; dw_count1 < fat_entries_per_sector; dw_count1++)
+		{
+
+			if (disk_is_fat_32)
+			{
+				dw_data = (DWORD)*buffer_pointer++;
+				dw_data |= (DWORD)(*buffer_pointer++) << 8;
+				dw_data |= (DWORD)(*buffer_pointer++) << 16;
+				dw_data |= (DWORD)(*buffer_pointer++) << 24;
+				dw_data &= 0x0fffffff;							//The top 4 bits are reserved
+				if (dw_data == 0)								//0x00000000 = free cluster
+					goto ffs_get_next_free_cluster_found;
+			}
+			else
+			{
+				w_data = (DWORD)*buffer_pointer++;
+				w_data |= (DWORD)(*buffer_pointer++) << 8;
+				if (w_data == 0)								//0x0000 = free cluster
+					goto ffs_get_next_free_cluster_found;
+			}
+			next_free_cluster++;	
+
+			//Check for overrun past the last cluster on the card
+			if (next_free_cluster > max_cluster_number)
+				goto ffs_get_next_free_cluster_none_found;
+
+			//Check for overrun into unavailable clusters (the values below denote special meanings in the fat table)
+			if (disk_is_fat_32)
+			{
+				if (next_free_cluster >= 0x0ffffff7)
+					goto ffs_get_next_free_cluster_none_found;
+			}
+			else
+			{
+				if (next_free_cluster >= 0x0000fff7)
+					goto ffs_get_next_free_cluster_none_found;
+			}
+		}
+		lba++;
+	}
+
+
+ffs_get_next_free_cluster_none_found:
+	//----------------------------------------------------------------
+	//----- THERE IS NO FREE CLUSTER ABOVE WHERE WE STARTED FROM -----
+	//----------------------------------------------------------------
+	//(We may have started part way through the FAT table, for instance from the FAT32 FSInfo next free cluster hint, so search again
+	//from the beginning before deciding the disk is full)
+	if (last_found_free_cluster > 2)
+	{
+		last_found_free_cluster = 2;
+		start_cluster = 2;
+		goto ffs_get_next_free_cluster_search;
+	}
+
+	//----- THERE IS NO FREE CLUSTER - DISK IS FULL -----
+	return(0xffffffff);
+
+
+ffs_get_next_free_cluster_found:
+	//---------------------------------------
+	//----- FOUND THE NEXT FREE CLUSTER -----
+	//---------------------------------------
+	last_found_free_cluster = next_free_cluster;			//Store ready for the next time we search
+
+	return(next_free_cluster);
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** GET NEXT CLUSTER NUMBER **********
+//*********************************************
+//*********************************************
+//Get the next cluster number from the FAT table
+DWORD ffs_get_next_cluster_no (DWORD current_cluster)
+{
+	DWORD fat_entries_per_sector;
+	WORD data;
+	DWORD lba;
+	DWORD dw_temp;
+	BYTE *buffer_pointer;
+
+	lba = fat1_start_sector;
+
+	if (disk_is_fat_32)
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
+	else
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
+
+
+	//----- MOVE TO THE SECTOR IN THE FAT TABLE FOR THE CURRENT CLUSTER NUMBER -----
+	dw_temp = (current_cluster / fat_entries_per_sector);
+	lba += dw_temp;
+	current_cluster -= (dw_temp * fat_entries_per_sector);
+
+	ffs_read_fat_sector_to_window(lba);
+
+
+	//----- GET THE NEXT CLUSTER ENTRY FROM THE FAT TABLE -----
+	if (disk_is_fat_32)
+	{
+		buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0] + (current_cluster << 2);
+
+		lba = (DWORD)*buffer_pointer++;									//FAT32 - 1 double word per entry
+		lba |= ((DWORD)(*buffer_pointer++) << 8);
+		lba |= ((DWORD)(*buffer_pointer++) << 16);
+		lba |= ((DWORD)((*buffer_pointer++) & 0x0f) << 24);				//Top nibble reserved bits need to be removed
+	}
+	else
+	{
+		buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0] + (current_cluster << 1);
+
+		lba = (DWORD)*buffer_pointer++;
+		lba |= ((DWORD)(*buffer_pointer++) << 8);						//FAT16 - 1 word per entry
+	}
+	return (lba);
+}
+
+
+
+
+
+
+//**************************************************************
+//**************************************************************
+//********** GET NEXT CLUSTER ADDING ONE IF NECESSARY **********
+//**************************************************************
+//**************************************************************
+//Get the next cluster number of a chain that is being written to.  If the current cluster is the last in the chain a free cluster
+//is added to the end of the chain.
+//Returns the next cluster number, or 0xffffffff if a new cluster was needed but there is no free cluster (card full)
+DWORD ffs_get_or_add_next_cluster (DWORD current_cluster)
+{
+	DWORD next_cluster;
+
+	next_cluster = ffs_get_next_cluster_no(current_cluster);
+
+	if (disk_is_fat_32)
+	{
+		if ((next_cluster >= 2) && (next_cluster < 0x0ffffff8))
+			return(next_cluster);
+	}
+	else
+	{
+		if ((next_cluster >= 2) && (next_cluster < 0xfff8))
+			return(next_cluster);
+	}
+
+	//----- THIS IS THE LAST CLUSTER OF THE CHAIN - ADD A NEW CLUSTER -----
+	next_cluster = ffs_get_next_free_cluster();
+	if (next_cluster == 0xffffffff)			//0xffffffff = no empty cluster found
+		return(0xffffffff);
+
+	//UPDATE THE CURRENT CLUSTER TO LINK TO THE NEXT CLUSTER
+	ffs_modify_cluster_entry_in_fat(current_cluster, next_cluster);
+
+	//UPDATE THE NEXT CLUSTER WITH THE END OF FILE MARKER
+	ffs_modify_cluster_entry_in_fat(next_cluster, 0x0fffffff);
+
+	return(next_cluster);
+}
+
+
+
+
+
+
+//*************************************************
+//*************************************************
+//********** WRITE WHOLE SECTORS TO FILE **********
+//*************************************************
+//*************************************************
+//Writes whole sectors from the callers buffer straight to the card starting at the current file position, which must be at the start of
+//a sector.  The driver buffer is not used.  Each run of contiguous clusters is sent to the card as a single multi sector write command.
+//source
+//	Data to write (sector_count x ffs_bytes_per_sector bytes)
+//Returns
+//	Number of sectors written (0 if the file position is not at the start of a sector, writing is not permitted or the card is full)
+DWORD ffs_write_file_sectors (FFS_FILE *file_pointer, BYTE *source, DWORD sector_count)
+{
+	DWORD next_cluster;
+	DWORD run_start_lba;
+	WORD run_length;
+	DWORD sectors_written = 0;
+	DWORD dw_temp;
+
+
+	//----- CHECK THAT WRITING IS PERMITTED -----
+	if ((file_pointer->flags.bits.file_is_open == 0) || (file_pointer->flags.bits.write_permitted == 0))
+		return(0);
+
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(0);
+
+	//----- CHECK THAT THE NEXT BYTE TO WRITE IS THE FIRST BYTE OF A SECTOR -----
+	dw_temp = file_pointer->current_byte_within_file;
+	if (file_pointer->flags.bits.inc_posn_before_next_rw)
+	{
+		if (file_pointer->current_byte != (ffs_bytes_per_sector - 1))
+			return(0);
+		dw_temp++;
+	}
+	else
+	{
+		if (file_pointer->current_byte != 0)
+			return(0);
+	}
+
+	if ((file_pointer->flags.bits.write_append_only) && (dw_temp < file_pointer->open_file->file_size))
+		return(0);								//(Leave ffs_fputc to move the position to the end of the file)
+
+	if (sector_count == 0)
+		return(0);
+
+
+	//----- MOVE TO THE START OF THE NEXT SECTOR IF NECESSARY -----
+	if (file_pointer->flags.bits.inc_posn_before_next_rw)
+	{
+		if ((file_pointer->current_sector + 1) >= sectors_per_cluster)
+		{
+			next_cluster = ffs_get_or_add_next_cluster(file_pointer->current_cluster);
+			if (next_cluster == 0xffffffff)
+				return(0);						//Card is full
+
+			file_pointer->current_cluster = next_cluster;
+			file_pointer->current_sector = 0;
+		}
+		else
+		{
+			file_pointer->current_sector++;
+		}
+		file_pointer->current_byte = 0;
+		file_pointer->current_byte_within_file++;
+		file_pointer->flags.bits.inc_posn_before_next_rw = 0;
+	}
+
+
+	//----- WRITE EACH RUN OF CONTIGUOUS SECTORS -----
+	run_start_lba = ((file_pointer->current_cluster - 2) * sectors_per_cluster) + (DWORD)file_pointer->current_sector + data_area_start_sector;
+	run_length = 0;
+
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//ADD THE REST OF THIS CLUSTER TO THE RUN
+		dw_temp = (DWORD)(sectors_per_cluster - file_pointer->current_sector);
+		if (dw_temp > sector_count)
+			dw_temp = sector_count;
+
+		run_length += (WORD)dw_temp;
+		sector_count -= dw_temp;
+		file_pointer->current_sector += (BYTE)(dw_temp - 1);				//Left pointing to the last sector written
+
+		if (sector_count == 0)
+			break;
+
+		//GET THE NEXT CLUSTER
+		next_cluster = ffs_get_or_add_next_cluster(file_pointer->current_cluster);
+		if (next_cluster == 0xffffffff)
+			break;								//Card is full - just write what we have
+
+		if (
+			(next_cluster != (file_pointer->current_cluster + 1)) ||
+			((run_length + sectors_per_cluster) > 256)
+			)
+		{
+			//NEXT CLUSTER IS NOT CONTIGUOUS (OR THE RUN IS AS LONG AS A SINGLE COMMAND ALLOWS) - WRITE THIS RUN AND START A NEW ONE
+			ffs_write_sectors(run_start_lba, run_length, source);
+			source += (DWORD)run_length * ffs_bytes_per_sector;
+			sectors_written += run_length;
+
+			run_start_lba = ((next_cluster - 2) * sectors_per_cluster) + data_area_start_sector;
+			run_length = 0;
+		}
+
+		file_pointer->current_cluster = next_cluster;
+		file_pointer->current_sector = 0;
+	}
+
+	ffs_write_sectors(run_start_lba, run_length, source);
+	sectors_written += run_length;
+
+
+	//----- LEAVE THE FILE POINTING TO THE LAST BYTE WRITTEN -----
+	file_pointer->current_byte = ffs_bytes_per_sector - 1;
+	file_pointer->current_byte_within_file += (sectors_written * ffs_bytes_per_sector) - 1;
+	file_pointer->flags.bits.inc_posn_before_next_rw = 1;
+
+	//----- ADJUST FILE SIZE IF WE HAVE WRITTEN PAST THE END OF THE FILE -----
+	if (file_pointer->current_byte_within_file >= file_pointer->open_file->file_size)
+	{
+		file_pointer->open_file->file_size = file_pointer->current_byte_within_file + 1;
+		file_pointer->open_file->flags.bits.file_size_has_changed = 1;
+	}
+
+	return(sectors_written);
+}
+
+
+
+
+
+
+//**************************************************
+//**************************************************
+//********** READ WHOLE SECTORS FROM FILE **********
+//**************************************************
+//**************************************************
+//Reads whole sectors from the current file position, which must be at the start of a sector, straight into the callers buffer.  The
+//driver buffer is not used.  Each run of contiguous clusters is read from the card as a single multi sector read command.  Only sectors
+//that are completely within the file are read.
+//destination
+//	Buffer to read to (sector_count x ffs_bytes_per_sector bytes)
+//Returns
+//	Number of sectors read (0 if the file position is not at the start of a sector, reading is not permitted or there isn't a whole
+//	sector of the file left to read)
+DWORD ffs_read_file_sectors (FFS_FILE *file_pointer, BYTE *destination, DWORD sector_count)
+{
+	DWORD next_cluster;
+	DWORD run_start_lba;
+	WORD run_length;
+	DWORD sectors_read = 0;
+	DWORD dw_temp;
+
+
+	//----- CHECK THAT READING IS PERMITTED -----
+	if ((file_pointer->flags.bits.file_is_open == 0) || (file_pointer->flags.bits.read_permitted == 0))
+		return(0);
+
+	//----- SELECT THE VOLUME THE FILE IS ON -----
+	if (ffs_select_volume(file_pointer->open_file->volume) == 0)
+		return(0);
+
+	//----- CHECK THAT THE NEXT BYTE TO READ IS THE FIRST BYTE OF A SECTOR -----
+	dw_temp = file_pointer->current_byte_within_file;
+	if (file_pointer->flags.bits.inc_posn_before_next_rw)
+	{
+		if (file_pointer->current_byte != (ffs_bytes_per_sector - 1))
+			return(0);
+		dw_temp++;
+	}
+	else
+	{
+		if (file_pointer->current_byte != 0)
+			return(0);
+	}
+
+	//----- LIMIT TO THE WHOLE SECTORS LEFT IN THE FILE -----
+	if (dw_temp >= file_pointer->open_file->file_size)
+		return(0);
+	dw_temp = (file_pointer->open_file->file_size - dw_temp) / ffs_bytes_per_sector;
+	if (sector_count > dw_temp)
+		sector_count = dw_temp;
+
+	if (sector_count == 0)
+		return(0);
+
+
+	//----- MOVE TO THE START OF THE NEXT SECTOR IF NECESSARY -----
+	if (file_pointer->flags.bits.inc_posn_before_next_rw)
+	{
+		if ((file_pointer->current_sector + 1) >= sectors_per_cluster)
+		{
+			next_cluster = ffs_get_next_cluster_no(file_pointer->current_cluster);
+			if (
+				((disk_is_fat_32) && (next_cluster >= 0x0ffffff8)) ||
+				((disk_is_fat_32 == 0) && (next_cluster >= 0xfff8))
+				)
+			{
+				return(0);						//There is no next cluster
+			}
+
+			file_pointer->current_cluster = next_cluster;
+			file_pointer->current_sector = 0;
+		}
+		else
+		{
+			file_pointer->current_sector++;
+		}
+		file_pointer->current_byte = 0;
+		file_pointer->current_byte_within_file++;
+		file_pointer->flags.bits.inc_posn_before_next_rw = 0;
+	}
+
+
+	//----- READ EACH RUN OF CONTIGUOUS SECTORS -----
+	run_start_lba = ((file_pointer->current_cluster - 2) * sectors_per_cluster) + (DWORD)file_pointer->current_sector + data_area_start_sector;
+	run_length = 0;
+
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//ADD THE REST OF THIS CLUSTER TO THE RUN
+		dw_temp = (DWORD)(sectors_per_cluster - file_pointer->current_sector);
+		if (dw_temp > sector_count)
+			dw_temp = sector_count;
+
+		run_length += (WORD)dw_temp;
+		sector_count -= dw_temp;
+		file_pointer->current_sector += (BYTE)(dw_temp - 1);				//Left pointing to the last sector read
+
+		if (sector_count == 0)
+			break;
+
+		//GET THE NEXT CLUSTER
+		next_cluster = ffs_get_next_cluster_no(file_pointer->current_cluster);
+		if (
+			((disk_is_fat_32) && (next_cluster >= 0x0ffffff8)) ||
+			((disk_is_fat_32 == 0) && (next_cluster >= 0xfff8))
+			)
+		{
+			break;								//There is no next cluster - just read what we have
+		}
+
+		if (
+			(next_cluster != (file_pointer->current_cluster + 1)) ||
+			((run_length + sectors_per_cluster) > 256)
+			)
+		{
+			//NEXT CLUSTER IS NOT CONTIGUOUS (OR THE RUN IS AS LONG AS A SINGLE COMMAND ALLOWS) - READ THIS RUN AND START A NEW ONE
+			ffs_read_sectors(run_start_lba, run_length, destination);
+			destination += (DWORD)run_length * ffs_bytes_per_sector;
+			sectors_read += run_length;
+
+			run_start_lba = ((next_cluster - 2) * sectors_per_cluster) + data_area_start_sector;
+			run_length = 0;
+		}
+
+		file_pointer->current_cluster = next_cluster;
+		file_pointer->current_sector = 0;
+	}
+
+	ffs_read_sectors(run_start_lba, run_length, destination);
+	sectors_read += run_length;
+
+
+	//----- LEAVE THE FILE POINTING TO THE LAST BYTE READ -----
+	file_pointer->current_byte = ffs_bytes_per_sector - 1;
+	file_pointer->current_byte_within_file += (sectors_read * ffs_bytes_per_sector) - 1;
+	file_pointer->flags.bits.inc_posn_before_next_rw = 1;
+
+	return(sectors_read);
+}
+
+
+
+
+
+
+//********************************************************
+//********************************************************
+//********** MODIFY CLUSTER VALUE IN FAT TABLES **********
+//********************************************************
+//********************************************************
+//The change is made in the FAT window and written to each active FAT table when the window moves to another sector or
+//ffs_flush_fat_window is called.  Working on a FAT sector as much as possible before writing it makes following, extending and
+//deleting cluster chains much faster as each FAT sector is only written once instead of once for each modified entry.
+void ffs_modify_cluster_entry_in_fat (DWORD cluster_to_modify, DWORD cluster_entry_new_value)
+{
+	DWORD lba;
+	BYTE *buffer_pointer;
+	DWORD fat_entries_per_sector;
+	BYTE temp;
+	DWORD dw_temp;
+
+
+	//----- TELL THE BLOCK DEVICE IF THE CLUSTER IS NO LONGER USED -----
+	//(Freed clusters are collected into runs and trimmed after the FAT tables have been written)
+	if (ffs_block_device->trim)
+		ffs_update_trim_runs(cluster_to_modify, (cluster_entry_new_value == 0));
+
+	//----- KEEP THE FREE CLUSTER BITMAP UP TO DATE -----
+	#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+		if ((ffs_active_volume == 0) && (cluster_to_modify < ffs_free_cluster_bitmap_scanned_to))
+		{
+			if (cluster_entry_new_value)
+				ffs_free_cluster_bitmap[cluster_to_modify >> 5] |= ((DWORD)0x00000001 << (BYTE)(cluster_to_modify & 0x1f));
+			else
+				ffs_free_cluster_bitmap[cluster_to_modify >> 5] &= ~((DWORD)0x00000001 << (BYTE)(cluster_to_modify & 0x1f));
+		}
+	#endif
+
+
+	//----- MOVE TO THE SECTOR FOR THIS CLUSTER ENTRY IN THE FAT1 TABLE -----
+	lba = fat1_start_sector;
+
+	if (disk_is_fat_32)
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
+	else
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
+
+	//Move to the relevant sector in the FAT table
+	dw_temp = (cluster_to_modify / fat_entries_per_sector);
+	lba += dw_temp;
+	cluster_to_modify -= (dw_temp * fat_entries_per_sector);
+
+	//----- MODIFY THE ENTRY IN THE FAT WINDOW -----
+	//We only read the first FAT table sector and then write it to all of the FAT tables.  This isn't perfect as ideally we would read each
+	//sector from each FAT table in case there was an error in the first table.  However this has a significant impact on speed so its worth
+	//accepting that any error in the first FAT table will be carried accross to other tables which is very unlikely (and anyway an error has
+	//then already occured)
+	ffs_read_fat_sector_to_window(lba);
+
+	if (disk_is_fat_32)
+		buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0] + (cluster_to_modify << 2);
+	else
+		buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0] + (cluster_to_modify << 1);
+
+	//----- KEEP THE FREE CLUSTER COUNT UP TO DATE -----
+	if (free_cluster_count != 0xffffffff)
+	{
+		dw_temp = (DWORD)buffer_pointer[0];
+		dw_temp |= (DWORD)buffer_pointer[1] << 8;
+		if (disk_is_fat_32)
+		{
+			dw_temp |= (DWORD)buffer_pointer[2] << 16;
+			dw_temp |= (DWORD)(buffer_pointer[3] & 0x0f) << 24;		//Top nibble reserved bits need to be removed
+		}
+
+		if ((dw_temp == 0) && (cluster_entry_new_value != 0))
+		{
+			free_cluster_count--;
+			file_system_information_needs_writing = 1;
+		}
+		else if ((dw_temp != 0) && (cluster_entry_new_value == 0))
+		{
+			free_cluster_count++;
+			file_system_information_needs_writing = 1;
+		}
+	}
+
+	*buffer_pointer++ = (BYTE)(cluster_entry_new_value & 0x000000ff);
+	*buffer_pointer++ = (BYTE)((cluster_entry_new_value & 0x0000ff00) >> 8);
+	if (disk_is_fat_32)
+	{
+		*buffer_pointer++ = (BYTE)((cluster_entry_new_value & 0x00ff0000) >> 16);
+		temp = (*buffer_pointer & 0xf0);
+		*buffer_pointer++ = ((BYTE)((cluster_entry_new_value & 0x0f000000) >> 24) | temp);		//The top 4 bits are reserved and should not be modified
+	}
+
+	ffs_fat_window_needs_writing_to_card = 1;
+}
+
+
+
+
+
+
+//***********************************************
+//***********************************************
+//********** READ FAT SECTOR TO WINDOW **********
+//***********************************************
+//***********************************************
+//The FAT table is accessed through its own buffer so that following and allocating clusters doesn't evict file data from the sector
+//cache.  If the window already holds the sector it isn't read again.
+//sector_lba = sector address in the FAT1 table
+void ffs_read_fat_sector_to_window (DWORD sector_lba)
+{
+	if (ffs_fat_window_lba == sector_lba)
+		return;
+
+	//----- IF THE WINDOW HAS BEEN MODIFIED THEN WRITE IT FIRST -----
+	ffs_write_fat_window();			//(Freed cluster runs are left to grow and are trimmed by the next ffs_flush_fat_window)
+
+	//----- READ THE SECTOR INTO THE WINDOW -----
+	ffs_fat_window_lba = 0xffffffff;
+	FFS_IO_READ_TYPE(FFS_IO_READ_FAT);
+	ffs_read_sectors(sector_lba, 1, &FFS_DRIVER_FAT_512_BYTE_BUFFER[0]);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+	ffs_fat_window_lba = sector_lba;
+	ffs_fat_window_volume = ffs_active_volume;
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** FLUSH FAT WINDOW **********
+//**************************************
+//**************************************
+//If the FAT window has been modified write it to each active FAT table, then trim the clusters that have been freed
+void ffs_flush_fat_window (void)
+{
+	ffs_write_fat_window();
+
+	ffs_trim_freed_clusters();
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** WRITE FAT WINDOW **********
+//**************************************
+//**************************************
+//If the FAT window has been modified write it to each active FAT table.  The window is left as it is when a different volume is selected
+//so it may hold a sector of a volume that isn't the active one - that volume's FAT tables are then found from its ffs_volume entry.
+void ffs_write_fat_window (void)
+{
+	DWORD lba;
+	DWORD fat_sectors;
+	BYTE fat_flags;
+	BYTE count;
+
+
+	if (ffs_fat_window_needs_writing_to_card == 0)
+		return;
+
+	ffs_fat_window_needs_writing_to_card = 0;
+
+	if (ffs_fat_window_lba == 0xffffffff)				//This should not be possible but check is made just in case!
+		return;
+
+	if (ffs_fat_window_volume == ffs_active_volume)
+	{
+		fat_flags = active_fat_table_flags;
+		fat_sectors = sectors_per_fat;
+	}
+	else
+	{
+		fat_flags = ffs_volume[ffs_fat_window_volume].active_fat_table_flags;
+		fat_sectors = ffs_volume[ffs_fat_window_volume].sectors_per_fat;
+	}
+
+	lba = ffs_fat_window_lba;
+	for (count = 0x01; count < 0x10; count <<= 1)
+	{
+		if (count & fat_flags)												//Only write FAT tables that are active
+			ffs_write_sectors(lba, 1, &FFS_DRIVER_FAT_512_BYTE_BUFFER[0]);
+
+		lba += fat_sectors;													//Move to next FAT table
+	}
+}
+
+
+
+
+
+
+//**************************************
+//**************************************
+//********** UPDATE TRIM RUNS **********
+//**************************************
+//**************************************
+//Called for each cluster entry modified in the FAT table when the block device supports trim.  A freed cluster is added to the run it
+//follows on from, or starts a new run.  A cluster that is used again is removed so it can't be trimmed after it has been written.  The
+//runs are held as sectors so runs freed on a volume that is no longer active are still trimmed correctly.
+//cluster_is_free = 1 if the cluster has been freed, 0 if it is now used
+void ffs_update_trim_runs (DWORD cluster, BYTE cluster_is_free)
+{
+	BYTE run;
+	DWORD sector;
+	FFS_TRIM_RUN *trim_run;
+
+
+	sector = ((cluster - 2) * sectors_per_cluster) + data_area_start_sector;
+
+	//----- A CLUSTER THAT IS USED AGAIN MUST NOT BE TRIMMED -----
+	if (cluster_is_free == 0)
+	{
+		for (run = 0; run < ffs_trim_run_count; run++)
+		{
+			trim_run = &ffs_trim_run[run];
+			if ((sector >= trim_run->start_sector) && (sector < (trim_run->start_sector + trim_run->sector_count)))
+				trim_run->sector_count = sector - trim_run->start_sector;		//(The end of the run is just not trimmed)
+		}
+		return;
+	}
+
+	//----- EXTEND A RUN THIS CLUSTER FOLLOWS ON FROM -----
+	for (run = 0; run < ffs_trim_run_count; run++)
+	{
+		trim_run = &ffs_trim_run[run];
+		if ((trim_run->sector_count) && (sector == (trim_run->start_sector + trim_run->sector_count)))
+		{
+			trim_run->sector_count += sectors_per_cluster;
+			return;
+		}
+	}
+
+	//----- START A NEW RUN -----
+	if (ffs_trim_run_count >= FFS_TRIM_RUNS)
+		ffs_flush_fat_window();			//No run free - write the FAT window now so the runs held can be trimmed
+
+	ffs_trim_run[ffs_trim_run_count].start_sector = sector;
+	ffs_trim_run[ffs_trim_run_count].sector_count = sectors_per_cluster;
+	ffs_trim_run_count++;
+}
+
+
+
+
+
+
+//*****************************************
+//*****************************************
+//********** TRIM FREED CLUSTERS **********
+//*****************************************
+//*****************************************
+//Tells the block device the freed cluster runs no longer hold any data, one trim per run.  Only called once the FAT window has been
+//written so the FAT tables on the card no longer use the clusters.
+void ffs_trim_freed_clusters (void)
+{
+	BYTE run;
+	DWORD lba;
+	DWORD sector_count;
+#ifdef FFS_IO_TRACE_FUNCTION
+	FFS_IO_TRACE_TIMER_TYPE trace_start_time;
+#endif
+
+
+	for (run = 0; run < ffs_trim_run_count; run++)
+	{
+		if (ffs_trim_run[run].sector_count == 0)
+			continue;
+
+		lba = ffs_trim_run[run].start_sector;
+		sector_count = ffs_trim_run[run].sector_count;
+
+		#ifdef FFS_IO_TRACE_FUNCTION
+			trace_start_time = FFS_IO_TRACE_TIME;
+		#endif
+
+		ffs_block_device->trim(lba, sector_count);
+
+		#ifdef FFS_IO_TRACE_FUNCTION
+			FFS_IO_TRACE_FUNCTION(FFS_IO_TRIM, lba, ((sector_count > 0xffff) ? 0xffff : (WORD)sector_count), FFS_IO_TRACE_DURATION(trace_start_time));
+		#endif
+	}
+	ffs_trim_run_count = 0;
+}
+
+
+
+
+
+
+#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+//*****************************************************
+//*****************************************************
+//********** FIND FREE CLUSTER IN THE BITMAP **********
+//*****************************************************
+//*****************************************************
+//Searches the bitmap from start_cluster, reading more of the FAT table into the bitmap as the search reaches the end of the part that is
+//already known.  Each FAT sector is only read once for the bitmap after the card is inserted.  The bitmap is only kept for volume 0.
+//Returns the cluster number, or 0xffffffff if there is no free cluster in the part of the card the bitmap covers
+DWORD ffs_find_free_cluster_in_bitmap (DWORD start_cluster)
+{
+	DWORD next_free_cluster;
+
+
+	if (ffs_active_volume != 0)				//The caller checks this but check is made just in case! (the bitmap would be filled from another volume's FAT table)
+		return(0xffffffff);
+
+	if (start_cluster < 2)
+		start_cluster = 2;
+
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		//----- SEARCH THE PART OF THE BITMAP THAT IS KNOWN -----
+		if (start_cluster < ffs_free_cluster_bitmap_scanned_to)
+		{
+			next_free_cluster = ffs_search_free_cluster_bitmap(start_cluster, ffs_free_cluster_bitmap_scanned_to);
+			if (next_free_cluster != 0xffffffff)
+				return(next_free_cluster);
+
+			start_cluster = ffs_free_cluster_bitmap_scanned_to;
+		}
+
+		//----- ADD THE NEXT FAT SECTOR TO THE BITMAP -----
+		if (
+			(ffs_free_cluster_bitmap_scanned_to >= FFS_FREE_CLUSTER_BITMAP_CLUSTERS) ||
+			(ffs_free_cluster_bitmap_scanned_to > max_cluster_number)
+			)
+		{
+			return(0xffffffff);
 		}
+
+		ffs_add_fat_sector_to_free_cluster_bitmap();
+	}
+}
+
+
+
+
+
+
+//************************************************
+//************************************************
+//********** SEARCH FREE CLUSTER BITMAP **********
+//************************************************
+//************************************************
+//Looks for the first clear bit from start_cluster up to (but not including) end_cluster (which must be a multiple of 32)
+//Returns the cluster number, or 0xffffffff if none found
+DWORD ffs_search_free_cluster_bitmap (DWORD start_cluster, DWORD end_cluster)
+{
+	DWORD word_number;
+	DWORD end_word_number;
+	DWORD bits;
+	BYTE bit_number;
+#ifdef FFS_FREE_CLUSTER_BITMAP_WIDE_SEARCH
+	DWORD all_bits;
+	BYTE count;
+#endif
+
+
+	word_number = (start_cluster >> 5);
+	end_word_number = (end_cluster >> 5);
+
+	//Treat the clusters before the start cluster in the first word as used
+	bits = ffs_free_cluster_bitmap[word_number] | (((DWORD)0x00000001 << (BYTE)(start_cluster & 0x1f)) - 1);
+
+	while (1)
+	{
+		//----- IF THIS WORD HAS A CLEAR BIT THEN FIND IT -----
+		if (bits != 0xffffffff)
+		{
+			bit_number = 0;
+			while (bits & 0x00000001)
+			{
+				bits >>= 1;
+				bit_number++;
+			}
+			return((word_number << 5) + (DWORD)bit_number);
+		}
+
+		word_number++;
+
+	#ifdef FFS_FREE_CLUSTER_BITMAP_WIDE_SEARCH
+		//----- SKIP BLOCKS OF 8 WORDS THAT ARE ALL USED -----
+		//(Written as a simple fixed length loop so the compiler can use vector instructions)
+		while ((word_number + 8) <= end_word_number)
+		{
+			all_bits = 0xffffffff;
+			for (count = 0; count < 8; count++)
+				all_bits &= ffs_free_cluster_bitmap[word_number + count];
+
+			if (all_bits != 0xffffffff)
+				break;
+
+			word_number += 8;
+		}
+	#endif
+
+		if (word_number >= end_word_number)
+			return(0xffffffff);
+
+		bits = ffs_free_cluster_bitmap[word_number];
+	}
+}
+
+
+
+
+
+
+//****************************************************************
+//****************************************************************
+//********** ADD NEXT FAT SECTOR TO FREE CLUSTER BITMAP **********
+//****************************************************************
+//****************************************************************
+//Reads the FAT sector for the clusters starting at ffs_free_cluster_bitmap_scanned_to and sets the bitmap bits for them
+void ffs_add_fat_sector_to_free_cluster_bitmap (void)
+{
+	DWORD fat_entries_per_sector;
+	DWORD cluster;
+	DWORD dw_data;
+	WORD count;
+	BYTE *buffer_pointer;
+
+
+	if (disk_is_fat_32)
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
+	else
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
+
+	cluster = ffs_free_cluster_bitmap_scanned_to;
+	ffs_read_fat_sector_to_window(fat1_start_sector + (cluster / fat_entries_per_sector));
+	buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0];
+
+	for (count = 0; count < (WORD)fat_entries_per_sector; count++)
+	{
+		if (disk_is_fat_32)
+		{
+			dw_data = (DWORD)*buffer_pointer++;
+			dw_data |= (DWORD)(*buffer_pointer++) << 8;
+			dw_data |= (DWORD)(*buffer_pointer++) << 16;
+			dw_data |= (DWORD)(*buffer_pointer++) << 24;
+			dw_data &= 0x0fffffff;							//The top 4 bits are reserved
+		}
+		else
+		{
+			dw_data = (DWORD)*buffer_pointer++;
+			dw_data |= (DWORD)(*buffer_pointer++) << 8;
+		}
+
+		//Clusters that are used, and FAT entries past the last cluster on the card, are flagged as used
+		if ((dw_data) || (cluster > max_cluster_number))
+			ffs_free_cluster_bitmap[cluster >> 5] |= ((DWORD)0x00000001 << (BYTE)(cluster & 0x1f));
+		else
+			ffs_free_cluster_bitmap[cluster >> 5] &= ~((DWORD)0x00000001 << (BYTE)(cluster & 0x1f));
+
+		cluster++;
 	}
+
+	ffs_free_cluster_bitmap_scanned_to = cluster;
 }
+#endif		//#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
 
 
 
 
 
 
-//*******************************************************************
-//*******************************************************************
-//********** CONVERT FILE NAME TO 8 CHARACTER DOS FILENAME **********
-//*******************************************************************
-//*******************************************************************
-//Source filename is a case insensitive string with between 1 and 8 filename characters, a period (full stop) character, between 1 and 3 extension characters and a terminating null.
-//Returns:
-//	1 if the filename contained any wildcard characters, 0 if not (this allow calling functions to detect invalid names if they are creating a new file)
-BYTE ffs_convert_filename_to_dos (const char *source_filename, BYTE *dos_filename, BYTE *dos_extension)
+//*****************************************
+//*****************************************
+//********** COUNT FREE CLUSTERS **********
+//*****************************************
+//*****************************************
+//Searches the whole FAT table
+//Returns the number of free clusters
+DWORD ffs_count_free_clusters (void)
 {
-	BYTE temp;
-	BYTE no_null_found_yet;
-	BYTE wildcard_character_found = 0;
-	BYTE asterix_wildcard_used;
+	DWORD lba;
+	DWORD cluster;
+	DWORD dw_data;
+	DWORD fat_entries_per_sector;
+	DWORD free_clusters;
+	WORD count;
+	BYTE *buffer_pointer;
 
-	//----- DO THE FILENAME -----
-	no_null_found_yet = 1;
-	asterix_wildcard_used = 0;
-	for (temp = 0; temp < 8; temp++)
-	{
-		//Flag if filename contains a wildcard character (for return)
-		if ((*source_filename == '?') || (*source_filename == '*'))
-			wildcard_character_found = 1;
 
-		//Check for asterix wildcard character
-		if (*source_filename == '*')
-			asterix_wildcard_used = 1;
+	if (disk_is_fat_32)
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
+	else
+		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
 
-		//Check for terminating '.'
-		if (*source_filename == '.')
-			no_null_found_yet = 0;
+	free_clusters = 0;
+	cluster = 0;
+	for (lba = fat1_start_sector; cluster <= max_cluster_number; lba++)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
 
-		//COPY THE CHARACTER
-		if (asterix_wildcard_used)
-		{
-			//Doing asterix wildcard replace
-			*dos_filename++ = '?';
-			if (no_null_found_yet)
-				*source_filename++;
-		}
-		else if (no_null_found_yet)
-		{
-			//Copy the character
-			*dos_filename++ = *source_filename++;
-		}
-		else
+		ffs_read_fat_sector_to_window(lba);
+		buffer_pointer = &FFS_DRIVER_FAT_512_BYTE_BUFFER[0];
+
+		for (count = 0; count < (WORD)fat_entries_per_sector; count++)
 		{
-			//Pad rest of name with spaces as characters are unused
-			*dos_filename++ = 0x20;				//0x20 is used for unused trailing characters
+			if (disk_is_fat_32)
+			{
+				dw_data = (DWORD)*buffer_pointer++;
+				dw_data |= (DWORD)(*buffer_pointer++) << 8;
+				dw_data |= (DWORD)(*buffer_pointer++) << 16;
+				dw_data |= (DWORD)(*buffer_pointer++) << 24;
+				dw_data &= 0x0fffffff;							//The top 4 bits are reserved
+			}
+			else
+			{
+				dw_data = (DWORD)*buffer_pointer++;
+				dw_data |= (DWORD)(*buffer_pointer++) << 8;
+			}
+
+			if ((dw_data == 0) && (cluster >= 2) && (cluster <= max_cluster_number))
+				free_clusters++;
+
+			cluster++;
 		}
 	}
+	return(free_clusters);
+}
 
-	//DUMP THE '.'
-	*source_filename++;
 
-	//----- DO THE EXTENSION -----
-	no_null_found_yet = 1;
-	asterix_wildcard_used = 0;
-	for (temp = 0; temp < 3; temp++)
-	{
-		//Flag if filename contains a wildcard character (for return)
-		if ((*source_filename == '?') || (*source_filename == '*'))
-			wildcard_character_found = 1;
 
-		//Check for asterix wildcard character
-		if (*source_filename == '*')
-			asterix_wildcard_used = 1;
 
-		//Check for terminating null
-		if (*source_filename == 0x00)
-			no_null_found_yet = 0;
 
-		//COPY THE CHARACTER
-		if (asterix_wildcard_used)
-		{
-			//Doing asterix wildcard replace
-			*dos_extension++ = '?';
-			if (no_null_found_yet)
-				*source_filename++;
-		}
-		else if (no_null_found_yet)
+
+//**********************************************************
+//**********************************************************
+//********** FLUSH FILE SYSTEM INFORMATION SECTOR **********
+//**********************************************************
+//**********************************************************
+//If the free cluster count or next free cluster have changed then update the FAT32 FSInfo sector
+void ffs_flush_file_system_information (void)
+{
+	BYTE *buffer_pointer;
+
+
+	if (file_system_information_needs_writing == 0)
+		return;
+
+	file_system_information_needs_writing = 0;
+
+	if (file_system_information_lba == 0xffffffff)			//FAT16 or the card has no valid FSInfo sector
+		return;
+
+	FFS_IO_READ_TYPE(FFS_IO_READ_SYSTEM);
+	ffs_read_sector_to_buffer(file_system_information_lba);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	//Write 'Free Cluster Count' [# + 0x01e8]
+	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + 488;
+	*buffer_pointer++ = (BYTE)(free_cluster_count & 0x000000ff);
+	*buffer_pointer++ = (BYTE)((free_cluster_count & 0x0000ff00) >> 8);
+	*buffer_pointer++ = (BYTE)((free_cluster_count & 0x00ff0000) >> 16);
+	*buffer_pointer++ = (BYTE)((free_cluster_count & 0xff000000) >> 24);
+
+	//Write 'Next Free Cluster' [# + 0x01ec]
+	*buffer_pointer++ = (BYTE)(last_found_free_cluster & 0x000000ff);
+	*buffer_pointer++ = (BYTE)((last_found_free_cluster & 0x0000ff00) >> 8);
+	*buffer_pointer++ = (BYTE)((last_found_free_cluster & 0x00ff0000) >> 16);
+	*buffer_pointer++ = (BYTE)((last_found_free_cluster & 0xff000000) >> 24);
+
+	ffs_write_sector_from_buffer(file_system_information_lba);
+}
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** RELEASE UNUSED CLUSTERS **********
+//*********************************************
+//*********************************************
+//Frees any clusters at the end of a files cluster chain that are beyond the end of the file (left over from ffs_fallocate)
+void ffs_release_unused_clusters (FFS_FILE *file_pointer)
+{
+	DWORD bytes_per_cluster;
+	DWORD clusters_used;
+	DWORD cluster;
+	DWORD next_cluster;
+#ifdef FFS_EXTENT_CACHE_ENTRIES
+	FFS_EXTENT *extent;
+#endif
+
+
+	bytes_per_cluster = (DWORD)sectors_per_cluster * (DWORD)ffs_bytes_per_sector;
+
+	clusters_used = (file_pointer->open_file->file_size / bytes_per_cluster);
+	if ((file_pointer->open_file->file_size % bytes_per_cluster) || (clusters_used == 0))
+		clusters_used++;						//(A file always keeps its start cluster)
+
+	//----- MARK THE CLUSTER CONTAINING THE END OF THE FILE AS THE END OF THE CHAIN -----
+	cluster = ffs_get_file_cluster(file_pointer, (clusters_used - 1));
+	next_cluster = ffs_get_next_cluster_no(cluster);
+	ffs_modify_cluster_entry_in_fat(cluster, 0x0fffffff);
+
+	//----- FREE THE REST OF THE CHAIN -----
+	while (1)
+	{
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
+
+		if (next_cluster < 2)
+			break;
+		if (disk_is_fat_32)
 		{
-			//Copy the character
-			*dos_extension++ = *source_filename++;
+			if (next_cluster >= 0x0ffffff8)
+				break;
 		}
 		else
 		{
-			//Pad rest of name with spaces as characters are unused
-			*dos_extension++ = 0x20;				//0x20 is used for unused trailing characters
+			if (next_cluster >= 0xfff8)
+				break;
 		}
+
+		cluster = next_cluster;
+		next_cluster = ffs_get_next_cluster_no(cluster);
+		ffs_modify_cluster_entry_in_fat(cluster, 0x00000000);
+
+		if (last_found_free_cluster > cluster)
+			last_found_free_cluster = cluster;
 	}
 
+	ffs_flush_fat_window();
 
-	//----- CONVERT TO UPPERCASE -----
-	dos_filename -= 8;
-	dos_extension -= 3;
+	#ifdef FFS_EXTENT_CACHE_ENTRIES
+		//----- REMOVE THE RELEASED CLUSTERS FROM THE EXTENT CACHE -----
+		//(Any other handlers the file is open with carry on using the cache)
+		while (file_pointer->open_file->extent_count)
+		{
+			extent = &file_pointer->open_file->extent[file_pointer->open_file->extent_count - 1];
+			if (extent->file_cluster < clusters_used)
+			{
+				if ((extent->file_cluster + extent->length) > clusters_used)
+					extent->length = clusters_used - extent->file_cluster;
+				break;
+			}
+			file_pointer->open_file->extent_count--;
+		}
+	#endif
+}
 
-	for (temp = 0; temp < 8; temp++)
+
+
+
+
+
+//**************************************
+//**************************************
+//********** MOUNT FAT VOLUME **********
+//**************************************
+//**************************************
+//Reads the master boot record and the boot record of the first partition from the block device (ffs_block_device, which must be set
+//first) and mounts it as volume 0.  Called by the card driver when a new card has been initialised.  Any other volumes are unmounted.
+//Returns
+//	1 if the volume is OK to use (ffs_card_ok is also set), 0 if not
+BYTE ffs_mount_volume (void)
+{
+	BYTE volume;
+
+
+	ffs_card_ok = 0;						//Default to not OK
+
+	//Discard anything cached from a previous card
+	ffs_initialise_sector_cache();
+	file_system_information_needs_writing = 0;
+
+	for (volume = 0; volume < FFS_VOLUMES_MAX; volume++)
+		ffs_volume[volume].is_mounted = 0;
+	ffs_active_volume = 0;
+	ffs_current_volume = 0;
+
+	//----- MOUNT PARTITION 1 AS VOLUME 0 -----
+	if (ffs_load_partition(0, 1) == 0)
+		return(0);
+
+	ffs_card_ok = 1;				//Flag that the card is OK
+	return(1);
+}
+
+
+
+
+
+
+//*************************************
+//*************************************
+//********** MOUNT PARTITION **********
+//*************************************
+//*************************************
+//Mounts another partition of the card as a volume, so that files on several partitions can be used at the same time (e.g. raw data on
+//one partition and configuration files and logs on another with a different cluster size).  Filenames passed to ffs_fopen, ffs_remove
+//etc refer to the volume selected with ffs_chvol.  File and directory handlers stay on the volume they were opened on.
+//volume
+//	1 - (FFS_VOLUMES_MAX - 1), or 0 to replace partition 1.  A partition that is already mounted as this volume is unmounted first.
+//partition
+//	1 - 4 = a primary partition, 5 upwards = the logical partitions in the extended partition (5 = the first)
+//Returns
+//	1 if the partition has been mounted, 0 if not (the card isn't available, the volume has files or directories open, or the partition
+//	doesn't exist or isn't FAT16 or FAT32)
+BYTE ffs_mount_partition (BYTE volume, BYTE partition)
+{
+	BYTE count;
+
+
+	if ((ffs_card_ok == 0) || (volume >= FFS_VOLUMES_MAX))
+		return(0);
+
+	//----- CHECK NO FILES OR DIRECTORIES ARE OPEN ON THE VOLUME -----
+	for (count = 0; count < FFS_OPEN_FILES_MAX; count++)
 	{
-		if ((dos_filename[temp] >= 0x61) && (dos_filename[temp] <= 0x7a))
-			dos_filename[temp] -= 0x20;
+		if ((ffs_open_file[count].handle_count) && (ffs_open_file[count].volume == volume))
+			return(0);
 	}
-	for (temp = 0; temp < 3; temp++)
+	for (count = 0; count < FFS_OPENDIR_MAX; count++)
 	{
-		if ((dos_extension[temp] >= 0x61) && (dos_extension[temp] <= 0x7a))
-			dos_extension[temp] -= 0x20;
+		if ((ffs_dir[count].dir_is_open) && (ffs_dir[count].volume == volume))
+			return(0);
 	}
 
-	return(wildcard_character_found);
+	return(ffs_load_partition(volume, partition));
 }
 
 
@@ -1772,235 +6751,472 @@ BYTE ffs_convert_filename_to_dos (const char *source_filename, BYTE *dos_filenam
 
 
 
-//***********************************************
-//***********************************************
-//********** READ NEXT DIRECTORY ENTRY **********
-//***********************************************
-//***********************************************
-//file_name
-//	8 character array filename will be written to here
-//file_extension
-//	3 character array filename extension will be written to here
-//attribute_byte
-//	file attribute byte will be written to here
-//file_size
-//	file size will be written to here
-//cluster_number
-//	start cluster for the file will be written to here
-//start_from_beginning
-//	set to cause routine to start from 1st directory entry (must be set if the drivers data buffer has been modified since the last call)
-//directory_entry_sector
-//	Sector that contains the files directory entry will be written to here
-//directory_entry_within_sector
-//	The file directory entry number within the sector that contains the file will be written to here
+//************************************
+//************************************
+//********** LOAD PARTITION **********
+//************************************
+//************************************
+//Reads the partition table entry and the boot record of a partition and makes it the active volume.
+//The partition start is taken from the 32 bit LBA value in the partition table, so mounting needs no card geometry and isn't limited
+//to the first 8GB of the card as CHS addressing is.  A primary partition is mounted from 2 sector reads (3 for FAT32, which also reads
+//FSInfo) and a logical partition needs 1 more for each extended boot record before it.
 //Returns
-//	1 = file entry found
-//	0 = not found = end of directory
-BYTE ffs_read_next_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte,
-									DWORD *file_size, DWORD *cluster_number, BYTE start_from_beginning,
-									DWORD *directory_entry_sector, BYTE *directory_entry_within_sector)
+//	1 if the volume is OK to use, 0 if not (the volume that was active is selected again)
+BYTE ffs_load_partition (BYTE volume, BYTE partition)
 {
 	BYTE b_temp;
 	WORD w_temp;
 	DWORD dw_temp;
+	DWORD lba;
+	DWORD main_partition_start_sector;
+	DWORD volume_sectors;
+	WORD number_of_reserved_sectors;
+	BYTE number_of_copies_of_fat;
 	BYTE *buffer_pointer;
-	static BYTE sectors_left_in_this_cluster;
-	static DWORD current_cluster;
 
-	//----- START FROM BEGINNING OF DIRECTORY? -----
-	if (start_from_beginning)
-	{
-		if (disk_is_fat_32)
-		{
-			//----- FAT32 -----
-			read_write_directory_last_lba = (data_area_start_sector + ((root_directory_start_sector_cluster - 2) * sectors_per_cluster) - 1);		//(For FAT32 it contains the start cluster)
-			current_cluster = root_directory_start_sector_cluster;
-			sectors_left_in_this_cluster = sectors_per_cluster;
-		}
-		else
-		{
-			//----- FAT16 -----
-			read_write_directory_last_lba = (root_directory_start_sector_cluster - 1);		//(For FAT16 it contains the start sector)
-			sectors_left_in_this_cluster = number_of_root_directory_sectors;
-		}
-		read_write_directory_last_entry = 0xffff;							//Cause the next cluster to be read
-	}
 
-	//----- LOAD A NEW SECTOR OF THE DIRECTORY? -----
-	if (read_write_directory_last_entry >= ((ffs_bytes_per_sector - 32) >> 5))			// /32 as each directory entry is 32 bytes
-	{
-		read_write_directory_last_lba++;										//Move to next sector
+	//----- STORE THE VOLUME THAT IS ACTIVE -----
+	//(Its values are about to be overwritten.  The FAT window is written first in case it holds a sector of the partition being mounted)
+	ffs_flush_fat_window();
+	ffs_flush_file_system_information();
+	ffs_store_active_volume();
+	ffs_volume[volume].is_mounted = 0;
+
+	//Set the number of bytes per sector before we move on to general access
+	ffs_bytes_per_sector = 512;
+
+	//------------------------------------------
+	//----- FIND THE PARTITION TABLE ENTRY -----
+	//------------------------------------------
+	//(Read to the buffer so that the partition table is read the same way for an 8 or 16 bit data bus)
+	buffer_pointer = ffs_find_partition(partition, &lba);
+	if (buffer_pointer == 0)
+		goto ffs_load_partition_fail;
+
+	//Check for Partition active (0x00 = inactive, 0x80 = active) [# + 0x00]
+	//(We allow a value of 0x00 as on some disks a value of 0x00 has been found for partition 1)
+	b_temp = *buffer_pointer++;
+	//if (b_temp != 0x80)
+	//	goto init_new_ffs_card_fail
+
+	//Dump 'Beginning of Partition - Head, Cylinder + Sector' [# + 0x01]
+	//(The CHS values depend on the geometry the card was formatted with - the LBA value below is used instead)
+	buffer_pointer += 3;
+
+	//Read the 'Type Of Partition' [# + 0x04]
+	//(We accept FAT16 or FAT32)
+	b_temp = *buffer_pointer++;
+
+	if (b_temp == 0x04)						//FAT16 (smaller than 32MB)
+		disk_is_fat_32 = 0;
+	else if (b_temp == 0x06)				//FAT16 (larger than 32MB)
+		disk_is_fat_32 = 0;
+	else if (b_temp == 0x0b)				//FAT32 (Partition Up to 2048GB)
+		disk_is_fat_32 = 1;
+	else if (b_temp == 0x0c)				//FAT32 (Partition Up to 2048GB - uses 13h extensions)
+		disk_is_fat_32 = 1;
+	else if (b_temp == 0x0e)				//FAT16 (partition larger than 32MB, uses 13h extensions)
+		disk_is_fat_32 = 0;
+	else
+		goto ffs_load_partition_fail;
 
-		//----- CHECK FOR MOVE TO NEXT CLUSTER -----
-		if (sectors_left_in_this_cluster == 0)
-		{
-			//----- NEED TO MOVE TO NEXT CLUSTER -----
-			if (disk_is_fat_32)
-			{
-				//----- FAT32 -----
-				//Move to next cluster that contains the next part of the directory
-				sectors_left_in_this_cluster = sectors_per_cluster - 1;
+	//Dump end of partition - Head, Cylinder & Sector [# + 0x05]
+	buffer_pointer += 3;
 
-				dw_temp = ffs_get_next_cluster_no(current_cluster);
-				
-				if ((dw_temp & 0x0fffffff) >= 0x0ffffff8)
-				{
-					//DIRECTORY HAS NO MORE CLUSTERS - ADD A NEW CLUSTER
-					dw_temp = ffs_get_next_free_cluster();
-					if (dw_temp == 0x0fffffff)
-					{
-						//No more space to extend the directory
-						FFS_CE = 1;						//Deselect the card
-						return (0);
-					}
-					ffs_modify_cluster_entry_in_fat(current_cluster, dw_temp);
-					ffs_modify_cluster_entry_in_fat(dw_temp, 0x0fffffff);
-					current_cluster = dw_temp;
-					
-					//SET THE CONTENTS OF THE NEW CLUSTER TO 0x00 = all entries unused
-					buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
-					for (w_temp = 0; w_temp < 512; w_temp++)
-						*buffer_pointer++ = 0x00;
-
-					for (b_temp = 0; b_temp < sectors_per_cluster; b_temp++)
-					{
-						ffs_write_sector_from_buffer(
-													data_area_start_sector + ((current_cluster - 2) * sectors_per_cluster) + b_temp		//(Data on a Partition starts with cluster number 2)
-													);			
-					}
-				}
-				else
-				{
-					current_cluster = dw_temp;
-				}
+	//----- GET START ADDRESS OF THE PARTITION -----
+	//Get no of sectors between the partition table sector and the first sector in the partition [# + 0x08]
+	main_partition_start_sector = (DWORD)*buffer_pointer++;
+	main_partition_start_sector |= (DWORD)(*buffer_pointer++) << 8;
+	main_partition_start_sector |= (DWORD)(*buffer_pointer++) << 16;
+	main_partition_start_sector |= (DWORD)(*buffer_pointer++) << 24;
+	if (main_partition_start_sector == 0)
+		goto ffs_load_partition_fail;							//Not a valid partition (the partition table is in the first sector)
+	main_partition_start_sector += lba;							//(0 for a primary partition, the extended boot record for a logical partition)
+
+	//WE NOW HAVE THE START ADDRESS OF THE PARTITION
+
+	//Get no of sectors in the partition - could be useful when we do writing of files [# + 0x0c]
+	dw_temp = (DWORD)*buffer_pointer++;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 8;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 16;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 24;
+	ffs_volume[volume].partition_sectors = dw_temp;
+
+
+
+	//------------------------------------------
+	//----- READ THE PARTITION BOOT RECORD -----
+	//------------------------------------------
+	//Setup for finding the FAT1 table start address root directory start address and data area start address
+	lba = main_partition_start_sector;
+
+	FFS_IO_READ_TYPE(FFS_IO_READ_SYSTEM);
+	ffs_read_sector_to_buffer(lba);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
+
+	//Dump jump code & OEM name (11 bytes)
+	buffer_pointer += 11;
+
+	//Get 'Bytes Per Sector' [# + 0x000b]
+	//Check value matches value read from 'Identify Drive' - Changed - use this value as ID value can be different (it = no of Unfotmatted bytes per sector)
+	//Value is usually 512, but can be 256 on some older CF cards.  Ensure <= 512 (this is the size of the sector read buffer we provide and it should not be bigger than this)
+	ffs_bytes_per_sector = (WORD)*buffer_pointer++;
+	ffs_bytes_per_sector |= (WORD)(*buffer_pointer++) << 8;
+	if (ffs_bytes_per_sector > 512)
+		goto ffs_load_partition_fail;
+
+	//Get 'Sectors Per Cluster' [# + 0x000d]
+	//(Restricted to powers of 2 (1, 2, 4, 8, 16, 32))
+	sectors_per_cluster = *buffer_pointer++;
+	
+	b_temp = 0;											//Check its power of 2 (other functions rely on this check)
+	for (w_temp = 0x01; w_temp < 0x0100; w_temp <<= 1)
+	{
+		if (sectors_per_cluster & (BYTE)w_temp)
+			b_temp++;
+	}
+	if (b_temp != 1)
+		goto ffs_load_partition_fail;
+
+
+	//Get '# of reserved sectors' [# + 0x000e]
+	//Adjust the start addresses acordingly
+	number_of_reserved_sectors = (WORD)*buffer_pointer++;
+	number_of_reserved_sectors |= (WORD)(*buffer_pointer++) << 8;
+
+	//Get 'no of copies of FAT' [# + 0x0010]
+	//(any number >= 1 is permitted, but no value other than 2 is recomended)
+	number_of_copies_of_fat = *buffer_pointer++;
+	if ((number_of_copies_of_fat > 4) || (number_of_copies_of_fat == 0))		//We set a limit on there being a maximum of 4 copies of fat
+		goto ffs_load_partition_fail;
+
+	//Get 'max root directory entries' [# + 0x0011]
+	//(Used by FAT16, but not for FAT32)
+	dw_temp = (DWORD)*buffer_pointer++;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 8;
+	number_of_root_directory_sectors = ((dw_temp * 32) + (DWORD)(ffs_bytes_per_sector - 1)) / ffs_bytes_per_sector;		//Multiply no of entries by 32 (no of bytes per entry)
+																														//This calculation rounds up
+	//Get 'number of sectors in partition < 32MB' [# + 0x0013]
+	//(0 if the partition is larger - the double word value later on in this table is then used)
+	volume_sectors = (DWORD)*buffer_pointer++;
+	volume_sectors |= (DWORD)(*buffer_pointer++) << 8;
+
+	//Get 'media descriptor' [# + 0x0015]
+	//(Should be 0xF8 for hard disk)
+	if (*buffer_pointer++ != 0xf8)
+		goto ffs_load_partition_fail;
+
+	//Get 'sectors per fat'  [# + 0x0016]
+	//(Used by FAT16, but not for FAT32 - for FAT32 the value is a double word and located later on in this table - variable will be overwritten)
+	sectors_per_fat = (DWORD)*buffer_pointer++;
+	sectors_per_fat |= (DWORD)(*buffer_pointer++) << 8;
+
+	//Dump sectors per track, # of heads, # of hidden sectors in partition (8 bytes)
+	buffer_pointer += 8;
+
+	//Get 'number of sectors in partition' [# + 0x0020]
+	dw_temp = (DWORD)*buffer_pointer++;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 8;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 16;
+	dw_temp |= (DWORD)(*buffer_pointer++) << 24;
+	if (volume_sectors == 0)
+		volume_sectors = dw_temp;
+
+	//Check the partition fits on the device (if the device knows its size)
+	dw_temp = ffs_block_device->sector_count();
+	if ((dw_temp) && ((main_partition_start_sector + volume_sectors) > dw_temp))
+		goto ffs_load_partition_fail;
+
+
+	if(disk_is_fat_32 == 0)
+	{
+		//---------------------------------------------------------------------------------------
+		//----- PARTITION IS FAT 16 - COMPLETE BOOT RECORD & INITAILISATION FOR THIS SYSTEM -----
+		//---------------------------------------------------------------------------------------
+
+		//CALCULATE THE PARTITION AREAS START ADDRESSES
+		fat1_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors;
+		root_directory_start_sector_cluster = main_partition_start_sector + (DWORD)number_of_reserved_sectors + (sectors_per_fat * number_of_copies_of_fat);
+		data_area_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors + (sectors_per_fat * number_of_copies_of_fat) + number_of_root_directory_sectors;
+
+		//SET THE ACTIVE FAT TABLE FLAGS
+		active_fat_table_flags = 0;						// #|#|#|#|USE_FAT_TABLE_3|USE_FAT_TABLE_2|USE_FAT_TABLE_1|USE_FAT_TABLE_0
+		for (b_temp = 0; b_temp < number_of_copies_of_fat; b_temp++)
+		{
+			active_fat_table_flags <<= 1;
+			active_fat_table_flags++;
+		}
+		
+		//SET UNUSED REGISTERS (used for FAT32)
+		file_system_information_sector = 0xffff;
 
-				//Set the address of the next sector we're going to read
-				read_write_directory_last_lba = data_area_start_sector + ((current_cluster - 2) * sectors_per_cluster);
-			}
-			else
+	}
+	else
+	{
+		//---------------------------------------------------------------------------------------
+		//----- PARTITION IS FAT 32 - COMPLETE BOOT RECORD & INITAILISATION FOR THIS SYSTEM -----
+		//---------------------------------------------------------------------------------------
+
+		//Get 'sectors per fat'  [# + 0x0024]
+		sectors_per_fat = (DWORD)*buffer_pointer++;
+		sectors_per_fat |= (DWORD)(*buffer_pointer++) << 8;
+		sectors_per_fat |= (DWORD)(*buffer_pointer++) << 16;
+		sectors_per_fat |= (DWORD)(*buffer_pointer++) << 24;
+
+		//Get 'Flags' [# + 0x0028]
+		//(Bits 0-4 Indicate Active FAT Copy)
+		//(Bit 7 Indicates whether FAT Mirroring is Enabled or Disabled <Clear is Enabled>) (If FAT Mirroringis Disabled, the FAT Information is
+		//only written to the copy indicated by bits 0-4)
+		w_temp = (DWORD)*buffer_pointer++;
+		w_temp |= (DWORD)(*buffer_pointer++) << 8;
+		if (w_temp & 0x0080)
+		{
+			//BIT7 = 1, FAT MIRRORING IS DISABLED
+			//Bits 3:0 set which FAT table is active
+			if ((w_temp & 0x000f) > number_of_copies_of_fat)
+				goto ffs_load_partition_fail;
+			
+			switch (w_temp & 0x000f)
 			{
-				//----- FAT16 -----
-				//We've reached the end of the root directory
-				FFS_CE = 1;						//Deselect the card
-				return (0);
+			case 0:
+				active_fat_table_flags = 0x01;						// #|#|#|#|USE_FAT_TABLE_3|USE_FAT_TABLE_2|USE_FAT_TABLE_1|USE_FAT_TABLE_0
+				break;
+			case 1:
+				active_fat_table_flags = 0x02;
+				break;
+			case 2:
+				active_fat_table_flags = 0x04;
+				break;
+			case 3:
+				active_fat_table_flags = 0x08;
+				break;
 			}
 		}
 		else
 		{
-			//----- GET NEXT SECTOR OF THIS CLUSTER -----
-			sectors_left_in_this_cluster--;
+			//BIT7 = 0, FAT MIRRORING IS ENABLED INTO ALL FATS
+			active_fat_table_flags = 0;						// #|#|#|#|USE_FAT_TABLE_3|USE_FAT_TABLE_2|USE_FAT_TABLE_1|USE_FAT_TABLE_0
+			for (b_temp = 0; b_temp < number_of_copies_of_fat; b_temp++)
+			{
+				active_fat_table_flags <<= 1;
+				active_fat_table_flags++;
+			}
 		}
 
-		//Read the next sector to our buffer
-		ffs_read_sector_to_buffer (read_write_directory_last_lba);
+		//Get 'Version of FAT32 Drive' [# + 0x002A]
+		//(High Byte = Major Version, Low Byte = Minor Version)
+		buffer_pointer++;
+		buffer_pointer++;
 
-		read_write_directory_last_entry = 0xffff;
+		//Get 'Cluster Number of the Start of the Root Directory' [# + 0x2C]
+		//(Usually 2, but not requried to be 2)
+		root_directory_start_sector_cluster = (DWORD)*buffer_pointer++;
+		root_directory_start_sector_cluster |= (DWORD)(*buffer_pointer++) << 8;
+		root_directory_start_sector_cluster |= (DWORD)(*buffer_pointer++) << 16;
+		root_directory_start_sector_cluster |= (DWORD)(*buffer_pointer++) << 24;
+
+		//Get 'Sector Number of the File System Information Sector' [# + 0x0030]
+		//(Referenced from the Start of the Partition. Usually 1, but not requried to be 1)
+		file_system_information_sector = (DWORD)*buffer_pointer++;
+		file_system_information_sector |= (DWORD)(*buffer_pointer++) << 8;
+
+
+		//CALCULATE THE PARTITION AREAS START ADDRESSES
+		fat1_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors;			//THE FAT START ADDRESS IS NOW GOOD (has correct offset)
+		//root_directory_start_sector_cluster already done above
+		data_area_start_sector = main_partition_start_sector + (DWORD)number_of_reserved_sectors + (sectors_per_fat * number_of_copies_of_fat);
+
+		//SET UNUSED REGISTERS (used for FAT16)
+		number_of_root_directory_sectors = 0;
 	}
 
+	//----- CALCULATE THE NUMBER OF CLUSTERS -----
+	//(Clusters are numbered from 2.  The FAT table may have more entries than there are clusters as its size is rounded up to whole sectors)
+	max_cluster_number = ((main_partition_start_sector + volume_sectors - data_area_start_sector) / sectors_per_cluster) + 1;
 
-	//----- GET THE NEXT DIRECTORY ENTRY FROM THE BUFFER -----
-	read_write_directory_last_entry++;
+	if (disk_is_fat_32)
+		dw_temp = (sectors_per_fat * (DWORD)(ffs_bytes_per_sector >> 2)) - 1;
+	else
+		dw_temp = (sectors_per_fat * (DWORD)(ffs_bytes_per_sector >> 1)) - 1;
+	if (max_cluster_number > dw_temp)
+		max_cluster_number = dw_temp;
 
-	//Offset to the start of the entry
-	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5);
+	//------------------------------------------------------------------------
+	//----- BOOT RECORD IS DONE - ALL REQUIRED DISK PARAMETERS ARE KNOWN -----
+	//------------------------------------------------------------------------
 
-	//GET FILE NAME [8]
-	file_name[0] = *buffer_pointer++;
-	file_name[1] = *buffer_pointer++;
-	file_name[2] = *buffer_pointer++;
-	file_name[3] = *buffer_pointer++;
-	file_name[4] = *buffer_pointer++;
-	file_name[5] = *buffer_pointer++;
-	file_name[6] = *buffer_pointer++;
-	file_name[7] = *buffer_pointer++;
 
-	//Convert to uppercase
-	for (b_temp = 0; b_temp < 8; b_temp++)
+	//-------------------------------
+	//----- VOLUME IS OK TO USE -----
+	//-------------------------------
+	ffs_active_volume = volume;
+	ffs_volume[volume].is_mounted = 1;
+
+	//Do CF Driver specific initialisations
+	last_found_free_cluster = 0;		//When we next look for a free cluster, start from the beginning
+	#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+		if (volume == 0)
+			ffs_free_cluster_bitmap_scanned_to = 0;		//The bitmap is re-built as the FAT table is searched (it is only kept for volume 0)
+	#endif
+	ffs_current_directory_cluster = 0;							//Start in the root directory
+	ffs_reset_directory_caches();
+	free_cluster_count = 0xffffffff;			//Not known
+	file_system_information_lba = 0xffffffff;
+	file_system_information_needs_writing = 0;
+
+
+	//------------------------------------------------------------------
+	//----- READ THE FAT32 FILE SYSTEM INFORMATION (FSINFO) SECTOR -----
+	//------------------------------------------------------------------
+	//Gives us the number of free clusters and where to start looking for the next free cluster without having to search the FAT table
+	if ((disk_is_fat_32) && (file_system_information_sector != 0) && (file_system_information_sector != 0xffff))
 	{
-		if ((file_name[b_temp] >= 0x61) && (file_name[b_temp] <= 0x7a))
-			file_name[b_temp] -= 0x20;
+		lba = main_partition_start_sector + (DWORD)file_system_information_sector;
+		FFS_IO_READ_TYPE(FFS_IO_READ_SYSTEM);
+		ffs_read_sector_to_buffer(lba);
+		FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
+
+		//Check the signatures [# + 0x0000] = 0x41615252 and [# + 0x01e4] = 0x61417272
+		if (
+			(buffer_pointer[0] == 0x52) && (buffer_pointer[1] == 0x52) && (buffer_pointer[2] == 0x61) && (buffer_pointer[3] == 0x41) &&
+			(buffer_pointer[484] == 0x72) && (buffer_pointer[485] == 0x72) && (buffer_pointer[486] == 0x41) && (buffer_pointer[487] == 0x61)
+			)
+		{
+			file_system_information_lba = lba;
+
+			//Get 'Free Cluster Count' [# + 0x01e8]
+			//(0xffffffff = not known.  Ignore the value if its not possible, or if it is 0 as a card left marked as full by another device
+			//is then checked by counting the free clusters in the FAT table)
+			buffer_pointer += 488;
+			dw_temp = (DWORD)*buffer_pointer++;
+			dw_temp |= (DWORD)(*buffer_pointer++) << 8;
+			dw_temp |= (DWORD)(*buffer_pointer++) << 16;
+			dw_temp |= (DWORD)(*buffer_pointer++) << 24;
+			if ((dw_temp != 0) && (dw_temp < max_cluster_number))
+				free_cluster_count = dw_temp;
+
+			//Get 'Next Free Cluster' [# + 0x01ec]
+			//(0xffffffff = not known.  This is only a hint of where to start looking)
+			dw_temp = (DWORD)*buffer_pointer++;
+			dw_temp |= (DWORD)(*buffer_pointer++) << 8;
+			dw_temp |= (DWORD)(*buffer_pointer++) << 16;
+			dw_temp |= (DWORD)(*buffer_pointer++) << 24;
+			if ((dw_temp >= 2) && (dw_temp <= max_cluster_number))
+				last_found_free_cluster = dw_temp;
+		}
 	}
 
-	//GET FILENAME EXTENSION [3]
-	file_extension[0] = *buffer_pointer++;
-	file_extension[1] = *buffer_pointer++;
-	file_extension[2] = *buffer_pointer++;
 
-	//Convert to uppercase
-	for (b_temp = 0; b_temp < 3; b_temp++)
-	{
-		if ((file_extension[b_temp] >= 0x61) && (file_extension[b_temp] <= 0x7a))
-			file_extension[b_temp] -= 0x20;
-	}
+	return(1);
 
-	//GET ATTRIBUTE BYTE [1]
-	//Bit	7-6					 5		   4		   3			  2		   1		0 
-	//		Reserved, set to 0 | Archive | Directory | Volume Label | System | Hidden | Read Only 
-	*attribute_byte = *buffer_pointer++;
 
-	//GET NT [1]
-	//(Dump)
-	buffer_pointer++;
+//------------------------------------
+//----- VOLUME IS NOT COMPATIBLE -----
+//------------------------------------
+ffs_load_partition_fail:
+	ffs_load_active_volume();		//Go back to the volume that was active
+	return(0);
+}
 
-	//GET CREATED TIME (mS portion) [1]
-	//(Dump)
-	buffer_pointer++;
 
-	//GET CREATED TIME (h + m) [2]
-	//(Dump)
-	buffer_pointer++;
-	buffer_pointer++;
 
-	//GET CREATED DATE [2]
-	//(Dump)
-	buffer_pointer++;
-	buffer_pointer++;
 
-	//GET LAST ACESSED DATE [2]
-	//(Dump)
-	buffer_pointer++;
-	buffer_pointer++;
 
-	//GET EXTENDED ATTRIBUTE [2]
-	//0x0000 for FAT16, high word of cluster number for FAT32
-	if (disk_is_fat_32)
+
+
+//************************************
+//************************************
+//********** FIND PARTITION **********
+//************************************
+//************************************
+//Reads the partition table that holds a partition's entry into the driver buffer.  Primary partitions are in the master boot record.
+//Logical partitions are in a chain of extended boot records in the extended partition, each holding the entry for one logical partition
+//(its start is relative to the extended boot record) and an entry for the next extended boot record (its start is relative to the start
+//of the extended partition).
+//partition
+//	1 - 4 = a primary partition, 5 upwards = the logical partitions in the extended partition (5 = the first)
+//partition_table_lba
+//	Set to the sector the partition table was read from (the partition start in the entry is relative to it)
+//Returns
+//	A pointer to the 16 byte partition table entry in FFS_DRIVER_GEN_512_BYTE_BUFFER, or 0 if the partition doesn't exist
+BYTE* ffs_find_partition (BYTE partition, DWORD *partition_table_lba)
+{
+	DWORD extended_partition_start;
+	BYTE *buffer_pointer;
+	BYTE count;
+
+
+	if (partition == 0)
+		return(0);
+
+	//---------------------------------------
+	//----- READ THE MASTER BOOT RECORD -----
+	//---------------------------------------
+	*partition_table_lba = 0;
+	FFS_IO_READ_TYPE(FFS_IO_READ_SYSTEM);
+	ffs_read_sector_to_buffer(0x00000000);
+	FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
+
+	//Skip the first 446 bytes of boot up executable code - now at start of the partition table [0x000001be]
+	//(Each of the 4 entries is 16 bytes)
+	if (partition <= 4)
+		return(&FFS_DRIVER_GEN_512_BYTE_BUFFER[0x1be + ((WORD)(partition - 1) << 4)]);
+
+	//----- FIND THE EXTENDED PARTITION -----
+	for (count = 0; count < 4; count++)
 	{
-		*cluster_number = ((DWORD)*buffer_pointer++ << 16);
-		*cluster_number += ((DWORD)*buffer_pointer++ << 24);
+		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0x1be + ((WORD)count << 4)];
+		if ((buffer_pointer[4] == 0x05) || (buffer_pointer[4] == 0x0f))		//Extended partition (0x0f = uses 13h extensions)
+			break;
 	}
-	else
+	if (count == 4)
+		return(0);
+
+	//Get 'Start of the Extended Partition' [# + 0x08]
+	extended_partition_start = (DWORD)buffer_pointer[8];
+	extended_partition_start |= (DWORD)buffer_pointer[9] << 8;
+	extended_partition_start |= (DWORD)buffer_pointer[10] << 16;
+	extended_partition_start |= (DWORD)buffer_pointer[11] << 24;
+	if (extended_partition_start == 0)
+		return(0);
+
+	//----- FOLLOW THE CHAIN OF EXTENDED BOOT RECORDS -----
+	*partition_table_lba = extended_partition_start;
+	partition -= 5;							//The number of logical partitions before the one we want
+	while (1)
 	{
-		buffer_pointer++;
-		buffer_pointer++;
-		*cluster_number = 0;
-	}
+		#ifdef CLEAR_WATCHDOG_TIMER
+			CLEAR_WATCHDOG_TIMER();
+		#endif
 
-	//GET TIME [2]
-	//(Dump)
-	buffer_pointer++;
-	buffer_pointer++;
+		FFS_IO_READ_TYPE(FFS_IO_READ_SYSTEM);
+		ffs_read_sector_to_buffer(*partition_table_lba);
+		FFS_IO_READ_TYPE(FFS_IO_READ_DATA);
 
-	//GET DATE [2]
-	//(Dump)
-	buffer_pointer++;
-	buffer_pointer++;
+		//Check the boot record signature [0x000001fe] (an extended boot record has no other identification)
+		if ((FFS_DRIVER_GEN_512_BYTE_BUFFER[0x1fe] != 0x55) || (FFS_DRIVER_GEN_512_BYTE_BUFFER[0x1ff] != 0xaa))
+			return(0);
 
-	//GET CLUSTER [2]
-	*cluster_number += (DWORD)*buffer_pointer++;
-	*cluster_number += ((DWORD)*buffer_pointer++ << 8);
-			
-	//GET FILE SIZE [4]
-	*file_size = (DWORD)*buffer_pointer++;
-	*file_size += ((DWORD)*buffer_pointer++ << 8);
-	*file_size += ((DWORD)*buffer_pointer++ << 16);
-	*file_size += ((DWORD)*buffer_pointer++ << 24);
+		//The first entry is the logical partition
+		if (partition == 0)
+			return(&FFS_DRIVER_GEN_512_BYTE_BUFFER[0x1be]);
+		partition--;
 
-	//Return the location of this directory entry
-	*directory_entry_sector = read_write_directory_last_lba;
-	*directory_entry_within_sector = read_write_directory_last_entry;
+		//The second entry is the next extended boot record (type 0x05, or 0x00 if this is the last logical partition)
+		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0x1ce];
+		if ((buffer_pointer[4] != 0x05) && (buffer_pointer[4] != 0x0f))
+			return(0);
 
-	FFS_CE = 1;						//Deselect the card
-	return(1);
+		*partition_table_lba = (DWORD)buffer_pointer[8];
+		*partition_table_lba |= (DWORD)buffer_pointer[9] << 8;
+		*partition_table_lba |= (DWORD)buffer_pointer[10] << 16;
+		*partition_table_lba |= (DWORD)buffer_pointer[11] << 24;
+		if (*partition_table_lba == 0)
+			return(0);
+		*partition_table_lba += extended_partition_start;
+	}
 }
 
 
@@ -2008,92 +7224,119 @@ BYTE ffs_read_next_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE
 
 
 
-//********************************************************
-//********************************************************
-//********** OVERWRITE LAST DIRECTORY FILE NAME **********
-//********************************************************
-//********************************************************
-//file_name = 8 character array filename (must be DOS compatible - uppercase and any trailing unused characters set to 0x20)
-//file_extension = 3 character array filename extension (must be DOS compatible - uppercase and any trailing unused characters set to 0x20)
-//attribute_byte = file attribute byte
-//file_size = file size
-//cluster_number = start cluster for the file
-void ffs_overwrite_last_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte,
-												DWORD *file_size, DWORD *cluster_number)
+//***********************************
+//***********************************
+//********** SELECT VOLUME **********
+//***********************************
+//***********************************
+//Makes a volume the active volume that the driver functions work on.  The values of the volume that was active are stored and the
+//values of the new volume are loaded.  The directory caches tag their entries with the volume and the FAT window is left as it is, so
+//switching between volumes doesn't lose what is remembered about each one or force a FAT table write.
+//Returns
+//	1 if the volume is selected, 0 if it isn't mounted
+BYTE ffs_select_volume (BYTE volume)
 {
-	BYTE *buffer_pointer;
 
-	//----- WRITE THE NEW ENTRY TO THE BUFFER -----
-	//Offset to the start of the entry
-	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (read_write_directory_last_entry << 5);
+	if ((ffs_card_ok == 0) || (volume >= FFS_VOLUMES_MAX) || (ffs_volume[volume].is_mounted == 0))
+		return(0);
 
-	//WRITE FILE NAME [8]
-	*buffer_pointer++ = file_name[0];
-	*buffer_pointer++ = file_name[1];
-	*buffer_pointer++ = file_name[2];
-	*buffer_pointer++ = file_name[3];
-	*buffer_pointer++ = file_name[4];
-	*buffer_pointer++ = file_name[5];
-	*buffer_pointer++ = file_name[6];
-	*buffer_pointer++ = file_name[7];
+	if (volume == ffs_active_volume)
+		return(1);
 
-	//WRITE FILENAME EXTENSION [3]
-	*buffer_pointer++ = file_extension[0];
-	*buffer_pointer++ = file_extension[1];
-	*buffer_pointer++ = file_extension[2];
+	ffs_store_active_volume();
 
-	//WRITE ATTRIBUTE BYTE [1]
-	//Bit	7-6					 5		   4		   3			  2		   1		0 
-	//		Reserved, set to 0 | Archive | Directory | Volume Label | System | Hidden | Read Only 
-	*buffer_pointer++ = *attribute_byte;
+	ffs_active_volume = volume;
+	ffs_load_active_volume();
 
-	//WRITE NT [1]
-	*buffer_pointer++ = 0x00;
+	return(1);
+}
 
-	//WRITE CREATED TIME (mS portion) [1]
-	*buffer_pointer++ = 0x00;
 
-	//WRITE CREATED TIME (h + m) [2]
-	//Bits	15-11								10-5								  4-0 
-	//		Hours - valid from 0-23 inclusive | Minutes - valid from 0-59 inclusive | Seconds / 2 - valid from 0-29 inclusive (0-58 seconds). 
-	*buffer_pointer++ = 0x00;
-	*buffer_pointer++ = 0x00;
 
-	//WRITE CREATED DATE [2]
-	//Bits	15-9													    8-5													 4-0 
-	//		Years since 1980 - valid from 0-127 inclusive (1980-2107) | Month of year - valid from 1-12 inclusive(1 = Jan) | Day of the month - valid from 1-31 inclusive. 
-	*buffer_pointer++ = 0x21;			//Hard coded to 1st Jan 2000
-	*buffer_pointer++ = 0x28;
 
-	//WRITE LAST ACESSED DATE [2]
-	*buffer_pointer++ = 0x21;			//Hard coded to 1st Jan 2000
-	*buffer_pointer++ = 0x28;
 
-	//WRITE EXTENDED ATTRIBUTE [2]
-	*buffer_pointer++ = (BYTE)(*cluster_number >> 16);		//0x0000 for FAT16, high word of cluster number for FAT32
-	*buffer_pointer++ = (BYTE)(*cluster_number >> 24);
 
-	//WRITE TIME [2]
-	*buffer_pointer++ = 0x00;
-	*buffer_pointer++ = 0x00;
+//*****************************************
+//*****************************************
+//********** STORE ACTIVE VOLUME **********
+//*****************************************
+//*****************************************
+//Stores the values of the active volume in its ffs_volume entry, and the hints of its selected directory in the directory hint table
+void ffs_store_active_volume (void)
+{
+	FFS_VOLUME *volume_pointer;
+
+
+	volume_pointer = &ffs_volume[ffs_active_volume];
+	volume_pointer->disk_is_fat_32 = disk_is_fat_32;
+	volume_pointer->sectors_per_cluster = sectors_per_cluster;
+	volume_pointer->active_fat_table_flags = active_fat_table_flags;
+	volume_pointer->file_system_information_needs_writing = file_system_information_needs_writing;
+	volume_pointer->bytes_per_sector = ffs_bytes_per_sector;
+	volume_pointer->number_of_root_directory_sectors = number_of_root_directory_sectors;
+	volume_pointer->fat1_start_sector = fat1_start_sector;
+	volume_pointer->sectors_per_fat = sectors_per_fat;
+	volume_pointer->root_directory_start_sector_cluster = root_directory_start_sector_cluster;
+	volume_pointer->data_area_start_sector = data_area_start_sector;
+	volume_pointer->max_cluster_number = max_cluster_number;
+	volume_pointer->last_found_free_cluster = last_found_free_cluster;
+	volume_pointer->free_cluster_count = free_cluster_count;
+	volume_pointer->file_system_information_lba = file_system_information_lba;
+	volume_pointer->current_directory_cluster = ffs_current_directory_cluster;
+
+	#ifdef FFS_DIRECTORY_HINT_ENTRIES
+		ffs_store_directory_hints();
+	#endif
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		if (ffs_directory_index_volume == ffs_active_volume)
+			ffs_directory_index_stored_state = ffs_directory_index_state;
+	#endif
+}
 
-	//WRITE DATE [2]
-	*buffer_pointer++ = 0x21;			//Hard coded to 1st Jan 2000
-	*buffer_pointer++ = 0x28;
 
-	//WRITE CLUSTER [2]
-	*buffer_pointer++ = (BYTE)*cluster_number;
-	*buffer_pointer++ = (BYTE)(*cluster_number >> 8);
-			
-	//WRITE FILE SIZE [4]
-	*buffer_pointer++ = (BYTE)*file_size;
-	*buffer_pointer++ = (BYTE)(*file_size >> 8);
-	*buffer_pointer++ = (BYTE)(*file_size >> 16);
-	*buffer_pointer++ = (BYTE)(*file_size >> 24);
 
-	//WRITE THE BUFFER BACK TO THE DISK SECTOR
-	ffs_write_sector_from_buffer(read_write_directory_last_lba);
-	FFS_CE = 1;						//Deselect the card
+
+
+
+//****************************************
+//****************************************
+//********** LOAD ACTIVE VOLUME **********
+//****************************************
+//****************************************
+//Loads the values of the active volume from its ffs_volume entry.  No directory is selected - the hints of the next directory selected
+//are restored from the directory hint table.
+void ffs_load_active_volume (void)
+{
+	FFS_VOLUME *volume_pointer;
+
+
+	volume_pointer = &ffs_volume[ffs_active_volume];
+	disk_is_fat_32 = volume_pointer->disk_is_fat_32;
+	sectors_per_cluster = volume_pointer->sectors_per_cluster;
+	active_fat_table_flags = volume_pointer->active_fat_table_flags;
+	file_system_information_needs_writing = volume_pointer->file_system_information_needs_writing;
+	ffs_bytes_per_sector = volume_pointer->bytes_per_sector;
+	number_of_root_directory_sectors = volume_pointer->number_of_root_directory_sectors;
+	fat1_start_sector = volume_pointer->fat1_start_sector;
+	sectors_per_fat = volume_pointer->sectors_per_fat;
+	root_directory_start_sector_cluster = volume_pointer->root_directory_start_sector_cluster;
+	data_area_start_sector = volume_pointer->data_area_start_sector;
+	max_cluster_number = volume_pointer->max_cluster_number;
+	last_found_free_cluster = volume_pointer->last_found_free_cluster;
+	free_cluster_count = volume_pointer->free_cluster_count;
+	file_system_information_lba = volume_pointer->file_system_information_lba;
+	ffs_current_directory_cluster = volume_pointer->current_directory_cluster;
+
+	read_write_directory_start_cluster = 0;
+	ffs_directory_hint_start_cluster = 0xffffffff;				//No directory selected
+	ffs_directory_free_entry.entry_number = 0xffffffff;
+	ffs_directory_end_entry_number = 0xffffffff;
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		if (ffs_directory_index_volume == ffs_active_volume)
+			ffs_directory_index_state = ffs_directory_index_stored_state;
+		else
+			ffs_directory_index_state = FFS_DIRECTORY_INDEX_NOT_BUILT;		//The index holds another volume's root directory
+	#endif
 }
 
 
@@ -2103,46 +7346,108 @@ void ffs_overwrite_last_directory_entry (BYTE *file_name, BYTE *file_extension,
 
 //********************************************
 //********************************************
-//********** GET FILE START CLUSTER **********
+//********** RESET DIRECTORY CACHES **********
 //********************************************
 //********************************************
-DWORD get_file_start_cluster(FFS_FILE *file_pointer)
+//Forgets everything that is remembered about the directories of the active volume when it is mounted.  Entries for volumes that aren't
+//mounted are also freed.
+void ffs_reset_directory_caches (void)
 {
-	DWORD start_cluster;
-	BYTE *buffer_pointer;
+#if defined(FFS_PATH_CACHE_ENTRIES) || defined(FFS_DIRECTORY_HINT_ENTRIES)
+	BYTE count;
+	BYTE volume;
+#endif
+
+
+	#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+		ffs_directory_index_state = FFS_DIRECTORY_INDEX_NOT_BUILT;		//The index is re-built the next time a file is looked for
+	#endif
+	read_write_directory_start_cluster = 0;
+	ffs_directory_hint_start_cluster = 0;
+	ffs_directory_free_entry.entry_number = 0xffffffff;			//Not known (found by the next search for a free directory entry)
+	ffs_directory_end_entry_number = 0xffffffff;					//Not known
+	#ifdef FFS_PATH_CACHE_ENTRIES
+		for (count = 0; count < FFS_PATH_CACHE_ENTRIES; count++)
+		{
+			volume = ffs_path_cache[count].volume;
+			if ((volume == ffs_active_volume) || (volume >= FFS_VOLUMES_MAX) || (ffs_volume[volume].is_mounted == 0))
+				ffs_path_cache[count].parent_cluster = 0xffffffff;		//Entry not used
+		}
+	#endif
+	#ifdef FFS_DIRECTORY_HINT_ENTRIES
+		for (count = 0; count < FFS_DIRECTORY_HINT_ENTRIES; count++)
+		{
+			volume = ffs_directory_hint[count].volume;
+			if ((volume == ffs_active_volume) || (volume >= FFS_VOLUMES_MAX) || (ffs_volume[volume].is_mounted == 0))
+				ffs_directory_hint[count].start_cluster = 0xffffffff;		//Entry not used
+		}
+	#endif
+}
 
-	//-----------------------------------
-	//----- ENSURE THE FILE IS OPEN -----
-	//-----------------------------------
-	if (file_pointer->flags.bits.file_is_open == 0)
-		return(1);
 
-	//---------------------------------------------------
-	//----- READ THE DIRECTORY SECTOR TO THE BUFFER -----
-	//---------------------------------------------------
-	ffs_read_sector_to_buffer (file_pointer->directory_entry_sector);
 
 
-	//Set pointer to start of extended attribute in the directory entry
-	buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + ((WORD)file_pointer->directory_entry_within_sector << 5) + 20;
 
-	if (disk_is_fat_32)
+
+
+//*******************************************
+//*******************************************
+//********** READ SECTOR TO BUFFER **********
+//*******************************************
+//*******************************************
+//Makes the requested sector the current driver buffer (FFS_DRIVER_GEN_512_BYTE_BUFFER), using the sector cache if it already holds it.
+//On a cache miss the least recently used entry is re-used, writing it back to the card first if it has been modified.
+//lba = start sector address
+void ffs_read_sector_to_buffer (DWORD sector_lba)
+{
+	BYTE entry;
+	BYTE oldest_entry;
+
+
+	//----- IF LBA MATCHES THE LAST LBA DON'T BOTHER RE-READING AS THE DATA IS STILL IN THE BUFFER -----
+	if (ffs_sector_buffer->lba == sector_lba)
+	{
+		ffs_sector_cache_hits++;
+		return;
+	}
+
+
+	//----- IF ANOTHER CACHE ENTRY HOLDS THIS SECTOR THEN USE IT -----
+	//(Also find the least recently used entry in case we need it)
+	oldest_entry = 0;
+	for (entry = 0; entry < FFS_SECTOR_CACHE_ENTRIES; entry++)
 	{
-		start_cluster = (DWORD)*buffer_pointer++ << 16;			//0x0000 for FAT16, high word of cluster number for FAT32
-		start_cluster += (DWORD)*buffer_pointer++ << 24;
-		buffer_pointer += 4;
+		if (ffs_sector_cache[entry].lba == sector_lba)
+		{
+			ffs_select_sector_cache_entry(entry);
+			ffs_sector_cache_hits++;
+			return;
+		}
+
+		if (ffs_sector_cache[entry].age > ffs_sector_cache[oldest_entry].age)
+			oldest_entry = entry;
 	}
-	else
+	ffs_sector_cache_misses++;
+
+
+	//----- RE-USE THE LEAST RECENTLY USED ENTRY -----
+	ffs_select_sector_cache_entry(oldest_entry);
+
+	//If the entry contains data that is waiting to be written then write it first
+	if (ffs_sector_buffer->needs_writing_to_card)
 	{
-		start_cluster = 0;
-		buffer_pointer += 6;
+		if (ffs_sector_buffer->lba != 0xffffffff)			//This should not be possible but check is made just in case!
+			ffs_write_sector_from_buffer(ffs_sector_buffer->lba);
+
+		ffs_sector_buffer->needs_writing_to_card = 0;
 	}
 
-	start_cluster += (DWORD)*buffer_pointer++;					//Cluster
-	start_cluster += (DWORD)*buffer_pointer++ << 8;
 
+	//----- READ THE SECTOR INTO THE BUFFER -----
+	ffs_sector_buffer->lba = 0xffffffff;
+	ffs_read_sectors(sector_lba, 1, &FFS_DRIVER_GEN_512_BYTE_BUFFER[0]);
 
-	return(start_cluster);
+	ffs_sector_buffer->lba = sector_lba;				//Flag that the data buffer currently contains data for this LBA (logged to avoid re-loading the buffer again if its not necessary)
 }
 
 
@@ -2150,322 +7455,227 @@ DWORD get_file_start_cluster(FFS_FILE *file_pointer)
 
 
 
-//*************************************
-//*************************************
-//********** CREATE NEW FILE **********
-//*************************************
-//*************************************
-//
-//file_name
-//	8 character array filename will be read from here
-//write_file_start_cluster
-//	start cluster for the file will be read from here
-//directory_entry_sector
-//	Sector that contains the files directory entry will be written to here
-//directory_entry_within_sector
-//	The file directory entry number within the sector that contains the file will be written to here
-//
-//Return value
-//	1 = successful
-//	0 = failed
-BYTE ffs_create_new_file (const char *file_name, DWORD *write_file_start_cluster, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector)
-{
-	BYTE temp;
-	BYTE temp1;
-	DWORD file_size;
-	BYTE converted_file_name[8];
-	BYTE converted_file_extension[3];
-	BYTE read_file_name[8];
-	BYTE read_file_extension[3];
-	BYTE read_attribute_byte;
-	DWORD read_file_size;
-	DWORD read_cluster_number;
-	BYTE attribute_byte;
-
-	//CHECK CARD IS INSERTED AND HAS BEEN INITIALISED
-	if(ffs_card_ok == 0)
-		return(0);
 
-	//----- CHECK FILE NAME DOES NOT ALREADY EXIST -----
-	//Disabled to avoid wasted time in large directories as this should not be possbile because fopen deletes the file first if it exists
+//***********************************************
+//***********************************************
+//********** SELECT SECTOR CACHE ENTRY **********
+//***********************************************
+//***********************************************
+//Makes an entry the current driver buffer and marks it as the most recently used entry
+void ffs_select_sector_cache_entry (BYTE entry)
+{
+	BYTE count;
+	BYTE previous_age;
 
 
-	//----- CONVERT FILE NAME TO 8 CHARACTER DOS FILENAME -----
-	if (ffs_convert_filename_to_dos (file_name, converted_file_name, converted_file_extension))		//Returns 1 if filename had wildcard characters
-		return(0);
+	previous_age = ffs_sector_cache[entry].age;
 
-	//----- FIND THE NEXT EMPTY CLUSTER TO USE FOR THE FILE
-	*write_file_start_cluster = ffs_get_next_free_cluster();
-	if (*write_file_start_cluster == 0xffffffff)			//0xffffffff = no empty cluster found
+	//Age all of the entries that were used more recently than this one
+	for (count = 0; count < FFS_SECTOR_CACHE_ENTRIES; count++)
 	{
-		//No cluster available - disk is full
-		FFS_CE = 1;						//Deselect the card
-		return(0);
+		if (ffs_sector_cache[count].age < previous_age)
+			ffs_sector_cache[count].age++;
 	}
 
-	//----- FIND EMPTY DIRECTORY ENTRY TO USE FOR THE FILE -----
-	//Get the first directory entry
-	if (ffs_read_next_directory_entry (&read_file_name[0], &read_file_extension[0], &read_attribute_byte, &file_size,
-										&read_cluster_number, 1, directory_entry_sector, directory_entry_within_sector) == 0)			//1 = start from beginning of directory
-	{
-		//Error - should not be able to happen
-		FFS_CE = 1;						//Deselect the card
-		return(0);						//Reached end of directory
-	}
+	ffs_sector_cache[entry].age = 0;
+	ffs_sector_buffer = &ffs_sector_cache[entry];
+}
 
-	//Get each entry until we find an empty entry
-	//(If 1st value is 0xe5 or 0x00 then entry is available - 0xe5 = deleted file, 0 = unused entry)
-	while ((read_file_name[0] != 0xe5) && (read_file_name[0] != 0x00))
-	{
-		//GET NEXT ENTRY
-		if (ffs_read_next_directory_entry (&read_file_name[0], &read_file_extension[0], &read_attribute_byte, &file_size,
-											&read_cluster_number, 0, directory_entry_sector, directory_entry_within_sector) == 0)
-		{
-			//Directory is full - no space for another entry
-			FFS_CE = 1;						//Deselect the card
-			return(0);						//Reached end of directory
-		}
-	}
 
-	//----- STORE FILE ENTRY IN DIRECTORY -----
-	read_file_size = 0;
-	attribute_byte = 0;
-	ffs_overwrite_last_directory_entry (converted_file_name, converted_file_extension, &attribute_byte, &read_file_size, write_file_start_cluster);
 
-	//----- STORE END OF FILE MARKER FOR THE CLUSTER ENTRY IN THE FAT TABLE -----
-	ffs_modify_cluster_entry_in_fat(*write_file_start_cluster, 0x0fffffff);
 
 
 
-	FFS_CE = 1;						//Deselect the card
-	return(1);
-}
 
+//*********************************************
+//*********************************************
+//********** INITIALISE SECTOR CACHE **********
+//*********************************************
+//*********************************************
+//Called when a new volume is mounted.  Empties all entries and the FAT window (without writing them back) and assigns each entry its buffer.
+void ffs_initialise_sector_cache (void)
+{
+	BYTE entry;
 
 
+	for (entry = 0; entry < FFS_SECTOR_CACHE_ENTRIES; entry++)
+	{
+		ffs_sector_cache[entry].lba = 0xffffffff;
+		ffs_sector_cache[entry].buffer = &FFS_DRIVER_SECTOR_CACHE_RAM[(WORD)entry << 9];
+		ffs_sector_cache[entry].age = entry;				//(Each entry must have a different age)
+		ffs_sector_cache[entry].needs_writing_to_card = 0;
+	}
+	ffs_sector_buffer = &ffs_sector_cache[0];
 
+	ffs_fat_window_lba = 0xffffffff;
+	ffs_fat_window_needs_writing_to_card = 0;
+	ffs_trim_run_count = 0;
+}
 
 
-//*******************************************
-//*******************************************
-//********** FIND NEXT FREE CLUSTER *********
-//*******************************************
-//*******************************************
-//Find the next free cluster in the FAT table
-//Returns the cluster number, or 0xffffffff if no free cluster found (card full)
-DWORD ffs_get_next_free_cluster (void)
-{
-	WORD w_data;
-	DWORD dw_data;
-	DWORD lba;
-	DWORD dw_count;
-	DWORD dw_count1;
-	DWORD fat_entries_per_sector;
-	DWORD next_free_cluster;
-	BYTE *buffer_pointer;
 
 
-	//----- START READING THE FAT TABLE FROM THE LAST ENTRY WHERE WE FOUND A FREE CLUSTER -----
-	lba = fat1_start_sector;
 
-	if (disk_is_fat_32)
-		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);	//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
-	else
-		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);	//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
 
-	//Move to the sector the last free cluster was found in
-	//(To avoid having to search from the start each time which could waste a lot of time)
-	dw_count = (last_found_free_cluster / fat_entries_per_sector);
-	lba += dw_count;
-	next_free_cluster = (dw_count * fat_entries_per_sector);
-	
 
-	//----- SEARCH FOR THE NEXT FREE CLUSTER -----
-	//Incrementally read each sector of the FAT table
-	for (dw_count = (lba - fat1_start_sector); dw_count < (sectors_per_fat - 1); dw_count++)	//We use (sectors_per_fat - 1) to avoid the need to calculate the total number of sectors per fat
-	{																							//(this saves code space and should only result in a relatively small amount of wasted clusters)
-		#ifdef CLEAR_WATCHDOG_TIMER
-			CLEAR_WATCHDOG_TIMER();
-		#endif
+//****************************************
+//****************************************
+//********** FLUSH SECTOR CACHE **********
+//****************************************
+//****************************************
+//Writes back every cache entry that has been modified.  The sectors remain in the cache.
+void ffs_flush_sector_cache (void)
+{
+	BYTE entry;
 
-		//Read the next sector
-		ffs_read_sector_to_buffer(lba);
-		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0];
 
-		//Check each entry in the sector
-		for (dw_count1 = 0; dw_count1 < fat_entries_per_sector; dw_count1++)
+	for (entry = 0; entry < FFS_SECTOR_CACHE_ENTRIES; entry++)
+	{
+		if (ffs_sector_cache[entry].needs_writing_to_card)
 		{
+			ffs_sector_cache[entry].needs_writing_to_card = 0;		//(Must be cleared before writing as the write calls other functions that check this flag)
 
-			if (disk_is_fat_32)
-			{
-				dw_data = (DWORD)*buffer_pointer++;
-				dw_data |= (DWORD)(*buffer_pointer++) << 8;
-				dw_data |= (DWORD)(*buffer_pointer++) << 16;
-				dw_data |= (DWORD)(*buffer_pointer++) << 24;
-				dw_data &= 0x0fffffff;							//The top 4 bits are reserved
-				if (dw_data == 0)								//0x00000000 = free cluster
-					goto ffs_get_next_free_cluster_found;
-			}
-			else
-			{
-				w_data = (DWORD)*buffer_pointer++;
-				w_data |= (DWORD)(*buffer_pointer++) << 8;
-				if (w_data == 0)								//0x0000 = free cluster
-					goto ffs_get_next_free_cluster_found;
-			}
-			next_free_cluster++;	
-
-			//Check for overrun into unavailable clusters (the values below denote special meanings in the fat table)
-			if (disk_is_fat_32)
-			{
-				if (next_free_cluster >= 0x0ffffff7)
-					return(0xffffffff);
-			}
-			else
-			{
-				if (next_free_cluster >= 0x0000fff7)
-					return(0xffffffff);
-			}
+			if (ffs_sector_cache[entry].lba != 0xffffffff)			//This should not be possible but check is made just in case!
+				ffs_write_sectors(ffs_sector_cache[entry].lba, 1, ffs_sector_cache[entry].buffer);
 		}
-		lba++;
 	}
+}
 
-	//---------------------------------------------------
-	//----- THERE IS NO FREE CLUSTER - DISK IS FULL -----
-	//---------------------------------------------------
-	return(0xffffffff);
 
 
-ffs_get_next_free_cluster_found:
-	//---------------------------------------
-	//----- FOUND THE NEXT FREE CLUSTER -----
-	//---------------------------------------
-	last_found_free_cluster = next_free_cluster;			//Store ready for the next time we search
 
-	return(next_free_cluster);
-}
 
 
 
+//*************************************************
+//*************************************************
+//********** READ SECTORS TO USER BUFFER **********
+//*************************************************
+//*************************************************
+//Reads a run of consecutive sectors straight into the callers memory without using the driver buffer, as a single block device
+//read so the device can transfer them much faster than reading the same sectors one at a time.
+//sector_lba = start sector address
+//sector_count = number of sectors to read
+//destination = buffer to read to (must be sector_count x ffs_bytes_per_sector bytes in size)
+void ffs_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination)
+{
+	BYTE entry;
+#ifdef FFS_IO_TRACE_FUNCTION
+	FFS_IO_TRACE_TIMER_TYPE trace_start_time;
+#endif
 
 
+	//----- IF THE SECTOR CACHE HOLDS MODIFIED DATA FOR ANY OF THE SECTORS BEING READ THEN WRITE IT TO THE CARD FIRST -----
+	for (entry = 0; entry < FFS_SECTOR_CACHE_ENTRIES; entry++)
+	{
+		if (
+			(ffs_sector_cache[entry].needs_writing_to_card) &&
+			(ffs_sector_cache[entry].lba >= sector_lba) &&
+			(ffs_sector_cache[entry].lba < (sector_lba + sector_count))
+			)
+		{
+			ffs_sector_cache[entry].needs_writing_to_card = 0;
+			ffs_write_sectors(ffs_sector_cache[entry].lba, 1, ffs_sector_cache[entry].buffer);
+		}
+	}
 
-//*********************************************
-//*********************************************
-//********** GET NEXT CLUSTER NUMBER **********
-//*********************************************
-//*********************************************
-//Get the next cluster number from the FAT table
-DWORD ffs_get_next_cluster_no (DWORD current_cluster)
-{
-	DWORD fat_entries_per_sector;
-	WORD data;
-	DWORD lba;
-	DWORD dw_temp;
-	BYTE *buffer_pointer;
 
-	lba = fat1_start_sector;
+	#ifdef FFS_IO_STATISTICS
+		ffs_io_counters.read_operations++;
+		ffs_io_counters.sector_reads += sector_count;
+		if (ffs_io_read_type == FFS_IO_READ_FAT)
+			ffs_io_counters.fat_sector_reads += sector_count;
+		else if (ffs_io_read_type == FFS_IO_READ_DIRECTORY)
+			ffs_io_counters.directory_sector_reads += sector_count;
+	#endif
 
-	if (disk_is_fat_32)
-		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
-	else
-		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
+	#ifdef FFS_IO_TRACE_FUNCTION
+		trace_start_time = FFS_IO_TRACE_TIME;
+	#endif
 
+	ffs_block_device->read_sectors(sector_lba, sector_count, destination);
 
-	//----- MOVE TO THE SECTOR IN THE FAT TABLE FOR THE CURRENT CLUSTER NUMBER -----
-	dw_temp = (current_cluster / fat_entries_per_sector);
-	lba += dw_temp;
-	current_cluster -= (dw_temp * fat_entries_per_sector);
+	#ifdef FFS_IO_TRACE_FUNCTION
+		FFS_IO_TRACE_FUNCTION(ffs_io_read_type, sector_lba, sector_count, FFS_IO_TRACE_DURATION(trace_start_time));
+	#endif
+}
 
-	ffs_read_sector_to_buffer(lba);
 
 
-	//----- GET THE NEXT CLUSTER ENTRY FROM THE FAT TABLE -----
-	if (disk_is_fat_32)
-	{
-		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (current_cluster << 2);
 
-		lba = (DWORD)*buffer_pointer++;									//FAT32 - 1 double word per entry
-		lba |= ((DWORD)(*buffer_pointer++) << 8);
-		lba |= ((DWORD)(*buffer_pointer++) << 16);
-		lba |= ((DWORD)((*buffer_pointer++) & 0x0f) << 24);				//Top nibble reserved bits need to be removed
-	}
-	else
-	{
-		buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (current_cluster << 1);
 
-		lba = (DWORD)*buffer_pointer++;
-		lba |= ((DWORD)(*buffer_pointer++) << 8);						//FAT16 - 1 word per entry
-	}
-	return (lba);
-}
 
 
+//**********************************************
+//**********************************************
+//********** WRITE SECTOR FROM BUFFER **********
+//**********************************************
+//**********************************************
+void ffs_write_sector_from_buffer (DWORD sector_lba)
+{
+	ffs_sector_buffer->needs_writing_to_card = 0;				//Flag that buffer is no longer waiting to write to card (must be at top as this function
+													//calls other functions that check this flag and would call the function back)
 
+	ffs_write_sectors(sector_lba, 1, &FFS_DRIVER_GEN_512_BYTE_BUFFER[0]);
+}
 
 
 
-//********************************************************
-//********************************************************
-//********** MODIFY CLUSTER VALUE IN FAT TABLES **********
-//********************************************************
-//********************************************************
-//The driver data buffer is used by this function
-void ffs_modify_cluster_entry_in_fat (DWORD cluster_to_modify, DWORD cluster_entry_new_value)
-{
-	DWORD lba;
-	BYTE *buffer_pointer;
-	BYTE count;
-	DWORD fat_entries_per_sector;
-	BYTE temp;
-	DWORD dw_temp;
-	BYTE done_read_of_fat_sector = 0;
 
 
-	//----- MOVE TO THE SECTOR FOR THIS CLUSTER ENTRY IN THE FAT1 TABLE -----
-	lba = fat1_start_sector;
 
-	if (disk_is_fat_32)
-		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 2);		//FAT32 - Divide no of bytes per sector by 4 as each fat entry is 1 double word
-	else
-		fat_entries_per_sector = (DWORD)(ffs_bytes_per_sector >> 1);		//FAT16 - Divide no of bytes per sector by 2 as each fat entry is 1 word
 
-	//Move to the relevant sector in the FAT table
-	dw_temp = (cluster_to_modify / fat_entries_per_sector);
-	lba += dw_temp;
-	cluster_to_modify -= (dw_temp * fat_entries_per_sector);
+//****************************************************
+//****************************************************
+//********** WRITE SECTORS FROM USER BUFFER **********
+//****************************************************
+//****************************************************
+//Writes a run of consecutive sectors straight from the callers memory as a single block device write, which cuts the command overhead
+//and lets the card work on larger units with its internal write buffer.
+//sector_lba = start sector address
+//sector_count = number of sectors to write
+//source = buffer to write from (must be sector_count x ffs_bytes_per_sector bytes in size)
+void ffs_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source)
+{
+	BYTE entry;
+#ifdef FFS_IO_TRACE_FUNCTION
+	FFS_IO_TRACE_TIMER_TYPE trace_start_time;
+#endif
 
-	//----- MODIFY EACH FAT TABLE -----
-	for (count = 0x01; count < 0x10; count <<= 1)
+
+	//----- IF THE SECTOR CACHE HOLDS ANY OF THE SECTORS BEING OVERWRITTEN THEN THEIR CONTENTS ARE NOW OUT OF DATE -----
+	//(Unless we are writing the entries buffer itself)
+	for (entry = 0; entry < FFS_SECTOR_CACHE_ENTRIES; entry++)
 	{
-		
-		if (count & active_fat_table_flags)									//Only modify FAT tables that are active
-		{
-			if (done_read_of_fat_sector == 0)						//We read the first FAT table sector, alter it and then write it back and to the other FAT tables.
-			{														//This isn't perfect as ideally we would read each sector from each FAT table in case there was an
-				done_read_of_fat_sector = 1;						//error in the first table.  However this has a significant impact on speed and would stop our
-				ffs_read_sector_to_buffer(lba);						//fast file delete aproach of only writing a FAT sector when we are moving to the next sector from
-																	//working so its worth doing this and accepting that any error in the first FAT table will be
-				if (disk_is_fat_32)									//carried accross to other tables which is very unlikely (and anyway an error has then already occured)
-					buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (cluster_to_modify << 2);
-				else
-					buffer_pointer = &FFS_DRIVER_GEN_512_BYTE_BUFFER[0] + (cluster_to_modify << 1);
-	
-				*buffer_pointer++ = (BYTE)(cluster_entry_new_value & 0x000000ff);
-				*buffer_pointer++ = (BYTE)((cluster_entry_new_value & 0x0000ff00) >> 8);
-				if (disk_is_fat_32)
-				{
-					*buffer_pointer++ = (BYTE)((cluster_entry_new_value & 0x00ff0000) >> 16);
-					temp = (*buffer_pointer & 0xf0);
-					*buffer_pointer++ = ((BYTE)((cluster_entry_new_value & 0x0f000000) >> 24) | temp);		//The top 4 bits are reserved and should not be modified
-				}
-			}
-			ffs_write_sector_from_buffer (lba);
+		if (
+			(source != ffs_sector_cache[entry].buffer) &&
+			(ffs_sector_cache[entry].lba >= sector_lba) &&
+			(ffs_sector_cache[entry].lba < (sector_lba + sector_count))
+			)
+		{
+			ffs_sector_cache[entry].lba = 0xffffffff;
+			ffs_sector_cache[entry].needs_writing_to_card = 0;
 		}
-		lba += sectors_per_fat;												//Move to next FAT table
 	}
 
 
+	#ifdef FFS_IO_STATISTICS
+		ffs_io_counters.write_operations++;
+		ffs_io_counters.sector_writes += sector_count;
+	#endif
+
+	#ifdef FFS_IO_TRACE_FUNCTION
+		trace_start_time = FFS_IO_TRACE_TIME;
+	#endif
+
+	ffs_block_device->write_sectors(sector_lba, sector_count, source);
+
+	#ifdef FFS_IO_TRACE_FUNCTION
+		if (source == &FFS_DRIVER_FAT_512_BYTE_BUFFER[0])
+			FFS_IO_TRACE_FUNCTION(FFS_IO_WRITE_FAT, sector_lba, sector_count, FFS_IO_TRACE_DURATION(trace_start_time));
+		else
+			FFS_IO_TRACE_FUNCTION(FFS_IO_WRITE, sector_lba, sector_count, FFS_IO_TRACE_DURATION(trace_start_time));
+	#endif
 }
 
 
@@ -2512,5 +7722,6 @@ void ffs_modify_cluster_entry_in_fat (DWORD cluster_to_modify, DWORD cluster_ent
 
 
 
+
 
 
@@ -80,8 +80,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //----- DEFINE TARGET COMPILER & PROCESSOR -----
 //----------------------------------------------
 //(ONLY 1 SHOULD BE INCLUDED, COMMENT OUT OTHERS - ALSO SET IN THE OTHER DRIVER .h FILE)
-#define	FFS_USING_MICROCHIP_C18_COMPILER
+//#define	FFS_USING_GCC_HOST_COMPILER				//Linux host build with mem-cf-sim.c or mem-image.c (or use -DFFS_USING_GCC_HOST_COMPILER)
 //<< add other compiler types here
+#if !defined(FFS_USING_GCC_HOST_COMPILER)
+#define	FFS_USING_MICROCHIP_C18_COMPILER			//(Used when no other compiler is selected)
+#endif
 
 
 
@@ -106,7 +109,77 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //------------------------
 //----- USER DEFINES -----									//<<<<< CHECK FOR A NEW APPLICATION <<<<<
 //------------------------
-#define	FFS_FOPEN_MAX				2		//Maximum number of files that may be opened simultaneously (1 - 254).  22 bytes or memory requried per file.
+#define	FFS_FOPEN_MAX				2		//Maximum number of file handles that may be open simultaneously (1 - 254).  15 bytes of memory required per handle.  A file
+											//may be open with more than one handle at the same time (e.g. one appending and others reading).
+#define	FFS_OPEN_FILES_MAX			2		//Maximum number of different files that may be open simultaneously (1 - FFS_FOPEN_MAX).  16 bytes of memory required per
+											//file (plus the extent cache).
+#define	FFS_OPENDIR_MAX				1		//Maximum number of directories that may be opened simultaneously with ffs_opendir (1 - 254).  34 bytes of memory required per directory
+											//(plus FFS_LONG_FILENAME_MAX + 3 bytes with long filenames).
+#define	FFS_VOLUMES_MAX				2		//Maximum number of partitions that may be mounted at the same time (1 - 255).  Partition 1 is mounted as volume 0 when a card
+											//is inserted and other primary or logical partitions may then be mounted with ffs_mount_partition.  49 bytes of memory
+											//required per volume.
+#define	FFS_EXTENT_CACHE_ENTRIES	4		//Optional - number of runs of consecutive clusters to remember for each open file so that ffs_fseek doesn't have to follow
+											//the files cluster chain through the FAT table (1 - 255).  When a file has more runs than this the runs kept are spread
+											//across the file, so a seek only follows the chain from the nearest run before it.  12 bytes of memory required per entry
+											//per open file (the cache is shared by all the handles a file is open with).  Comment out if not required.
+#define	FFS_SECTOR_CACHE_ENTRIES	2		//Number of 512 byte sector buffers held in the driver sector cache (1 - 255).  512 + 8 bytes of memory required per entry
+											//(the ffs_512_byte_ram_section in the linker script must be big enough for them all plus the 512 byte FAT window).  Check ffs_sector_cache_hits and
+											//ffs_sector_cache_misses while running your application to see if more entries are worthwhile.
+//#define	FFS_FREE_CLUSTER_BITMAP_CLUSTERS	65536	//Optional - keep a bitmap of used clusters in ram so that free clusters can be found without re-reading the FAT table.
+											//1 bit of memory required per cluster (must be a multiple of 256).  The bitmap is only kept for volume 0 - free clusters
+											//above this value, and on any other volume, are found by reading the FAT table as normal.  Comment out if not required.
+//#define	FFS_FREE_CLUSTER_BITMAP_WIDE_SEARCH		//Optional - search the bitmap 8 double words at a time (for 32 / 64 bit processors where the compiler can vectorise the
+											//loop).  Comment out for 8 / 16 bit processors.
+//#define	FFS_DIRECTORY_INDEX_ENTRIES		64		//Optional - keep an index in ram of the files in the root directory so that opening a file doesn't have to search
+											//the directory (a power of 2).  The index is built the first time a file is looked for (and again if the root directory
+											//of another volume has been indexed since).  If the directory has more files than this the files that don't fit are still
+											//found by searching the directory.  Only the root directory is indexed and only file lookups (FFS_FIND_FILE) use it -
+											//subdirectories, hidden files and ffs_mkdir / ffs_chdir still search the directory.  Long filename lookups check every index
+											//entry for a matching hash rather than hashing to a slot.  25 bytes of memory required per entry (27 with long filenames).
+											//Comment out if not required.
+#define	FFS_PATH_CACHE_ENTRIES		4		//Optional - number of subdirectories to remember the start cluster of, so that opening a file in a subdirectory doesn't
+											//have to search each directory in its path (1 - 255).  20 bytes of memory required per entry.  Only subdirectories named
+											//in a path by their 8.3 name are remembered.  Comment out if not required.
+#define	FFS_DIRECTORY_HINT_ENTRIES	4		//Optional - number of directories, other than the selected one, to remember the first free entry and end of directory
+											//marker for so that working on files in several directories in turn doesn't search each one from its start again
+											//(1 - 255).  22 bytes of memory required per entry.  Comment out to only remember them for the selected directory.
+//#define	FFS_LONG_FILENAME_MAX		64		//Optional - support long filenames (VFAT).  Files and directories may be opened by their long filename or their 8.3 name
+											//and names that aren't valid 8.3 names are created with a long filename and an 8.3 alias ("LONGFI~1.TXT", or a hashed
+											//alias such as "LO3F2A~1.TXT" once ~1 - ~4 are used).  The value is
+											//the longest long filename ffs_readdir returns (12 - 255, longer names are returned as their 8.3 alias).  Comment out if
+											//not required (names that aren't valid 8.3 names are then rejected).
+//#define	FFS_DIRECTORY_WIDE_COMPARE				//Optional - compare filenames with directory entries 4 bytes at a time (for 32 / 64 bit processors).  Comment out for
+											//8 / 16 bit processors.
+//#define	FFS_IO_STATISTICS					//Optional - count card accesses in ffs_io_counters (sectors read and written, FAT and directory sector reads, RDY and
+											//-WAIT wait loops and timeouts).  Comment out if not required.
+//#define	FFS_IO_TRACE_FUNCTION	ap_ffs_io_trace	//Optional - function to call after every card access, defined in your application as:
+											//void ap_ffs_io_trace (BYTE operation, DWORD sector_lba, WORD sector_count, DWORD duration)
+											//(operation = FFS_IO_READ_DATA, FFS_IO_WRITE etc).  Comment out if not required.
+//#define	FFS_IO_TRACE_TIMER		TMR1		//Optional - a free running timer used to give the trace function the duration of each access (in timer counts).
+											//Comment out to pass a duration of 0.
+//#define	FFS_IO_TRACE_TIMER_TYPE	WORD		//Required with FFS_IO_TRACE_TIMER - the width of the timer (BYTE, WORD or DWORD).  The duration is subtracted
+											//in this width so it is correct when the timer wraps (accesses longer than one timer period are not measurable).
+
+
+//--------------------------------------
+//----- DRIVER RAM BUFFER DEFINES -----						//<<<<< CHECK FOR A NEW APPLICATION <<<<<
+//--------------------------------------
+#ifdef FFS_USING_MICROCHIP_C18_COMPILER
+
+#define	FFS_DRIVER_SECTOR_CACHE_RAM		ffs_general_buffer		//The ram used for the sector cache buffers (FFS_SECTOR_CACHE_ENTRIES x 512 bytes).  This may be the same as the
+																//buffer that the application uses to read and write data from and to the card if ram is limited
+#define	FFS_DRIVER_FAT_512_BYTE_BUFFER	ffs_fat_buffer			//The ram used for the FAT table window (512 bytes).  This must not be shared with anything else.
+#endif		//#ifdef FFS_USING_MICROCHIP_C18_COMPILER
+
+#ifdef FFS_USING_GCC_HOST_COMPILER
+
+#define	FFS_DRIVER_SECTOR_CACHE_RAM		ffs_general_buffer
+#define	FFS_DRIVER_FAT_512_BYTE_BUFFER	ffs_fat_buffer
+#endif		//#ifdef FFS_USING_GCC_HOST_COMPILER
+
+
+#define	FFS_DRIVER_GEN_512_BYTE_BUFFER	ffs_sector_buffer->buffer		//The general buffer used by routines is the sector cache entry last accessed
+
 
 
 //-------------------------------------------------
@@ -149,15 +222,52 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 
 //----- DATA TYPE DEFINITIONS -----
-typedef struct _FFS_FILE
+typedef struct _FFS_EXTENT
 {
-	DWORD directory_entry_sector;						//The sector that contains the entry for the file being accessed
+	DWORD file_cluster;									//The cluster number within the file of the first cluster of this run (0 = the files start cluster)
+	DWORD disk_cluster;									//The cluster number on the card of the first cluster of this run
+	DWORD length;										//The number of consecutive clusters in this run
+} FFS_EXTENT;
+
+
+//The state of an open file that is shared by all the handles it is open with, so each handle sees the changes made through the others
+typedef struct _FFS_OPEN_FILE
+{
+	DWORD directory_entry_sector;						//The sector that contains the entry for the file
 	BYTE directory_entry_within_sector;					//The entry number within that sector (512 / 32 = 16 so max range is 0-15 for a 512 bytes per sector disk)
+	DWORD start_cluster;								//The first cluster of the file
+	DWORD file_size;									//The current size of the file
+	BYTE handle_count;									//The number of handles the file is open with (0 = this entry is not in use)
+	BYTE volume;										//The volume the file is on
+
+	union
+	{
+		struct
+		{
+			unsigned int open_for_writing			:1;	//One of the handles may write to the file (only one handle may at a time)
+			unsigned int file_size_has_changed		:1;
+			unsigned int clusters_preallocated		:1;	//Clusters added by ffs_fallocate may not all be used (unused clusters are released by ffs_fclose)
+			unsigned int reserved					:5;
+		} bits;
+		BYTE byte;
+	} flags;
+
+#ifdef FFS_EXTENT_CACHE_ENTRIES
+	FFS_EXTENT extent[FFS_EXTENT_CACHE_ENTRIES];		//Runs of consecutive clusters of the files cluster chain in file order, starting with the files start cluster (there may be
+														//parts of the chain between them that aren't known).  Filled as the chain is followed.
+	BYTE extent_count;									//The number of extents in use
+#endif
+} FFS_OPEN_FILE;
+
+
+//A file handle - a position in an open file
+typedef struct _FFS_FILE
+{
+	FFS_OPEN_FILE *open_file;							//The shared state of the file
 	DWORD current_cluster;								//The current cluster being accessed for the file
 	BYTE current_sector;								//The current sector within the current cluster
 	WORD current_byte;									//The current byte within the current sector
 	DWORD current_byte_within_file;						//The current byte within the overall file
-	DWORD file_size;									//The current size of the file
 
 	union
 	{
@@ -170,15 +280,217 @@ typedef struct _FFS_FILE
 			unsigned int inc_posn_before_next_rw	:1;	//The location of the current byte pointer needs to be incremented before the next read or write operation
 			unsigned int access_error				:1;
 			unsigned int end_of_file				:1;
-			unsigned int file_size_has_changed		:1;
-			unsigned int reserved					:8;
+			unsigned int reserved					:9;
 		} bits;
 		WORD word;
 	} flags;
-
 } FFS_FILE;
 
 
+//Directory entry returned by ffs_readdir
+typedef struct _FFS_DIRENT
+{
+#ifdef FFS_LONG_FILENAME_MAX
+	char name[FFS_LONG_FILENAME_MAX + 1];				//The long filename, null terminated (the same as short_name if the entry doesn't have a long filename)
+	char short_name[13];								//The 8.3 name as "NAME.EXT", null terminated (the '.' is left out if there is no extension)
+#else
+	char name[13];										//"NAME.EXT", null terminated (the '.' is left out if there is no extension)
+#endif
+	BYTE attribute_byte;								//Bit 4 = directory, bit 2 = system, bit 1 = hidden, bit 0 = read only
+	DWORD file_size;
+	DWORD start_cluster;
+} FFS_DIRENT;
+
+
+//Directory handler for ffs_opendir, ffs_readdir and ffs_closedir
+typedef struct _FFS_DIR
+{
+	DWORD current_lba;									//The directory sector being read (0xffffffff = end of directory reached)
+	DWORD current_cluster;								//The directory cluster that contains the sector (0 for the FAT16 root directory)
+	BYTE sectors_left;									//Sectors after this one in the cluster (or in the FAT16 root directory)
+	BYTE current_entry;									//The next entry to read within the sector
+	BYTE dir_is_open;
+	BYTE volume;										//The volume the directory is on
+#ifdef FFS_LONG_FILENAME_MAX
+	BYTE long_name_sequence;							//The sequence number of the last long filename entry read (0 = not reading a long filename)
+	BYTE long_name_checksum;							//The 8.3 name checksum stored in the long filename entries
+#endif
+	FFS_DIRENT entry;									//The last entry returned by ffs_readdir
+} FFS_DIR;
+
+
+//A mounted partition.  The driver works on one volume at a time using global copies of these values (fat1_start_sector, sectors_per_cluster
+//etc) - they are stored here when a different volume is selected and copied back when the volume is selected again.
+typedef struct _FFS_VOLUME
+{
+	BYTE is_mounted;
+	BYTE disk_is_fat_32;
+	BYTE sectors_per_cluster;
+	BYTE active_fat_table_flags;
+	BYTE file_system_information_needs_writing;
+	WORD bytes_per_sector;
+	WORD number_of_root_directory_sectors;				//Only used by FAT16, 0 for FAT32
+	DWORD fat1_start_sector;
+	DWORD sectors_per_fat;
+	DWORD root_directory_start_sector_cluster;			//Start sector for FAT16, start cluster for FAT32
+	DWORD data_area_start_sector;
+	DWORD max_cluster_number;
+	DWORD last_found_free_cluster;
+	DWORD free_cluster_count;							//0xffffffff = not known
+	DWORD file_system_information_lba;					//FAT32 FSInfo sector (0xffffffff = none)
+	DWORD current_directory_cluster;					//The current directory set by ffs_chdir for this volume (0 = root directory)
+	DWORD partition_sectors;
+} FFS_VOLUME;
+
+
+typedef struct _FFS_SECTOR_CACHE_ENTRY
+{
+	DWORD lba;											//The sector this entry currently holds (0xffffffff = empty)
+	BYTE *buffer;										//This entries 512 byte buffer
+	BYTE age;											//0 = most recently used, higher values = used less recently (the oldest entry is re-used on a cache miss)
+	BYTE needs_writing_to_card;							//1 = the buffer has been modified and must be written back before it is re-used
+} FFS_SECTOR_CACHE_ENTRY;
+
+
+//The FAT driver only accesses the card through these functions, so it can be used with any type of card (or a disk image file) that
+//provides them.  The card driver sets ffs_block_device before calling ffs_mount_volume.
+typedef struct _FFS_BLOCK_DEVICE
+{
+	void (*read_sectors) (DWORD sector_lba, WORD sector_count, BYTE *destination);		//Read consecutive sectors to a buffer
+	void (*write_sectors) (DWORD sector_lba, WORD sector_count, BYTE *source);			//Write consecutive sectors from a buffer
+	void (*sync) (void);											//Complete any writes that are still being carried out (called by ffs_fflush)
+	DWORD (*sector_count) (void);									//Returns the number of sectors the device has (0 = not known)
+	void (*trim) (DWORD sector_lba, DWORD sector_count);			//Optional - the sectors no longer hold any data (0 if not supported)
+} FFS_BLOCK_DEVICE;
+
+
+//A position within the directory
+typedef struct _FFS_DIRECTORY_POSITION
+{
+	DWORD entry_number;									//The entry number counting from the start of the directory (0xffffffff = not known)
+	DWORD lba;											//The sector that contains the entry
+	BYTE entry_within_sector;
+	DWORD cluster;										//The directory cluster that contains the sector (0 for the FAT16 root directory)
+} FFS_DIRECTORY_POSITION;
+
+
+//Root directory index entry (FFS_DIRECTORY_INDEX_ENTRIES)
+typedef struct _FFS_DIRECTORY_INDEX_ENTRY
+{
+	DWORD directory_entry_sector;						//The sector that contains the files directory entry (0xffffffff = entry never used, 0 = entry has been removed)
+	BYTE directory_entry_within_sector;
+	BYTE file_name[8];									//DOS filename, as stored in the directory entry
+	BYTE file_extension[3];
+	BYTE attribute_byte;
+	DWORD start_cluster;
+	DWORD file_size;
+#ifdef FFS_LONG_FILENAME_MAX
+	WORD long_name_hash;								//ffs_long_filename_hash of the files long filename (0 = the file doesn't have a long filename)
+#endif
+} FFS_DIRECTORY_INDEX_ENTRY;
+
+#define	FFS_DIRECTORY_INDEX_NOT_BUILT	0				//ffs_directory_index_state values
+#define	FFS_DIRECTORY_INDEX_COMPLETE	1				//Every file in the directory is in the index
+#define	FFS_DIRECTORY_INDEX_PARTIAL		2				//Some files didn't fit in the index - a file that isn't found in the index may still exist
+
+
+//Subdirectory path cache entry (FFS_PATH_CACHE_ENTRIES)
+typedef struct _FFS_PATH_CACHE_ENTRY
+{
+	BYTE volume;										//The volume the subdirectory is on
+	DWORD parent_cluster;								//The start cluster of the directory that contains the subdirectory (0 = root directory, 0xffffffff = entry not used)
+	BYTE file_name[8];									//DOS name of the subdirectory, as stored in its directory entry
+	BYTE file_extension[3];
+	DWORD start_cluster;								//The start cluster of the subdirectory
+} FFS_PATH_CACHE_ENTRY;
+
+
+//8.3 alias being made for a long filename (FFS_LONG_FILENAME_MAX)
+typedef struct _FFS_SHORT_ALIAS
+{
+	BYTE name[6];										//The start of the alias - up to 6 characters of the long filename
+	BYTE name_length;
+	BYTE hash_name[6];									//The start of the hashed alias - up to 2 characters of the long filename and 4 hex digits of its hash
+	BYTE hash_name_length;
+	BYTE extension[3];
+	BYTE used_numbers;									//Bits 1 - 4 set = the alias with that number is already used
+	WORD used_hash_numbers;								//Bits 1 - 9 set = the hashed alias with that number is already used
+} FFS_SHORT_ALIAS;
+
+
+//Freed cluster run waiting to be trimmed (ffs_block_device->trim)
+typedef struct _FFS_TRIM_RUN
+{
+	DWORD start_sector;									//(Held as sectors rather than clusters so the run doesn't depend on which volume is active)
+	DWORD sector_count;									//(0 = run not used)
+} FFS_TRIM_RUN;
+
+#define	FFS_TRIM_RUNS					4				//Freed cluster runs held until the FAT window is written (when full the FAT window is written early)
+
+
+//Directory free entry hint (FFS_DIRECTORY_HINT_ENTRIES)
+typedef struct _FFS_DIRECTORY_HINT
+{
+	BYTE volume;										//The volume the directory is on
+	DWORD start_cluster;								//The directory the hints are for (0 = root directory, 0xffffffff = entry not used)
+	FFS_DIRECTORY_POSITION free_entry;					//As ffs_directory_free_entry
+	DWORD end_entry_number;								//As ffs_directory_end_entry_number
+} FFS_DIRECTORY_HINT;
+
+
+//ffs_find_directory_entry find_type values
+#define	FFS_FIND_FILE					0				//Files (hidden files and directories are not matched)
+#define	FFS_FIND_DIRECTORY				1				//Subdirectories
+#define	FFS_FIND_ANY					2				//Files and subdirectories
+
+
+//Card access counters (FFS_IO_STATISTICS)
+typedef struct _FFS_IO_COUNTERS
+{
+	DWORD sector_reads;									//Sectors read from the card
+	DWORD sector_writes;								//Sectors written to the card
+	DWORD read_operations;								//Block device reads (each may be several sectors)
+	DWORD write_operations;								//Block device writes (each may be several sectors)
+	DWORD fat_sector_reads;
+	DWORD directory_sector_reads;
+	DWORD rdy_wait_loops;								//Times round the loops waiting for the card RDY signal
+	DWORD wait_state_loops;								//Times round the loops waiting for the card -WAIT signal
+	DWORD timeouts;										//Card accesses abandoned because the card didn't become ready
+} FFS_IO_COUNTERS;
+
+#ifdef FFS_IO_STATISTICS
+#define	FFS_IO_COUNT(counter)		ffs_io_counters.counter++
+#else
+#define	FFS_IO_COUNT(counter)
+#endif
+
+
+//Card access trace operations (FFS_IO_TRACE_FUNCTION)
+#define	FFS_IO_READ_DATA			0x00				//(Reads are flagged with the type of sector being read)
+#define	FFS_IO_READ_FAT				0x01
+#define	FFS_IO_READ_DIRECTORY		0x02
+#define	FFS_IO_READ_SYSTEM			0x03				//Master boot record, boot record or FSInfo sector
+#define	FFS_IO_WRITE				0x10
+#define	FFS_IO_WRITE_FAT			0x11
+#define	FFS_IO_SYNC					0x20
+#define	FFS_IO_TRIM					0x30
+
+#if defined(FFS_IO_STATISTICS) || defined(FFS_IO_TRACE_FUNCTION)
+#define	FFS_IO_READ_TYPE(type)		ffs_io_read_type = type
+#else
+#define	FFS_IO_READ_TYPE(type)
+#endif
+
+#ifdef FFS_IO_TRACE_TIMER
+#define	FFS_IO_TRACE_TIME			(FFS_IO_TRACE_TIMER_TYPE)(FFS_IO_TRACE_TIMER)
+#define	FFS_IO_TRACE_DURATION(start)	(DWORD)(FFS_IO_TRACE_TIMER_TYPE)(FFS_IO_TRACE_TIME - (start))		//(Cast back to the timer width so a wrap gives the right count)
+#else
+#define	FFS_IO_TRACE_TIMER_TYPE		BYTE
+#define	FFS_IO_TRACE_TIME			0
+#define	FFS_IO_TRACE_DURATION(start)	0
+#endif
+
+
 
 //FSEEK origin defines:-
 #define	FFS_SEEK_SET		0			//Beginning of file
@@ -205,14 +517,87 @@ typedef struct _FFS_FILE
 //----- INTERNAL ONLY FUNCTIONS -----
 //-----------------------------------
 DWORD ffs_find_file (const char *filename, DWORD *file_size, BYTE *attribute_byte, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector, BYTE *read_file_name, BYTE *read_file_extension);
+DWORD ffs_find_directory_entry (const char *filename, BYTE find_type, DWORD *file_size, BYTE *attribute_byte, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector, BYTE *read_file_name, BYTE *read_file_extension);
+DWORD ffs_find_path_directory (const char *path, const char **file_name);
+DWORD ffs_find_subdirectory (DWORD directory_cluster, const char *name, WORD name_length);
+void ffs_select_directory (DWORD start_cluster);
+#ifdef FFS_DIRECTORY_HINT_ENTRIES
+void ffs_store_directory_hints (void);
+#endif
 BYTE ffs_convert_filename_to_dos (const char *source_filename, BYTE *dos_filename, BYTE *dos_extension);
+#ifdef FFS_LONG_FILENAME_MAX
+BYTE ffs_follow_long_filename_entry (BYTE *entry_pointer, BYTE *long_name_sequence, BYTE *long_name_checksum);
+BYTE ffs_compare_long_filename_entry (BYTE *entry_pointer, const char *long_name, WORD long_name_length);
+BYTE ffs_check_long_filename (const char *long_name, WORD long_name_length, DWORD entry_number);
+void ffs_delete_long_filename (DWORD entry_number);
+void ffs_write_long_filename_entry (const char *long_name, WORD long_name_length, BYTE sequence, BYTE checksum);
+WORD ffs_check_long_filename_characters (const char *long_name);
+void ffs_start_short_alias (const char *long_name, WORD long_name_length, FFS_SHORT_ALIAS *alias);
+void ffs_check_short_alias_entry (FFS_SHORT_ALIAS *alias, BYTE *file_name, BYTE *file_extension);
+BYTE ffs_finish_short_alias (FFS_SHORT_ALIAS *alias, BYTE *alias_name, BYTE *alias_extension);
+BYTE ffs_short_alias_character (BYTE character);
+BYTE ffs_short_name_checksum (BYTE *file_name, BYTE *file_extension);
+BYTE* ffs_read_directory_entry_number (DWORD entry_number);
+WORD ffs_long_filename_hash (const char *long_name, WORD long_name_length);
+WORD ffs_long_filename_entry_hash (BYTE *entry_pointer);
+WORD ffs_long_filename_character_hash (WORD character, WORD position);
+#endif
 BYTE ffs_read_next_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte, DWORD *file_size, DWORD *cluster_number, BYTE start_from_beginning, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector);
+void ffs_move_to_directory_start (void);
+BYTE ffs_move_to_next_directory_sector (void);
+void ffs_clear_directory_cluster (DWORD cluster);
+void ffs_get_directory_entry (BYTE *entry_pointer, BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte, DWORD *file_size, DWORD *cluster_number);
 void ffs_overwrite_last_directory_entry (BYTE *file_name, BYTE *file_extension, BYTE *attribute_byte, DWORD *file_size, DWORD *cluster_number);
-DWORD get_file_start_cluster(FFS_FILE *file_pointer);
-BYTE ffs_create_new_file (const char *file_name, DWORD *write_file_start_cluster, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector);
+void ffs_move_to_directory_entry (FFS_DIRECTORY_POSITION *position);
+DWORD ffs_get_directory_entry_number (DWORD directory_entry_sector, BYTE directory_entry_within_sector, DWORD *cluster);
+void ffs_delete_directory_entry (DWORD directory_entry_sector, BYTE directory_entry_within_sector);
+FFS_OPEN_FILE* ffs_find_open_file (DWORD directory_entry_sector, BYTE directory_entry_within_sector);
+DWORD ffs_get_file_cluster (FFS_FILE *file_pointer, DWORD file_cluster);
+#ifdef FFS_EXTENT_CACHE_ENTRIES
+void ffs_add_file_cluster_to_extent_cache (FFS_FILE *file_pointer, DWORD file_cluster, DWORD disk_cluster);
+FFS_EXTENT* ffs_extent_cache_entry (FFS_OPEN_FILE *open_file, FFS_EXTENT *new_extent, BYTE new_position, WORD entry);
+#endif
+BYTE ffs_create_new_file (const char *file_name, BYTE attribute_byte, DWORD *write_file_start_cluster, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector);
+BYTE ffs_add_directory_entry (const char *file_name, BYTE attribute_byte, DWORD file_size, DWORD *start_cluster, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector);
 DWORD ffs_get_next_free_cluster (void);
 DWORD ffs_get_next_cluster_no (DWORD current_cluster);
+DWORD ffs_get_or_add_next_cluster (DWORD current_cluster);
+DWORD ffs_write_file_sectors (FFS_FILE *file_pointer, BYTE *source, DWORD sector_count);
+DWORD ffs_read_file_sectors (FFS_FILE *file_pointer, BYTE *destination, DWORD sector_count);
 void ffs_modify_cluster_entry_in_fat (DWORD cluster_to_modify, DWORD cluster_entry_new_value);
+void ffs_release_unused_clusters (FFS_FILE *file_pointer);
+void ffs_read_fat_sector_to_window (DWORD sector_lba);
+void ffs_write_fat_window (void);
+void ffs_flush_fat_window (void);
+void ffs_update_trim_runs (DWORD cluster, BYTE cluster_is_free);
+void ffs_trim_freed_clusters (void);
+#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+DWORD ffs_find_free_cluster_in_bitmap (DWORD start_cluster);
+DWORD ffs_search_free_cluster_bitmap (DWORD start_cluster, DWORD end_cluster);
+void ffs_add_fat_sector_to_free_cluster_bitmap (void);
+#endif
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+void ffs_build_directory_index (void);
+DWORD ffs_find_file_in_directory_index (BYTE *file_name, BYTE *file_extension, DWORD *file_size, BYTE *attribute_byte, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector);
+#ifdef FFS_LONG_FILENAME_MAX
+DWORD ffs_find_long_filename_in_directory_index (const char *long_name, WORD long_name_length, DWORD *file_size, BYTE *attribute_byte, DWORD *directory_entry_sector, BYTE *directory_entry_within_sector, BYTE *read_file_name, BYTE *read_file_extension);
+#endif
+void ffs_add_file_to_directory_index (BYTE *file_name, BYTE *file_extension, BYTE attribute_byte, DWORD start_cluster, DWORD file_size, DWORD directory_entry_sector, BYTE directory_entry_within_sector, WORD long_name_hash);
+FFS_DIRECTORY_INDEX_ENTRY* ffs_get_directory_index_entry (DWORD directory_entry_sector, BYTE directory_entry_within_sector);
+WORD ffs_directory_index_hash (BYTE *file_name, BYTE *file_extension);
+#endif
+void ffs_flush_file_system_information (void);
+BYTE* ffs_find_partition (BYTE partition, DWORD *partition_table_lba);
+BYTE ffs_load_partition (BYTE volume, BYTE partition);
+BYTE ffs_select_volume (BYTE volume);
+void ffs_store_active_volume (void);
+void ffs_load_active_volume (void);
+void ffs_reset_directory_caches (void);
+DWORD ffs_count_free_clusters (void);
+void ffs_select_sector_cache_entry (BYTE entry);
+#ifdef FFS_IO_TRACE_FUNCTION
+void FFS_IO_TRACE_FUNCTION (BYTE operation, DWORD sector_lba, WORD sector_count, DWORD duration);		//(In the application)
+#endif
 
 
 //-----------------------------------------
@@ -233,13 +618,29 @@ char* ffs_fgets (char *string, int length, FFS_FILE *file_pointer);
 int ffs_fwrite (const void *buffer, int size, int count, FFS_FILE *file_pointer);
 int ffs_fread (void *buffer, int size, int count, FFS_FILE *file_pointer);
 int ffs_fflush (FFS_FILE *file_pointer);
+int ffs_fallocate (FFS_FILE *file_pointer, DWORD length);
 int	ffs_fclose (FFS_FILE *file_pointer);
 int ffs_remove (const char *filename);
 int ffs_rename (const char *old_filename, const char *new_filename);
+int ffs_mkdir (const char *dirname);
+int ffs_chdir (const char *dirname);
+int ffs_chvol (BYTE volume);
+FFS_DIR* ffs_opendir (const char *dirname);
+FFS_DIRENT* ffs_readdir (FFS_DIR *dir_pointer);
+int ffs_closedir (FFS_DIR *dir_pointer);
 void ffs_clearerr (FFS_FILE *file_pointer);
 int ffs_feof (FFS_FILE *file_pointer);
 int ffs_ferror (FFS_FILE *file_pointer);
 BYTE ffs_is_card_available (void);
+DWORD ffs_get_free_space (void);
+BYTE ffs_mount_volume (void);
+BYTE ffs_mount_partition (BYTE volume, BYTE partition);
+void ffs_initialise_sector_cache (void);
+void ffs_read_sector_to_buffer (DWORD sector_lba);
+void ffs_flush_sector_cache (void);
+void ffs_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination);
+void ffs_write_sector_from_buffer (DWORD sector_lba);
+void ffs_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source);
 
 
 
@@ -265,13 +666,29 @@ extern char* ffs_fgets (char *string, int length, FFS_FILE *file_pointer);
 extern int ffs_fwrite (const void *buffer, int size, int count, FFS_FILE *file_pointer);
 extern int ffs_fread (void *buffer, int size, int count, FFS_FILE *file_pointer);
 extern int ffs_fflush (FFS_FILE *file_pointer);
+extern int ffs_fallocate (FFS_FILE *file_pointer, DWORD length);
 extern int	ffs_fclose (FFS_FILE *file_pointer);
 extern int ffs_remove (const char *filename);
 extern int ffs_rename (const char *old_filename, const char *new_filename);
+extern int ffs_mkdir (const char *dirname);
+extern int ffs_chdir (const char *dirname);
+extern int ffs_chvol (BYTE volume);
+extern FFS_DIR* ffs_opendir (const char *dirname);
+extern FFS_DIRENT* ffs_readdir (FFS_DIR *dir_pointer);
+extern int ffs_closedir (FFS_DIR *dir_pointer);
 extern void ffs_clearerr (FFS_FILE *file_pointer);
 extern int ffs_feof (FFS_FILE *file_pointer);
 extern int ffs_ferror (FFS_FILE *file_pointer);
 extern BYTE ffs_is_card_available (void);
+extern DWORD ffs_get_free_space (void);
+extern BYTE ffs_mount_volume (void);
+extern BYTE ffs_mount_partition (BYTE volume, BYTE partition);
+extern void ffs_initialise_sector_cache (void);
+extern void ffs_read_sector_to_buffer (DWORD sector_lba);
+extern void ffs_flush_sector_cache (void);
+extern void ffs_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination);
+extern void ffs_write_sector_from_buffer (DWORD sector_lba);
+extern void ffs_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source);
 
 
 
@@ -292,7 +709,30 @@ extern BYTE ffs_is_card_available (void);
 //--------------------------------------------
 //----- INTERNAL ONLY MEMORY DEFINITIONS -----
 //--------------------------------------------
-
+#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+DWORD ffs_free_cluster_bitmap[FFS_FREE_CLUSTER_BITMAP_CLUSTERS >> 5];		//Bit set = cluster is used.  (C18 - if larger than 256 bytes this needs its own section in the linker script like the 512 byte buffers)
+#endif
+#ifdef FFS_DIRECTORY_INDEX_ENTRIES
+FFS_DIRECTORY_INDEX_ENTRY ffs_directory_index[FFS_DIRECTORY_INDEX_ENTRIES];		//Open addressed hash table of the root directory files.  (C18 - if larger than 256 bytes this needs its own section in the linker script)
+BYTE ffs_directory_index_state = FFS_DIRECTORY_INDEX_NOT_BUILT;			//(For the active volume)
+BYTE ffs_directory_index_volume = 0;							//The volume whose root directory is in the index
+BYTE ffs_directory_index_stored_state = FFS_DIRECTORY_INDEX_NOT_BUILT;	//ffs_directory_index_state of ffs_directory_index_volume while another volume is active
+#endif
+#ifdef FFS_PATH_CACHE_ENTRIES
+FFS_PATH_CACHE_ENTRY ffs_path_cache[FFS_PATH_CACHE_ENTRIES];
+BYTE ffs_path_cache_next_entry = 0;								//The entry to replace next
+#endif
+#ifdef FFS_DIRECTORY_HINT_ENTRIES
+FFS_DIRECTORY_HINT ffs_directory_hint[FFS_DIRECTORY_HINT_ENTRIES];	//The hints for directories that aren't selected (the selected directory's hints are in ffs_directory_free_entry etc)
+BYTE ffs_directory_hint_next_entry = 0;							//The entry to replace next
+#endif
+#ifdef FFS_LONG_FILENAME_MAX
+const BYTE ffs_long_filename_character_offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};		//Where the 13 characters are in a long filename entry
+#endif
+WORD file_system_information_sector;
+#if defined(FFS_IO_STATISTICS) || defined(FFS_IO_TRACE_FUNCTION)
+BYTE ffs_io_read_type = FFS_IO_READ_DATA;					//The type of sector the next card read is for
+#endif
 
 
 
@@ -304,54 +744,158 @@ extern BYTE ffs_is_card_available (void);
 //--------------------------------------------------
 //(Also defined below as extern)
 FFS_FILE ffs_file[FFS_FOPEN_MAX];
+FFS_OPEN_FILE ffs_open_file[FFS_OPEN_FILES_MAX];
+FFS_DIR ffs_dir[FFS_OPENDIR_MAX];
+FFS_VOLUME ffs_volume[FFS_VOLUMES_MAX];
+BYTE ffs_active_volume;											//The volume the values below are for
+BYTE ffs_current_volume;										//The volume set by ffs_chvol that filenames refer to
 BYTE ffs_card_ok = 0;
 BYTE ffs_10ms_timer = 0;
 WORD ffs_bytes_per_sector;
+FFS_BLOCK_DEVICE *ffs_block_device;								//The block device functions of the card driver
+WORD number_of_root_directory_sectors;				//Only used by FAT16, 0 for FAT32
+DWORD fat1_start_sector;
+DWORD root_directory_start_sector_cluster;			//Start sector for FAT16, start clustor for FAT32
+DWORD data_area_start_sector;
+BYTE disk_is_fat_32;
+BYTE sectors_per_cluster;
+DWORD last_found_free_cluster;
+DWORD max_cluster_number;							//The highest valid cluster number (clusters are numbered from 2)
+DWORD free_cluster_count;							//0xffffffff = not known
+DWORD file_system_information_lba;					//FAT32 FSInfo sector (0xffffffff = none)
+BYTE file_system_information_needs_writing;
+DWORD sectors_per_fat;
+BYTE active_fat_table_flags;
+DWORD read_write_directory_last_lba;
+WORD read_write_directory_last_entry;
+DWORD read_write_directory_current_cluster;						//(FAT32 only)
+BYTE read_write_directory_sectors_left;
+DWORD read_write_directory_start_cluster;						//The directory the directory functions are working on (0 = root directory)
+DWORD ffs_current_directory_cluster;							//The start cluster of the current directory set by ffs_chdir (0 = root directory)
+DWORD ffs_directory_hint_start_cluster;						//The directory that ffs_directory_free_entry and ffs_directory_end_entry_number are for (0 = root directory)
+FFS_DIRECTORY_POSITION ffs_directory_free_entry;				//No directory entry before this one is free (entry_number 0xffffffff = not known)
+DWORD ffs_directory_end_entry_number;							//The first directory entry that has never been used - no entry from here on is used (0xffffffff = not known)
+FFS_SECTOR_CACHE_ENTRY ffs_sector_cache[FFS_SECTOR_CACHE_ENTRIES];
+FFS_SECTOR_CACHE_ENTRY *ffs_sector_buffer = &ffs_sector_cache[0];		//The cache entry last accessed - this is the buffer FFS_DRIVER_GEN_512_BYTE_BUFFER refers to
+DWORD ffs_sector_cache_hits = 0;
+DWORD ffs_sector_cache_misses = 0;
+DWORD ffs_fat_window_lba = 0xffffffff;					//The FAT1 table sector held in the FAT window (0xffffffff = none)
+BYTE ffs_fat_window_needs_writing_to_card = 0;
+BYTE ffs_fat_window_volume = 0;							//The volume the FAT window sector is from (it is left in the window when a different volume is selected)
+FFS_TRIM_RUN ffs_trim_run[FFS_TRIM_RUNS];
+BYTE ffs_trim_run_count = 0;
+#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+DWORD ffs_free_cluster_bitmap_scanned_to;						//Bitmap entries below this cluster number are valid (the FAT table is read into the bitmap one sector at a time as it is needed)
+#endif
+#ifdef FFS_IO_STATISTICS
+FFS_IO_COUNTERS ffs_io_counters;
+#endif
 
 
 
 
 
-//----- 512 BYTE DRIVER DATA BUFFER -----
-//(Required as read and write operations are carried out on complete sectors which are 512 bytes in size
+//----- 512 BYTE DRIVER DATA BUFFERS -----
+//(Required as read and write operations are carried out on complete sectors which are 512 bytes in size.  One buffer per sector cache entry plus
+//a separate buffer for the FAT table window so that following and allocating clusters doesn't evict file data from the sector cache.
 //We use a special big section of ram defiend in the linker script to give us our large ram buffer (C18 large array requirement):
 //N.B. This buffer is only referenced through a pointer by the driver to allow for compillers and processors that have this requirement.
 
 #ifdef FFS_USING_MICROCHIP_C18_COMPILER
 
 #pragma udata ffs_512_byte_ram_section				//This is the PIC C18 compiler command to use the specially defined section in the linker script (this project uses a modified linker script)
-BYTE ffs_general_buffer[512];								//<<<<< CHECK FOR A NEW APPLICATION <<<<<
+BYTE ffs_general_buffer[FFS_SECTOR_CACHE_ENTRIES * 512];								//<<<<< CHECK FOR A NEW APPLICATION <<<<<
+BYTE ffs_fat_buffer[512];
 #pragma udata
 
 #endif			//#ifdef FFS_USING_MICROCHIP_C18_COMPILER
 
+#ifdef FFS_USING_GCC_HOST_COMPILER
+
+BYTE ffs_general_buffer[FFS_SECTOR_CACHE_ENTRIES * 512];
+BYTE ffs_fat_buffer[512];
+
+#endif			//#ifdef FFS_USING_GCC_HOST_COMPILER
+
 
 #else	//FFS_C
 //---------------------------------------
 //----- EXTERNAL MEMORY DEFINITIONS -----
 //---------------------------------------
 extern FFS_FILE ffs_file[FFS_FOPEN_MAX];
+extern FFS_OPEN_FILE ffs_open_file[FFS_OPEN_FILES_MAX];
+extern FFS_DIR ffs_dir[FFS_OPENDIR_MAX];
+extern FFS_VOLUME ffs_volume[FFS_VOLUMES_MAX];
+extern BYTE ffs_active_volume;
+extern BYTE ffs_current_volume;
 extern BYTE ffs_card_ok;
 extern BYTE ffs_10ms_timer;
 extern WORD ffs_bytes_per_sector;
+extern FFS_BLOCK_DEVICE *ffs_block_device;
+extern WORD number_of_root_directory_sectors;
+extern DWORD fat1_start_sector;
+extern DWORD root_directory_start_sector_cluster;
+extern DWORD data_area_start_sector;
+extern BYTE disk_is_fat_32;
+extern BYTE sectors_per_cluster;
+extern DWORD last_found_free_cluster;
+extern DWORD max_cluster_number;
+extern DWORD free_cluster_count;
+extern DWORD file_system_information_lba;
+extern BYTE file_system_information_needs_writing;
+extern DWORD sectors_per_fat;
+extern BYTE active_fat_table_flags;
+extern DWORD read_write_directory_last_lba;
+extern WORD read_write_directory_last_entry;
+extern DWORD read_write_directory_current_cluster;
+extern BYTE read_write_directory_sectors_left;
+extern DWORD read_write_directory_start_cluster;
+extern DWORD ffs_current_directory_cluster;
+extern DWORD ffs_directory_hint_start_cluster;
+extern FFS_DIRECTORY_POSITION ffs_directory_free_entry;
+extern DWORD ffs_directory_end_entry_number;
+extern FFS_SECTOR_CACHE_ENTRY ffs_sector_cache[FFS_SECTOR_CACHE_ENTRIES];
+extern FFS_SECTOR_CACHE_ENTRY *ffs_sector_buffer;
+extern DWORD ffs_sector_cache_hits;
+extern DWORD ffs_sector_cache_misses;
+extern DWORD ffs_fat_window_lba;
+extern BYTE ffs_fat_window_needs_writing_to_card;
+extern BYTE ffs_fat_window_volume;
+extern FFS_TRIM_RUN ffs_trim_run[FFS_TRIM_RUNS];
+extern BYTE ffs_trim_run_count;
+#ifdef FFS_FREE_CLUSTER_BITMAP_CLUSTERS
+extern DWORD ffs_free_cluster_bitmap_scanned_to;
+#endif
+#ifdef FFS_IO_STATISTICS
+extern FFS_IO_COUNTERS ffs_io_counters;
+#endif
 
 
 
 
 
-//----- 512 BYTE DRIVER DATA BUFFER -----
-//(Required as read and write operations are carried out on complete sectors which are 512 bytes in size
+//----- 512 BYTE DRIVER DATA BUFFERS -----
+//(Required as read and write operations are carried out on complete sectors which are 512 bytes in size.  One buffer per sector cache entry plus
+//a separate buffer for the FAT table window so that following and allocating clusters doesn't evict file data from the sector cache.
 //We use a special big section of ram defiend in the linker script to give us our large ram buffer (C18 large array requirement):
 //N.B. This buffer is only referenced through a pointer by the driver to allow for compillers and processors that have this requirement.
 
 #ifdef FFS_USING_MICROCHIP_C18_COMPILER
 
 #pragma udata ffs_512_byte_ram_section				//This is the PIC C18 compiler command to use the specially defined section in the linker script (this project uses a modified linker script)
-extern BYTE ffs_general_buffer[512];								//<<<<< CHECK FOR A NEW APPLICATION <<<<<
+extern BYTE ffs_general_buffer[FFS_SECTOR_CACHE_ENTRIES * 512];								//<<<<< CHECK FOR A NEW APPLICATION <<<<<
+extern BYTE ffs_fat_buffer[512];
 #pragma udata
 
 #endif			//#ifdef FFS_USING_MICROCHIP_C18_COMPILER
 
+#ifdef FFS_USING_GCC_HOST_COMPILER
+
+extern BYTE ffs_general_buffer[FFS_SECTOR_CACHE_ENTRIES * 512];
+extern BYTE ffs_fat_buffer[512];
+
+#endif			//#ifdef FFS_USING_GCC_HOST_COMPILER
+
 
 #endif	//FFS_C
 
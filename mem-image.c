@@ -0,0 +1,270 @@
+/*
+IBEX UK LTD http://www.ibexuk.com
+Electronic Product Design Specialists
+RELEASED SOFTWARE
+
+The MIT License (MIT)
+
+Copyright (c) 2013, IBEX UK Ltd, http://ibexuk.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Project Name:		COMPACT FLASH MEMORY CARD FAT16 & FAT 32 DRIVER
+//DISK IMAGE FILE BLOCK DEVICE C CODE FILE
+
+
+
+
+#define	_GNU_SOURCE							//(For fallocate)
+#include "main.h"					//Global data type definitions (see https://github.com/ibexuk/C_Generic_Header_File )
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#define IMAGE_C
+#include "mem-ffs.h"
+#include "mem-image.h"
+
+
+
+
+
+
+
+//******************************************
+//******************************************
+//********** OPEN DISK IMAGE FILE **********
+//******************************************
+//******************************************
+//Opens a disk image file (a copy of a whole card including its master boot record) and mounts its first partition.  Any image file
+//already open is closed first.
+//Returns
+//	1 if the image is OK to use (ffs_card_ok is also set), 0 if not
+BYTE ffs_image_open (const char *filename)
+{
+	struct stat file_status;
+
+
+	ffs_image_close();
+
+	ffs_image_file = open(filename, O_RDWR);
+	if (ffs_image_file < 0)
+		return(0);
+
+	if (fstat(ffs_image_file, &file_status) != 0)
+	{
+		ffs_image_close();
+		return(0);
+	}
+	ffs_image_sectors = (DWORD)(file_status.st_size / FFS_IMAGE_BYTES_PER_SECTOR);
+
+	//----- MOUNT THE FAT FILE SYSTEM -----
+	ffs_block_device = &ffs_image_block_device;
+
+	if (ffs_mount_volume() == 0)
+	{
+		ffs_image_close();
+		return(0);
+	}
+	return(1);
+}
+
+
+
+
+
+
+//*******************************************
+//*******************************************
+//********** CLOSE DISK IMAGE FILE **********
+//*******************************************
+//*******************************************
+//Closes any files that are still open (storing their data) and then closes the disk image file.
+void ffs_image_close (void)
+{
+	BYTE b_temp;
+
+
+	if (ffs_image_file < 0)
+		return;
+
+	if (ffs_card_ok)
+	{
+		for (b_temp = 0; b_temp < FFS_FOPEN_MAX; b_temp++)
+		{
+			if (ffs_file[b_temp].flags.bits.file_is_open)
+				ffs_fclose(&ffs_file[b_temp]);
+		}
+	}
+	for (b_temp = 0; b_temp < FFS_OPENDIR_MAX; b_temp++)
+		ffs_dir[b_temp].dir_is_open = 0;
+	ffs_card_ok = 0;
+
+	fsync(ffs_image_file);
+	close(ffs_image_file);
+	ffs_image_file = -1;
+}
+
+
+
+
+
+
+
+
+
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+//****************************** DRIVER SUB FUNCTIONS BELOW HERE ******************************
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+//*********************************************************************************************
+
+
+
+
+
+
+
+//*********************************************
+//*********************************************
+//********** READ SECTORS FROM IMAGE **********
+//*********************************************
+//*********************************************
+//Block device function.  Sectors beyond the end of the image file are read as 0x00.
+void ffs_image_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination)
+{
+	size_t bytes_remaining;
+	off_t offset;
+	ssize_t bytes_read;
+
+
+	bytes_remaining = (size_t)sector_count * FFS_IMAGE_BYTES_PER_SECTOR;
+	offset = (off_t)sector_lba * FFS_IMAGE_BYTES_PER_SECTOR;
+
+	while (bytes_remaining)
+	{
+		bytes_read = pread(ffs_image_file, destination, bytes_remaining, offset);
+		if (bytes_read <= 0)
+		{
+			memset(destination, 0x00, bytes_remaining);
+			return;
+		}
+		destination += bytes_read;
+		offset += bytes_read;
+		bytes_remaining -= (size_t)bytes_read;
+	}
+}
+
+
+
+
+
+
+//********************************************
+//********************************************
+//********** WRITE SECTORS TO IMAGE **********
+//********************************************
+//********************************************
+//Block device function.
+void ffs_image_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source)
+{
+	size_t bytes_remaining;
+	off_t offset;
+	ssize_t bytes_written;
+
+
+	bytes_remaining = (size_t)sector_count * FFS_IMAGE_BYTES_PER_SECTOR;
+	offset = (off_t)sector_lba * FFS_IMAGE_BYTES_PER_SECTOR;
+
+	while (bytes_remaining)
+	{
+		bytes_written = pwrite(ffs_image_file, source, bytes_remaining, offset);
+		if (bytes_written <= 0)
+			return;
+		source += bytes_written;
+		offset += bytes_written;
+		bytes_remaining -= (size_t)bytes_written;
+	}
+}
+
+
+
+
+
+
+//********************************
+//********************************
+//********** SYNC IMAGE **********
+//********************************
+//********************************
+//Block device function.  The written data is already with the host (pwrite) so the image file is only fsync'ed if FFS_IMAGE_FSYNC_ON_SYNC
+//is defined (it is always fsync'ed when it is closed).
+void ffs_image_sync (void)
+{
+#ifdef FFS_IMAGE_FSYNC_ON_SYNC
+	fsync(ffs_image_file);
+#endif
+}
+
+
+
+
+
+
+//************************************
+//************************************
+//********** GET IMAGE SIZE **********
+//************************************
+//************************************
+//Block device function.
+DWORD ffs_image_sector_count (void)
+{
+	return(ffs_image_sectors);
+}
+
+
+
+
+
+
+//********************************
+//********************************
+//********** TRIM IMAGE **********
+//********************************
+//********************************
+//Block device function.  The sectors are punched out of the image file so the host can release the disk space they used (they then read
+//as 0x00).  Does nothing if the host doesn't support punching holes.
+void ffs_image_trim (DWORD sector_lba, DWORD sector_count)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	fallocate(ffs_image_file, (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE), ((off_t)sector_lba * FFS_IMAGE_BYTES_PER_SECTOR), ((off_t)sector_count * FFS_IMAGE_BYTES_PER_SECTOR));
+#endif
+}
+
+
+
+
+
+
+
+
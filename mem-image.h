@@ -0,0 +1,136 @@
+/*
+IBEX UK LTD http://www.ibexuk.com
+Electronic Product Design Specialists
+RELEASED SOFTWARE
+
+The MIT License (MIT)
+
+Copyright (c) 2013, IBEX UK Ltd, http://ibexuk.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+//Project Name:		COMPACT FLASH MEMORY CARD FAT16 & FAT 32 DRIVER
+//DISK IMAGE FILE BLOCK DEVICE C CODE HEADER FILE
+//(For running the FAT driver on a POSIX host (e.g. Linux) with a disk image file instead of a card - use instead of mem-cf.c)
+
+
+
+
+//##################################
+//##################################
+//########## USING DRIVER ##########
+//##################################
+//##################################
+/*
+	//----- OPEN A DISK IMAGE FILE -----
+	//(Instead of calling ffs_process)
+	if (ffs_image_open("card.img") == 0)
+		//Error
+
+	//... use the ffs_ file functions as normal ...
+
+	//----- CLOSE THE DISK IMAGE FILE -----
+	ffs_image_close();
+*/
+
+
+
+
+
+//*****************************
+//*****************************
+//********** DEFINES **********
+//*****************************
+//*****************************
+#ifndef IMAGE_C_INIT		//Do only once the first time this file is used
+#define	IMAGE_C_INIT
+
+
+#define	FFS_IMAGE_BYTES_PER_SECTOR		512
+
+//#define	FFS_IMAGE_FSYNC_ON_SYNC					//Optional - fsync the image file every time the driver syncs the block device (ffs_fflush, ffs_fclose etc) so the
+												//data survives the host crashing.  Comment out to leave it to the host and only fsync when the image is closed (much faster).
+
+
+#endif
+
+
+
+
+//*******************************
+//*******************************
+//********** FUNCTIONS **********
+//*******************************
+//*******************************
+#ifdef IMAGE_C
+//-----------------------------------
+//----- INTERNAL ONLY FUNCTIONS -----
+//-----------------------------------
+void ffs_image_read_sectors (DWORD sector_lba, WORD sector_count, BYTE *destination);
+void ffs_image_write_sectors (DWORD sector_lba, WORD sector_count, BYTE *source);
+void ffs_image_sync (void);
+DWORD ffs_image_sector_count (void);
+void ffs_image_trim (DWORD sector_lba, DWORD sector_count);
+
+
+
+//-----------------------------------------
+//----- INTERNAL & EXTERNAL FUNCTIONS -----
+//-----------------------------------------
+//(Also defined below as extern)
+BYTE ffs_image_open (const char *filename);
+void ffs_image_close (void);
+
+
+
+
+#else
+//------------------------------
+//----- EXTERNAL FUNCTIONS -----
+//------------------------------
+extern BYTE ffs_image_open (const char *filename);
+extern void ffs_image_close (void);
+
+
+
+#endif
+
+
+
+
+//****************************
+//****************************
+//********** MEMORY **********
+//****************************
+//****************************
+#ifdef IMAGE_C
+//--------------------------------------------
+//----- INTERNAL ONLY MEMORY DEFINITIONS -----
+//--------------------------------------------
+int ffs_image_file = -1;						//File descriptor of the open disk image (-1 = none)
+DWORD ffs_image_sectors;
+
+//The block device functions the FAT driver uses to access the disk image
+FFS_BLOCK_DEVICE ffs_image_block_device = {ffs_image_read_sectors, ffs_image_write_sectors, ffs_image_sync, ffs_image_sector_count, ffs_image_trim};
+
+
+
+#endif
+
+
+